@@ -777,6 +777,13 @@ void CL_WritePacket( int repeat ) {
 	// write the last reliable message we received
 	MSG_WriteLong( &buf, clc.serverCommandSequence );
 
+	// acknowledge received download blocks at most once per packet
+	// and leave enough room in reliable commands buffer for other commands
+	if ( clc.downloadAckPending && clc.reliableSequence - clc.reliableAcknowledge < MAX_RELIABLE_COMMANDS / 2 ) {
+		clc.downloadAckPending = qfalse;
+		CL_AddReliableCommand( va( "nextdl %d", clc.downloadBlock - 1 ), qfalse );
+	}
+
 	// write any unacknowledged clientCommands
 	n = clc.reliableSequence - clc.reliableAcknowledge;
 	for ( i = 0; i < n; i++ ) {
@@ -2082,8 +2082,13 @@ static void CL_BeginDownload( const char *localName, const char *remoteName ) {
 
 	clc.downloadBlock = 0; // Starting new file
 	clc.downloadCount = 0;
+	clc.downloadCaps = clc.sv_dlCaps & DL_CAP_ALL;
+	CL_ClearDownloadWindow();
 
-	CL_AddReliableCommand( va("download %s", remoteName), qfalse );
+	if ( clc.downloadCaps )
+		CL_AddReliableCommand( va("download %s %i", remoteName, clc.downloadCaps), qfalse );
+	else
+		CL_AddReliableCommand( va("download %s", remoteName), qfalse );
 }
 
 
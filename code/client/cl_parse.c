@@ -484,6 +484,7 @@ static void CL_ParseServerInfo( void )
 	Q_strncpyz(clc.sv_dlURL,
 		Info_ValueForKey(serverInfo, "sv_dlURL"),
 		sizeof(clc.sv_dlURL));
+	clc.sv_dlCaps = atoi( Info_ValueForKey( serverInfo, "sv_dlCaps" ) );
 
 	/* remove ending slash in URLs */
 	len = strlen( clc.sv_dlURL );
@@ -666,59 +667,31 @@ qboolean CL_ValidPakSignature( const byte *data, int len )
 
 //=====================================================================
 
+// blocks received ahead of clc.downloadBlock from servers with DL_CAP_WINDOW
+static byte	dlWindowData[ MAX_DOWNLOAD_WINDOW_EXT ][ MAX_DOWNLOAD_BLKSIZE ];
+static int	dlWindowBlock[ MAX_DOWNLOAD_WINDOW_EXT ]; // block number + 1, 0 for empty slot
+static int	dlWindowSize[ MAX_DOWNLOAD_WINDOW_EXT ];
+
+
 /*
 =====================
-CL_ParseDownload
-
-A download message has been received from the server
+CL_ClearDownloadWindow
 =====================
 */
-static void CL_ParseDownload( msg_t *msg ) {
-	int		size;
-	unsigned char data[ MAX_MSGLEN ];
-	uint16_t block;
-
-	if (!*clc.downloadTempName) {
-		Com_Printf("Server sending download, but no download was requested\n");
-		CL_AddReliableCommand( "stopdl", qfalse );
-		return;
-	}
-
-	if ( clc.recordfile != FS_INVALID_HANDLE ) {
-		CL_StopRecord_f();
-	}
-
-	// read the data
-	block = MSG_ReadShort ( msg );
-
-	if(!block && !clc.downloadBlock)
-	{
-		// block zero is special, contains file size
-		clc.downloadSize = MSG_ReadLong ( msg );
-
-		Cvar_SetIntegerValue( "cl_downloadSize", clc.downloadSize );
-
-		if (clc.downloadSize < 0)
-		{
-			Com_Error( ERR_DROP, "%s", MSG_ReadString( msg ) );
-			return;
-		}
-	}
+void CL_ClearDownloadWindow( void ) {
+	Com_Memset( dlWindowBlock, 0, sizeof( dlWindowBlock ) );
+	clc.downloadAckPending = qfalse;
+}
 
-	size = MSG_ReadShort ( msg );
-	if (size < 0 || size > sizeof(data))
-	{
-		Com_Error(ERR_DROP, "CL_ParseDownload: Invalid size %d for download chunk", size);
-		return;
-	}
 
-	MSG_ReadData(msg, data, size);
+/*
+=====================
+CL_WriteDownloadBlock
 
-	if((clc.downloadBlock & 0xFFFF) != block)
-	{
-		Com_DPrintf( "CL_ParseDownload: Expected block %d, got %d\n", (clc.downloadBlock & 0xFFFF), block);
-		return;
-	}
+Writes next expected block to file, returns qfalse if download is finished or aborted
+=====================
+*/
+static qboolean CL_WriteDownloadBlock( const byte *data, int size ) {
 
 	// open the file if not opened yet
 	if ( clc.download == FS_INVALID_HANDLE )
@@ -728,7 +701,7 @@ static void CL_ParseDownload( msg_t *msg ) {
 			Com_Printf( S_COLOR_YELLOW "Invalid pak signature for %s\n", clc.downloadName );
 			CL_AddReliableCommand( "stopdl", qfalse );
 			CL_NextDownload();
-			return;
+			return qfalse;
 		}
 
 		clc.download = FS_SV_FOpenFileWrite( clc.downloadTempName );
@@ -738,14 +711,19 @@ static void CL_ParseDownload( msg_t *msg ) {
 			Com_Printf( "Could not create %s\n", clc.downloadTempName );
 			CL_AddReliableCommand( "stopdl", qfalse );
 			CL_NextDownload();
-			return;
+			return qfalse;
 		}
 	}
 
 	if (size)
 		FS_Write( data, size, clc.download );
 
-	CL_AddReliableCommand( va("nextdl %d", clc.downloadBlock), qfalse );
+	if ( clc.downloadCaps & DL_CAP_WINDOW ) {
+		// cumulative acknowledge will be sent with next packet
+		clc.downloadAckPending = qtrue;
+	} else {
+		CL_AddReliableCommand( va("nextdl %d", clc.downloadBlock), qfalse );
+	}
 	clc.downloadBlock++;
 
 	clc.downloadCount += size;
@@ -762,6 +740,11 @@ static void CL_ParseDownload( msg_t *msg ) {
 			FS_SV_Rename( clc.downloadTempName, clc.downloadName );
 		}
 
+		if ( clc.downloadAckPending ) {
+			clc.downloadAckPending = qfalse;
+			CL_AddReliableCommand( va("nextdl %d", clc.downloadBlock - 1), qfalse );
+		}
+
 		// send intentions now
 		// We need this because without it, we would hold the last nextdl and then start
 		// loading right away.  If we take a while to load, the server is happily trying
@@ -771,6 +754,96 @@ static void CL_ParseDownload( msg_t *msg ) {
 
 		// get another file if needed
 		CL_NextDownload();
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+
+/*
+=====================
+CL_ParseDownload
+
+A download message has been received from the server
+=====================
+*/
+static void CL_ParseDownload( msg_t *msg ) {
+	int		size;
+	unsigned char data[ MAX_MSGLEN ];
+	uint16_t block;
+	int		blockNum, index;
+
+	if (!*clc.downloadTempName) {
+		Com_Printf("Server sending download, but no download was requested\n");
+		CL_AddReliableCommand( "stopdl", qfalse );
+		return;
+	}
+
+	if ( clc.recordfile != FS_INVALID_HANDLE ) {
+		CL_StopRecord_f();
+	}
+
+	// read the data
+	block = MSG_ReadShort ( msg );
+
+	// restore full block number, server never sends blocks further than window size from expected one
+	blockNum = clc.downloadBlock + (int16_t)( block - ( clc.downloadBlock & 0xFFFF ) );
+
+	if ( blockNum == 0 )
+	{
+		// block zero is special, contains file size
+		clc.downloadSize = MSG_ReadLong ( msg );
+
+		Cvar_SetIntegerValue( "cl_downloadSize", clc.downloadSize );
+
+		if (clc.downloadSize < 0)
+		{
+			Com_Error( ERR_DROP, "%s", MSG_ReadString( msg ) );
+			return;
+		}
+	}
+
+	size = MSG_ReadShort ( msg );
+	if (size < 0 || size > sizeof(data))
+	{
+		Com_Error(ERR_DROP, "CL_ParseDownload: Invalid size %d for download chunk", size);
+		return;
+	}
+
+	if ( size > 0 ) {
+		if ( clc.downloadCaps & DL_CAP_RAW )
+			MSG_ReadRawData( msg, data, size );
+		else
+			MSG_ReadData( msg, data, size );
+	}
+
+	if ( blockNum != clc.downloadBlock )
+	{
+		if ( ( clc.downloadCaps & DL_CAP_WINDOW ) && blockNum > clc.downloadBlock &&
+			blockNum - clc.downloadBlock < MAX_DOWNLOAD_WINDOW_EXT && size <= MAX_DOWNLOAD_BLKSIZE ) {
+			// keep it until missing blocks arrive
+			index = blockNum % MAX_DOWNLOAD_WINDOW_EXT;
+			Com_Memcpy( dlWindowData[ index ], data, size );
+			dlWindowSize[ index ] = size;
+			dlWindowBlock[ index ] = blockNum + 1;
+			return;
+		}
+		Com_DPrintf( "CL_ParseDownload: Expected block %d, got %d\n", (clc.downloadBlock & 0xFFFF), block);
+		return;
+	}
+
+	if ( !CL_WriteDownloadBlock( data, size ) )
+		return;
+
+	// flush blocks which arrived ahead of this one
+	for ( ;; ) {
+		index = clc.downloadBlock % MAX_DOWNLOAD_WINDOW_EXT;
+		if ( dlWindowBlock[ index ] != clc.downloadBlock + 1 )
+			break;
+		dlWindowBlock[ index ] = 0;
+		if ( !CL_WriteDownloadBlock( dlWindowData[ index ], dlWindowSize[ index ] ) )
+			break;
 	}
 }
 
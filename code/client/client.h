@@ -201,6 +201,9 @@ typedef struct {
 	char		downloadTempName[MAX_OSPATH + 4]; // downloadName + ".tmp"
 	int			sv_allowDownload;
 	char		sv_dlURL[MAX_CVAR_VALUE_STRING];
+	int			sv_dlCaps;		// DL_CAP_* flags supported by server
+	int			downloadCaps;	// DL_CAP_* flags requested for current download
+	qboolean	downloadAckPending;	// cumulative acknowledge of received blocks is not sent yet
 	int			downloadNumber;
 	int			downloadBlock;	// block we are waiting for
 	int			downloadCount;	// how many bytes we got
@@ -491,6 +494,7 @@ extern int cl_connectedToPureServer;
 extern int cl_connectedToCheatServer;
 
 void CL_ParseServerMessage( msg_t *msg );
+void CL_ClearDownloadWindow( void );
 
 //====================================================================
 
@@ -97,6 +97,20 @@ typedef struct {
 } sharedEntity_t;
 
 
+// single request of the G_TRACE_BATCH engine extension
+typedef struct {
+	vec3_t		start;
+	vec3_t		mins;
+	vec3_t		maxs;
+	vec3_t		end;
+	int			passEntityNum;
+	int			contentmask;
+	int			capsule;
+} traceRequest_t;
+
+#define	MAX_TRACE_BATCH		1024
+
+
 
 //===============================================================
 
@@ -398,6 +412,9 @@ typedef enum {
 
 	// engine extensions
 	G_CVAR_SETDESCRIPTION,
+	G_TRACE_BATCH,	// ( const traceRequest_t *requests, trace_t *results, int count );
+	// same as G_TRACE/G_TRACECAPSULE for each request, query "trap_TraceBatch_Q3E" with G_TRAP_GETVALUE for availability
+
 	G_TRAP_GETVALUE = COM_TRAP_GETVALUE
 
 } gameImport_t;
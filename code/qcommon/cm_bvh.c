@@ -0,0 +1,280 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// cm_bvh.c -- bounding volume hierarchies over brushes and patches of large leafs
+
+#include "cm_local.h"
+#include "cm_patch.h"
+
+/*
+=============================================================================
+
+Leafs with many detail brushes are tested brush by brush, a hierarchy lets
+a trace reject most of them with a few box tests. It is only used to select
+candidates: callers still walk the leaf lists in their original order and
+skip non-candidates, so results are the same as without the hierarchy.
+
+=============================================================================
+*/
+
+qboolean cm_useBvh = qtrue;
+
+typedef struct {
+	vec3_t	bounds[2];
+	vec3_t	center;
+	int		pos;		// position in leaf brush list, surfaces follow brushes
+} bvhItem_t;
+
+static cBvhNode_t	*bvhNodes;
+static int			bvhNumNodes;
+static int			*bvhItems;
+static int			bvhNumItems;
+static int			bvhSortAxis;
+
+
+/*
+=================
+CM_CompareBvhItems
+=================
+*/
+static int QDECL CM_CompareBvhItems( const void *a, const void *b ) {
+	const bvhItem_t *ia = (const bvhItem_t *)a;
+	const bvhItem_t *ib = (const bvhItem_t *)b;
+
+	if ( ia->center[ bvhSortAxis ] < ib->center[ bvhSortAxis ] )
+		return -1;
+	if ( ia->center[ bvhSortAxis ] > ib->center[ bvhSortAxis ] )
+		return 1;
+
+	// keep the order stable
+	return ia->pos - ib->pos;
+}
+
+
+/*
+=================
+CM_BuildBvhNode
+
+Median split along the longest axis of item centers,
+returns index of the created node
+=================
+*/
+static int CM_BuildBvhNode( bvhItem_t *items, int count ) {
+	vec3_t mins, maxs;
+	cBvhNode_t *node;
+	int index, i, half;
+
+	index = bvhNumNodes++;
+	node = &bvhNodes[ index ];
+
+	ClearBounds( node->bounds[0], node->bounds[1] );
+	ClearBounds( mins, maxs );
+	for ( i = 0; i < count; i++ ) {
+		AddPointToBounds( items[i].bounds[0], node->bounds[0], node->bounds[1] );
+		AddPointToBounds( items[i].bounds[1], node->bounds[0], node->bounds[1] );
+		AddPointToBounds( items[i].center, mins, maxs );
+	}
+
+	if ( count <= BVH_LEAF_ITEMS ) {
+		node->first = bvhNumItems;
+		node->count = count;
+		for ( i = 0; i < count; i++ ) {
+			bvhItems[ bvhNumItems++ ] = items[i].pos;
+		}
+		return index;
+	}
+
+	bvhSortAxis = 0;
+	for ( i = 1; i < 3; i++ ) {
+		if ( maxs[i] - mins[i] > maxs[ bvhSortAxis ] - mins[ bvhSortAxis ] ) {
+			bvhSortAxis = i;
+		}
+	}
+	qsort( items, count, sizeof( items[0] ), CM_CompareBvhItems );
+
+	half = count / 2;
+
+	node->count = 0;
+	CM_BuildBvhNode( items, half );
+	i = CM_BuildBvhNode( items + half, count - half );
+	bvhNodes[ index ].first = i;
+
+	return index;
+}
+
+
+/*
+=================
+CM_CollectBvhItems
+
+Returns number of items with valid bounds or 0 if leaf is not worth a hierarchy
+=================
+*/
+static int CM_CollectBvhItems( const cLeaf_t *leaf, bvhItem_t *items ) {
+	const cPatch_t *patch;
+	const float *bounds;
+	int count, k, n;
+
+	if ( leaf->numLeafBrushes + leaf->numLeafSurfaces > BVH_MAX_ITEMS ) {
+		return 0;
+	}
+
+	count = 0;
+	for ( k = 0; k < leaf->numLeafBrushes + leaf->numLeafSurfaces; k++ ) {
+		if ( k < leaf->numLeafBrushes ) {
+			bounds = cm.brushes[ cm.leafbrushes[ leaf->firstLeafBrush + k ] ].bounds[0];
+		} else {
+			patch = cm.surfaces[ cm.leafsurfaces[ leaf->firstLeafSurface + k - leaf->numLeafBrushes ] ];
+			if ( !patch ) {
+				continue;
+			}
+			bounds = patch->pc->bounds[0];
+		}
+		for ( n = 0; n < 3; n++ ) {
+			items[ count ].bounds[0][n] = bounds[n];
+			items[ count ].bounds[1][n] = bounds[n + 3];
+			items[ count ].center[n] = ( bounds[n] + bounds[n + 3] ) * 0.5f;
+		}
+		items[ count ].pos = k;
+		count++;
+	}
+
+	if ( count < BVH_MIN_ITEMS ) {
+		return 0;
+	}
+
+	return count;
+}
+
+
+/*
+=================
+CM_BuildLeafBvhs
+
+Builds hierarchies for all large world leafs and inline models
+=================
+*/
+void CM_BuildLeafBvhs( void ) {
+	bvhItem_t *items;
+	cLeaf_t *leaf;
+	int64_t start;
+	int maxItems, totalItems, count, i;
+
+	start = Sys_Microseconds();
+
+	cm.numBvhNodes = cm.numBvhItems = cm.numBvhLeafs = 0;
+
+	// size temporary storage
+	maxItems = totalItems = 0;
+	for ( i = 0; i < cm.numLeafs + cm.numSubModels; i++ ) {
+		leaf = ( i < cm.numLeafs ) ? &cm.leafs[i] : &cm.cmodels[ i - cm.numLeafs ].leaf;
+		leaf->firstBvhNode = leaf->numBvhNodes = 0;
+		if ( i == cm.numLeafs ) {
+			continue; // world model has no own leaf
+		}
+		count = leaf->numLeafBrushes + leaf->numLeafSurfaces;
+		if ( count >= BVH_MIN_ITEMS && count <= BVH_MAX_ITEMS ) {
+			maxItems = MAX( maxItems, count );
+			totalItems += count;
+		}
+	}
+
+	if ( !totalItems ) {
+		return;
+	}
+
+	items = Z_Malloc( maxItems * sizeof( *items ) );
+	bvhNodes = Z_Malloc( totalItems * 2 * sizeof( *bvhNodes ) );
+	bvhItems = Z_Malloc( totalItems * sizeof( *bvhItems ) );
+	bvhNumNodes = bvhNumItems = 0;
+
+	for ( i = 0; i < cm.numLeafs + cm.numSubModels; i++ ) {
+		if ( i == cm.numLeafs ) {
+			continue;
+		}
+		leaf = ( i < cm.numLeafs ) ? &cm.leafs[i] : &cm.cmodels[ i - cm.numLeafs ].leaf;
+		count = CM_CollectBvhItems( leaf, items );
+		if ( !count ) {
+			continue;
+		}
+		leaf->firstBvhNode = bvhNumNodes;
+		CM_BuildBvhNode( items, count );
+		leaf->numBvhNodes = bvhNumNodes - leaf->firstBvhNode;
+		cm.numBvhLeafs++;
+	}
+
+	// move to the map hunk
+	if ( bvhNumNodes ) {
+		cm.numBvhNodes = bvhNumNodes;
+		cm.bvhNodes = Hunk_Alloc( bvhNumNodes * sizeof( *cm.bvhNodes ), h_high );
+		Com_Memcpy( cm.bvhNodes, bvhNodes, bvhNumNodes * sizeof( *cm.bvhNodes ) );
+		cm.numBvhItems = bvhNumItems;
+		cm.bvhItems = Hunk_Alloc( bvhNumItems * sizeof( *cm.bvhItems ), h_high );
+		Com_Memcpy( cm.bvhItems, bvhItems, bvhNumItems * sizeof( *cm.bvhItems ) );
+	}
+
+	Z_Free( bvhItems );
+	Z_Free( bvhNodes );
+	Z_Free( items );
+	bvhNodes = NULL;
+	bvhItems = NULL;
+
+	cm.bvhBuildTime = (int)( Sys_Microseconds() - start );
+}
+
+
+/*
+=================
+CM_LeafCandidates
+
+Sets bits of leaf brush and surface positions which may intersect given bounds,
+bits must have room for ( numLeafBrushes + numLeafSurfaces ) entries
+=================
+*/
+void CM_LeafCandidates( const cLeaf_t *leaf, const vec3_t mins, const vec3_t maxs, unsigned int *bits ) {
+	const cBvhNode_t *node;
+	int stack[ BVH_STACK ];
+	int sp, n, i, pos;
+
+	Com_Memset( bits, 0, ( ( leaf->numLeafBrushes + leaf->numLeafSurfaces + 31 ) >> 5 ) * sizeof( bits[0] ) );
+
+	sp = 0;
+	stack[ sp++ ] = leaf->firstBvhNode;
+
+	while ( sp ) {
+		n = stack[ --sp ];
+		node = &cm.bvhNodes[ n ];
+
+		if ( !CM_BoundsIntersect( mins, maxs, node->bounds[0], node->bounds[1] ) ) {
+			continue;
+		}
+
+		if ( node->count ) {
+			for ( i = 0; i < node->count; i++ ) {
+				pos = cm.bvhItems[ node->first + i ];
+				bits[ pos >> 5 ] |= 1u << ( pos & 31 );
+			}
+		} else {
+			stack[ sp++ ] = node->first;
+			stack[ sp++ ] = n + 1;
+		}
+	}
+}
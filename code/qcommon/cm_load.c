@@ -41,13 +41,6 @@ void SetPlaneSignbits( cplane_t *out ) {
 }
 #endif //BSPC
 
-// to allow boxes to be treated as brush models, we allocate
-// some extra indexes along with those needed by the map
-#define	BOX_BRUSHES		1
-#define	BOX_SIDES		6
-#define	BOX_LEAFS		2
-#define	BOX_PLANES		12
-
 #define	LL(x) x=LittleLong(x)
 
 
@@ -62,6 +55,7 @@ static byte *cmod_base;
 cvar_t		*cm_noAreas;
 cvar_t		*cm_noCurves;
 cvar_t		*cm_playerCurveClip;
+cvar_t		*cm_patchCache;
 #endif
 
 static cmodel_t box_model;
@@ -502,6 +496,19 @@ static void CMod_LoadBrushSides( const lump_t *l )
 		}
 		out->surfaceFlags = cm.shaders[out->shaderNum].surfaceFlags;
 	}
+
+	// structure of arrays for brush side tests, padded for groups
+	for ( i = 0; i < 4; i++ ) {
+		cm.sidePlanes[i] = Hunk_Alloc( ( count + SIDE_GROUP ) * sizeof( cm.sidePlanes[i][0] ), h_high );
+	}
+
+	out = cm.brushsides;
+	for ( i = 0; i < count; i++, out++ ) {
+		cm.sidePlanes[0][i] = out->plane->normal[0];
+		cm.sidePlanes[1][i] = out->plane->normal[1];
+		cm.sidePlanes[2][i] = out->plane->normal[2];
+		cm.sidePlanes[3][i] = out->plane->dist;
+	}
 }
 
 
@@ -594,6 +601,10 @@ static void CMod_LoadPatches( const lump_t *surfs, const lump_t *verts ) {
 		Com_Error( ERR_DROP, "%s: funny lump size", __func__ );
 	totalVerts = verts->filelen / sizeof(*dv);
 
+#ifndef BSPC
+	CM_OpenPatchCache();
+#endif
+
 	// scan through all the surfaces, but only load patches,
 	// not planar faces
 	for ( i = 0 ; i < count ; i++, in++ ) {
@@ -632,8 +643,18 @@ static void CMod_LoadPatches( const lump_t *surfs, const lump_t *verts ) {
 		patch->surfaceFlags = cm.shaders[shaderNum].surfaceFlags;
 
 		// create the internal facet structure
+#ifndef BSPC
+		patch->pc = CM_CachedPatchCollide( i );
+		if ( patch->pc ) {
+			continue;
+		}
+#endif
 		patch->pc = CM_GeneratePatchCollide( width, height, points );
 	}
+
+#ifndef BSPC
+	CM_ClosePatchCache();
+#endif
 }
 
 //==================================================================
@@ -706,6 +727,9 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	Cvar_SetDescription( cm_noCurves, "Do not collide against curves." );
 	cm_playerCurveClip = Cvar_Get( "cm_playerCurveClip", "1", CVAR_ARCHIVE_ND | CVAR_CHEAT );
 	Cvar_SetDescription( cm_playerCurveClip, "Collide player against curves." );
+	cm_patchCache = Cvar_Get( "cm_patchCache", "1", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( cm_patchCache, "0", "1", CV_INTEGER );
+	Cvar_SetDescription( cm_patchCache, "Store generated curve collision in the home directory and reuse it on next load of the same map." );
 #endif
 
 	Com_DPrintf( "%s( '%s', %i )\n", __func__, name, clientload );
@@ -794,6 +818,10 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 
 	CM_FloodAreaConnections();
 
+	CM_InitTraceContext( &cm.trace, Hunk_Alloc( CM_TraceContextSize(), h_high ) );
+
+	CM_BuildLeafBvhs();
+
 	// allow this to be cached if it is loaded by the server
 	if ( !clientload ) {
 		Q_strncpyz( cm.name, name, sizeof( cm.name ) );
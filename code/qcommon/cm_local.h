@@ -87,8 +87,18 @@ typedef struct {
 
 	int			firstLeafSurface;
 	int			numLeafSurfaces;
+
+	int			firstBvhNode;		// hierarchy over brushes and patches of large leafs
+	int			numBvhNodes;		// 0 if leaf is tested linearly
 } cLeaf_t;
 
+// bounding volume hierarchy node, inner nodes are followed by their first child
+typedef struct {
+	vec3_t		bounds[2];
+	int			first;		// first item for leaf nodes, index of the second child for inner nodes
+	int			count;		// number of items, 0 for inner nodes
+} cBvhNode_t;
+
 typedef struct cmodel_s {
 	vec3_t		mins, maxs;
 	cLeaf_t		leaf;			// submodels don't reference the main tree
@@ -106,12 +116,10 @@ typedef struct {
 	vec3_t		bounds[2];
 	int			numsides;
 	cbrushside_t	*sides;
-	int			checkcount;		// to avoid repeated testings
 } cbrush_t;
 
 
 typedef struct {
-	int			checkcount;				// to avoid repeated testings
 	int			surfaceFlags;
 	int			contents;
 	struct patchCollide_s	*pc;
@@ -123,6 +131,17 @@ typedef struct {
 	int			floodvalid;
 } cArea_t;
 
+// brushes and patches can be linked into many leafs, the trace context
+// remembers which of them were already tested by the current trace;
+// each thread that traces concurrently must use its own context
+struct traceContext_s {
+	unsigned int	generation;		// incremented on each trace
+	unsigned int	*brushStamps;	// [numBrushes] generation of the last test
+	unsigned int	*patchStamps;	// [numSurfaces]
+	int				numBrushes;		// including box brushes
+	int				numSurfaces;
+};
+
 typedef struct {
 	char		name[MAX_QPATH];
 
@@ -131,6 +150,7 @@ typedef struct {
 
 	int			numBrushSides;
 	cbrushside_t *brushsides;
+	double		*sidePlanes[4];	// SoA copy of brushside normals and distances for SIMD tests, without box sides
 
 	int			numPlanes;
 	cplane_t	*planes;
@@ -169,12 +189,37 @@ typedef struct {
 	cPatch_t	**surfaces;			// non-patches will be NULL
 
 	int			floodvalid;
-	int			checkcount;					// incremented on each trace
+	traceContext_t	trace;			// visited state of the main thread
+
+	int			numBvhNodes;
+	cBvhNode_t	*bvhNodes;
+	int			numBvhItems;
+	int			*bvhItems;			// positions in leaf brush list, surfaces follow brushes
+	int			numBvhLeafs;
+	int			bvhBuildTime;		// usec
 
 	unsigned int checksum;
 } clipMap_t;
 
 
+// to allow boxes to be treated as brush models, we allocate
+// some extra indexes along with those needed by the map
+#define	BOX_BRUSHES		1
+#define	BOX_SIDES		6
+#define	BOX_LEAFS		2
+#define	BOX_PLANES		12
+
+// SoA side planes are read in groups of this size past the last brush side
+#define	SIDE_GROUP		4
+
+// leaf hierarchies
+#define	BVH_MIN_ITEMS	32		// smaller leafs are tested linearly
+#define	BVH_MAX_ITEMS	8192	// brushes and surfaces, limited by candidate bitset size
+#define	BVH_LEAF_ITEMS	4
+#define	BVH_STACK		64
+
+#define	BVH_CANDIDATE( bits, n ) ( (bits)[ (n) >> 5 ] & ( 1u << ( (n) & 31 ) ) )
+
 // keep 1/8 unit away to keep the position valid before network snapping
 // and to avoid various numeric issues
 #define	SURFACE_CLIP_EPSILON	(0.125)
@@ -185,6 +230,8 @@ extern	int			c_traces, c_brush_traces, c_patch_traces;
 extern	cvar_t		*cm_noAreas;
 extern	cvar_t		*cm_noCurves;
 extern	cvar_t		*cm_playerCurveClip;
+extern	cvar_t		*cm_patchCache;
+extern	qboolean	cm_useBvh;
 
 // cm_test.c
 
@@ -210,6 +257,9 @@ typedef struct {
 	qboolean	isPoint;	// optimized case
 	trace_t		trace;		// returned from trace call
 	sphere_t	sphere;		// sphere for oriendted capsule collision
+	traceContext_t	*context;	// visited brushes and patches
+	int			brushTraces;	// statistics
+	int			patchTraces;
 } traceWork_t;
 
 typedef struct leafList_s {
@@ -225,6 +275,10 @@ typedef struct leafList_s {
 
 int CM_BoxBrushes( const vec3_t mins, const vec3_t maxs, cbrush_t **list, int listsize );
 
+int CM_TraceContextSize( void );
+void CM_InitTraceContext( traceContext_t *ctx, void *stamps );
+void CM_BeginTrace( traceContext_t *ctx );
+
 void CM_StoreLeafs( leafList_t *ll, int nodenum );
 void CM_StoreBrushes( leafList_t *ll, int nodenum );
 
@@ -234,9 +288,17 @@ cmodel_t	*CM_ClipHandleToModel( clipHandle_t handle );
 qboolean CM_BoundsIntersect( const vec3_t mins, const vec3_t maxs, const vec3_t mins2, const vec3_t maxs2 );
 qboolean CM_BoundsIntersectPoint( const vec3_t mins, const vec3_t maxs, const vec3_t point );
 
+// cm_bvh.c
+
+void CM_BuildLeafBvhs( void );
+void CM_LeafCandidates( const cLeaf_t *leaf, const vec3_t mins, const vec3_t maxs, unsigned int *bits );
+
 // cm_patch.c
 
 struct patchCollide_s	*CM_GeneratePatchCollide( int width, int height, vec3_t *points );
 void CM_TraceThroughPatchCollide( traceWork_t *tw, const struct patchCollide_s *pc );
 qboolean CM_PositionTestInPatchCollide( traceWork_t *tw, const struct patchCollide_s *pc );
 void CM_ClearLevelPatches( void );
+void CM_OpenPatchCache( void );
+struct patchCollide_s	*CM_CachedPatchCollide( int surface );
+void CM_ClosePatchCache( void );
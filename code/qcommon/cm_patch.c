@@ -1258,6 +1258,322 @@ struct patchCollide_s *CM_GeneratePatchCollide( int width, int height, vec3_t *p
 	return pf;
 }
 
+
+#ifndef BSPC
+/*
+================================================================================
+
+PATCH COLLISION CACHE
+
+Generated patch collision is stored in the home directory in a file named
+after the map checksum, all patches of the map go in surface order:
+
+[header] ( [item] [planes] [facets] )...
+
+The file is host-specific and will be ignored if anything in the header
+does not match. Loaded data is validated so a damaged file can't produce
+out of range plane references, on the first mismatch remaining patches
+are generated as usual and the whole file is rewritten afterwards.
+
+================================================================================
+*/
+
+#define PATCH_CACHE_VERSION	1
+#define PATCH_CACHE_MAXSIZE	( 64 * 1024 * 1024 )
+
+typedef struct {
+	char		magic[4];		// "PCOL"
+	uint32_t	version;
+	uint32_t	byteOrder;		// 0x01020304 in host order
+	uint32_t	checksum;		// map checksum
+	uint32_t	numSurfaces;
+	uint32_t	numPatches;
+	uint32_t	planeSize;		// sizeof( patchPlane_t )
+	uint32_t	facetSize;		// sizeof( facet_t )
+} patchCacheHeader_t;
+
+typedef struct {
+	uint32_t	surface;
+	uint32_t	numPlanes;
+	uint32_t	numFacets;
+	vec3_t		bounds[2];
+} patchCacheItem_t;
+
+static byte		*patchCache;		// temp memory
+static int		patchCacheSize;
+static int		patchCacheOffset;
+static int		patchCacheHits;
+static int		patchCacheMisses;
+
+
+/*
+=================
+CM_PatchCacheName
+=================
+*/
+static const char *CM_PatchCacheName( void ) {
+	return va( "patchcache/%08x.dat", cm.checksum );
+}
+
+
+/*
+=================
+CM_OpenPatchCache
+
+Reads cached patch collision of the current map, if any
+=================
+*/
+void CM_OpenPatchCache( void ) {
+	const patchCacheHeader_t *header;
+	fileHandle_t f;
+	int length;
+
+	patchCache = NULL;
+	patchCacheSize = patchCacheOffset = 0;
+	patchCacheHits = patchCacheMisses = 0;
+
+	if ( !cm_patchCache->integer ) {
+		return;
+	}
+
+	length = FS_SV_FOpenFileRead( CM_PatchCacheName(), &f );
+	if ( f == FS_INVALID_HANDLE ) {
+		return;
+	}
+
+	if ( length < sizeof( *header ) || length > PATCH_CACHE_MAXSIZE ) {
+		FS_FCloseFile( f );
+		return;
+	}
+
+	patchCache = Hunk_AllocateTempMemory( length );
+	if ( FS_Read( patchCache, length, f ) != length ) {
+		FS_FCloseFile( f );
+		Hunk_FreeTempMemory( patchCache );
+		patchCache = NULL;
+		return;
+	}
+	FS_FCloseFile( f );
+
+	header = (const patchCacheHeader_t *)patchCache;
+	if ( memcmp( header->magic, "PCOL", 4 ) || header->version != PATCH_CACHE_VERSION || header->byteOrder != 0x01020304
+		|| header->checksum != cm.checksum || header->numSurfaces != cm.numSurfaces
+		|| header->planeSize != sizeof( patchPlane_t ) || header->facetSize != sizeof( facet_t ) ) {
+		Com_DPrintf( "%s: outdated\n", CM_PatchCacheName() );
+		Hunk_FreeTempMemory( patchCache );
+		patchCache = NULL;
+		return;
+	}
+
+	patchCacheSize = length;
+	patchCacheOffset = sizeof( *header );
+}
+
+
+/*
+=================
+CM_ValidateCachedPatch
+=================
+*/
+static qboolean CM_ValidateCachedPatch( const patchCacheItem_t *item, const patchPlane_t *planes, const facet_t *facets ) {
+	const facet_t *facet;
+	int i, j;
+
+	for ( i = 0; i < item->numPlanes; i++ ) {
+		if ( (unsigned)planes[i].signbits > 7 ) {
+			return qfalse;
+		}
+	}
+
+	for ( i = 0, facet = facets; i < item->numFacets; i++, facet++ ) {
+		if ( (unsigned)facet->surfacePlane >= item->numPlanes ) {
+			return qfalse;
+		}
+		if ( (unsigned)facet->numBorders > ARRAY_LEN( facet->borderPlanes ) ) {
+			return qfalse;
+		}
+		for ( j = 0; j < facet->numBorders; j++ ) {
+			if ( (unsigned)facet->borderPlanes[j] >= item->numPlanes ) {
+				return qfalse;
+			}
+		}
+	}
+
+	return qtrue;
+}
+
+
+/*
+=================
+CM_CachedPatchCollide
+
+Returns cached collision of the given surface or NULL if it must be generated
+=================
+*/
+struct patchCollide_s *CM_CachedPatchCollide( int surface ) {
+	const patchCacheItem_t *item;
+	const patchPlane_t *planes;
+	const facet_t *facets;
+	patchCollide_t *pf;
+	int size;
+
+	if ( !patchCache ) {
+		patchCacheMisses++;
+		return NULL;
+	}
+
+	item = (const patchCacheItem_t *)( patchCache + patchCacheOffset );
+	if ( patchCacheOffset + sizeof( *item ) > patchCacheSize
+		|| item->surface != surface
+		|| item->numPlanes > MAX_PATCH_PLANES || item->numFacets > MAX_FACETS ) {
+		goto invalid;
+	}
+
+	size = sizeof( *item ) + item->numPlanes * sizeof( *planes ) + item->numFacets * sizeof( *facets );
+	if ( patchCacheOffset + size > patchCacheSize ) {
+		goto invalid;
+	}
+
+	planes = (const patchPlane_t *)( item + 1 );
+	facets = (const facet_t *)( planes + item->numPlanes );
+	if ( !CM_ValidateCachedPatch( item, planes, facets ) ) {
+		goto invalid;
+	}
+
+	patchCacheOffset += size;
+
+	pf = Hunk_Alloc( sizeof( *pf ), h_high );
+	VectorCopy( item->bounds[0], pf->bounds[0] );
+	VectorCopy( item->bounds[1], pf->bounds[1] );
+	pf->numPlanes = item->numPlanes;
+	pf->numFacets = item->numFacets;
+	pf->facets = Hunk_Alloc( pf->numFacets * sizeof( *pf->facets ), h_high );
+	Com_Memcpy( pf->facets, facets, pf->numFacets * sizeof( *pf->facets ) );
+	pf->planes = Hunk_Alloc( pf->numPlanes * sizeof( *pf->planes ), h_high );
+	Com_Memcpy( pf->planes, planes, pf->numPlanes * sizeof( *pf->planes ) );
+
+	patchCacheHits++;
+
+	return pf;
+
+invalid:
+	Com_DPrintf( "%s: mismatch at surface %i\n", CM_PatchCacheName(), surface );
+	Hunk_FreeTempMemory( patchCache );
+	patchCache = NULL;
+	patchCacheMisses++;
+	return NULL;
+}
+
+
+/*
+=================
+CM_WritePatchCache
+=================
+*/
+static void CM_WritePatchCache( void ) {
+	patchCacheHeader_t header;
+	patchCacheItem_t item;
+	const cPatch_t *patch;
+	const patchCollide_t *pc;
+	char tmpname[ MAX_QPATH ];
+	const char *name;
+	fileHandle_t f;
+	qboolean ok;
+	byte rnd[4];
+	int i, len;
+
+	name = CM_PatchCacheName();
+
+	Com_Memset( &header, 0, sizeof( header ) );
+	Com_Memcpy( header.magic, "PCOL", 4 );
+	header.version = PATCH_CACHE_VERSION;
+	header.byteOrder = 0x01020304;
+	header.checksum = cm.checksum;
+	header.numSurfaces = cm.numSurfaces;
+	header.planeSize = sizeof( patchPlane_t );
+	header.facetSize = sizeof( facet_t );
+	for ( i = 0; i < cm.numSurfaces; i++ ) {
+		if ( cm.surfaces[i] ) {
+			header.numPatches++;
+		}
+	}
+
+	// write under temporary name and rename so concurrent
+	// map loads will never read partially written file
+	Com_RandomBytes( rnd, sizeof( rnd ) );
+	Com_sprintf( tmpname, sizeof( tmpname ), "%s.%02x%02x%02x%02x.tmp", name, rnd[0], rnd[1], rnd[2], rnd[3] );
+
+	f = FS_SV_FOpenFileWrite( tmpname );
+	if ( f == FS_INVALID_HANDLE ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't write %s\n", name );
+		return;
+	}
+
+	// unbuffered so short writes are reported by FS_Write() and not lost on close
+	FS_ForceFlush( f );
+
+	ok = ( FS_Write( &header, sizeof( header ), f ) == sizeof( header ) );
+
+	for ( i = 0; i < cm.numSurfaces && ok; i++ ) {
+		patch = cm.surfaces[i];
+		if ( !patch ) {
+			continue;
+		}
+		pc = patch->pc;
+		Com_Memset( &item, 0, sizeof( item ) );
+		item.surface = i;
+		item.numPlanes = pc->numPlanes;
+		item.numFacets = pc->numFacets;
+		VectorCopy( pc->bounds[0], item.bounds[0] );
+		VectorCopy( pc->bounds[1], item.bounds[1] );
+		len = pc->numPlanes * sizeof( *pc->planes );
+		ok = ( FS_Write( &item, sizeof( item ), f ) == sizeof( item ) ) && ( FS_Write( pc->planes, len, f ) == len );
+		len = pc->numFacets * sizeof( *pc->facets );
+		ok = ok && ( FS_Write( pc->facets, len, f ) == len );
+	}
+
+	FS_FCloseFile( f );
+
+	if ( !ok ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't write %s\n", name );
+		FS_Remove( FS_BuildOSPath( FS_GetHomePath(), tmpname, NULL ) );
+		return;
+	}
+
+	if ( !FS_SV_Replace( tmpname, name ) ) {
+		return;
+	}
+
+	Com_DPrintf( "%s: stored %i patches\n", name, header.numPatches );
+}
+
+
+/*
+=================
+CM_ClosePatchCache
+
+Releases cached data, rewrites cache file if some patches were generated
+=================
+*/
+void CM_ClosePatchCache( void ) {
+	if ( patchCache ) {
+		Hunk_FreeTempMemory( patchCache );
+		patchCache = NULL;
+	}
+
+	if ( patchCacheHits ) {
+		Com_DPrintf( "%s: %i patches loaded\n", CM_PatchCacheName(), patchCacheHits );
+	}
+
+	if ( patchCacheMisses && cm_patchCache->integer ) {
+		CM_WritePatchCache();
+	}
+
+	patchCacheHits = patchCacheMisses = 0;
+}
+#endif // !BSPC
+
+
 /*
 ================================================================================
 
@@ -1342,10 +1658,11 @@ static void CM_TracePointThroughPatchCollide( traceWork_t *tw, const struct patc
 		if ( j == facet->numBorders ) {
 			// we hit this facet
 #ifndef BSPC
-			if (!cv) {
+			// debug surface is shared, update it only from the main thread
+			if ( tw->context == &cm.trace && !cv ) {
 				cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
 			}
-			if (cv->integer) {
+			if ( tw->context == &cm.trace && cv->integer ) {
 				debugPatchCollide = pc;
 				debugFacet = facet;
 			}
@@ -1533,10 +1850,11 @@ void CM_TraceThroughPatchCollide( traceWork_t *tw, const struct patchCollide_s *
 				//	enterFrac = 0;
 				//}
 #ifndef BSPC
-				if (!cv) {
+				// debug surface is shared, update it only from the main thread
+				if ( tw->context == &cm.trace && !cv ) {
 					cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
 				}
-				if (cv && cv->integer) {
+				if ( tw->context == &cm.trace && cv->integer ) {
 					debugPatchCollide = pc;
 					debugFacet = facet;
 				}
@@ -46,6 +46,26 @@ void		CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 						clipHandle_t model, int brushmask,
 						const vec3_t origin, const vec3_t angles, qboolean capsule );
 
+// traces above share the visited state of the main thread, these can run
+// concurrently from other threads as long as each one uses its own context;
+// contexts are sized for the current map and must be reallocated after map change,
+// temporary box and capsule models are still owned by the main thread
+typedef struct traceContext_s traceContext_t;
+
+traceContext_t *CM_AllocTraceContext( void );
+void		CM_FreeTraceContext( traceContext_t *ctx );
+void		CM_ContextBoxTrace( traceContext_t *ctx, trace_t *results, const vec3_t start, const vec3_t end,
+						const vec3_t mins, const vec3_t maxs,
+						clipHandle_t model, int brushmask, qboolean capsule );
+void		CM_ContextTransformedBoxTrace( traceContext_t *ctx, trace_t *results, const vec3_t start, const vec3_t end,
+						const vec3_t mins, const vec3_t maxs,
+						clipHandle_t model, int brushmask,
+						const vec3_t origin, const vec3_t angles, qboolean capsule );
+void		CM_TraceStress_f( void );
+void		CM_TraceRecord_f( void );
+void		CM_TraceCompare_f( void );
+void		CM_Stats_f( void );
+
 byte		*CM_ClusterPVS (int cluster);
 
 int			CM_PointLeafnum( const vec3_t p );
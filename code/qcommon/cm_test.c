@@ -88,6 +88,8 @@ void CM_StoreLeafs( leafList_t *ll, int nodenum ) {
 }
 
 void CM_StoreBrushes( leafList_t *ll, int nodenum ) {
+	unsigned int candidates[ BVH_MAX_ITEMS / 32 ];
+	qboolean	bvh;
 	int			i, k;
 	int			leafnum;
 	int			brushnum;
@@ -98,13 +100,21 @@ void CM_StoreBrushes( leafList_t *ll, int nodenum ) {
 
 	leaf = &cm.leafs[leafnum];
 
+	bvh = leaf->numBvhNodes && cm_useBvh;
+	if ( bvh ) {
+		CM_LeafCandidates( leaf, ll->bounds[0], ll->bounds[1], candidates );
+	}
+
 	for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
+		if ( bvh && !BVH_CANDIDATE( candidates, k ) ) {
+			continue;
+		}
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
-		b = &cm.brushes[brushnum];
-		if ( b->checkcount == cm.checkcount ) {
+		if ( cm.trace.brushStamps[brushnum] == cm.trace.generation ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = cm.checkcount;
+		cm.trace.brushStamps[brushnum] = cm.trace.generation;
+		b = &cm.brushes[brushnum];
 		for ( i = 0 ; i < 3 ; i++ ) {
 			if ( b->bounds[0][i] >= ll->bounds[1][i] || b->bounds[1][i] <= ll->bounds[0][i] ) {
 				break;
@@ -172,8 +182,6 @@ CM_BoxLeafnums
 int	CM_BoxLeafnums( const vec3_t mins, const vec3_t maxs, int *list, int listsize, int *lastLeaf) {
 	leafList_t	ll;
 
-	cm.checkcount++;
-
 	VectorCopy( mins, ll.bounds[0] );
 	VectorCopy( maxs, ll.bounds[1] );
 	ll.count = 0;
@@ -197,7 +205,7 @@ CM_BoxBrushes
 int CM_BoxBrushes( const vec3_t mins, const vec3_t maxs, cbrush_t **list, int listsize ) {
 	leafList_t	ll;
 
-	cm.checkcount++;
+	CM_BeginTrace( &cm.trace );
 
 	VectorCopy( mins, ll.bounds[0] );
 	VectorCopy( maxs, ll.bounds[1] );
@@ -21,6 +21,11 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include "cm_local.h"
 
+#if defined(_MSC_SSE2) || defined(_GCC_SSE2)
+#include <emmintrin.h>
+#define USE_SIMD_SIDES
+#endif
+
 // always use bbox vs. bbox collision and never capsule vs. bbox or vice versa
 //#define ALWAYS_BBOX_VS_BBOX
 // always use capsule vs. capsule collision and never capsule vs. bbox or vice versa
@@ -146,6 +151,151 @@ POSITION TESTING
 ===============================================================================
 */
 
+/*
+===============================================================================
+
+BRUSH SIDE DISTANCES
+
+===============================================================================
+*/
+
+// reference scalar path can be forced for comparisons
+static qboolean cm_simdSides = qtrue;
+
+#ifdef USE_SIMD_SIDES
+/*
+================
+CM_SelectOffsets
+
+Per-lane equivalent of tw->offsets[ plane->signbits ]
+================
+*/
+static ID_INLINE __m128d CM_SelectOffsets( __m128d normal, float size0, float size1 ) {
+	const __m128d mask = _mm_cmplt_pd( normal, _mm_setzero_pd() );
+	return _mm_or_pd( _mm_and_pd( mask, _mm_set1_pd( size1 ) ), _mm_andnot_pd( mask, _mm_set1_pd( size0 ) ) );
+}
+#endif
+
+
+/*
+================
+CM_SideDistances
+
+Fills distances of trace start and end points to SIDE_GROUP brush sides
+beginning from the first one, sides are pushed out by the box size.
+Both paths must produce the same bits as the double precision scalar code.
+================
+*/
+static void CM_SideDistances( const traceWork_t *tw, const cbrush_t *brush, int first, double *d1, double *d2 ) {
+	const cplane_t *plane;
+	double dist;
+	int k;
+
+#ifdef USE_SIMD_SIDES
+	// box brush planes are not copied as they change with each temp box model
+	if ( cm_simdSides && brush->sides < cm.brushsides + cm.numBrushSides ) {
+		const int index = ( brush->sides - cm.brushsides ) + first;
+		__m128d nx, ny, nz, pd, ox, oy, oz, dv;
+
+		for ( k = 0; k < SIDE_GROUP; k += 2 ) {
+			nx = _mm_loadu_pd( cm.sidePlanes[0] + index + k );
+			ny = _mm_loadu_pd( cm.sidePlanes[1] + index + k );
+			nz = _mm_loadu_pd( cm.sidePlanes[2] + index + k );
+			pd = _mm_loadu_pd( cm.sidePlanes[3] + index + k );
+
+			ox = CM_SelectOffsets( nx, tw->size[0][0], tw->size[1][0] );
+			oy = CM_SelectOffsets( ny, tw->size[0][1], tw->size[1][1] );
+			oz = CM_SelectOffsets( nz, tw->size[0][2], tw->size[1][2] );
+
+			dv = _mm_sub_pd( pd, _mm_add_pd( _mm_add_pd( _mm_mul_pd( ox, nx ), _mm_mul_pd( oy, ny ) ), _mm_mul_pd( oz, nz ) ) );
+
+			_mm_storeu_pd( d1 + k, _mm_sub_pd( _mm_add_pd( _mm_add_pd(
+				_mm_mul_pd( _mm_set1_pd( tw->start[0] ), nx ),
+				_mm_mul_pd( _mm_set1_pd( tw->start[1] ), ny ) ),
+				_mm_mul_pd( _mm_set1_pd( tw->start[2] ), nz ) ), dv ) );
+
+			_mm_storeu_pd( d2 + k, _mm_sub_pd( _mm_add_pd( _mm_add_pd(
+				_mm_mul_pd( _mm_set1_pd( tw->end[0] ), nx ),
+				_mm_mul_pd( _mm_set1_pd( tw->end[1] ), ny ) ),
+				_mm_mul_pd( _mm_set1_pd( tw->end[2] ), nz ) ), dv ) );
+		}
+		return;
+	}
+#endif
+
+	for ( k = 0; k < SIDE_GROUP && first + k < brush->numsides; k++ ) {
+		plane = brush->sides[ first + k ].plane;
+
+		// adjust the plane distance appropriately for mins/maxs
+		dist = plane->dist - DotProductDP( tw->offsets[ plane->signbits ], plane->normal );
+
+		d1[k] = DotProductDP( tw->start, plane->normal ) - dist;
+		d2[k] = DotProductDP( tw->end, plane->normal ) - dist;
+	}
+}
+
+
+/*
+================
+CM_SideStartDistances
+
+Same as CM_SideDistances for the start point only, with plane
+adjustment done in single precision like in CM_TestBoxInBrush
+================
+*/
+static void CM_SideStartDistances( const traceWork_t *tw, const cbrush_t *brush, int first, double *d1 ) {
+	const cplane_t *plane;
+	double dist;
+	int k;
+
+#ifdef USE_SIMD_SIDES
+	if ( cm_simdSides && brush->sides < cm.brushsides + cm.numBrushSides ) {
+		const int index = ( brush->sides - cm.brushsides ) + first;
+		const __m128 zero = _mm_setzero_ps();
+		__m128d nx, ny, nz, dv;
+		__m128 fx, fy, fz, mx, my, mz, df;
+
+		for ( k = 0; k < SIDE_GROUP; k += 2 ) {
+			nx = _mm_loadu_pd( cm.sidePlanes[0] + index + k );
+			ny = _mm_loadu_pd( cm.sidePlanes[1] + index + k );
+			nz = _mm_loadu_pd( cm.sidePlanes[2] + index + k );
+
+			// planes are stored as floats in the map so these conversions are exact
+			fx = _mm_cvtpd_ps( nx );
+			fy = _mm_cvtpd_ps( ny );
+			fz = _mm_cvtpd_ps( nz );
+
+			mx = _mm_cmplt_ps( fx, zero );
+			my = _mm_cmplt_ps( fy, zero );
+			mz = _mm_cmplt_ps( fz, zero );
+
+			df = _mm_add_ps( _mm_add_ps(
+				_mm_mul_ps( _mm_or_ps( _mm_and_ps( mx, _mm_set1_ps( tw->size[1][0] ) ), _mm_andnot_ps( mx, _mm_set1_ps( tw->size[0][0] ) ) ), fx ),
+				_mm_mul_ps( _mm_or_ps( _mm_and_ps( my, _mm_set1_ps( tw->size[1][1] ) ), _mm_andnot_ps( my, _mm_set1_ps( tw->size[0][1] ) ) ), fy ) ),
+				_mm_mul_ps( _mm_or_ps( _mm_and_ps( mz, _mm_set1_ps( tw->size[1][2] ) ), _mm_andnot_ps( mz, _mm_set1_ps( tw->size[0][2] ) ) ), fz ) );
+			df = _mm_sub_ps( _mm_cvtpd_ps( _mm_loadu_pd( cm.sidePlanes[3] + index + k ) ), df );
+			dv = _mm_cvtps_pd( df );
+
+			_mm_storeu_pd( d1 + k, _mm_sub_pd( _mm_add_pd( _mm_add_pd(
+				_mm_mul_pd( _mm_set1_pd( tw->start[0] ), nx ),
+				_mm_mul_pd( _mm_set1_pd( tw->start[1] ), ny ) ),
+				_mm_mul_pd( _mm_set1_pd( tw->start[2] ), nz ) ), dv ) );
+		}
+		return;
+	}
+#endif
+
+	for ( k = 0; k < SIDE_GROUP && first + k < brush->numsides; k++ ) {
+		plane = brush->sides[ first + k ].plane;
+
+		// adjust the plane distance appropriately for mins/maxs
+		dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+
+		d1[k] = DotProductDP( tw->start, plane->normal ) - dist;
+	}
+}
+
+
 /*
 ================
 CM_TestBoxInBrush
@@ -201,16 +351,16 @@ static void CM_TestBoxInBrush( traceWork_t *tw, const cbrush_t *brush ) {
 			}
 		}
 	} else {
+		double	d1s[ SIDE_GROUP ];
+
 		// the first six planes are the axial planes, so we only
 		// need to test the remainder
 		for ( i = 6 ; i < brush->numsides ; i++ ) {
-			side = brush->sides + i;
-			plane = side->plane;
-
-			// adjust the plane distance appropriately for mins/maxs
-			dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+			if ( ( ( i - 6 ) & ( SIDE_GROUP - 1 ) ) == 0 ) {
+				CM_SideStartDistances( tw, brush, i, d1s );
+			}
 
-			d1 = DotProductDP( tw->start, plane->normal ) - dist;
+			d1 = d1s[ ( i - 6 ) & ( SIDE_GROUP - 1 ) ];
 
 			// if completely in front of face, no intersection
 			if ( d1 > 0 ) {
@@ -232,19 +382,21 @@ CM_TestInLeaf
 ================
 */
 static void CM_TestInLeaf( traceWork_t *tw, const cLeaf_t *leaf ) {
+	traceContext_t *ctx = tw->context;
 	int			k;
 	int			brushnum;
+	int			patchnum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
 
 	// test box position against all brushes in the leaf
 	for (k=0 ; k<leaf->numLeafBrushes ; k++) {
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
-		b = &cm.brushes[brushnum];
-		if (b->checkcount == cm.checkcount) {
+		if ( ctx->brushStamps[brushnum] == ctx->generation ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = cm.checkcount;
+		ctx->brushStamps[brushnum] = ctx->generation;
+		b = &cm.brushes[brushnum];
 
 		if ( !(b->contents & tw->contents)) {
 			continue;
@@ -263,14 +415,15 @@ static void CM_TestInLeaf( traceWork_t *tw, const cLeaf_t *leaf ) {
 	if ( !cm_noCurves->integer ) {
 #endif //BSPC
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = cm.surfaces[ cm.leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			patchnum = cm.leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = cm.surfaces[ patchnum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == cm.checkcount ) {
+			if ( ctx->patchStamps[patchnum] == ctx->generation ) {
 				continue;	// already checked this brush in another leaf
 			}
-			patch->checkcount = cm.checkcount;
+			ctx->patchStamps[patchnum] = ctx->generation;
 
 			if ( !(patch->contents & tw->contents)) {
 				continue;
@@ -423,13 +576,8 @@ static void CM_PositionTest( traceWork_t *tw ) {
 	ll.lastLeaf = 0;
 	ll.overflowed = qfalse;
 
-	cm.checkcount++;
-
 	CM_BoxLeafnums_r( &ll, 0 );
 
-
-	cm.checkcount++;
-
 	// test the contents of the leafs
 	for (i=0 ; i < ll.count ; i++) {
 		CM_TestInLeaf( tw, &cm.leafs[leafs[i]] );
@@ -439,6 +587,91 @@ static void CM_PositionTest( traceWork_t *tw ) {
 	}
 }
 
+/*
+===============================================================================
+
+TRACE CONTEXTS
+
+===============================================================================
+*/
+
+/*
+==================
+CM_TraceContextSize
+
+Returns size of the visited stamps required for the current map
+==================
+*/
+int CM_TraceContextSize( void ) {
+	return ( cm.numBrushes + BOX_BRUSHES + cm.numSurfaces ) * sizeof( unsigned int );
+}
+
+
+/*
+==================
+CM_InitTraceContext
+
+Stamps must be CM_TraceContextSize() bytes long
+==================
+*/
+void CM_InitTraceContext( traceContext_t *ctx, void *stamps ) {
+	ctx->numBrushes = cm.numBrushes + BOX_BRUSHES;
+	ctx->numSurfaces = cm.numSurfaces;
+	ctx->brushStamps = (unsigned int *)stamps;
+	ctx->patchStamps = ctx->brushStamps + ctx->numBrushes;
+	ctx->generation = 0;
+	Com_Memset( stamps, 0, CM_TraceContextSize() );
+}
+
+
+/*
+==================
+CM_BeginTrace
+
+Invalidates all visited marks of the context
+==================
+*/
+void CM_BeginTrace( traceContext_t *ctx ) {
+	if ( ctx->numBrushes != cm.numBrushes + BOX_BRUSHES || ctx->numSurfaces != cm.numSurfaces ) {
+		Com_Error( ERR_DROP, "%s: trace context doesn't match current map", __func__ );
+	}
+	if ( ++ctx->generation == 0 ) {
+		// wrapped around, stale stamps may match again
+		Com_Memset( ctx->brushStamps, 0, ( ctx->numBrushes + ctx->numSurfaces ) * sizeof( unsigned int ) );
+		ctx->generation = 1;
+	}
+}
+
+
+#ifndef BSPC
+/*
+==================
+CM_AllocTraceContext
+==================
+*/
+traceContext_t *CM_AllocTraceContext( void ) {
+	traceContext_t *ctx;
+
+	ctx = Z_Malloc( sizeof( *ctx ) + CM_TraceContextSize() );
+	CM_InitTraceContext( ctx, ctx + 1 );
+
+	return ctx;
+}
+
+
+/*
+==================
+CM_FreeTraceContext
+==================
+*/
+void CM_FreeTraceContext( traceContext_t *ctx ) {
+	if ( ctx ) {
+		Z_Free( ctx );
+	}
+}
+#endif
+
+
 /*
 ===============================================================================
 
@@ -456,7 +689,7 @@ CM_TraceThroughPatch
 static void CM_TraceThroughPatch( traceWork_t *tw, const cPatch_t *patch ) {
 	float		oldFrac;
 
-	c_patch_traces++;
+	tw->patchTraces++;
 
 	oldFrac = tw->trace.fraction;
 
@@ -495,7 +728,7 @@ static void CM_TraceThroughBrush( traceWork_t *tw, const cbrush_t *brush ) {
 		return;
 	}
 
-	c_brush_traces++;
+	tw->brushTraces++;
 
 	getout = qfalse;
 	startout = qfalse;
@@ -570,20 +803,23 @@ static void CM_TraceThroughBrush( traceWork_t *tw, const cbrush_t *brush ) {
 			}
 		}
 	} else {
+		double	d1s[ SIDE_GROUP ], d2s[ SIDE_GROUP ];
+
 		//
 		// compare the trace against all planes of the brush
 		// find the latest time the trace crosses a plane towards the interior
 		// and the earliest time the trace crosses a plane towards the exterior
 		//
 		for (i = 0; i < brush->numsides; i++) {
+			if ( ( i & ( SIDE_GROUP - 1 ) ) == 0 ) {
+				CM_SideDistances( tw, brush, i, d1s, d2s );
+			}
+
 			side = brush->sides + i;
 			plane = side->plane;
 
-			// adjust the plane distance appropriately for mins/maxs
-			dist = plane->dist - DotProductDP( tw->offsets[ plane->signbits ], plane->normal );
-
-			d1 = DotProductDP( tw->start, plane->normal ) - dist;
-			d2 = DotProductDP( tw->end, plane->normal ) - dist;
+			d1 = d1s[ i & ( SIDE_GROUP - 1 ) ];
+			d2 = d2s[ i & ( SIDE_GROUP - 1 ) ];
 
 			if (d2 > 0) {
 				getout = qtrue;	// endpoint is not in solid
@@ -663,20 +899,34 @@ CM_TraceThroughLeaf
 ================
 */
 static void CM_TraceThroughLeaf( traceWork_t *tw, const cLeaf_t *leaf ) {
+	traceContext_t *ctx = tw->context;
+	unsigned int candidates[ BVH_MAX_ITEMS / 32 ];
+	qboolean	bvh;
 	int			k;
 	int			brushnum;
+	int			patchnum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
 
+	// skip brushes and patches which are far from the trace in large leafs
+	bvh = leaf->numBvhNodes && cm_useBvh;
+	if ( bvh ) {
+		CM_LeafCandidates( leaf, tw->bounds[0], tw->bounds[1], candidates );
+	}
+
 	// trace line against all brushes in the leaf
 	for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
+		if ( bvh && !BVH_CANDIDATE( candidates, k ) ) {
+			continue;
+		}
+
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
 
-		b = &cm.brushes[brushnum];
-		if ( b->checkcount == cm.checkcount ) {
+		if ( ctx->brushStamps[brushnum] == ctx->generation ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = cm.checkcount;
+		ctx->brushStamps[brushnum] = ctx->generation;
+		b = &cm.brushes[brushnum];
 
 		if ( !(b->contents & tw->contents) ) {
 			continue;
@@ -700,14 +950,19 @@ static void CM_TraceThroughLeaf( traceWork_t *tw, const cLeaf_t *leaf ) {
 	if ( !cm_noCurves->integer ) {
 #endif
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = cm.surfaces[ cm.leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			if ( bvh && !BVH_CANDIDATE( candidates, leaf->numLeafBrushes + k ) ) {
+				continue;
+			}
+
+			patchnum = cm.leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = cm.surfaces[ patchnum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == cm.checkcount ) {
+			if ( ctx->patchStamps[patchnum] == ctx->generation ) {
 				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = cm.checkcount;
+			ctx->patchStamps[patchnum] = ctx->generation;
 
 			if ( !(patch->contents & tw->contents) ) {
 				continue;
@@ -1136,12 +1391,61 @@ static void CM_TraceThroughTree( traceWork_t *tw, int num, float p1f, float p2f,
 //======================================================================
 
 
+#ifndef BSPC
+// CM_Trace arguments, including temporary box model state
+typedef struct {
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		origin;
+	vec3_t		boxMins, boxMaxs;
+	clipHandle_t model;
+	int			brushmask;
+	qboolean	capsule;
+	qboolean	hasSphere;
+	sphere_t	sphere;
+} traceRecord_t;
+
+static fileHandle_t	cm_traceLog = FS_INVALID_HANDLE;
+static int			cm_traceLogCount;
+
+/*
+==================
+CM_RecordTrace
+==================
+*/
+static void CM_RecordTrace( const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+						clipHandle_t model, const vec3_t origin, int brushmask, qboolean capsule, const sphere_t *sphere ) {
+	traceRecord_t rec;
+
+	Com_Memset( &rec, 0, sizeof( rec ) );
+	VectorCopy( start, rec.start );
+	VectorCopy( end, rec.end );
+	VectorCopy( mins, rec.mins );
+	VectorCopy( maxs, rec.maxs );
+	VectorCopy( origin, rec.origin );
+	if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE ) {
+		CM_ModelBounds( model, rec.boxMins, rec.boxMaxs );
+	}
+	rec.model = model;
+	rec.brushmask = brushmask;
+	rec.capsule = capsule;
+	if ( sphere ) {
+		rec.hasSphere = qtrue;
+		rec.sphere = *sphere;
+	}
+
+	FS_Write( &rec, sizeof( rec ), cm_traceLog );
+	cm_traceLogCount++;
+}
+#endif
+
+
 /*
 ==================
 CM_Trace
 ==================
 */
-static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+static void CM_Trace( traceContext_t *ctx, trace_t *results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
 						clipHandle_t model, const vec3_t origin, int brushmask, qboolean capsule, const sphere_t *sphere ) {
 	int			i;
 	traceWork_t	tw;
@@ -1150,14 +1454,11 @@ static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, co
 
 	cmod = CM_ClipHandleToModel( model );
 
-	cm.checkcount++;		// for multi-check avoidance
-
-	c_traces++;				// for statistics, may be zeroed
-
 	// fill in a default trace
 	Com_Memset( &tw, 0, sizeof(tw) );
 	tw.trace.fraction = 1;	// assume it goes the entire distance until shown otherwise
 	VectorCopy(origin, tw.modelOrigin);
+	tw.context = ctx;
 
 	if (!cm.numNodes) {
 		*results = tw.trace;
@@ -1165,6 +1466,8 @@ static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, co
 		return;	// map not loaded, shouldn't happen
 	}
 
+	CM_BeginTrace( ctx );	// for multi-check avoidance
+
 	// allow NULL to be passed in for 0,0,0
 	if ( !mins ) {
 		mins = vec3_origin;
@@ -1173,6 +1476,12 @@ static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, co
 		maxs = vec3_origin;
 	}
 
+#ifndef BSPC
+	if ( cm_traceLog != FS_INVALID_HANDLE && ctx == &cm.trace ) {
+		CM_RecordTrace( start, end, mins, maxs, model, origin, brushmask, capsule, sphere );
+	}
+#endif
+
 	// set basic parms
 	tw.contents = brushmask;
 
@@ -1352,6 +1661,13 @@ static void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, co
                tw.trace.fraction == 1.0 ||
                VectorLengthSquared(tw.trace.plane.normal) > 0.9999);
 	*results = tw.trace;
+
+	// for statistics, may be zeroed
+	if ( ctx == &cm.trace ) {
+		c_traces++;
+		c_brush_traces += tw.brushTraces;
+		c_patch_traces += tw.patchTraces;
+	}
 }
 
 
@@ -1363,19 +1679,33 @@ CM_BoxTrace
 void CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
 						const vec3_t mins, const vec3_t maxs,
 						clipHandle_t model, int brushmask, qboolean capsule ) {
-	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, capsule, NULL );
+	CM_Trace( &cm.trace, results, start, end, mins, maxs, model, vec3_origin, brushmask, capsule, NULL );
 }
 
 
 /*
 ==================
-CM_TransformedBoxTrace
+CM_ContextBoxTrace
+
+Same as CM_BoxTrace but keeps visited state in the caller's context
+==================
+*/
+void CM_ContextBoxTrace( traceContext_t *ctx, trace_t *results, const vec3_t start, const vec3_t end,
+						const vec3_t mins, const vec3_t maxs,
+						clipHandle_t model, int brushmask, qboolean capsule ) {
+	CM_Trace( ctx, results, start, end, mins, maxs, model, vec3_origin, brushmask, capsule, NULL );
+}
+
+
+/*
+==================
+CM_ContextTransformedBoxTrace
 
 Handles offsetting and rotation of the end points for moving and
 rotating entities
 ==================
 */
-void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
+void CM_ContextTransformedBoxTrace( traceContext_t *ctx, trace_t *results, const vec3_t start, const vec3_t end,
 						const vec3_t mins, const vec3_t maxs,
 						clipHandle_t model, int brushmask,
 						const vec3_t origin, const vec3_t angles, qboolean capsule ) {
@@ -1449,7 +1779,7 @@ void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 	}
 
 	// sweep the box through the model
-	CM_Trace( &trace, start_l, end_l, symetricSize[0], symetricSize[1], model, origin, brushmask, capsule, &sphere );
+	CM_Trace( ctx, &trace, start_l, end_l, symetricSize[0], symetricSize[1], model, origin, brushmask, capsule, &sphere );
 
 	// if the bmodel was rotated and there was a collision
 	if ( rotated && trace.fraction != 1.0 ) {
@@ -1466,3 +1796,513 @@ void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 
 	*results = trace;
 }
+
+
+/*
+==================
+CM_TransformedBoxTrace
+==================
+*/
+void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
+						const vec3_t mins, const vec3_t maxs,
+						clipHandle_t model, int brushmask,
+						const vec3_t origin, const vec3_t angles, qboolean capsule ) {
+	CM_ContextTransformedBoxTrace( &cm.trace, results, start, end, mins, maxs, model, brushmask, origin, angles, capsule );
+}
+
+
+#ifndef BSPC
+/*
+===============================================================================
+
+TRACE STRESS TEST
+
+===============================================================================
+*/
+
+#define STRESS_BATCH	16384
+#define STRESS_JOBS		32
+
+typedef struct {
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		origin, angles;
+	clipHandle_t model;
+	int			brushmask;
+	qboolean	capsule;
+} stressTrace_t;
+
+typedef struct {
+	const stressTrace_t	*traces;
+	trace_t				*results;
+	int					count;
+	traceContext_t		*contexts[ STRESS_JOBS ];
+} stressBatch_t;
+
+
+/*
+==================
+CM_StressRand
+
+xorshift32, seed must be non-zero
+==================
+*/
+static unsigned int CM_StressRand( unsigned int *seed ) {
+	unsigned int x = *seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*seed = x;
+
+	return x;
+}
+
+
+/*
+==================
+CM_StressRandom
+
+Returns random number in [0..1) range
+==================
+*/
+static float CM_StressRandom( unsigned int *seed ) {
+	return ( CM_StressRand( seed ) >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+
+/*
+==================
+CM_StressRandomTrace
+==================
+*/
+static void CM_StressRandomTrace( stressTrace_t *st, unsigned int *seed ) {
+	const cmodel_t *world = &cm.cmodels[0];
+	float len;
+	int i, r;
+
+	Com_Memset( st, 0, sizeof( *st ) );
+
+	for ( i = 0 ; i < 3 ; i++ ) {
+		st->start[i] = world->mins[i] - 64 + CM_StressRandom( seed ) * ( world->maxs[i] - world->mins[i] + 128 );
+	}
+
+	r = CM_StressRand( seed ) & 7;
+	if ( r == 0 ) {
+		// position test
+		VectorCopy( st->start, st->end );
+	} else {
+		// mostly short traces which are common in game, some long ones
+		len = ( r < 6 ) ? 256 : 8192;
+		for ( i = 0 ; i < 3 ; i++ ) {
+			st->end[i] = st->start[i] + ( 2.0f * CM_StressRandom( seed ) - 1.0f ) * len;
+		}
+	}
+
+	r = CM_StressRand( seed ) % 3;
+	if ( r == 1 ) {
+		VectorSet( st->mins, -15, -15, -24 );
+		VectorSet( st->maxs, 15, 15, 32 );
+	} else if ( r == 2 ) {
+		for ( i = 0 ; i < 3 ; i++ ) {
+			st->mins[i] = -CM_StressRandom( seed ) * 32;
+			st->maxs[i] = CM_StressRandom( seed ) * 32;
+		}
+	}
+
+	st->brushmask = ( CM_StressRand( seed ) & 1 ) ? CONTENTS_SOLID : -1;
+	st->capsule = ( CM_StressRand( seed ) & 3 ) == 0;
+
+	// inline models, rotated half of the time
+	if ( cm.numSubModels > 1 && ( CM_StressRand( seed ) & 3 ) == 0 ) {
+		st->model = 1 + CM_StressRand( seed ) % ( cm.numSubModels - 1 );
+		for ( i = 0 ; i < 3 ; i++ ) {
+			st->origin[i] = ( 2.0f * CM_StressRandom( seed ) - 1.0f ) * 64;
+			if ( CM_StressRand( seed ) & 1 ) {
+				st->angles[i] = CM_StressRandom( seed ) * 360;
+			}
+		}
+	}
+}
+
+
+/*
+==================
+CM_StressTrace
+==================
+*/
+static void CM_StressTrace( traceContext_t *ctx, const stressTrace_t *st, trace_t *results ) {
+	if ( st->model ) {
+		CM_ContextTransformedBoxTrace( ctx, results, st->start, st->end, st->mins, st->maxs,
+			st->model, st->brushmask, st->origin, st->angles, st->capsule );
+	} else {
+		CM_ContextBoxTrace( ctx, results, st->start, st->end, st->mins, st->maxs,
+			st->model, st->brushmask, st->capsule );
+	}
+}
+
+
+/*
+==================
+CM_StressJob
+==================
+*/
+static void CM_StressJob( void *data, int index ) {
+	stressBatch_t *batch = (stressBatch_t *)data;
+	int i, first, last;
+
+	first = index * batch->count / STRESS_JOBS;
+	last = ( index + 1 ) * batch->count / STRESS_JOBS;
+
+	for ( i = first; i < last; i++ ) {
+		CM_StressTrace( batch->contexts[ index ], &batch->traces[ i ], &batch->results[ i ] );
+	}
+}
+
+
+/*
+==================
+CM_TracesEqual
+
+Bit-exact comparison of everything filled by CM_Trace
+==================
+*/
+static qboolean CM_TracesEqual( const trace_t *a, const trace_t *b ) {
+	if ( a->allsolid != b->allsolid || a->startsolid != b->startsolid )
+		return qfalse;
+	if ( memcmp( &a->fraction, &b->fraction, sizeof( a->fraction ) ) )
+		return qfalse;
+	if ( memcmp( a->endpos, b->endpos, sizeof( a->endpos ) ) )
+		return qfalse;
+	if ( memcmp( a->plane.normal, b->plane.normal, sizeof( a->plane.normal ) ) || memcmp( &a->plane.dist, &b->plane.dist, sizeof( a->plane.dist ) ) )
+		return qfalse;
+	if ( a->surfaceFlags != b->surfaceFlags || a->contents != b->contents || a->entityNum != b->entityNum )
+		return qfalse;
+	return qtrue;
+}
+
+
+/*
+==================
+CM_TraceStress_f
+
+Runs random traces through the loaded map serially and then from several
+threads with separate trace contexts and reports any differences
+==================
+*/
+void CM_TraceStress_f( void ) {
+	stressBatch_t batch;
+	stressTrace_t *traces;
+	trace_t *serial, *parallel;
+	int64_t start, serialTime, parallelTime;
+	int count, numThreads, done, n, i;
+	int mismatches;
+	unsigned int seed;
+
+	if ( !cm.numNodes ) {
+		Com_Printf( "No map loaded.\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() > 3 ) {
+		Com_Printf( "Usage: %s [count] [threads]\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	count = ( Cmd_Argc() > 1 ) ? atoi( Cmd_Argv( 1 ) ) : 1000000;
+	numThreads = ( Cmd_Argc() > 2 ) ? atoi( Cmd_Argv( 2 ) ) : 4;
+	if ( count <= 0 ) {
+		count = 1000000;
+	}
+	if ( numThreads < 2 ) {
+		numThreads = 2;
+	} else if ( numThreads > MAX_WORKER_THREADS + 1 ) {
+		numThreads = MAX_WORKER_THREADS + 1;
+	}
+
+	traces = Z_Malloc( STRESS_BATCH * sizeof( *traces ) );
+	serial = Z_Malloc( STRESS_BATCH * sizeof( *serial ) );
+	parallel = Z_Malloc( STRESS_BATCH * sizeof( *parallel ) );
+
+	Com_Memset( &batch, 0, sizeof( batch ) );
+	for ( i = 0; i < STRESS_JOBS; i++ ) {
+		batch.contexts[ i ] = CM_AllocTraceContext();
+	}
+	batch.traces = traces;
+	batch.results = parallel;
+
+	seed = Sys_Milliseconds() | 1;
+
+	serialTime = parallelTime = 0;
+	mismatches = 0;
+
+	for ( done = 0; done < count; done += n ) {
+		n = MIN( count - done, STRESS_BATCH );
+
+		for ( i = 0; i < n; i++ ) {
+			CM_StressRandomTrace( &traces[ i ], &seed );
+		}
+
+		start = Sys_Microseconds();
+		for ( i = 0; i < n; i++ ) {
+			CM_StressTrace( &cm.trace, &traces[ i ], &serial[ i ] );
+		}
+		serialTime += Sys_Microseconds() - start;
+
+		Com_Memset( parallel, 0, n * sizeof( *parallel ) );
+		batch.count = n;
+
+		start = Sys_Microseconds();
+		Sys_RunJobs( CM_StressJob, &batch, STRESS_JOBS, numThreads );
+		parallelTime += Sys_Microseconds() - start;
+
+		for ( i = 0; i < n; i++ ) {
+			if ( CM_TracesEqual( &serial[ i ], &parallel[ i ] ) ) {
+				continue;
+			}
+			if ( mismatches < 8 ) {
+				const stressTrace_t *st = &traces[ i ];
+				Com_Printf( S_COLOR_YELLOW "mismatch: model %i (%.3f %.3f %.3f)->(%.3f %.3f %.3f) fraction %f != %f\n",
+					st->model, st->start[0], st->start[1], st->start[2], st->end[0], st->end[1], st->end[2],
+					serial[ i ].fraction, parallel[ i ].fraction );
+			}
+			mismatches++;
+		}
+	}
+
+	for ( i = 0; i < STRESS_JOBS; i++ ) {
+		CM_FreeTraceContext( batch.contexts[ i ] );
+	}
+	Z_Free( parallel );
+	Z_Free( serial );
+	Z_Free( traces );
+
+	Com_Printf( "%i traces: serial %i msec, %i threads %i msec, %i mismatches\n", count,
+		(int)( serialTime / 1000 ), numThreads, (int)( parallelTime / 1000 ), mismatches );
+}
+
+
+/*
+==================
+CM_Stats_f
+
+Prints leaf hierarchy statistics and compares trace
+timings with and without hierarchies on the loaded map
+==================
+*/
+void CM_Stats_f( void ) {
+	stressTrace_t *traces;
+	trace_t *linear, *bvh;
+	int64_t start, linearTime, bvhTime;
+	int count, done, n, i, mismatches;
+	int maxItems, leafItems;
+	unsigned int seed;
+
+	if ( !cm.numNodes ) {
+		Com_Printf( "No map loaded.\n" );
+		return;
+	}
+
+	maxItems = leafItems = 0;
+	for ( i = 0; i < cm.numLeafs; i++ ) {
+		maxItems = MAX( maxItems, cm.leafs[i].numLeafBrushes + cm.leafs[i].numLeafSurfaces );
+		if ( cm.leafs[i].numBvhNodes ) {
+			leafItems += cm.leafs[i].numLeafBrushes + cm.leafs[i].numLeafSurfaces;
+		}
+	}
+
+	Com_Printf( "map: %s\n", cm.name[0] ? cm.name : "(client)" );
+	Com_Printf( "%i leafs, %i brushes, %i surfaces, max %i brushes and surfaces in a leaf\n",
+		cm.numLeafs, cm.numBrushes, cm.numSurfaces, maxItems );
+	Com_Printf( "hierarchies: %i leafs and models (%i items), %i nodes, %i KB, built in %i.%03i msec\n",
+		cm.numBvhLeafs, cm.numBvhItems, cm.numBvhNodes,
+		(int)( ( cm.numBvhNodes * sizeof( cBvhNode_t ) + cm.numBvhItems * sizeof( int ) + 1023 ) / 1024 ),
+		cm.bvhBuildTime / 1000, cm.bvhBuildTime % 1000 );
+
+	if ( !cm.numBvhLeafs ) {
+		return;
+	}
+
+	count = ( Cmd_Argc() > 1 ) ? atoi( Cmd_Argv( 1 ) ) : 100000;
+	if ( count <= 0 ) {
+		count = 100000;
+	}
+
+	traces = Z_Malloc( STRESS_BATCH * sizeof( *traces ) );
+	linear = Z_Malloc( STRESS_BATCH * sizeof( *linear ) );
+	bvh = Z_Malloc( STRESS_BATCH * sizeof( *bvh ) );
+
+	seed = 0x5eed;
+	linearTime = bvhTime = 0;
+	mismatches = 0;
+
+	for ( done = 0; done < count; done += n ) {
+		n = MIN( count - done, STRESS_BATCH );
+
+		for ( i = 0; i < n; i++ ) {
+			CM_StressRandomTrace( &traces[ i ], &seed );
+		}
+
+		cm_useBvh = qfalse;
+		start = Sys_Microseconds();
+		for ( i = 0; i < n; i++ ) {
+			CM_StressTrace( &cm.trace, &traces[ i ], &linear[ i ] );
+		}
+		linearTime += Sys_Microseconds() - start;
+
+		cm_useBvh = qtrue;
+		start = Sys_Microseconds();
+		for ( i = 0; i < n; i++ ) {
+			CM_StressTrace( &cm.trace, &traces[ i ], &bvh[ i ] );
+		}
+		bvhTime += Sys_Microseconds() - start;
+
+		for ( i = 0; i < n; i++ ) {
+			if ( !CM_TracesEqual( &linear[ i ], &bvh[ i ] ) ) {
+				mismatches++;
+			}
+		}
+	}
+
+	Z_Free( bvh );
+	Z_Free( linear );
+	Z_Free( traces );
+
+	Com_Printf( "%i random traces: linear %i msec, hierarchy %i msec, speedup %.2fx, %i mismatches\n", count,
+		(int)( linearTime / 1000 ), (int)( bvhTime / 1000 ),
+		bvhTime ? (double)linearTime / bvhTime : 1.0, mismatches );
+}
+
+
+/*
+==================
+CM_TraceRecord_f
+==================
+*/
+void CM_TraceRecord_f( void ) {
+
+	if ( cm_traceLog != FS_INVALID_HANDLE ) {
+		FS_FCloseFile( cm_traceLog );
+		cm_traceLog = FS_INVALID_HANDLE;
+		Com_Printf( "Stopped trace recording, %i traces written.\n", cm_traceLogCount );
+		return;
+	}
+
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "Usage: %s <filename>\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	cm_traceLog = FS_FOpenFileWrite( Cmd_Argv( 1 ) );
+	if ( cm_traceLog == FS_INVALID_HANDLE ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't open %s\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	cm_traceLogCount = 0;
+	Com_Printf( "Recording traces to %s, run %s again to stop.\n", Cmd_Argv( 1 ), Cmd_Argv( 0 ) );
+}
+
+
+/*
+==================
+CM_ReplayTraces
+==================
+*/
+static int64_t CM_ReplayTraces( const traceRecord_t *records, int count, trace_t *results ) {
+	const traceRecord_t *rec;
+	int64_t start;
+	int i;
+
+	start = Sys_Microseconds();
+
+	for ( i = 0, rec = records; i < count; i++, rec++ ) {
+		if ( rec->model == BOX_MODEL_HANDLE || rec->model == CAPSULE_MODEL_HANDLE ) {
+			CM_TempBoxModel( rec->boxMins, rec->boxMaxs, rec->model == CAPSULE_MODEL_HANDLE );
+		}
+		CM_Trace( &cm.trace, &results[ i ], rec->start, rec->end, rec->mins, rec->maxs, rec->model,
+			rec->origin, rec->brushmask, rec->capsule, rec->hasSphere ? &rec->sphere : NULL );
+	}
+
+	return Sys_Microseconds() - start;
+}
+
+
+/*
+==================
+CM_TraceCompare_f
+
+Replays recorded traces with scalar and SIMD brush side tests
+and reports any differences between them
+==================
+*/
+void CM_TraceCompare_f( void ) {
+	traceRecord_t *records;
+	trace_t *scalar, *simd;
+	int64_t scalarTime, simdTime;
+	int count, mismatches, n, k;
+	fileHandle_t f;
+
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "Usage: %s <filename>\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	if ( !cm.numNodes ) {
+		Com_Printf( "No map loaded.\n" );
+		return;
+	}
+
+	if ( cm_traceLog != FS_INVALID_HANDLE ) {
+		Com_Printf( "Stop trace recording first.\n" );
+		return;
+	}
+
+	if ( FS_FOpenFileRead( Cmd_Argv( 1 ), &f, qtrue ) < 0 || f == FS_INVALID_HANDLE ) {
+		Com_Printf( "Couldn't read %s\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	records = Z_Malloc( STRESS_BATCH * sizeof( *records ) );
+	scalar = Z_Malloc( STRESS_BATCH * sizeof( *scalar ) );
+	simd = Z_Malloc( STRESS_BATCH * sizeof( *simd ) );
+
+	scalarTime = simdTime = 0;
+	mismatches = 0;
+	count = 0;
+
+	while ( ( n = FS_Read( records, STRESS_BATCH * sizeof( *records ), f ) / sizeof( *records ) ) > 0 ) {
+
+		cm_simdSides = qfalse;
+		scalarTime += CM_ReplayTraces( records, n, scalar );
+
+		cm_simdSides = qtrue;
+		simdTime += CM_ReplayTraces( records, n, simd );
+
+		for ( k = 0; k < n; k++ ) {
+			if ( !CM_TracesEqual( &scalar[ k ], &simd[ k ] ) ) {
+				if ( mismatches < 8 ) {
+					Com_Printf( S_COLOR_YELLOW "mismatch at %i: fraction %f != %f\n", count + k,
+						scalar[ k ].fraction, simd[ k ].fraction );
+				}
+				mismatches++;
+			}
+		}
+
+		count += n;
+	}
+
+	FS_FCloseFile( f );
+	Z_Free( simd );
+	Z_Free( scalar );
+	Z_Free( records );
+
+#ifdef USE_SIMD_SIDES
+	Com_Printf( "%i traces: scalar %i msec, simd %i msec, %i mismatches\n", count,
+		(int)( scalarTime / 1000 ), (int)( simdTime / 1000 ), mismatches );
+#else
+	Com_Printf( "%i traces: %i msec, no SIMD brush side tests in this build\n", count,
+		(int)( scalarTime / 1000 ) );
+#endif
+}
+#endif // !BSPC
@@ -65,6 +65,7 @@ int32_t	x87_cw_cvfi = 0;
 #endif
 
 static fileHandle_t logfile = FS_INVALID_HANDLE;
+static int com_instanceIndex; // forked dedicated server instance, 0 in initial process
 static fileHandle_t com_journalFile = FS_INVALID_HANDLE ; // events are written here
 fileHandle_t com_journalDataFile = FS_INVALID_HANDLE; // config files are written here
 
@@ -87,6 +88,7 @@ cvar_t	*com_timedemo;
 cvar_t	*com_affinityMask;
 #endif
 static cvar_t *com_logfile;		// 1 = buffer log, 2 = flush after each print
+static cvar_t *com_instances;
 static cvar_t *com_showtrace;
 cvar_t	*com_version;
 static cvar_t *com_buildScript;	// for automated data building scripts
@@ -215,7 +217,7 @@ void FORMAT_PRINTF(1, 2) QDECL Com_Printf( const char *fmt, ... ) {
 		// TTimo: only open the qconsole.log if the filesystem is in an initialized state
 		//   also, avoid recursing in the qconsole.log opening (i.e. if fs_debug is on)
 		if ( logfile == FS_INVALID_HANDLE && FS_Initialized() && !opening_qconsole ) {
-			const char *logName = "qconsole.log";
+			const char *logName = com_instanceIndex ? va( "qconsole%i.log", com_instanceIndex ) : "qconsole.log";
 			int mode;
 
 			opening_qconsole = qtrue;
@@ -3776,6 +3778,78 @@ void Q_fpucw( unsigned short *cw )
 #endif // USE_X87
 
 
+/*
+=================
+Com_StartInstances
+
+Executes startup commands so the first map is loaded, then forks dedicated
+server into com_instances processes before opening network sockets.
+Memory pages loaded so far stay shared between processes until modified,
+so sharing covers only the initial map: pages are copied once an instance
+loads another one. Instance N listens on net_port + N, writes qconsoleN.log
+and executes instanceN.cfg if it exists.
+=================
+*/
+static void Com_StartInstances( void ) {
+	int i, port, port6, httpPort, seed;
+
+	Cbuf_Execute();
+
+	port = Cvar_VariableIntegerValue( "net_port" );
+	if ( port == 0 )
+		port = PORT_SERVER;
+	port6 = Cvar_VariableIntegerValue( "net_port6" );
+	if ( port6 == 0 )
+		port6 = PORT_SERVER;
+	httpPort = Cvar_VariableIntegerValue( "sv_httpPort" );
+
+	// cached pk3 handles would share file offsets with children
+	FS_ClosePakHandles();
+
+	for ( i = 1; i < com_instances->integer; i++ ) {
+		const int pid = Sys_ForkInstance();
+		if ( pid < 0 ) {
+			break;
+		}
+		if ( pid == 0 ) {
+			com_instanceIndex = i;
+
+			// reopened as qconsoleN.log on next print
+			if ( logfile != FS_INVALID_HANDLE ) {
+				FS_FCloseFile( logfile );
+				logfile = FS_INVALID_HANDLE;
+			}
+			FS_ReopenHandles();
+
+			// don't share challenge secret and random state with other instances
+			Com_MD5Init();
+			Com_RandomBytes( (byte*)&seed, sizeof( seed ) );
+			srand( seed );
+			Com_RandomBytes( (byte*)&seed, sizeof( seed ) );
+			Cvar_SetIntegerValue( "net_qport", seed & 0xffff );
+
+			Cvar_SetIntegerValue( "net_port", port + i );
+			Cvar_SetIntegerValue( "net_port6", port6 + i );
+			if ( httpPort > 0 ) {
+				Cvar_SetIntegerValue( "sv_httpPort", httpPort + i );
+			}
+			break;
+		}
+		Com_Printf( "Started instance %i (pid %i) on port %i\n", i, pid, port + i );
+	}
+
+	if ( com_instanceIndex == 0 ) {
+		Sys_ReapInstances();
+	}
+
+	Cvar_Get( "com_instance", va( "%i", com_instanceIndex ), CVAR_ROM );
+
+	if ( FS_FOpenFileRead( va( "instance%i.cfg", com_instanceIndex ), NULL, qtrue ) > 0 ) {
+		Cbuf_AddText( va( "exec instance%i.cfg\n", com_instanceIndex ) );
+	}
+}
+
+
 /*
 =================
 Com_Init
@@ -3813,6 +3887,7 @@ void Com_Init( char *commandLine ) {
 	Com_ParseCommandLine( commandLine );
 
 //	Swap_Init ();
+	HuffmanInitLookup();
 	Cbuf_Init();
 
 	// override anything from the config files with command line args
@@ -3972,6 +4047,11 @@ void Com_Init( char *commandLine ) {
 		gw_minimized = qfalse;
 	}
 
+	com_instances = Cvar_Get( "com_instances", "1", CVAR_INIT | CVAR_PROTECTED );
+	Cvar_CheckRange( com_instances, "1", "64", CV_INTEGER );
+	Cvar_SetDescription( com_instances, "Number of dedicated server instances started from a single initialization, each one listens on the next net_port "
+		"and shares file system index, clip map and compiled game VM of the initial map with the others, memory is copied once an instance loads another map." );
+
 	if ( com_developer->integer ) {
 		Cmd_AddCommand( "error", Com_Error_f );
 		Cmd_AddCommand( "crash", Com_Crash_f );
@@ -3980,6 +4060,11 @@ void Com_Init( char *commandLine ) {
 
 	Cmd_AddCommand( "quit", Com_Quit_f );
 	Cmd_AddCommand( "changeVectors", MSG_ReportChangeVectors_f );
+	Cmd_AddCommand( "swarm", NET_Swarm_f );
+	Cmd_AddCommand( "cm_traceStress", CM_TraceStress_f );
+	Cmd_AddCommand( "cm_traceRecord", CM_TraceRecord_f );
+	Cmd_AddCommand( "cm_traceCompare", CM_TraceCompare_f );
+	Cmd_AddCommand( "cm_stats", CM_Stats_f );
 	Cmd_AddCommand( "writeconfig", Com_WriteConfig_f );
 	Cmd_SetCommandCompletionFunc( "writeconfig", Cmd_CompleteWriteCfgName );
 	Cmd_AddCommand( "game_restart", Com_GameRestart_f );
@@ -4077,6 +4162,10 @@ void Com_Init( char *commandLine ) {
 
 	Com_Printf( "--- Common Initialization Complete ---\n" );
 
+	if ( com_dedicated->integer && com_instances->integer > 1 ) {
+		Com_StartInstances();
+	}
+
 	NET_Init();
 
 	Com_Printf( "Working directory: %s\n", Sys_Pwd() );
@@ -4266,6 +4355,7 @@ void Com_Frame( qboolean noDelay ) {
 	int	sleepMsec;
 	int	timeVal;
 	int	timeValSV;
+	int	timeValQueue;
 
 	int	timeBeforeFirstEvents;
 	int	timeBeforeServer;
@@ -4358,6 +4448,10 @@ void Com_Frame( qboolean noDelay ) {
 		} else {
 			timeVal = Com_TimeVal( minMsec );
 		}
+		// wake up for delayed packets
+		timeValQueue = NET_RunPacketQueues();
+		if ( timeValQueue >= 0 && timeValQueue < timeVal )
+			timeVal = timeValQueue;
 		sleepMsec = timeVal;
 #ifndef DEDICATED
 		if ( !gw_minimized && timeVal > com_yieldCPU->integer )
@@ -4453,7 +4547,7 @@ void Com_Frame( qboolean noDelay ) {
 	}
 #endif
 
-	NET_FlushPacketQueue( 0 );
+	NET_RunPacketQueues();
 
 	Cbuf_Wait();
 
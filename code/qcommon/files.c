@@ -1009,6 +1009,90 @@ int FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp ) {
 }
 
 
+/*
+===========
+FS_SV_MapFile
+
+Maps file from the same locations as FS_SV_FOpenFileRead() into memory for reading
+===========
+*/
+const void *FS_SV_MapFile( const char *filename, int *size ) {
+	const void *data;
+	char *ospath;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	// search homepath
+	ospath = FS_BuildOSPath( fs_homepath->string, filename, NULL );
+	data = Sys_MapFile( ospath, size );
+
+	if ( !data && Q_stricmp( fs_homepath->string, fs_basepath->string ) != 0 ) {
+		// search basepath
+		ospath = FS_BuildOSPath( fs_basepath->string, filename, NULL );
+		data = Sys_MapFile( ospath, size );
+	}
+
+	if ( !data && fs_steampath->string[0] ) {
+		// search steampath
+		ospath = FS_BuildOSPath( fs_steampath->string, filename, NULL );
+		data = Sys_MapFile( ospath, size );
+	}
+
+	if ( data && fs_debug->integer ) {
+		Com_Printf( "FS_SV_MapFile: %s\n", ospath );
+	}
+
+	return data;
+}
+
+
+/*
+===========
+FS_SV_OpenSysFile
+
+Opens file from the same locations as FS_SV_FOpenFileRead() without allocating
+file handle, for long-living transfers which need OS file descriptor
+===========
+*/
+FILE *FS_SV_OpenSysFile( const char *filename, int *length ) {
+	FILE *f;
+	char *ospath;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	*length = 0;
+
+	// search homepath
+	ospath = FS_BuildOSPath( fs_homepath->string, filename, NULL );
+	f = Sys_FOpen( ospath, "rb" );
+
+	if ( !f && Q_stricmp( fs_homepath->string, fs_basepath->string ) != 0 ) {
+		// search basepath
+		ospath = FS_BuildOSPath( fs_basepath->string, filename, NULL );
+		f = Sys_FOpen( ospath, "rb" );
+	}
+
+	if ( !f && fs_steampath->string[0] ) {
+		// search steampath
+		ospath = FS_BuildOSPath( fs_steampath->string, filename, NULL );
+		f = Sys_FOpen( ospath, "rb" );
+	}
+
+	if ( f ) {
+		if ( fs_debug->integer ) {
+			Com_Printf( "FS_SV_OpenSysFile: %s\n", ospath );
+		}
+		*length = FS_FileLength( f );
+	}
+
+	return f;
+}
+
+
 /*
 ===========
 FS_SV_Rename
@@ -1046,6 +1130,43 @@ void FS_SV_Rename( const char *from, const char *to ) {
 }
 
 
+/*
+===========
+FS_SV_Replace
+
+Atomically replaces file in home directory with another one,
+source file is removed if it can't be done
+===========
+*/
+qboolean FS_SV_Replace( const char *from, const char *to ) {
+	const char *from_ospath, *to_ospath;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	if ( FS_CheckDirTraversal( from ) || FS_CheckDirTraversal( to ) ) {
+		Com_Printf( S_COLOR_ERROR "%s: rename %s -> %s failed\n", __func__, from, to );
+		return qfalse;
+	}
+
+	from_ospath = FS_BuildOSPath( fs_homepath->string, from, NULL );
+	to_ospath = FS_BuildOSPath( fs_homepath->string, to, NULL );
+
+	if ( fs_debug->integer ) {
+		Com_Printf( "FS_SV_Replace: %s --> %s\n", from_ospath, to_ospath );
+	}
+
+	if ( !Sys_ReplaceFile( from_ospath, to_ospath ) ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't replace %s\n", to );
+		FS_Remove( from_ospath );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+
 /*
 ===========
 FS_Rename
@@ -3190,6 +3311,72 @@ static pack_t *FS_LoadZipFile( const char *zipfile )
 }
 
 
+/*
+=================
+FS_ClosePakHandles
+
+Closes cached pk3 handles which are not in use so they are reopened on demand,
+called before forking so processes don't share file offsets
+=================
+*/
+void FS_ClosePakHandles( void )
+{
+	searchpath_t *sp;
+	pack_t *pak;
+
+	for ( sp = fs_searchpaths; sp; sp = sp->next ) {
+		pak = sp->pack;
+		if ( pak && pak->handle && pak->handleUsed == 0 ) {
+			if ( pak->next_h )
+				FS_RemoveFromHandleList( pak );
+			unzClose( pak->handle );
+			pak->handle = NULL;
+		}
+	}
+}
+
+
+/*
+=================
+FS_ReopenHandles
+
+Gives forked process its own file offsets for all handles still open
+=================
+*/
+void FS_ReopenHandles( void )
+{
+	const searchpath_t *sp;
+	const fileHandleData_t *fd;
+	FILE *f;
+	int i;
+
+	for ( sp = fs_searchpaths; sp; sp = sp->next ) {
+		if ( sp->pack && sp->pack->handle ) {
+			f = unzGetStream( sp->pack->handle );
+			if ( f && !Sys_ReopenFile( f ) ) {
+				Com_Printf( S_COLOR_YELLOW "WARNING: couldn't reopen %s\n", sp->pack->pakFilename );
+			}
+		}
+	}
+
+	for ( i = 1; i < MAX_FILE_HANDLES; i++ ) {
+		fd = &fsh[i];
+		if ( fd->handleFiles.file.v == NULL ) {
+			continue;
+		}
+		if ( fd->zipFile ) {
+			// shared pak streams are already reopened above
+			f = fd->handleFiles.unique ? unzGetStream( fd->handleFiles.file.z ) : NULL;
+		} else {
+			f = fd->handleFiles.file.o;
+		}
+		if ( f && !Sys_ReopenFile( f ) ) {
+			Com_Printf( S_COLOR_YELLOW "WARNING: couldn't reopen %s\n", fd->name );
+		}
+	}
+}
+
+
 /*
 =================
 FS_FreePak
@@ -209,3 +209,171 @@ int HuffmanGetSymbol( unsigned int* symbol, const byte* buffer, int bitIndex )
 
 	return (int)(entry >> 8);
 }
+
+
+/*
+=============================================================================
+
+word-level encoder and decoder
+
+Same static codes as above but a whole MSG_WriteBits()/MSG_ReadBits() value
+is handled at once: codes are collected in 64-bit accumulator and stored
+with a single read-modify-write, decoder loads 64-bit window and resolves
+up to two symbols per lookup. Maximum code length is 11 bits so 32-bit
+value takes at most 7 + 4 * 11 = 51 bits, plus 7 bits of byte offset.
+
+=============================================================================
+*/
+
+#define HUFF_LOOKUP_BITS	12
+
+// [ 0..7 ] first symbol, [ 8..11 ] its length,
+// [ 12..19 ] second symbol, [ 20..24 ] length of both symbols or zero
+static uint32_t HuffmanLookupTable[ 1 << HUFF_LOOKUP_BITS ];
+
+
+/*
+=================
+HuffmanInitLookup
+=================
+*/
+void HuffmanInitLookup( void )
+{
+	uint32_t i, entry, first, second, len;
+
+	for ( i = 0; i < ARRAY_LEN( HuffmanLookupTable ); i++ )
+	{
+		first = HuffmanDecoderTable[ i & 0x7FF ];
+		len = first >> 8;
+		entry = ( first & 0xFF ) | ( len << 8 );
+
+		second = HuffmanDecoderTable[ ( i >> len ) & 0x7FF ];
+		if ( len + ( second >> 8 ) <= HUFF_LOOKUP_BITS )
+		{
+			entry |= ( second & 0xFF ) << 12;
+			entry |= ( len + ( second >> 8 ) ) << 20;
+		}
+
+		HuffmanLookupTable[ i ] = entry;
+	}
+}
+
+
+/*
+=================
+HuffmanWriteBits
+
+Writes (bits & 7) raw bits of value followed by (bits >> 3) huffman-coded bytes,
+lower bits of the current byte are preserved, returns number of bits written
+=================
+*/
+int HuffmanWriteBits( byte *fout, int bitIndex, int bufSize, uint32_t value, int bits )
+{
+	const int rawBits = bits & 7;
+	const int offset = bitIndex & 7;
+	const int byteIndex = bitIndex >> 3;
+	uint64_t acc, mask, old;
+	uint16_t code;
+	int n, i, count;
+
+	acc = value & ( ( 1U << rawBits ) - 1 );
+	value >>= rawBits;
+	n = rawBits;
+
+	for ( i = rawBits; i < bits; i += 8 )
+	{
+		code = HuffmanEncoderTable[ value & 0xFF ];
+		acc |= (uint64_t)( ( code >> 4 ) & 0x7FF ) << n;
+		n += code & 15;
+		value >>= 8;
+	}
+
+	acc = ( acc << offset ) | ( fout[ byteIndex ] & ( ( 1 << offset ) - 1 ) );
+	count = ( offset + n + 7 ) >> 3;
+
+#ifdef Q3_LITTLE_ENDIAN
+	if ( byteIndex + 8 <= bufSize )
+	{
+		mask = ( count == 8 ) ? ~(uint64_t)0 : ( ( (uint64_t)1 << ( count * 8 ) ) - 1 );
+		memcpy( &old, fout + byteIndex, sizeof( old ) );
+		old = ( old & ~mask ) | acc;
+		memcpy( fout + byteIndex, &old, sizeof( old ) );
+		return n;
+	}
+#endif
+
+	for ( i = 0; i < count; i++ )
+	{
+		fout[ byteIndex + i ] = (byte)( acc >> ( i * 8 ) );
+	}
+
+	return n;
+}
+
+
+/*
+=================
+HuffmanReadBits
+
+Reverse of HuffmanWriteBits(), returns number of bits consumed
+=================
+*/
+int HuffmanReadBits( uint32_t *value, const byte *buffer, int bitIndex, int bufSize, int bits )
+{
+	const int rawBits = bits & 7;
+	const int byteIndex = bitIndex >> 3;
+	uint64_t window;
+	uint32_t result, entry;
+	int n, shift, symbols, i, count;
+
+#ifdef Q3_LITTLE_ENDIAN
+	if ( byteIndex + 8 <= bufSize )
+	{
+		memcpy( &window, buffer + byteIndex, sizeof( window ) );
+	}
+	else
+#endif
+	{
+		count = bufSize - byteIndex;
+		if ( count > 8 )
+			count = 8;
+		window = 0;
+		for ( i = 0; i < count; i++ )
+		{
+			window |= (uint64_t)buffer[ byteIndex + i ] << ( i * 8 );
+		}
+	}
+
+	window >>= bitIndex & 7;
+
+	result = (uint32_t)window & ( ( 1U << rawBits ) - 1 );
+	window >>= rawBits;
+	n = rawBits;
+	shift = rawBits;
+
+	for ( symbols = bits >> 3; symbols > 0; )
+	{
+		entry = HuffmanLookupTable[ window & ( ( 1 << HUFF_LOOKUP_BITS ) - 1 ) ];
+		if ( symbols >= 2 && ( entry >> 20 ) )
+		{
+			result |= ( entry & 0xFF ) << shift;
+			result |= ( ( entry >> 12 ) & 0xFF ) << ( shift + 8 );
+			window >>= entry >> 20;
+			n += entry >> 20;
+			shift += 16;
+			symbols -= 2;
+		}
+		else
+		{
+			result |= ( entry & 0xFF ) << shift;
+			window >>= ( entry >> 8 ) & 15;
+			n += ( entry >> 8 ) & 15;
+			shift += 8;
+			symbols--;
+		}
+	}
+
+	*value = result;
+
+	return n;
+}
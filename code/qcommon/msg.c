@@ -93,6 +93,14 @@ bit functions
 =============================================================================
 */
 
+// per-bit encoder and decoder, kept for comparison in benchmarks
+static qboolean msg_legacyBits;
+
+void MSG_LegacyBits( qboolean enable ) {
+	msg_legacyBits = enable;
+}
+
+
 // negative bit values include signs
 void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 	int	i;
@@ -125,7 +133,7 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 		} else {
 			Com_Error(ERR_DROP, "can't write %d bits", bits);
 		}
-	} else {
+	} else if ( msg_legacyBits ) {
 		value &= (0xffffffff>>(32-bits));
 		if ( bits & 7 ) {
 			int nbits;
@@ -144,6 +152,9 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 			}
 		}
 		msg->cursize = (msg->bit>>3)+1;
+	} else {
+		msg->bit += HuffmanWriteBits( msg->data, msg->bit, msg->maxsize, (uint32_t)value & (0xffffffff>>(32-bits)), bits );
+		msg->cursize = (msg->bit>>3)+1;
 	}
 
 	if ( msg->bit > msg->maxbits ) {
@@ -152,6 +163,76 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 }
 
 
+/*
+=================
+MSG_WriteBitStream
+
+Appends already huffman-encoded bit sequence produced by MSG_WriteBits()
+into non-OOB message, unused bits in the last data byte must be zero
+=================
+*/
+void MSG_WriteBitStream( msg_t *msg, const byte *data, int bits ) {
+	byte *out;
+	int offset, n;
+
+	if ( msg->overflowed != qfalse || bits <= 0 )
+		return;
+
+	if ( msg->bit + bits > msg->maxbits ) {
+		msg->overflowed = qtrue;
+		return;
+	}
+
+	out = msg->data + ( msg->bit >> 3 );
+	offset = msg->bit & 7;
+	msg->bit += bits;
+
+	if ( offset == 0 ) {
+		Com_Memcpy( out, data, ( bits + 7 ) >> 3 );
+	} else {
+		// lower bits of the current byte are already set, higher bits are zero
+		for ( ; bits > 0; bits -= 8, data++, out++ ) {
+			n = bits < 8 ? bits : 8;
+			*out |= *data << offset;
+			if ( offset + n > 8 ) {
+				out[1] = *data >> ( 8 - offset );
+			}
+		}
+	}
+
+	msg->cursize = ( msg->bit >> 3 ) + 1;
+}
+
+
+/*
+=================
+MSG_WriteRawData
+
+Appends data to non-OOB message without huffman encoding, starting from
+the next byte boundary, reader must use MSG_ReadRawData() at this point
+=================
+*/
+void MSG_WriteRawData( msg_t *msg, const void *data, int length ) {
+	int bit;
+
+	if ( msg->overflowed != qfalse || length <= 0 )
+		return;
+
+	bit = ( msg->bit + 7 ) & ~7;
+
+	if ( bit + length * 8 > msg->maxbits ) {
+		msg->overflowed = qtrue;
+		return;
+	}
+
+	// padding bits up to the byte boundary are skipped by reader
+	Com_Memcpy( msg->data + ( bit >> 3 ), data, length );
+
+	msg->bit = bit + length * 8;
+	msg->cursize = ( msg->bit >> 3 ) + 1;
+}
+
+
 static int MSG_ReadBits( msg_t *msg, int bits ) {
 	int		value;
 	qboolean	sgn;
@@ -194,6 +275,12 @@ static int MSG_ReadBits( msg_t *msg, int bits ) {
 		}
 		else
 			Com_Error( ERR_DROP, "can't read %d bits", bits );
+	} else if ( !msg_legacyBits ) {
+		uint32_t result;
+		msg->bit += HuffmanReadBits( &result, buffer, msg->bit, msg->maxsize, bits );
+		msg->readcount = (msg->bit >> 3) + 1;
+		value = (int)result;
+		bits -= bits & 7; // sign is taken from the same bit as below
 	} else {
 		const int nbits = bits & 7;
 		int bitIndex = msg->bit; // dereference optimization
@@ -488,6 +575,36 @@ void MSG_ReadData( msg_t *msg, void *data, int len ) {
 }
 
 
+/*
+=================
+MSG_ReadRawData
+
+Reverse of MSG_WriteRawData()
+=================
+*/
+void MSG_ReadRawData( msg_t *msg, void *data, int len ) {
+	int bit;
+
+	if ( len <= 0 )
+		return;
+
+	bit = ( msg->bit + 7 ) & ~7;
+
+	if ( ( bit >> 3 ) + len > msg->cursize ) {
+		// read past end of message
+		Com_Memset( data, 0, len );
+		msg->bit = msg->cursize * 8;
+		msg->readcount = msg->cursize + 1;
+		return;
+	}
+
+	Com_Memcpy( data, msg->data + ( bit >> 3 ), len );
+
+	msg->bit = bit + len * 8;
+	msg->readcount = ( msg->bit >> 3 ) + 1;
+}
+
+
 int MSG_ReadEntitynum( msg_t *msg ) {
 	const int num = MSG_ReadBits( msg, GENTITYNUM_BITS );
 	if ( msg->readcount > msg->cursize ) {
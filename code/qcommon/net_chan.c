@@ -54,6 +54,8 @@ cvar_t		*showpackets;
 cvar_t		*showdrop;
 cvar_t		*qport;
 
+static void NET_ImpairInit( void );
+
 static const char *netsrcString[2] = {
 	"client",
 	"server"
@@ -73,6 +75,8 @@ void Netchan_Init( int port ) {
 	Cvar_SetDescription( showdrop, "Toggles information of dropped packet traffic." );
 	qport = Cvar_Get ("net_qport", va("%i", port), CVAR_INIT );
 	Cvar_SetDescription( qport, "Set internal network port. This allows more than one person to play from behind a NAT router by using only one IP address." );
+
+	NET_ImpairInit();
 }
 
 
@@ -569,83 +573,477 @@ static void NET_SendLoopPacket( netsrc_t sock, int length, const void *data )
 
 //=============================================================================
 
-typedef struct packetQueue_s {
-		struct packetQueue_s *next;
-		struct packetQueue_s *prev;
-		int length;
-		byte *data;
-		netadr_t to;
-		netsrc_t sock;
-		int release;
-} packetQueue_t;
-
-static packetQueue_t *packetQueue = NULL;
-
-static packetQueue_t *list_remove( packetQueue_t *head, packetQueue_t *item ) {
-	if ( item->next != item ) {
-		item->next->prev = item->prev;
-		item->prev->next = item->next;
+/*
+=============================================================================
+
+Delayed and impaired packets
+
+Packets held back by cl_packetdelay, sv_packetdelay or the impairment
+emulator are kept in timer wheels with one millisecond slots, so both
+queuing and releasing cost the same regardless of number of packets in
+flight. Packets due later than one wheel revolution stay in their slot
+until the wheel comes around again.
+
+The emulator is enabled by net_impair bits: 1 - outgoing, 2 - incoming
+packets, each direction has its own link state. Losses follow the
+Gilbert-Elliott model: link switches between good and bad states with
+net_impairBurstEnter/net_impairBurstExit chance per packet and loses
+net_impairLoss/net_impairBurstLoss percent of packets in them. Random
+numbers come from a private generator seeded by net_impairSeed, so runs
+with the same traffic and settings are reproducible.
+
+=============================================================================
+*/
+
+#define QUEUE_WHEEL_SLOTS	1024		// msec, must be a power of two
+#define IMPAIR_MAX_BACKLOG	1000		// msec of data waiting for net_impairRate before tail drop
+#define IMPAIR_PARETO_ALPHA	3.0			// shape of heavy-tailed jitter distribution
+
+#define IMPAIR_OUTGOING		1
+#define IMPAIR_INCOMING		2
+
+typedef struct queuedPacket_s {
+	struct queuedPacket_s *next;
+	int			release;
+	int			length;
+	int			readcount;
+	netadr_t	adr;					// destination or source of incoming packet
+	netsrc_t	sock;
+	byte		data[4];				// variable sized
+} queuedPacket_t;
+
+typedef struct {
+	queuedPacket_t	*slots[ QUEUE_WHEEL_SLOTS ];
+	queuedPacket_t	*tails[ QUEUE_WHEEL_SLOTS ];
+	int			time;					// next slot to process
+	int			count;
+} packetWheel_t;
+
+typedef struct {
+	qboolean	bad;					// Gilbert-Elliott state
+	double		busyUntil;				// msec, queued data is transmitted till this time
+	int			packets;
+	int			lost;
+	int			overflows;
+	int			duplicated;
+	int			reordered;
+	int			peakQueued;
+} impairLink_t;
+
+static packetWheel_t	outgoingQueue;
+static packetWheel_t	incomingQueue;
+
+static impairLink_t		impairLinks[2];	// outgoing, incoming
+static uint64_t			impairRandom;
+
+static cvar_t	*net_impair;
+static cvar_t	*net_impairLatency;
+static cvar_t	*net_impairJitter;
+static cvar_t	*net_impairDist;
+static cvar_t	*net_impairLoss;
+static cvar_t	*net_impairBurstEnter;
+static cvar_t	*net_impairBurstExit;
+static cvar_t	*net_impairBurstLoss;
+static cvar_t	*net_impairReorder;
+static cvar_t	*net_impairDuplicate;
+static cvar_t	*net_impairRate;
+static cvar_t	*net_impairSeed;
+
+
+/*
+===============
+NET_WheelInsert
+===============
+*/
+static void NET_WheelInsert( packetWheel_t *w, queuedPacket_t *item ) {
+	int slot;
+
+	if ( w->count == 0 ) {
+		w->time = Sys_Milliseconds();
+	}
+
+	// slots before wheel time are already processed
+	if ( item->release - w->time < 0 ) {
+		slot = w->time & ( QUEUE_WHEEL_SLOTS - 1 );
+	} else {
+		slot = item->release & ( QUEUE_WHEEL_SLOTS - 1 );
+	}
+
+	item->next = NULL;
+	if ( w->slots[ slot ] ) {
+		w->tails[ slot ]->next = item;
 	} else {
-		item->next = item->prev = NULL;
+		w->slots[ slot ] = item;
 	}
-	return item == head ? item->next : head;
+	w->tails[ slot ] = item;
+	w->count++;
 }
 
 
-static packetQueue_t *list_insert( packetQueue_t *head, packetQueue_t *item )
-{
-	if ( head ) {
-		packetQueue_t *prev = head->prev;
-		packetQueue_t *next = head;
-		prev->next = item;
-		next->prev = item;
-		item->prev = prev;
-		item->next = next;
-		return head;
+/*
+===============
+NET_WheelRelease
+
+Sends or dispatches single queued packet and frees it,
+item must be already removed from the wheel
+===============
+*/
+static void NET_WheelRelease( const packetWheel_t *w, queuedPacket_t *item ) {
+	static byte buffer[ MAX_MSGLEN_BUF ];
+	netadr_t adr;
+	msg_t msg;
+
+	if ( w == &incomingQueue ) {
+		MSG_Init( &msg, buffer, MAX_MSGLEN );
+		Com_Memcpy( msg.data, item->data, item->length );
+		msg.cursize = item->length;
+		msg.readcount = item->readcount;
+		adr = item->adr;
+		// dispatched packet may cause Com_Error() so nothing should be left to free
+		Z_Free( item );
+		NET_DispatchPacket( &adr, &msg );
+		return;
+	}
+
+#ifndef DEDICATED
+	if ( item->adr.type == NA_LOOPBACK )
+		NET_SendLoopPacket( item->sock, item->length, item->data );
+	else
+#endif
+		Sys_SendPacket( item->length, item->data, &item->adr );
+
+	Z_Free( item );
+}
+
+
+/*
+===============
+NET_WheelProcess
+
+Releases all packets due at specified time, every slot is visited at most once.
+Packets are unlinked one at a time so the wheel stays consistent if
+dispatch doesn't return
+===============
+*/
+static void NET_WheelProcess( packetWheel_t *w, int now ) {
+	queuedPacket_t *item, *prev;
+	int slot;
+
+	if ( now - w->time >= QUEUE_WHEEL_SLOTS ) {
+		w->time = now - QUEUE_WHEEL_SLOTS + 1;
+	}
+
+	for ( ; w->count > 0 && w->time - now <= 0; w->time++ ) {
+		slot = w->time & ( QUEUE_WHEEL_SLOTS - 1 );
+		prev = NULL;
+		item = w->slots[ slot ];
+		while ( item ) {
+			if ( item->release - now > 0 ) {
+				// due on one of the next revolutions
+				prev = item;
+				item = item->next;
+				continue;
+			}
+			if ( prev ) {
+				prev->next = item->next;
+			} else {
+				w->slots[ slot ] = item->next;
+			}
+			if ( w->tails[ slot ] == item ) {
+				w->tails[ slot ] = prev;
+			}
+			w->count--;
+			NET_WheelRelease( w, item );
+			// dispatch may queue new packets in the same slot
+			item = prev ? prev->next : w->slots[ slot ];
+		}
+	}
+}
+
+
+/*
+===============
+NET_WheelTimeout
+
+Returns msec until the first occupied slot, -1 if wheel is empty
+===============
+*/
+static int NET_WheelTimeout( const packetWheel_t *w, int now ) {
+	int n, t;
+
+	if ( w->count == 0 ) {
+		return -1;
+	}
+
+	for ( n = 0, t = w->time; n < QUEUE_WHEEL_SLOTS; n++, t++ ) {
+		if ( w->slots[ t & ( QUEUE_WHEEL_SLOTS - 1 ) ] ) {
+			return t - now > 0 ? t - now : 0;
+		}
+	}
+
+	return QUEUE_WHEEL_SLOTS;
+}
+
+
+/*
+===============
+NET_WheelQueue
+===============
+*/
+static void NET_WheelQueue( packetWheel_t *w, netsrc_t sock, int length, const void *data, int readcount, const netadr_t *adr, int offset ) {
+	queuedPacket_t *item;
+
+	item = S_Malloc( sizeof( *item ) + length );
+	Com_Memcpy( item->data, data, length );
+	item->length = length;
+	item->readcount = readcount;
+	item->adr = *adr;
+	item->sock = sock;
+	item->release = Sys_Milliseconds() + (int)( (float)offset / com_timescale->value );
+
+	NET_WheelInsert( w, item );
+}
+
+
+/*
+===============
+NET_ImpairRand
+
+xorshift64*, returns value in [0..1) range
+===============
+*/
+static double NET_ImpairRand( void ) {
+	impairRandom ^= impairRandom >> 12;
+	impairRandom ^= impairRandom << 25;
+	impairRandom ^= impairRandom >> 27;
+	return (double)( ( impairRandom * 2685821657736338717ULL ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+
+/*
+===============
+NET_ImpairReset
+===============
+*/
+static void NET_ImpairReset( void ) {
+	net_impairSeed->modified = qfalse;
+
+	if ( net_impairSeed->integer ) {
+		impairRandom = (uint64_t)(unsigned int)net_impairSeed->integer;
 	} else {
-		item->prev = item->next = item;
-		return item;
+		impairRandom = (uint64_t)Sys_Microseconds();
 	}
+	// splitmix64 step to spread small seeds, state must be never zero
+	impairRandom = ( impairRandom + 0x9E3779B97F4A7C15ULL ) * 0xBF58476D1CE4E5B9ULL;
+	impairRandom ^= impairRandom >> 31;
+	if ( impairRandom == 0 ) {
+		impairRandom = 1;
+	}
+
+	Com_Memset( impairLinks, 0, sizeof( impairLinks ) );
 }
 
 
-static packetQueue_t *list_process( packetQueue_t *head, const int time_diff )
-{
-	packetQueue_t *item = head;
-	int do_break = 0;
-	int now;
-	do {
-		if ( head == NULL ) {
-			break;
+/*
+===============
+NET_ImpairPacket
+
+Returns number of copies of the packet to deliver, 0 if it is lost,
+adds latency and link transmission time to delay
+===============
+*/
+static int NET_ImpairPacket( impairLink_t *link, int length, int *delay ) {
+	const int now = Sys_Milliseconds();
+	double latency, jitter, start, u;
+	int copies;
+
+	if ( net_impairSeed->modified ) {
+		NET_ImpairReset();
+	}
+
+	link->packets++;
+
+	if ( link->bad ) {
+		if ( NET_ImpairRand() * 100.0 < net_impairBurstExit->value ) {
+			link->bad = qfalse;
 		}
-		if ( head->prev == item ) {
-			do_break = 1;
+	} else {
+		if ( NET_ImpairRand() * 100.0 < net_impairBurstEnter->value ) {
+			link->bad = qtrue;
 		}
-		now = Sys_Milliseconds();
-		if ( now - item->release >= time_diff ) {
-			packetQueue_t *next = item->next;
-#ifndef DEDICATED
-			if ( item->to.type == NA_LOOPBACK )
-				NET_SendLoopPacket( item->sock, item->length, item->data );
-			else
-#endif
-				Sys_SendPacket( item->length, item->data, &item->to );
-			head = list_remove( head, item );
-			Z_Free( item );
-			item = next;
-		} else {
-			item = item->next;
+	}
+
+	if ( NET_ImpairRand() * 100.0 < ( link->bad ? net_impairBurstLoss->value : net_impairLoss->value ) ) {
+		link->lost++;
+		return 0;
+	}
+
+	latency = net_impairLatency->value;
+	jitter = net_impairJitter->value;
+
+	if ( jitter > 0.0 ) {
+		u = 1.0 - NET_ImpairRand(); // (0..1]
+		switch ( net_impairDist->integer ) {
+			case 1: // normal, jitter is standard deviation
+				latency += jitter * sqrt( -2.0 * log( u ) ) * cos( 2.0 * M_PI * NET_ImpairRand() );
+				break;
+			case 2: // pareto, rare long spikes
+				latency += jitter * ( pow( u, -1.0 / IMPAIR_PARETO_ALPHA ) - 1.0 );
+				break;
+			default: // uniform
+				latency += jitter * ( 2.0 * u - 1.0 );
+				break;
+		}
+		if ( latency < 0.0 ) {
+			latency = 0.0;
+		}
+	}
+
+	// reordered packets skip the queue
+	if ( net_impairReorder->value > 0.0f && NET_ImpairRand() * 100.0 < net_impairReorder->value ) {
+		link->reordered++;
+		latency = 0.0;
+	}
+
+	if ( net_impairRate->integer > 0 ) {
+		start = link->busyUntil > now ? link->busyUntil : now;
+		if ( start - now > IMPAIR_MAX_BACKLOG ) {
+			link->overflows++;
+			return 0;
 		}
-	} while ( do_break == 0 );
+		link->busyUntil = start + length * 1000.0 / ( net_impairRate->integer * 1024.0 );
+		latency += link->busyUntil - now;
+	}
+
+	copies = 1;
+	if ( net_impairDuplicate->value > 0.0f && NET_ImpairRand() * 100.0 < net_impairDuplicate->value ) {
+		link->duplicated++;
+		copies++;
+	}
+
+	*delay += (int)( latency + 0.5 );
+
+	return copies;
+}
+
+
+/*
+===============
+NET_ImpairIncoming
+
+Returns qtrue if received packet was lost or queued for later dispatch
+===============
+*/
+qboolean NET_ImpairIncoming( const netadr_t *from, const msg_t *msg ) {
+	impairLink_t *link = &impairLinks[ 1 ];
+	int copies, delay;
+
+	if ( !( net_impair->integer & IMPAIR_INCOMING ) || com_timescale->value == 0.0f ) {
+		return qfalse;
+	}
+
+	delay = 0;
+	copies = NET_ImpairPacket( link, msg->cursize, &delay );
+	if ( copies == 0 ) {
+		return qtrue;
+	}
+
+	if ( delay <= 0 ) {
+		// dispatch now, duplicate a moment later
+		if ( copies > 1 ) {
+			NET_WheelQueue( &incomingQueue, NS_SERVER, msg->cursize, msg->data, msg->readcount, from, 1 );
+		}
+		return qfalse;
+	}
+
+	while ( copies-- > 0 ) {
+		NET_WheelQueue( &incomingQueue, NS_SERVER, msg->cursize, msg->data, msg->readcount, from, delay );
+	}
+
+	if ( link->peakQueued < incomingQueue.count ) {
+		link->peakQueued = incomingQueue.count;
+	}
 
-	return head;
+	return qtrue;
+}
+
+
+/*
+===============
+NET_ImpairStats_f
+===============
+*/
+static void NET_ImpairStats_f( void ) {
+	static const char *names[2] = { "outgoing", "incoming" };
+	const impairLink_t *link;
+	int i;
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		NET_ImpairReset();
+		Com_Printf( "Impairment statistics reset.\n" );
+		return;
+	}
+
+	Com_Printf( "link       packets     lost overflow duplicate reordered  queued peak\n" );
+	Com_Printf( "-------- --------- -------- -------- --------- --------- ------- ----\n" );
+	for ( i = 0; i < ARRAY_LEN( impairLinks ); i++ ) {
+		link = &impairLinks[ i ];
+		Com_Printf( "%-8s %9i %8i %8i %9i %9i %7i %4i\n", names[ i ], link->packets, link->lost, link->overflows,
+			link->duplicated, link->reordered, i ? incomingQueue.count : outgoingQueue.count, link->peakQueued );
+	}
+}
+
+
+/*
+===============
+NET_ImpairInit
+===============
+*/
+static void NET_ImpairInit( void ) {
+	net_impair = Cvar_Get( "net_impair", "0", CVAR_TEMP );
+	Cvar_CheckRange( net_impair, "0", "3", CV_INTEGER );
+	Cvar_SetDescription( net_impair, "Network impairment emulator:\n 0 - disabled\n 1 - outgoing packets\n 2 - incoming packets\n 3 - both directions" );
+	net_impairLatency = Cvar_Get( "net_impairLatency", "0", CVAR_TEMP );
+	Cvar_CheckRange( net_impairLatency, "0", "10000", CV_INTEGER );
+	Cvar_SetDescription( net_impairLatency, "Emulated one-way latency in milliseconds." );
+	net_impairJitter = Cvar_Get( "net_impairJitter", "0", CVAR_TEMP );
+	Cvar_CheckRange( net_impairJitter, "0", "10000", CV_INTEGER );
+	Cvar_SetDescription( net_impairJitter, "Emulated latency variation in milliseconds, see net_impairDist." );
+	net_impairDist = Cvar_Get( "net_impairDist", "0", CVAR_TEMP );
+	Cvar_CheckRange( net_impairDist, "0", "2", CV_INTEGER );
+	Cvar_SetDescription( net_impairDist, "Emulated latency distribution:\n 0 - uniform within +/- net_impairJitter\n 1 - normal with net_impairJitter deviation\n 2 - pareto, occasional long delays" );
+	net_impairLoss = Cvar_Get( "net_impairLoss", "0", CVAR_TEMP );
+	Cvar_CheckRange( net_impairLoss, "0", "100", CV_FLOAT );
+	Cvar_SetDescription( net_impairLoss, "Emulated packet loss percentage in good link state." );
+	net_impairBurstEnter = Cvar_Get( "net_impairBurstEnter", "0", CVAR_TEMP );
+	Cvar_CheckRange( net_impairBurstEnter, "0", "100", CV_FLOAT );
+	Cvar_SetDescription( net_impairBurstEnter, "Chance in percent per packet for emulated link to enter bad state with burst losses." );
+	net_impairBurstExit = Cvar_Get( "net_impairBurstExit", "25", CVAR_TEMP );
+	Cvar_CheckRange( net_impairBurstExit, "0", "100", CV_FLOAT );
+	Cvar_SetDescription( net_impairBurstExit, "Chance in percent per packet for emulated link to return to good state." );
+	net_impairBurstLoss = Cvar_Get( "net_impairBurstLoss", "100", CVAR_TEMP );
+	Cvar_CheckRange( net_impairBurstLoss, "0", "100", CV_FLOAT );
+	Cvar_SetDescription( net_impairBurstLoss, "Emulated packet loss percentage in bad link state." );
+	net_impairReorder = Cvar_Get( "net_impairReorder", "0", CVAR_TEMP );
+	Cvar_CheckRange( net_impairReorder, "0", "100", CV_FLOAT );
+	Cvar_SetDescription( net_impairReorder, "Percentage of packets sent without emulated latency, ahead of delayed ones." );
+	net_impairDuplicate = Cvar_Get( "net_impairDuplicate", "0", CVAR_TEMP );
+	Cvar_CheckRange( net_impairDuplicate, "0", "100", CV_FLOAT );
+	Cvar_SetDescription( net_impairDuplicate, "Percentage of duplicated packets." );
+	net_impairRate = Cvar_Get( "net_impairRate", "0", CVAR_TEMP );
+	Cvar_CheckRange( net_impairRate, "0", "1000000", CV_INTEGER );
+	Cvar_SetDescription( net_impairRate, "Emulated link bandwidth in KB/s for each direction, 0 - unlimited." );
+	net_impairSeed = Cvar_Get( "net_impairSeed", "0", CVAR_TEMP );
+	Cvar_SetDescription( net_impairSeed, "Random seed of the network impairment emulator, 0 - seed from current time." );
+
+	NET_ImpairReset();
+
+	Cmd_AddCommand( "net_impairStats", NET_ImpairStats_f );
 }
 
 
 void NET_QueuePacket( netsrc_t sock, int length, const void *data, const netadr_t *to, int offset )
 {
-	packetQueue_t *new;
-
 	if ( to->type == NA_BOT ) {
 		return;
 	}
@@ -656,30 +1054,55 @@ void NET_QueuePacket( netsrc_t sock, int length, const void *data, const netadr_
 		return;
 	}
 
-	if ( offset > 999 ) {
-		offset = 999;
+	NET_WheelQueue( &outgoingQueue, sock, length, data, 0, to, offset );
+
+	if ( impairLinks[ 0 ].peakQueued < outgoingQueue.count ) {
+		impairLinks[ 0 ].peakQueued = outgoingQueue.count;
 	}
+}
 
-	new = S_Malloc(sizeof(*new) + length);
-	new->data = (byte *)( new + 1 );
-	Com_Memcpy(new->data, data, length);
-	new->length = length;
-	new->to = *to;
-	new->sock = sock;
-	new->release = Sys_Milliseconds() + (int)( (float)offset / com_timescale->value );
-	new->next = NULL;
 
-	packetQueue = list_insert( packetQueue, new );
+void NET_FlushPacketQueue( int time_diff )
+{
+	const int now = Sys_Milliseconds();
+
+	NET_WheelProcess( &outgoingQueue, now - time_diff );
+
+	// don't leave processed time ahead of real time after forced flush
+	if ( outgoingQueue.time - now > 1 ) {
+		outgoingQueue.time = now + 1;
+	}
 }
 
 
-void NET_FlushPacketQueue( int time_diff )
+/*
+===============
+NET_RunPacketQueues
+
+Sends and dispatches queued packets which are due,
+returns msec until the next one or -1 if there are none
+===============
+*/
+int NET_RunPacketQueues( void )
 {
-	packetQueue = list_process( packetQueue, time_diff );
+	const int now = Sys_Milliseconds();
+	int timeout, incoming;
+
+	NET_WheelProcess( &outgoingQueue, now );
+	NET_WheelProcess( &incomingQueue, now );
+
+	timeout = NET_WheelTimeout( &outgoingQueue, now );
+	incoming = NET_WheelTimeout( &incomingQueue, now );
+	if ( incoming >= 0 && ( timeout < 0 || incoming < timeout ) ) {
+		timeout = incoming;
+	}
+
+	return timeout;
 }
 
 
 void NET_SendPacket( netsrc_t sock, int length, const void *data, const netadr_t *to ) {
+	int delay, copies;
 
 	// sequenced packets are shown in netchan, so just show oob
 	if ( showpackets->integer && *(int32_t *)data == -1 ) {
@@ -692,21 +1115,34 @@ void NET_SendPacket( netsrc_t sock, int length, const void *data, const netadr_t
 	if ( to->type == NA_BAD ) {
 		return;
 	}
+
+	delay = 0;
 #ifndef DEDICATED
 	if ( sock == NS_CLIENT && cl_packetdelay->integer > 0 ) {
-		NET_QueuePacket( sock, length, data, to, cl_packetdelay->integer );
-	} else
+		delay = MIN( cl_packetdelay->integer, 999 );
+	}
 #endif
 	if ( sock == NS_SERVER && sv_packetdelay->integer > 0 ) {
-		NET_QueuePacket( sock, length, data, to, sv_packetdelay->integer );
+		delay = MIN( sv_packetdelay->integer, 999 );
 	}
-#ifndef DEDICATED
-	else if ( to->type == NA_LOOPBACK ) {
-		NET_SendLoopPacket( sock, length, data );
+
+	copies = 1;
+	if ( net_impair->integer & IMPAIR_OUTGOING && com_timescale->value != 0.0f ) {
+		copies = NET_ImpairPacket( &impairLinks[ 0 ], length, &delay );
 	}
+
+	for ( ; copies > 0; copies-- ) {
+		if ( delay > 0 ) {
+			NET_QueuePacket( sock, length, data, to, delay );
+		}
+#ifndef DEDICATED
+		else if ( to->type == NA_LOOPBACK ) {
+			NET_SendLoopPacket( sock, length, data );
+		}
 #endif
-	else {
-		Sys_SendPacket( length, data, to );
+		else {
+			Sys_SendPacket( length, data, to );
+		}
 	}
 }
 
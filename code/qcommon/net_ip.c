@@ -20,6 +20,10 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 ===========================================================================
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE // recvmmsg(), sendmmsg()
+#endif
+
 #include "../qcommon/q_shared.h"
 #include "../qcommon/qcommon.h"
 
@@ -85,6 +89,7 @@ static qboolean	winsockInitialized = qfalse;
 #	include <sys/ioctl.h>
 #	include <sys/types.h>
 #	include <sys/time.h>
+#	include <signal.h>
 #	include <unistd.h>
 #	if !defined(__sun) && !defined(__sgi)
 #		include <ifaddrs.h>
@@ -102,6 +107,29 @@ typedef int SOCKET;
 typedef int	ioctlarg_t;
 #	define socketError			errno
 
+#	ifdef __linux__
+#		include <sys/epoll.h>
+#		include <sys/timerfd.h>
+#		include <sys/eventfd.h>
+#		include <linux/filter.h>
+#		include <sys/sendfile.h>
+#		include <pthread.h>
+#		include <poll.h>
+#		define USE_MMSG
+#		define USE_EPOLL
+#		ifdef SO_ATTACH_REUSEPORT_CBPF
+#			define USE_QUERY_SHARDS
+#		endif
+extern qboolean stdin_active;
+#	endif
+
+#endif
+
+// don't raise SIGPIPE when writing to connections closed by peer
+#ifdef MSG_NOSIGNAL
+#	define NET_SEND_FLAGS	MSG_NOSIGNAL
+#else
+#	define NET_SEND_FLAGS	0
 #endif
 
 typedef union {
@@ -176,6 +204,19 @@ static cvar_t	*net_mcast6addr;
 static cvar_t	*net_mcast6iface;
 #endif
 static cvar_t	*net_dropsim;
+#ifdef USE_MMSG
+static cvar_t	*net_batch;
+#endif
+#ifdef USE_EPOLL
+static cvar_t	*net_poll;
+#endif
+#ifdef USE_QUERY_SHARDS
+static cvar_t	*net_queryShards;
+#endif
+
+#ifdef USE_QUERY_SHARDS
+static int		query_event_fd = -1;	// signalled when query threads forward packets
+#endif
 
 static sockaddr_t socksRelayAddr;
 
@@ -215,6 +256,11 @@ static nip_localaddr_t localIP[MAX_IPS];
 static int numIP;
 
 static void	NET_Restart_f( void );
+static void	NET_Bench_f( void );
+static void	NET_PacketEvent( const netadr_t *from, msg_t *msg );
+#ifdef USE_EPOLL
+static void	NET_PollStats_f( void );
+#endif
 
 //=============================================================================
 
@@ -637,6 +683,476 @@ qboolean NET_IsLocalAddress( const netadr_t *adr )
 
 //=============================================================================
 
+/*
+==================
+NET_SendError
+
+Reports sendto() failure unless it is expected
+==================
+*/
+static void NET_SendError( netadrtype_t type )
+{
+	int err = socketError;
+
+	// wouldblock is silent
+	if ( err == EAGAIN ) {
+		return;
+	}
+
+	// some PPP links do not allow broadcasts and return an error
+	if ( err == EADDRNOTAVAIL && type == NA_BROADCAST ) {
+		return;
+	}
+
+	Com_Printf( "Sys_SendPacket: %s\n", NET_ErrorString() );
+}
+
+
+#ifdef USE_MMSG
+/*
+=============================================================================
+
+BATCHED SOCKET I/O
+
+recvmmsg() drains up to NET_BATCH_SIZE datagrams per system call into
+a per-socket queue which is then consumed by NET_GetPacket() one by one,
+outgoing packets issued between Sys_BeginPacketBatch() and
+Sys_FlushPacketBatch() are collected and sent with a single sendmmsg()
+
+=============================================================================
+*/
+
+#define NET_BATCH_SIZE	16
+
+typedef struct {
+	struct mmsghdr	hdr[ NET_BATCH_SIZE ];
+	struct iovec	iov[ NET_BATCH_SIZE ];
+	sockaddr_t		addr[ NET_BATCH_SIZE ];
+	netadrtype_t	type[ NET_BATCH_SIZE ];
+	int				count;
+	int				current;
+	byte			data[ NET_BATCH_SIZE ][ MAX_MSGLEN_BUF ];
+} netBatch_t;
+
+static netBatch_t	ip_recvBatch;
+static netBatch_t	ip_sendBatch;
+#ifdef USE_IPV6
+static netBatch_t	ip6_recvBatch;
+static netBatch_t	ip6_sendBatch;
+#endif
+
+static qboolean		batchSend;
+static qboolean		batchUnsupported; // kernel without recvmmsg/sendmmsg
+
+
+/*
+==================
+NET_BatchRecv
+
+Returns number of received datagrams or SOCKET_ERROR
+==================
+*/
+static int NET_BatchRecv( netBatch_t *b, SOCKET s )
+{
+	struct msghdr *h;
+	int i, ret;
+
+	for ( i = 0; i < NET_BATCH_SIZE; i++ ) {
+		h = &b->hdr[i].msg_hdr;
+		b->iov[i].iov_base = b->data[i];
+		b->iov[i].iov_len = MAX_MSGLEN;
+		memset( h, 0, sizeof( *h ) );
+		h->msg_name = &b->addr[i];
+		h->msg_namelen = sizeof( b->addr[i] );
+		h->msg_iov = &b->iov[i];
+		h->msg_iovlen = 1;
+	}
+
+	b->current = 0;
+	b->count = 0;
+
+	ret = recvmmsg( s, b->hdr, NET_BATCH_SIZE, MSG_DONTWAIT, NULL );
+	if ( ret == 0 ) {
+		errno = EAGAIN;
+		return SOCKET_ERROR;
+	}
+
+	if ( ret > 0 ) {
+		b->count = ret;
+	}
+
+	return ret;
+}
+
+
+/*
+==================
+NET_BatchQueue
+
+Appends datagram to the send queue, caller must flush full queue first
+==================
+*/
+static void NET_BatchQueue( netBatch_t *b, const void *data, int length, const sockaddr_t *addr, socklen_t addrlen, netadrtype_t type )
+{
+	struct msghdr *h;
+	int n;
+
+	n = b->count++;
+
+	memcpy( b->data[n], data, length );
+	memcpy( &b->addr[n], addr, addrlen );
+	b->type[n] = type;
+	b->iov[n].iov_base = b->data[n];
+	b->iov[n].iov_len = length;
+
+	h = &b->hdr[n].msg_hdr;
+	memset( h, 0, sizeof( *h ) );
+	h->msg_name = &b->addr[n];
+	h->msg_namelen = addrlen;
+	h->msg_iov = &b->iov[n];
+	h->msg_iovlen = 1;
+}
+
+
+/*
+==================
+NET_BatchSend
+
+Sends all queued datagrams, failed ones are reported and skipped
+==================
+*/
+static void NET_BatchSend( netBatch_t *b, SOCKET s )
+{
+	const struct msghdr *h;
+	int sent, ret;
+
+	for ( sent = 0; sent < b->count; ) {
+		if ( !batchUnsupported ) {
+			ret = sendmmsg( s, b->hdr + sent, b->count - sent, 0 );
+			if ( ret > 0 ) {
+				sent += ret;
+				continue;
+			}
+			if ( socketError == ENOSYS ) {
+				batchUnsupported = qtrue;
+				continue;
+			}
+		} else {
+			h = &b->hdr[ sent ].msg_hdr;
+			ret = sendto( s, b->data[ sent ], b->iov[ sent ].iov_len, 0, h->msg_name, h->msg_namelen );
+			if ( ret != SOCKET_ERROR ) {
+				sent++;
+				continue;
+			}
+		}
+		NET_SendError( b->type[ sent ] );
+		sent++;
+	}
+
+	b->count = 0;
+}
+
+
+/*
+==================
+NET_RecvFrom
+
+recvfrom() replacement which reads from the socket queue
+==================
+*/
+static int NET_RecvFrom( SOCKET s, netBatch_t *b, void *buf, int len, sockaddr_t *from, socklen_t *fromlen )
+{
+	const struct mmsghdr *h;
+	int ret;
+
+	if ( b->current >= b->count ) {
+		if ( !net_batch->integer || batchUnsupported ) {
+			return recvfrom( s, buf, len, 0, (struct sockaddr *) from, fromlen );
+		}
+		if ( NET_BatchRecv( b, s ) == SOCKET_ERROR ) {
+			if ( socketError == ENOSYS ) {
+				batchUnsupported = qtrue;
+				return recvfrom( s, buf, len, 0, (struct sockaddr *) from, fromlen );
+			}
+			return SOCKET_ERROR;
+		}
+	}
+
+	h = &b->hdr[ b->current ];
+
+	ret = MIN( (int)h->msg_len, len );
+	memcpy( buf, b->data[ b->current ], ret );
+
+	*fromlen = MIN( h->msg_hdr.msg_namelen, *fromlen );
+	memcpy( from, &b->addr[ b->current ], *fromlen );
+
+	b->current++;
+
+	return ret;
+}
+
+
+/*
+==================
+NET_SendTo
+
+sendto() replacement which appends to the socket queue while batching
+==================
+*/
+static int NET_SendTo( SOCKET s, netBatch_t *b, const void *data, int length, const sockaddr_t *addr, socklen_t addrlen, netadrtype_t type )
+{
+	if ( !batchSend || batchUnsupported || length > MAX_MSGLEN ) {
+		// keep packet order
+		if ( b->count ) {
+			NET_BatchSend( b, s );
+		}
+		return sendto( s, data, length, 0, (const struct sockaddr *) addr, addrlen );
+	}
+
+	if ( b->count >= NET_BATCH_SIZE ) {
+		NET_BatchSend( b, s );
+	}
+
+	NET_BatchQueue( b, data, length, addr, addrlen, type );
+
+	return length;
+}
+
+
+/*
+==================
+NET_PendingPackets
+
+Marks sockets with already received but not yet processed datagrams
+==================
+*/
+static qboolean NET_PendingPackets( fd_set *fdr )
+{
+	qboolean pending = qfalse;
+
+	FD_ZERO( fdr );
+
+	if ( ip_socket != INVALID_SOCKET && ip_recvBatch.current < ip_recvBatch.count ) {
+		FD_SET( ip_socket, fdr );
+		pending = qtrue;
+	}
+
+#ifdef USE_IPV6
+	if ( ip6_socket != INVALID_SOCKET && ip6_recvBatch.current < ip6_recvBatch.count ) {
+		FD_SET( ip6_socket, fdr );
+		pending = qtrue;
+	}
+#endif
+
+	return pending;
+}
+#endif // USE_MMSG
+
+
+/*
+==================
+Sys_BeginPacketBatch
+
+Collect outgoing packets until Sys_FlushPacketBatch()
+==================
+*/
+void Sys_BeginPacketBatch( void )
+{
+#ifdef USE_MMSG
+	batchSend = ( net_batch && net_batch->integer && !usingSocks ) ? qtrue : qfalse;
+#endif
+}
+
+
+/*
+==================
+Sys_FlushPacketBatch
+==================
+*/
+void Sys_FlushPacketBatch( void )
+{
+#ifdef USE_MMSG
+	batchSend = qfalse;
+
+	if ( ip_sendBatch.count ) {
+		if ( ip_socket != INVALID_SOCKET )
+			NET_BatchSend( &ip_sendBatch, ip_socket );
+		else
+			ip_sendBatch.count = 0;
+	}
+#ifdef USE_IPV6
+	if ( ip6_sendBatch.count ) {
+		if ( ip6_socket != INVALID_SOCKET )
+			NET_BatchSend( &ip6_sendBatch, ip6_socket );
+		else
+			ip6_sendBatch.count = 0;
+	}
+#endif
+#endif // USE_MMSG
+}
+
+
+#ifdef USE_EPOLL
+/*
+=============================================================================
+
+EPOLL EVENT LOOP
+
+Sockets, the dedicated console and a timerfd are registered once when
+sockets are opened so NET_Sleep() does not need to rebuild descriptor
+sets each frame, the timerfd provides sub-millisecond wakeup precision
+
+=============================================================================
+*/
+
+static int		epoll_fd = -1;
+static int		timer_fd = -1;
+static int		pollConsole; // 0 - not checked yet, 1 - registered, -1 - unsupported
+
+static struct {
+	uint64_t	wakeups;
+	uint64_t	timeouts;
+	uint64_t	events;
+	int			maxEvents;
+} pollStats;
+
+
+/*
+====================
+NET_PollAdd
+====================
+*/
+static qboolean NET_PollAdd( int fd, uint32_t events )
+{
+	struct epoll_event ev;
+
+	if ( epoll_fd == -1 || fd == INVALID_SOCKET )
+		return qfalse;
+
+	memset( &ev, 0, sizeof( ev ) );
+	ev.events = events;
+	ev.data.fd = fd;
+
+	if ( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &ev ) == -1 ) {
+		Com_DPrintf( "NET_PollAdd: epoll_ctl( %i ): %s\n", fd, strerror( errno ) );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+
+/*
+====================
+NET_PollRemove
+====================
+*/
+static void NET_PollRemove( int fd )
+{
+	struct epoll_event ev;
+
+	if ( epoll_fd == -1 || fd == INVALID_SOCKET )
+		return;
+
+	memset( &ev, 0, sizeof( ev ) );
+	epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, &ev );
+}
+
+
+/*
+====================
+NET_PollClose
+====================
+*/
+static void NET_PollClose( void )
+{
+	if ( timer_fd != -1 ) {
+		close( timer_fd );
+		timer_fd = -1;
+	}
+
+	if ( epoll_fd != -1 ) {
+		close( epoll_fd );
+		epoll_fd = -1;
+	}
+
+	pollConsole = 0;
+}
+
+
+/*
+====================
+NET_PollOpen
+====================
+*/
+static void NET_PollOpen( void )
+{
+	NET_PollClose();
+
+	if ( !net_poll->integer )
+		return;
+
+	epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+	if ( epoll_fd == -1 ) {
+		Com_Printf( "WARNING: epoll_create1: %s, using select()\n", strerror( errno ) );
+		return;
+	}
+
+	timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+	if ( timer_fd == -1 || !NET_PollAdd( timer_fd, EPOLLIN ) ) {
+		Com_Printf( "WARNING: timerfd_create: %s, using select()\n", strerror( errno ) );
+		NET_PollClose();
+		return;
+	}
+
+	NET_PollAdd( ip_socket, EPOLLIN );
+#ifdef USE_IPV6
+	NET_PollAdd( ip6_socket, EPOLLIN );
+	if ( multicast6_socket != ip6_socket )
+		NET_PollAdd( multicast6_socket, EPOLLIN );
+#endif
+#ifdef USE_QUERY_SHARDS
+	NET_PollAdd( query_event_fd, EPOLLIN );
+#endif
+}
+
+
+/*
+====================
+NET_PollConsole
+
+Returns qtrue if NET_Sleep() also wakes up on console input
+====================
+*/
+qboolean NET_PollConsole( void )
+{
+	if ( epoll_fd == -1 )
+		return qfalse;
+
+	if ( !stdin_active ) {
+		// stop polling closed input, it would stay readable forever
+		if ( pollConsole == 1 ) {
+			NET_PollRemove( STDIN_FILENO );
+			pollConsole = -1;
+		}
+		return qfalse;
+	}
+
+	// console input is initialized after networking
+	if ( pollConsole == 0 ) {
+		// level-triggered as console input is consumed in small portions
+		// once per frame and the rest must wake up next NET_Sleep() again
+		if ( com_dedicated->integer && NET_PollAdd( STDIN_FILENO, EPOLLIN ) )
+			pollConsole = 1;
+		else
+			pollConsole = -1;
+	}
+
+	return ( pollConsole == 1 ) ? qtrue : qfalse;
+}
+#endif // USE_EPOLL
+
+
 /*
 ==================
 NET_GetPacket
@@ -654,7 +1170,11 @@ static qboolean NET_GetPacket( netadr_t *net_from, msg_t *net_message, const fd_
 	if(ip_socket != INVALID_SOCKET && FD_ISSET(ip_socket, fdr))
 	{
 		fromlen = sizeof(from);
+#ifdef USE_MMSG
+		ret = NET_RecvFrom( ip_socket, &ip_recvBatch, net_message->data, net_message->maxsize, &from, &fromlen );
+#else
 		ret = recvfrom( ip_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen );
+#endif
 
 		if (ret == SOCKET_ERROR)
 		{
@@ -699,7 +1219,11 @@ static qboolean NET_GetPacket( netadr_t *net_from, msg_t *net_message, const fd_
 	if(ip6_socket != INVALID_SOCKET && FD_ISSET(ip6_socket, fdr))
 	{
 		fromlen = sizeof(from);
+#ifdef USE_MMSG
+		ret = NET_RecvFrom( ip6_socket, &ip6_recvBatch, net_message->data, net_message->maxsize, &from, &fromlen );
+#else
 		ret = recvfrom(ip6_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen);
+#endif
 
 		if (ret == SOCKET_ERROR)
 		{
@@ -814,28 +1338,25 @@ void Sys_SendPacket( int length, const void *data, const netadr_t *to ) {
 		}
 	}
 	else {
+#ifdef USE_MMSG
 		if ( addr.ss.ss_family == AF_INET )
-			ret = sendto( ip_socket, data, length, 0, (struct sockaddr *) &addr, sizeof(struct sockaddr_in) );
+			ret = NET_SendTo( ip_socket, &ip_sendBatch, data, length, &addr, sizeof(struct sockaddr_in), to->type );
 #ifdef USE_IPV6
 		else if ( addr.ss.ss_family == AF_INET6 )
-			ret = sendto( ip6_socket, data, length, 0, (struct sockaddr *) &addr, sizeof(struct sockaddr_in6) );
+			ret = NET_SendTo( ip6_socket, &ip6_sendBatch, data, length, &addr, sizeof(struct sockaddr_in6), to->type );
 #endif
-	}
+#else
+		if ( addr.ss.ss_family == AF_INET )
+			ret = sendto( ip_socket, data, length, 0, (struct sockaddr *) &addr, sizeof(struct sockaddr_in) );
+#ifdef USE_IPV6
+		else if ( addr.ss.ss_family == AF_INET6 )
+			ret = sendto( ip6_socket, data, length, 0, (struct sockaddr *) &addr, sizeof(struct sockaddr_in6) );
+#endif
+#endif // !USE_MMSG
+	}
 
 	if( ret == SOCKET_ERROR ) {
-		int err = socketError;
-
-		// wouldblock is silent
-		if( err == EAGAIN ) {
-			return;
-		}
-
-		// some PPP links do not allow broadcasts and return an error
-		if( ( err == EADDRNOTAVAIL ) && ( to->type == NA_BROADCAST ) ) {
-			return;
-		}
-
-		Com_Printf( "Sys_SendPacket: %s\n", NET_ErrorString() );
+		NET_SendError( to->type );
 	}
 }
 
@@ -962,7 +1483,7 @@ void Sys_ShowIP( void ) {
 NET_IPSocket
 ====================
 */
-static SOCKET NET_IPSocket( const char *net_interface, int port, int *err ) {
+static SOCKET NET_IPSocket( const char *net_interface, int port, qboolean reusePort, int *err ) {
 	SOCKET				newsocket;
 	struct sockaddr_in	address;
 	ioctlarg_t			_true = 1;
@@ -995,6 +1516,13 @@ static SOCKET NET_IPSocket( const char *net_interface, int port, int *err ) {
 		Com_Printf( "WARNING: NET_IPSocket: setsockopt SO_BROADCAST: %s\n", NET_ErrorString() );
 	}
 
+#ifdef SO_REUSEPORT
+	// share port with query sockets
+	if( reusePort && setsockopt( newsocket, SOL_SOCKET, SO_REUSEPORT, (char *) &i, sizeof(i) ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_IPSocket: setsockopt SO_REUSEPORT: %s\n", NET_ErrorString() );
+	}
+#endif
+
 	if( !net_interface || !net_interface[0]) {
 		address.sin_family = AF_INET;
 		address.sin_addr.s_addr = INADDR_ANY;
@@ -1200,6 +1728,11 @@ void NET_JoinMulticast6( void )
 			return;
 		}
 	}
+
+#ifdef USE_EPOLL
+	if(multicast6_socket != ip6_socket)
+		NET_PollAdd(multicast6_socket, EPOLLIN);
+#endif
 }
 
 
@@ -1557,6 +2090,339 @@ static void NET_GetLocalAddress( void ) {
 #endif // _WIN32
 
 
+#ifdef USE_QUERY_SHARDS
+/*
+=============================================================================
+
+QUERY SHARDS
+
+Extra SO_REUSEPORT sockets bound to the IPv4 game port, a classic BPF
+program steers connectionless packets to them while netchan traffic stays
+on ip_socket. Each shard is served by its own thread which answers queries
+through the registered handler and forwards everything else to the main
+thread.
+
+=============================================================================
+*/
+
+#define MAX_QUERY_SHARDS	8
+#define QUERY_QUEUE_SIZE	16		// must be power of two
+#define QUERY_PACKET_SIZE	4096	// forwarded packets are connect/rcon/etc.
+
+typedef struct {
+	netadr_t		from;
+	int				length;
+	byte			data[ QUERY_PACKET_SIZE ];
+} queryPacket_t;
+
+typedef struct {
+	SOCKET			socket;
+	void			*thread;
+	volatile int	head;			// advanced by shard thread
+	volatile int	tail;			// advanced by main thread
+	volatile int	forwarded;		// statistics, updated by shard thread
+	volatile int	dropped;
+	queryPacket_t	queue[ QUERY_QUEUE_SIZE ];
+} queryShard_t;
+
+static queryShard_t	queryShards[ MAX_QUERY_SHARDS ];
+static int			numQueryShards;
+static volatile int	queryStop;
+
+static volatile netQueryHandler_t queryHandler;
+
+
+/*
+====================
+NET_QueryConnectPacket
+
+Returns qtrue for connectionless packets which start client connection
+====================
+*/
+static qboolean NET_QueryConnectPacket( const byte *data, int length )
+{
+	if ( length >= 4 + 12 && !Q_strncmp( (const char *)data + 4, "getchallenge", 12 ) )
+		return qtrue;
+
+	if ( length >= 4 + 7 && !Q_strncmp( (const char *)data + 4, "connect", 7 ) )
+		return qtrue;
+
+	return qfalse;
+}
+
+
+/*
+====================
+NET_QueryForward
+
+Passes packet to the main thread, drops it if the queue is full.
+Last half of the queue is reserved for connection requests
+so they are not lost during query floods.
+====================
+*/
+static void NET_QueryForward( queryShard_t *shard, const netadr_t *from, const byte *data, int length )
+{
+	const uint64_t one = 1;
+	queryPacket_t *p;
+	int limit;
+
+	limit = NET_QueryConnectPacket( data, length ) ? QUERY_QUEUE_SIZE : QUERY_QUEUE_SIZE / 2;
+
+	if ( length > QUERY_PACKET_SIZE || shard->head - shard->tail >= limit ) {
+		shard->dropped++;
+		return;
+	}
+
+	shard->forwarded++;
+
+	p = &shard->queue[ shard->head & ( QUERY_QUEUE_SIZE - 1 ) ];
+	p->from = *from;
+	p->length = length;
+	memcpy( p->data, data, length );
+
+	// publish
+	Sys_AtomicAdd( &shard->head, 1 );
+
+	if ( write( query_event_fd, &one, sizeof( one ) ) != sizeof( one ) ) {
+		// counter is already signalled
+	}
+}
+
+
+/*
+====================
+NET_QueryThread
+====================
+*/
+static void NET_QueryThread( void *arg )
+{
+	queryShard_t		*shard = (queryShard_t *)arg;
+	byte				data[ MAX_MSGLEN_BUF ];
+	byte				reply[ MAX_MSGLEN ];
+	sockaddr_t			from;
+	socklen_t			fromlen;
+	struct pollfd		pfd;
+	netQueryHandler_t	handler;
+	netadr_t			adr;
+	int					ret, len;
+
+	pfd.fd = shard->socket;
+	pfd.events = POLLIN;
+
+	while ( !queryStop ) {
+		// wake up periodically to check for shutdown
+		if ( poll( &pfd, 1, 100 ) <= 0 )
+			continue;
+
+		fromlen = sizeof( from );
+		ret = recvfrom( shard->socket, data, MAX_MSGLEN, 0, (struct sockaddr *) &from, &fromlen );
+		if ( ret <= 0 || ret >= MAX_MSGLEN )
+			continue;
+
+		memset( &from.v4.sin_zero, 0, sizeof( from.v4.sin_zero ) );
+		adr.type = NA_BAD;
+		SockadrToNetadr( &from, &adr );
+
+		handler = queryHandler;
+		len = handler ? handler( &adr, data, ret, reply, sizeof( reply ) ) : -1;
+
+		if ( len > 0 ) {
+			// errors are ignored, just like for out-of-band replies
+			sendto( shard->socket, reply, len, 0, (struct sockaddr *) &from, fromlen );
+		} else if ( len < 0 ) {
+			NET_QueryForward( shard, &adr, data, ret );
+		}
+	}
+}
+
+
+/*
+====================
+NET_CloseQueryShards
+====================
+*/
+static void NET_CloseQueryShards( void )
+{
+	int i;
+
+	queryStop = 1;
+
+	for ( i = 0; i < numQueryShards; i++ ) {
+		if ( queryShards[i].thread ) {
+			Sys_JoinThread( queryShards[i].thread );
+			queryShards[i].thread = NULL;
+		}
+		if ( queryShards[i].socket != INVALID_SOCKET ) {
+			closesocket( queryShards[i].socket );
+			queryShards[i].socket = INVALID_SOCKET;
+		}
+	}
+
+	numQueryShards = 0;
+
+	if ( query_event_fd != -1 ) {
+		close( query_event_fd );
+		query_event_fd = -1;
+	}
+}
+
+
+/*
+====================
+NET_OpenQueryShards
+
+Re-opens free game port in SO_REUSEPORT mode and adds query sockets to it,
+returns new ip_socket
+====================
+*/
+static SOCKET NET_OpenQueryShards( SOCKET probe, int port )
+{
+	struct sock_filter code[] = {
+		BPF_STMT( BPF_LD | BPF_W | BPF_ABS, 0 ),					// first 4 bytes of UDP payload
+		BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, 0xFFFFFFFF, 1, 0 ),	// connectionless?
+		BPF_STMT( BPF_RET | BPF_K, 0 ),								// no, game socket
+		BPF_STMT( BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU ),
+		BPF_STMT( BPF_ALU | BPF_MOD | BPF_K, 1 ),					// patched with number of shards
+		BPF_STMT( BPF_ALU | BPF_ADD | BPF_K, 1 ),
+		BPF_STMT( BPF_RET | BPF_A, 0 ),
+	};
+	struct sock_fprog prog;
+	SOCKET s;
+	int i, count, err, one = 1;
+
+	count = net_queryShards->integer;
+	if ( count > MAX_QUERY_SHARDS )
+		count = MAX_QUERY_SHARDS;
+
+	// probe socket was bound without SO_REUSEPORT so we know that
+	// no other server shares this port, it is kept as game socket
+	// without unbinding to not let anyone else take the port meanwhile,
+	// socket index in the group is defined by join order so it goes first
+	s = probe;
+	if ( setsockopt( s, SOL_SOCKET, SO_REUSEPORT, (char *) &one, sizeof( one ) ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_OpenQueryShards: setsockopt SO_REUSEPORT: %s\n", NET_ErrorString() );
+		return s;
+	}
+
+	queryStop = 0;
+
+	for ( numQueryShards = 0; numQueryShards < count; numQueryShards++ ) {
+		queryShards[ numQueryShards ].thread = NULL;
+		queryShards[ numQueryShards ].head = 0;
+		queryShards[ numQueryShards ].tail = 0;
+		queryShards[ numQueryShards ].forwarded = 0;
+		queryShards[ numQueryShards ].dropped = 0;
+		queryShards[ numQueryShards ].socket = NET_IPSocket( net_ip->string, port, qtrue, &err );
+		if ( queryShards[ numQueryShards ].socket == INVALID_SOCKET )
+			goto fail;
+	}
+
+	code[4].k = count;
+	prog.len = ARRAY_LEN( code );
+	prog.filter = code;
+
+	if ( setsockopt( s, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof( prog ) ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_OpenQueryShards: setsockopt SO_ATTACH_REUSEPORT_CBPF: %s\n", NET_ErrorString() );
+		goto fail;
+	}
+
+	query_event_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	if ( query_event_fd == -1 ) {
+		Com_Printf( "WARNING: NET_OpenQueryShards: eventfd: %s\n", NET_ErrorString() );
+		goto fail;
+	}
+
+	for ( i = 0; i < count; i++ ) {
+		queryShards[i].thread = Sys_CreateThread( NET_QueryThread, &queryShards[i] );
+		if ( !queryShards[i].thread ) {
+			Com_Printf( "WARNING: NET_OpenQueryShards: couldn't create thread\n" );
+			goto fail;
+		}
+	}
+
+	Com_Printf( "Connectionless packets are handled by %i query thread%s\n", count, count > 1 ? "s" : "" );
+
+	return s;
+
+fail:
+	NET_CloseQueryShards();
+	// don't let other sockets join the port later
+	one = 0;
+	setsockopt( s, SOL_SOCKET, SO_REUSEPORT, (char *) &one, sizeof( one ) );
+	return s;
+}
+
+
+/*
+====================
+NET_QueryDrain
+
+Processes packets forwarded by query threads
+====================
+*/
+static void NET_QueryDrain( void )
+{
+	byte			bufData[ MAX_MSGLEN_BUF ];
+	queryShard_t	*shard;
+	queryPacket_t	*p;
+	netadr_t		from;
+	msg_t			netmsg;
+	uint64_t		count;
+	int				i;
+
+	if ( read( query_event_fd, &count, sizeof( count ) ) != sizeof( count ) ) {
+		// not signalled
+	}
+
+	for ( i = 0; i < numQueryShards; i++ ) {
+		shard = &queryShards[i];
+		while ( shard->tail != Sys_AtomicAdd( &shard->head, 0 ) ) {
+			p = &shard->queue[ shard->tail & ( QUERY_QUEUE_SIZE - 1 ) ];
+			MSG_Init( &netmsg, bufData, MAX_MSGLEN );
+			memcpy( netmsg.data, p->data, p->length );
+			netmsg.cursize = p->length;
+			from = p->from;
+			// release slot before processing
+			Sys_AtomicAdd( &shard->tail, 1 );
+			NET_PacketEvent( &from, &netmsg );
+		}
+	}
+}
+#endif // USE_QUERY_SHARDS
+
+
+/*
+====================
+NET_SetQueryHandler
+
+Installs connectionless packet handler for query threads
+====================
+*/
+void NET_SetQueryHandler( netQueryHandler_t handler )
+{
+#ifdef USE_QUERY_SHARDS
+	queryHandler = handler;
+#endif
+}
+
+
+/*
+====================
+NET_QueryThreads
+
+Returns number of running query threads
+====================
+*/
+int NET_QueryThreads( void )
+{
+#ifdef USE_QUERY_SHARDS
+	return numQueryShards;
+#else
+	return 0;
+#endif
+}
+
+
 /*
 ====================
 NET_OpenIP
@@ -1605,10 +2471,15 @@ static void NET_OpenIP( void ) {
 	if(net_enabled->integer & NET_ENABLEV4)
 	{
 		for( i = 0 ; i < 10 ; i++ ) {
-			ip_socket = NET_IPSocket( net_ip->string, port + i, &err );
+			ip_socket = NET_IPSocket( net_ip->string, port + i, qfalse, &err );
 			if (ip_socket != INVALID_SOCKET) {
 				Cvar_SetIntegerValue( "net_port", port + i );
 
+#ifdef USE_QUERY_SHARDS
+				if (net_queryShards->integer && !net_socksEnabled->integer)
+					ip_socket = NET_OpenQueryShards( ip_socket, port + i );
+#endif
+
 				if (net_socksEnabled->integer)
 					NET_OpenSocks( port + i );
 
@@ -1624,6 +2495,10 @@ static void NET_OpenIP( void ) {
 		if(ip_socket == INVALID_SOCKET)
 			Com_Printf( "WARNING: Couldn't bind to a v4 ip address.\n");
 	}
+
+#ifdef USE_EPOLL
+	NET_PollOpen();
+#endif
 }
 
 
@@ -1729,6 +2604,30 @@ static qboolean NET_GetCvars( void ) {
 	net_dropsim = Cvar_Get( "net_dropsim", "", CVAR_TEMP );
 	Cvar_SetDescription( net_dropsim, "Simulated packet drops." );
 
+#ifdef USE_EPOLL
+	net_poll = Cvar_Get( "net_poll", "1", CVAR_LATCH | CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( net_poll, "0", "1", CV_INTEGER );
+	Cvar_SetDescription( net_poll, "Network event loop backend:\n"
+		" 0 - select()\n"
+		" 1 - epoll with timerfd timeouts" );
+	modified += net_poll->modified;
+	net_poll->modified = qfalse;
+#endif
+
+#ifdef USE_QUERY_SHARDS
+	net_queryShards = Cvar_Get( "net_queryShards", "0", CVAR_LATCH | CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( net_queryShards, "0", XSTRING( MAX_QUERY_SHARDS ), CV_INTEGER );
+	Cvar_SetDescription( net_queryShards, "Number of SO_REUSEPORT sockets on the IPv4 game port which receive connectionless packets, each served by its own thread so server queries do not delay game frames." );
+	modified += net_queryShards->modified;
+	net_queryShards->modified = qfalse;
+#endif
+
+#ifdef USE_MMSG
+	net_batch = Cvar_Get( "net_batch", "1", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( net_batch, "0", "1", CV_INTEGER );
+	Cvar_SetDescription( net_batch, "Receive and send multiple UDP packets per system call with recvmmsg()/sendmmsg()." );
+#endif
+
 	return modified ? qtrue : qfalse;
 }
 
@@ -1780,6 +2679,19 @@ static void NET_Config( qboolean enableNetworking ) {
 	}
 
 	if( stop ) {
+		Sys_FlushPacketBatch();
+#ifdef USE_EPOLL
+		NET_PollClose();
+#endif
+#ifdef USE_QUERY_SHARDS
+		NET_CloseQueryShards();
+#endif
+#ifdef USE_MMSG
+		ip_recvBatch.count = ip_recvBatch.current = 0;
+#ifdef USE_IPV6
+		ip6_recvBatch.count = ip6_recvBatch.current = 0;
+#endif
+#endif
 		if ( ip_socket != INVALID_SOCKET ) {
 			closesocket( ip_socket );
 			ip_socket = INVALID_SOCKET;
@@ -1840,6 +2752,10 @@ void NET_Init( void ) {
 	NET_Config( qtrue );
 	
 	Cmd_AddCommand( "net_restart", NET_Restart_f );
+	Cmd_AddCommand( "net_bench", NET_Bench_f );
+#ifdef USE_EPOLL
+	Cmd_AddCommand( "net_pollStats", NET_PollStats_f );
+#endif
 }
 
 
@@ -1849,6 +2765,8 @@ NET_Shutdown
 ====================
 */
 void NET_Shutdown( void ) {
+	NET_SwarmFree();
+
 	if ( !networkingEnabled ) {
 		return;
 	}
@@ -1862,6 +2780,45 @@ void NET_Shutdown( void ) {
 }
 
 
+/*
+====================
+NET_PacketEvent
+====================
+*/
+static void NET_PacketEvent( const netadr_t *from, msg_t *msg )
+{
+	if ( net_dropsim->value > 0.0f && net_dropsim->value <= 100.0f )
+	{
+		// com_dropsim->value percent of incoming packets get dropped.
+		if ( rand() < (int) (((double) RAND_MAX) / 100.0 * (double) net_dropsim->value) )
+			return; // drop this packet
+	}
+
+	if ( NET_ImpairIncoming( from, msg ) )
+		return; // dropped or delayed
+
+	NET_DispatchPacket( from, msg );
+}
+
+
+/*
+====================
+NET_DispatchPacket
+====================
+*/
+void NET_DispatchPacket( const netadr_t *from, msg_t *msg )
+{
+#ifdef DEDICATED
+	Com_RunAndTimeServerPacket( from, msg );
+#else
+	if ( com_sv_running->integer || com_dedicated->integer )
+		Com_RunAndTimeServerPacket( from, msg );
+	else
+		CL_PacketEvent( from, msg );
+#endif
+}
+
+
 /*
 ====================
 NET_Event
@@ -1874,33 +2831,139 @@ static void NET_Event( const fd_set *fdr )
 	byte bufData[ MAX_MSGLEN_BUF ];
 	netadr_t from;
 	msg_t netmsg;
-	
+
+#ifdef USE_QUERY_SHARDS
+	if ( query_event_fd != -1 && FD_ISSET( query_event_fd, fdr ) )
+		NET_QueryDrain();
+#endif
+
 	while( 1 )
 	{
 		MSG_Init( &netmsg, bufData, MAX_MSGLEN );
 
 		if ( NET_GetPacket( &from, &netmsg, fdr ) )
-		{
-			if ( net_dropsim->value > 0.0f && net_dropsim->value <= 100.0f )
-			{
-				// com_dropsim->value percent of incoming packets get dropped.
-				if ( rand() < (int) (((double) RAND_MAX) / 100.0 * (double) net_dropsim->value) )
-					continue; // drop this packet
+			NET_PacketEvent( &from, &netmsg );
+		else
+			break;
+	}
+}
+
+
+#ifdef USE_EPOLL
+/*
+====================
+NET_PollWait
+
+epoll_wait() with timerfd-based timeout, in microseconds
+====================
+*/
+static qboolean NET_PollWait( int timeout )
+{
+	struct epoll_event events[ 8 ];
+	struct itimerspec its;
+	qboolean network;
+	uint64_t expirations;
+	fd_set fdr;
+	int i, n, fd, handled;
+
+	NET_PollConsole();
+
+	if ( timeout > 0 ) {
+		// re-arming also clears expirations left from previous wait
+		memset( &its, 0, sizeof( its ) );
+		its.it_value.tv_sec = timeout / 1000000;
+		its.it_value.tv_nsec = ( timeout % 1000000 ) * 1000;
+		timerfd_settime( timer_fd, 0, &its, NULL );
+	}
+
+	n = epoll_wait( epoll_fd, events, ARRAY_LEN( events ), timeout > 0 ? -1 : 0 );
+
+	if ( n == -1 ) {
+		if ( errno != EINTR )
+			Com_Printf( S_COLOR_YELLOW "Warning: epoll_wait() syscall failed: %s\n", strerror( errno ) );
+		return qtrue;
+	}
+
+	pollStats.wakeups++;
+
+	network = qfalse;
+	handled = 0;
+
+	FD_ZERO( &fdr );
+
+	for ( i = 0; i < n; i++ ) {
+		fd = events[i].data.fd;
+		if ( fd == timer_fd ) {
+			if ( read( timer_fd, &expirations, sizeof( expirations ) ) ) {
+				// timer is one-shot
+			}
+		} else if ( fd == STDIN_FILENO && pollConsole == 1 ) {
+			if ( ( events[i].events & ( EPOLLERR | EPOLLHUP ) ) && !( events[i].events & EPOLLIN ) ) {
+				// nothing left to read
+				NET_PollRemove( STDIN_FILENO );
+				pollConsole = -1;
 			}
+			handled++;
+		} else {
+			FD_SET( fd, &fdr );
+			network = qtrue;
+			handled++;
+		}
+	}
 
-#ifdef DEDICATED
-			Com_RunAndTimeServerPacket( &from, &netmsg );
-#else
-			if ( com_sv_running->integer || com_dedicated->integer )
-				Com_RunAndTimeServerPacket( &from, &netmsg );
-			else
-				CL_PacketEvent( &from, &netmsg );
-#endif
+	if ( handled == 0 ) {
+		pollStats.timeouts++;
+		return qtrue;
+	}
+
+	pollStats.events += handled;
+	if ( handled > pollStats.maxEvents )
+		pollStats.maxEvents = handled;
+
+	if ( network ) {
+		NET_Event( &fdr );
+	}
+
+	return qfalse;
+}
+
+
+/*
+====================
+NET_PollStats_f
+====================
+*/
+static void NET_PollStats_f( void )
+{
+	uint64_t active;
+#ifdef USE_QUERY_SHARDS
+	int i;
+
+	for ( i = 0; i < numQueryShards; i++ ) {
+		Com_Printf( "Query thread %i: %i forwarded, %i dropped\n", i, queryShards[i].forwarded, queryShards[i].dropped );
+		if ( Cmd_Argc() > 1 && !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+			queryShards[i].forwarded = queryShards[i].dropped = 0;
 		}
-		else
-			break;
+	}
+#endif
+
+	if ( epoll_fd == -1 ) {
+		Com_Printf( "Event loop: select()\n" );
+		return;
+	}
+
+	active = pollStats.wakeups - pollStats.timeouts;
+
+	Com_Printf( "Event loop: epoll%s\n", pollConsole == 1 ? " + console" : "" );
+	Com_Printf( "  wakeups: %llu (%llu on timeout)\n", (unsigned long long)pollStats.wakeups, (unsigned long long)pollStats.timeouts );
+	Com_Printf( "   events: %llu, %.2f avg, %i max per wakeup\n", (unsigned long long)pollStats.events,
+		active ? (double)pollStats.events / active : 0.0, pollStats.maxEvents );
+
+	if ( Cmd_Argc() > 1 && !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		memset( &pollStats, 0, sizeof( pollStats ) );
 	}
 }
+#endif // USE_EPOLL
 
 
 /*
@@ -1922,6 +2985,23 @@ qboolean NET_Sleep( int timeout )
 	if ( timeout < 0 )
 		timeout = 0;
 
+#ifdef USE_MMSG
+	// collected packets may be left unsent after error
+	Sys_FlushPacketBatch();
+
+	// process remaining datagrams from previous recvmmsg() calls
+	if ( NET_PendingPackets( &fdr ) ) {
+		NET_Event( &fdr );
+		return qfalse;
+	}
+#endif
+
+#ifdef USE_EPOLL
+	if ( epoll_fd != -1 ) {
+		return NET_PollWait( timeout );
+	}
+#endif
+
 	FD_ZERO( &fdr );
 
 	if ( ip_socket != INVALID_SOCKET )
@@ -1941,7 +3021,17 @@ qboolean NET_Sleep( int timeout )
 	}
 #endif
 
-	if ( highestfd == INVALID_SOCKET )
+#ifdef USE_QUERY_SHARDS
+	if ( query_event_fd != -1 )
+	{
+		FD_SET( query_event_fd, &fdr );
+
+		if ( highestfd == INVALID_SOCKET || query_event_fd > highestfd )
+			highestfd = query_event_fd;
+	}
+#endif
+
+	if ( highestfd == INVALID_SOCKET )
 	{
 #ifdef _WIN32
 		// windows ain't happy when select is called without valid FDs
@@ -1987,3 +3077,559 @@ static void NET_Restart_f( void )
 {
 	NET_Config( qtrue );
 }
+
+
+/*
+====================
+NET_OpenClientSocket
+
+Opens unbound non-blocking datagram socket for talking to a remote
+server from an ephemeral port, used by load generators
+====================
+*/
+intptr_t NET_OpenClientSocket( netadrtype_t type )
+{
+	SOCKET		newsocket;
+	ioctlarg_t	_true = 1;
+	int			family;
+
+	if ( !networkingEnabled ) {
+		return (intptr_t)INVALID_SOCKET;
+	}
+
+#ifdef USE_IPV6
+	family = ( type == NA_IP6 ) ? PF_INET6 : PF_INET;
+#else
+	if ( type != NA_IP ) {
+		return (intptr_t)INVALID_SOCKET;
+	}
+	family = PF_INET;
+#endif
+
+	if ( ( newsocket = socket( family, SOCK_DGRAM, IPPROTO_UDP ) ) == INVALID_SOCKET ) {
+		Com_Printf( "WARNING: NET_OpenClientSocket: socket: %s\n", NET_ErrorString() );
+		return (intptr_t)INVALID_SOCKET;
+	}
+
+	if ( ioctlsocket( newsocket, FIONBIO, &_true ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_OpenClientSocket: ioctl FIONBIO: %s\n", NET_ErrorString() );
+		closesocket( newsocket );
+		return (intptr_t)INVALID_SOCKET;
+	}
+
+	return (intptr_t)newsocket;
+}
+
+
+/*
+====================
+NET_CloseClientSocket
+====================
+*/
+void NET_CloseClientSocket( intptr_t sock )
+{
+	if ( (SOCKET)sock != INVALID_SOCKET ) {
+		closesocket( (SOCKET)sock );
+	}
+}
+
+
+/*
+====================
+NET_ClientSendTo
+====================
+*/
+qboolean NET_ClientSendTo( intptr_t sock, const netadr_t *to, const void *data, int length )
+{
+	sockaddr_t	addr;
+	socklen_t	addrlen;
+
+	memset( &addr, 0, sizeof( addr ) );
+	NetadrToSockadr( to, &addr );
+#ifdef USE_IPV6
+	addrlen = ( to->type == NA_IP6 ) ? sizeof( addr.v6 ) : sizeof( addr.v4 );
+#else
+	addrlen = sizeof( addr.v4 );
+#endif
+
+	if ( sendto( (SOCKET)sock, (const char *)data, length, 0, (const struct sockaddr *) &addr, addrlen ) == SOCKET_ERROR ) {
+		if ( socketError != EAGAIN ) {
+			NET_SendError( to->type );
+		}
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+
+/*
+====================
+NET_ClientRecvFrom
+
+Returns qfalse if there are no more pending datagrams on the socket
+====================
+*/
+qboolean NET_ClientRecvFrom( intptr_t sock, netadr_t *from, msg_t *msg )
+{
+	sockaddr_t	addr;
+	socklen_t	addrlen;
+	int			ret;
+
+	addrlen = sizeof( addr );
+	ret = recvfrom( (SOCKET)sock, (char *)msg->data, msg->maxsize, 0, (struct sockaddr *) &addr, &addrlen );
+	if ( ret == SOCKET_ERROR ) {
+		return qfalse;
+	}
+
+	memset( from, 0, sizeof( *from ) );
+	SockadrToNetadr( &addr, from );
+	msg->readcount = 0;
+	msg->cursize = ret;
+	if ( ret >= msg->maxsize ) {
+		// oversize datagram, caller should ignore it
+		msg->cursize = 0;
+	}
+
+	return qtrue;
+}
+
+
+/*
+====================
+NET_WaitClientSockets
+
+Waits up to usec microseconds for any of the sockets to become readable
+====================
+*/
+void NET_WaitClientSockets( const intptr_t *socks, int count, int usec )
+{
+	struct timeval	tv;
+	fd_set			fdr;
+	SOCKET			highestfd = INVALID_SOCKET;
+	int				i;
+
+	FD_ZERO( &fdr );
+
+	for ( i = 0; i < count; i++ ) {
+		if ( (SOCKET)socks[ i ] == INVALID_SOCKET ) {
+			continue;
+		}
+#ifndef _WIN32
+		// descriptor value is the limit here, unread sockets are still polled by caller
+		if ( (SOCKET)socks[ i ] >= FD_SETSIZE ) {
+			continue;
+		}
+#endif
+		FD_SET( (SOCKET)socks[ i ], &fdr );
+		if ( highestfd == INVALID_SOCKET || (SOCKET)socks[ i ] > highestfd ) {
+			highestfd = (SOCKET)socks[ i ];
+		}
+	}
+
+	tv.tv_sec = usec / 1000000;
+	tv.tv_usec = usec % 1000000;
+
+	if ( highestfd == INVALID_SOCKET ) {
+#ifdef _WIN32
+		Sleep( usec / 1000 );
+#else
+		usleep( usec );
+#endif
+		return;
+	}
+
+	select( highestfd + 1, &fdr, NULL, NULL, &tv );
+}
+
+
+/*
+====================
+NET_MaxClientSockets
+
+Number of sockets NET_WaitClientSockets() can wait for
+====================
+*/
+int NET_MaxClientSockets( void )
+{
+	return FD_SETSIZE;
+}
+
+
+/*
+====================
+NET_TCPListen
+
+Opens non-blocking IPv4 stream socket listening on net_ip interface
+====================
+*/
+intptr_t NET_TCPListen( int port )
+{
+	struct sockaddr_in	address;
+	SOCKET				newsocket;
+	ioctlarg_t			_true = 1;
+	int					i = 1;
+
+	if ( !networkingEnabled || !net_ip ) {
+		return (intptr_t)INVALID_SOCKET;
+	}
+
+	Com_Printf( "Opening TCP socket: %s:%i\n", net_ip->string, port );
+
+	if ( ( newsocket = socket( PF_INET, SOCK_STREAM, IPPROTO_TCP ) ) == INVALID_SOCKET ) {
+		Com_Printf( "WARNING: NET_TCPListen: socket: %s\n", NET_ErrorString() );
+		return (intptr_t)INVALID_SOCKET;
+	}
+
+	if ( ioctlsocket( newsocket, FIONBIO, &_true ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_TCPListen: ioctl FIONBIO: %s\n", NET_ErrorString() );
+		closesocket( newsocket );
+		return (intptr_t)INVALID_SOCKET;
+	}
+
+#ifndef _WIN32
+	// allow fast restart while old connections are in TIME_WAIT
+	setsockopt( newsocket, SOL_SOCKET, SO_REUSEADDR, (char *) &i, sizeof( i ) );
+#endif
+
+	if ( !Sys_StringToSockaddr( net_ip->string, (sockaddr_t *)&address, sizeof( address ), AF_INET, SOCK_STREAM ) ) {
+		closesocket( newsocket );
+		return (intptr_t)INVALID_SOCKET;
+	}
+	address.sin_port = htons( (unsigned short)port );
+
+	if ( bind( newsocket, (void *)&address, sizeof( address ) ) == SOCKET_ERROR || listen( newsocket, 16 ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_TCPListen: %s\n", NET_ErrorString() );
+		closesocket( newsocket );
+		return (intptr_t)INVALID_SOCKET;
+	}
+
+	return (intptr_t)newsocket;
+}
+
+
+/*
+====================
+NET_TCPAccept
+
+Returns non-blocking socket of pending connection or INVALID_SOCKET
+====================
+*/
+intptr_t NET_TCPAccept( intptr_t listener, netadr_t *from )
+{
+	sockaddr_t	addr;
+	socklen_t	addrlen;
+	SOCKET		newsocket;
+	ioctlarg_t	_true = 1;
+
+	addrlen = sizeof( addr );
+	newsocket = accept( (SOCKET)listener, (struct sockaddr *) &addr, &addrlen );
+	if ( newsocket == INVALID_SOCKET ) {
+		return (intptr_t)INVALID_SOCKET;
+	}
+
+	if ( ioctlsocket( newsocket, FIONBIO, &_true ) == SOCKET_ERROR ) {
+		closesocket( newsocket );
+		return (intptr_t)INVALID_SOCKET;
+	}
+
+#ifdef SO_NOSIGPIPE
+	// where MSG_NOSIGNAL is not available
+	setsockopt( newsocket, SOL_SOCKET, SO_NOSIGPIPE, (char *) &_true, sizeof( _true ) );
+#endif
+
+	memset( from, 0, sizeof( *from ) );
+	SockadrToNetadr( &addr, from );
+
+	return (intptr_t)newsocket;
+}
+
+
+/*
+====================
+NET_TCPRecv
+
+Returns number of received bytes, 0 if nothing is pending or -1 if connection is closed
+====================
+*/
+int NET_TCPRecv( intptr_t sock, void *data, int length )
+{
+	int ret;
+
+	ret = recv( (SOCKET)sock, (char *)data, length, 0 );
+	if ( ret == SOCKET_ERROR ) {
+		return ( socketError == EAGAIN ) ? 0 : -1;
+	}
+
+	return ( ret == 0 ) ? -1 : ret;
+}
+
+
+/*
+====================
+NET_TCPSend
+
+Returns number of queued bytes, 0 if send buffer is full or -1 on error
+====================
+*/
+int NET_TCPSend( intptr_t sock, const void *data, int length )
+{
+	int ret;
+
+	ret = send( (SOCKET)sock, (const char *)data, length, NET_SEND_FLAGS );
+	if ( ret == SOCKET_ERROR ) {
+		return ( socketError == EAGAIN ) ? 0 : -1;
+	}
+
+	return ret;
+}
+
+
+/*
+====================
+NET_TCPSendFile
+
+Sends length bytes of file starting from offset, file data is copied
+by kernel directly where sendfile() is available.
+Returns number of queued bytes, 0 if send buffer is full or -1 on error
+====================
+*/
+int NET_TCPSendFile( intptr_t sock, FILE *f, int offset, int length )
+{
+#ifdef __linux__
+	static const struct timespec nowait = { 0, 0 };
+	sigset_t pipeMask, oldMask, pending;
+	off_t	off = offset;
+	ssize_t	ret;
+	int		err;
+
+	// sendfile() has no MSG_NOSIGNAL, so SIGPIPE is blocked for this thread only
+	// and discarded if it was raised by this call
+	sigemptyset( &pipeMask );
+	sigaddset( &pipeMask, SIGPIPE );
+	sigpending( &pending );
+	pthread_sigmask( SIG_BLOCK, &pipeMask, &oldMask );
+
+	ret = sendfile( (SOCKET)sock, fileno( f ), &off, length );
+	err = errno;
+
+	if ( ret < 0 && err == EPIPE && !sigismember( &pending, SIGPIPE ) ) {
+		while ( sigtimedwait( &pipeMask, NULL, &nowait ) == -1 && errno == EINTR )
+			;
+	}
+	pthread_sigmask( SIG_SETMASK, &oldMask, NULL );
+
+	if ( ret < 0 ) {
+		return ( err == EAGAIN ) ? 0 : -1;
+	}
+
+	return (int)ret;
+#else
+	char	buf[ 16384 ];
+	int		ret;
+
+	if ( length > sizeof( buf ) ) {
+		length = sizeof( buf );
+	}
+
+	if ( fseek( f, offset, SEEK_SET ) != 0 || ( length = (int)fread( buf, 1, length, f ) ) <= 0 ) {
+		return -1;
+	}
+
+	// whatever is not accepted now will be read again from new offset
+	ret = send( (SOCKET)sock, buf, length, NET_SEND_FLAGS );
+	if ( ret == SOCKET_ERROR ) {
+		return ( socketError == EAGAIN ) ? 0 : -1;
+	}
+
+	return ret;
+#endif
+}
+
+
+/*
+====================
+NET_GetPrimaryAddress
+
+Finds first non-loopback local IPv4 address
+====================
+*/
+qboolean NET_GetPrimaryAddress( netadr_t *adr )
+{
+	int i;
+
+	for ( i = 0; i < numIP; i++ ) {
+		if ( localIP[i].type != NA_IP ) {
+			continue;
+		}
+		memset( adr, 0, sizeof( *adr ) );
+		SockadrToNetadr( &localIP[i].addr, adr );
+		if ( adr->ipv._4[0] != 127 ) {
+			return qtrue;
+		}
+	}
+
+	return qfalse;
+}
+
+
+/*
+====================
+NET_BenchRun
+
+Sends datagrams in bursts through the loopback interface,
+returns number of datagrams received back
+====================
+*/
+#define NET_BENCH_BURST 16
+
+static int NET_BenchRun( SOCKET tx, SOCKET rx, const sockaddr_t *addr, int count, int size, void *batch )
+{
+	byte		data[ MAX_MSGLEN_BUF ];
+	sockaddr_t	from;
+	socklen_t	fromlen;
+	int			i, n, sent, recvd, got;
+#ifdef USE_MMSG
+	netBatch_t	*sendBatch = (netBatch_t *)batch;
+	netBatch_t	*recvBatch = sendBatch + 1;
+#endif
+
+	memset( data, 0xAA, size );
+
+	for ( sent = recvd = 0; sent < count; sent += n ) {
+		n = MIN( count - sent, NET_BENCH_BURST );
+
+#ifdef USE_MMSG
+		if ( batch ) {
+			for ( i = 0; i < n; i++ )
+				NET_BatchQueue( sendBatch, data, size, addr, sizeof( addr->v4 ), NA_IP );
+			NET_BatchSend( sendBatch, tx );
+		}
+		else
+#endif
+		for ( i = 0; i < n; i++ ) {
+			if ( sendto( tx, (const char *)data, size, 0, (const struct sockaddr *) addr, sizeof( addr->v4 ) ) == SOCKET_ERROR )
+				NET_SendError( NA_IP );
+		}
+
+		for ( got = 0; got < n; ) {
+#ifdef USE_MMSG
+			if ( batch ) {
+				if ( NET_BatchRecv( recvBatch, rx ) > 0 ) {
+					got += recvBatch->count;
+					continue;
+				}
+			}
+			else
+#endif
+			{
+				fromlen = sizeof( from );
+				if ( recvfrom( rx, (char *)data, sizeof( data ), 0, (struct sockaddr *) &from, &fromlen ) != SOCKET_ERROR ) {
+					got++;
+					continue;
+				}
+			}
+			if ( socketError != EAGAIN ) {
+				break;
+			}
+			else {
+				// wait a bit for late datagrams before counting them as lost
+				struct timeval tv;
+				fd_set fdr;
+				FD_ZERO( &fdr );
+				FD_SET( rx, &fdr );
+				tv.tv_sec = 0;
+				tv.tv_usec = 100000;
+				if ( select( rx + 1, &fdr, NULL, NULL, &tv ) <= 0 )
+					break;
+			}
+		}
+
+		recvd += got;
+	}
+
+	return recvd;
+}
+
+
+/*
+====================
+NET_Bench_f
+
+Measures UDP throughput through the loopback interface
+with per-packet and batched system calls
+====================
+*/
+static void NET_Bench_f( void )
+{
+	SOCKET		tx, rx;
+	sockaddr_t	addr;
+	socklen_t	addrlen;
+	int64_t		start, usec;
+	int			count, size, recvd, err;
+	int			pass, passes;
+	void		*batch;
+
+	if ( !networkingEnabled ) {
+		Com_Printf( "Networking is not enabled.\n" );
+		return;
+	}
+
+	count = 100000;
+	size = MAX_PACKETLEN;
+
+	if ( Cmd_Argc() > 1 )
+		count = atoi( Cmd_Argv( 1 ) );
+	if ( Cmd_Argc() > 2 )
+		size = atoi( Cmd_Argv( 2 ) );
+
+	if ( count < NET_BENCH_BURST || size < 1 || size > MAX_PACKETLEN ) {
+		Com_Printf( "Usage: %s [packets] [size]\nPackets must be at least %i and size must be in range 1..%i\n",
+			Cmd_Argv( 0 ), NET_BENCH_BURST, MAX_PACKETLEN );
+		return;
+	}
+
+	tx = NET_IPSocket( "127.0.0.1", 0, qfalse, &err );
+	if ( tx == INVALID_SOCKET )
+		return;
+
+	rx = NET_IPSocket( "127.0.0.1", 0, qfalse, &err );
+	if ( rx == INVALID_SOCKET ) {
+		closesocket( tx );
+		return;
+	}
+
+	addrlen = sizeof( addr );
+	if ( getsockname( rx, (struct sockaddr *) &addr, &addrlen ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_Bench: getsockname: %s\n", NET_ErrorString() );
+		closesocket( rx );
+		closesocket( tx );
+		return;
+	}
+
+	Com_Printf( "Sending %i packets of %i bytes to 127.0.0.1:%i\n", count, size, ntohs( addr.v4.sin_port ) );
+
+#ifdef USE_MMSG
+	batch = Z_Malloc( sizeof( netBatch_t ) * 2 );
+	passes = batchUnsupported ? 1 : 2;
+#else
+	batch = NULL;
+	passes = 1;
+#endif
+
+	for ( pass = 0; pass < passes; pass++ ) {
+		start = Sys_Microseconds();
+		recvd = NET_BenchRun( tx, rx, &addr, count, size, pass ? batch : NULL );
+		usec = Sys_Microseconds() - start;
+		if ( usec < 1 )
+			usec = 1;
+		Com_Printf( "%10s: %8i packets/sec, %i lost\n", pass ? "batched" : "per-packet",
+			(int)( recvd * 1000000LL / usec ), count - recvd );
+	}
+
+	if ( batch )
+		Z_Free( batch );
+
+	closesocket( rx );
+	closesocket( tx );
+}
@@ -0,0 +1,946 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// net_swarm.c -- headless synthetic clients for server load testing
+
+#include "q_shared.h"
+#include "qcommon.h"
+
+/*
+=============================================================================
+
+Each swarm client owns a datagram socket and walks through the regular
+getchallenge/connect/gamestate handshake using the new protocol, then
+sends usercmd packets at fixed rate. Server messages go through the
+regular Netchan_Process() path, server commands and gamestate are parsed
+to keep acknowledges and usercmd keys valid, snapshots are only counted
+because nothing is rendered.
+
+Target server should run with sv_pure 0 and sv_maxclientsPerIP at least
+equal to the number of swarm clients.
+
+=============================================================================
+*/
+
+#define SWARM_MAX_CLIENTS		256
+#define SWARM_RESEND_TIME		1000	// for challenge and connect requests
+#define SWARM_CONNECT_INTERVAL	250		// stay below per-address rate limits on server
+#define SWARM_REPORT_INTERVAL	5000
+#define SWARM_MAX_SCRIPT		256
+#define SWARM_TIMEOUT			10000
+
+typedef enum {
+	SWARM_IDLE,
+	SWARM_CHALLENGING,
+	SWARM_CONNECTING,
+	SWARM_CONNECTED,	// waiting for gamestate
+	SWARM_PRIMED,		// waiting for first snapshot
+	SWARM_ACTIVE,
+	SWARM_DROPPED
+} swarmState_t;
+
+static const char *swarmStateNames[] = {
+	"idle",
+	"challenging",
+	"connecting",
+	"connected",
+	"primed",
+	"active",
+	"dropped"
+};
+
+typedef struct {
+	int			msec;
+	int			forwardmove;
+	int			rightmove;
+	int			upmove;
+	float		yaw;		// degrees per second
+	float		pitch;
+	int			buttons;
+} swarmMove_t;
+
+typedef struct {
+	swarmState_t state;
+	intptr_t	sock;
+	netchan_t	netchan;
+
+	int			qport;
+	int			clientChallenge;
+	int			challenge;
+	int			lastRequestTime;
+	int			lastPacketTime;
+	int			nextPacketTime;
+
+	// server state needed to build valid client messages
+	int			serverId;
+	int			checksumFeed;
+	int			serverMessageSequence;
+	int			serverCommandSequence;
+	int			commandKeys[ MAX_RELIABLE_COMMANDS ];
+	int			snapMessageNum;
+	int			serverTime;
+	int			snapTime;
+
+	// only disconnect command is ever sent
+	int			reliableSequence;
+	int			reliableAcknowledge;
+
+	usercmd_t	cmds[ 2 ];	// current and previous one, for redundancy
+	int			cmdNumber;
+	float		viewangles[ 2 ];
+	int			moveIndex;
+	int			moveTime;
+	swarmMove_t	randomMove;
+
+	// statistics
+	int			activeTime;
+	int			transit;
+	float		jitter;
+	int			snapshots, totalSnapshots;
+	int			bytes, totalBytes;
+	int			received, totalReceived;
+	int			lost, totalLost;
+
+	char		error[ 96 ];
+} swarmClient_t;
+
+static netadr_t		swarmServer;
+static swarmMove_t	swarmScript[ SWARM_MAX_SCRIPT ];
+static int			swarmScriptLength;
+
+// kept outside of NET_Swarm_f() so Com_Error() during the run doesn't leak them
+static swarmClient_t *swarmClients;
+static int			swarmNumClients;
+
+
+/*
+=================
+NET_SwarmDrop
+=================
+*/
+static void NET_SwarmDrop( swarmClient_t *cl, const char *reason ) {
+	cl->state = SWARM_DROPPED;
+	Q_strncpyz( cl->error, reason, sizeof( cl->error ) );
+}
+
+
+/*
+=================
+NET_SwarmSendOOB
+=================
+*/
+static void NET_SwarmSendOOB( swarmClient_t *cl, const char *text ) {
+	char	data[ MAX_PACKETLEN ];
+	int		len;
+
+	data[0] = data[1] = data[2] = data[3] = -1;
+	len = Com_sprintf( data + 4, sizeof( data ) - 4, "%s", text ) + 4;
+
+	NET_ClientSendTo( cl->sock, &swarmServer, data, len );
+}
+
+
+/*
+=================
+NET_SwarmSendConnect
+
+Same as NET_OutOfBandCompress() but through client socket
+=================
+*/
+static void NET_SwarmSendConnect( swarmClient_t *cl, int index ) {
+	char	info[ MAX_INFO_STRING ];
+	byte	data[ MAX_INFO_STRING * 2 ];
+	msg_t	mbuf;
+	int		len;
+
+	info[0] = '\0';
+	Info_SetValueForKey( info, "name", va( "swarm%i", index ) );
+	Info_SetValueForKey( info, "rate", "25000" );
+	Info_SetValueForKey( info, "snaps", "40" );
+	Info_SetValueForKey( info, "protocol", XSTRING( NEW_PROTOCOL_VERSION ) );
+	Info_SetValueForKey( info, "qport", va( "%i", cl->qport ) );
+	Info_SetValueForKey( info, "challenge", va( "%i", cl->challenge ) );
+	Info_SetValueForKey( info, "client", Q3_VERSION );
+
+	data[0] = data[1] = data[2] = data[3] = 0xff;
+	len = Com_sprintf( (char *)data + 4, sizeof( data ) - 4, "connect \"%s\"", info );
+
+	mbuf.data = data;
+	mbuf.cursize = len + 4;
+	Huff_Compress( &mbuf, 12 );
+
+	NET_ClientSendTo( cl->sock, &swarmServer, mbuf.data, mbuf.cursize );
+}
+
+
+/*
+=================
+NET_SwarmTransmit
+
+Client side of Netchan_Transmit(), messages are never fragmented
+=================
+*/
+static void NET_SwarmTransmit( swarmClient_t *cl, const msg_t *buf ) {
+	netchan_t	*chan = &cl->netchan;
+	byte		send_buf[ MAX_PACKETLEN + 8 ];
+	msg_t		send;
+
+	MSG_InitOOB( &send, send_buf, sizeof( send_buf ) - 8 );
+
+	MSG_WriteLong( &send, chan->outgoingSequence );
+	MSG_WriteShort( &send, cl->qport );
+	MSG_WriteLong( &send, NETCHAN_GENCHECKSUM( chan->challenge, chan->outgoingSequence ) );
+
+	chan->outgoingSequence++;
+
+	MSG_WriteData( &send, buf->data, buf->cursize );
+
+	NET_ClientSendTo( cl->sock, &chan->remoteAddress, send.data, send.cursize );
+
+	chan->lastSentTime = Sys_Milliseconds();
+	chan->lastSentSize = send.cursize;
+}
+
+
+/*
+=================
+NET_SwarmNextMove
+
+Advances scripted or random movement and builds new usercmd
+=================
+*/
+static void NET_SwarmNextMove( swarmClient_t *cl, int now, int msec ) {
+	const swarmMove_t *move;
+	usercmd_t *cmd;
+
+	if ( swarmScriptLength ) {
+		move = &swarmScript[ cl->moveIndex ];
+		if ( now - cl->moveTime >= move->msec ) {
+			cl->moveIndex = ( cl->moveIndex + 1 ) % swarmScriptLength;
+			cl->moveTime = now;
+			move = &swarmScript[ cl->moveIndex ];
+		}
+	} else {
+		move = &cl->randomMove;
+		if ( now - cl->moveTime >= move->msec ) {
+			cl->moveTime = now;
+			cl->randomMove.msec = 200 + rand() % 800;
+			cl->randomMove.forwardmove = ( rand() % 3 - 1 ) * 127;
+			cl->randomMove.rightmove = ( rand() % 3 - 1 ) * 127;
+			cl->randomMove.upmove = ( rand() % 10 == 0 ) ? 127 : 0;
+			cl->randomMove.yaw = (float)( rand() % 361 - 180 );
+			cl->randomMove.pitch = 0.0f;
+			cl->randomMove.buttons = ( rand() % 4 == 0 ) ? BUTTON_ATTACK : 0;
+		}
+	}
+
+	cl->viewangles[ YAW ] = AngleNormalize360( cl->viewangles[ YAW ] + move->yaw * msec * 0.001f );
+	cl->viewangles[ PITCH ] += move->pitch * msec * 0.001f;
+	if ( cl->viewangles[ PITCH ] > 80.0f )
+		cl->viewangles[ PITCH ] = 80.0f;
+	else if ( cl->viewangles[ PITCH ] < -80.0f )
+		cl->viewangles[ PITCH ] = -80.0f;
+
+	cl->cmds[ 0 ] = cl->cmds[ 1 ];
+	cmd = &cl->cmds[ 1 ];
+	Com_Memset( cmd, 0, sizeof( *cmd ) );
+
+	// estimate current server time from the last snapshot
+	cmd->serverTime = cl->serverTime + ( now - cl->snapTime );
+	if ( cmd->serverTime - cl->cmds[ 0 ].serverTime <= 0 ) {
+		cmd->serverTime = cl->cmds[ 0 ].serverTime + 1;
+	}
+	cmd->angles[ YAW ] = ANGLE2SHORT( cl->viewangles[ YAW ] );
+	cmd->angles[ PITCH ] = ANGLE2SHORT( cl->viewangles[ PITCH ] );
+	cmd->forwardmove = move->forwardmove;
+	cmd->rightmove = move->rightmove;
+	cmd->upmove = move->upmove;
+	cmd->buttons = move->buttons;
+	cmd->weapon = 2; // WP_MACHINEGUN in baseq3
+
+	cl->cmdNumber++;
+}
+
+
+/*
+=================
+NET_SwarmWritePacket
+
+Mirrors CL_WritePacket()
+=================
+*/
+static void NET_SwarmWritePacket( swarmClient_t *cl, const char *command ) {
+	byte		data[ MAX_PACKETLEN ];
+	msg_t		buf;
+	usercmd_t	nullcmd;
+	const usercmd_t *oldcmd;
+	int			i, count, key;
+
+	MSG_Init( &buf, data, sizeof( data ) );
+
+	MSG_Bitstream( &buf );
+	MSG_WriteLong( &buf, cl->serverId );
+	MSG_WriteLong( &buf, cl->serverMessageSequence );
+	MSG_WriteLong( &buf, cl->serverCommandSequence );
+
+	if ( command && cl->reliableSequence != cl->reliableAcknowledge ) {
+		MSG_WriteByte( &buf, clc_clientCommand );
+		MSG_WriteLong( &buf, cl->reliableSequence );
+		MSG_WriteString( &buf, command );
+	}
+
+	count = MIN( cl->cmdNumber, ARRAY_LEN( cl->cmds ) );
+	if ( count > 0 && cl->state >= SWARM_PRIMED ) {
+		// claim delta source only if last message did carry a snapshot
+		if ( cl->snapMessageNum == cl->serverMessageSequence && cl->state == SWARM_ACTIVE ) {
+			MSG_WriteByte( &buf, clc_move );
+		} else {
+			MSG_WriteByte( &buf, clc_moveNoDelta );
+		}
+
+		MSG_WriteByte( &buf, count );
+
+		key = cl->checksumFeed;
+		key ^= cl->serverMessageSequence;
+		key ^= cl->commandKeys[ cl->serverCommandSequence & ( MAX_RELIABLE_COMMANDS - 1 ) ];
+
+		Com_Memset( &nullcmd, 0, sizeof( nullcmd ) );
+		oldcmd = &nullcmd;
+		for ( i = ARRAY_LEN( cl->cmds ) - count; i < ARRAY_LEN( cl->cmds ); i++ ) {
+			MSG_WriteDeltaUsercmdKey( &buf, key, oldcmd, &cl->cmds[ i ] );
+			oldcmd = &cl->cmds[ i ];
+		}
+	}
+
+	MSG_WriteByte( &buf, clc_EOF );
+
+	NET_SwarmTransmit( cl, &buf );
+}
+
+
+/*
+=================
+NET_SwarmSystemInfo
+=================
+*/
+static void NET_SwarmSystemInfo( swarmClient_t *cl, const char *info ) {
+	const char *s;
+
+	s = Info_ValueForKey( info, "sv_serverid" );
+	if ( *s ) {
+		cl->serverId = atoi( s );
+	}
+}
+
+
+/*
+=================
+NET_SwarmServerCommand
+=================
+*/
+static void NET_SwarmServerCommand( swarmClient_t *cl, msg_t *msg ) {
+	char	info[ BIG_INFO_STRING ];
+	char	prefix[ 16 ];
+	const char *s;
+	int		seq;
+	int		len;
+
+	seq = MSG_ReadLong( msg );
+	s = MSG_ReadString( msg );
+
+	if ( cl->serverCommandSequence - seq >= 0 ) {
+		return; // already received
+	}
+
+	cl->serverCommandSequence = seq;
+	cl->commandKeys[ seq & ( MAX_RELIABLE_COMMANDS - 1 ) ] = MSG_HashKey( s, 32 );
+
+	if ( !Q_strncmp( s, "disconnect", 10 ) ) {
+		NET_SwarmDrop( cl, s );
+		return;
+	}
+
+	// serverId may be updated without new gamestate
+	len = Com_sprintf( prefix, sizeof( prefix ), "cs %i \"", CS_SYSTEMINFO );
+	if ( !Q_strncmp( s, prefix, len ) ) {
+		Q_strncpyz( info, s + len, sizeof( info ) );
+		len = (int)strlen( info );
+		if ( len > 0 && info[ len - 1 ] == '"' ) {
+			info[ len - 1 ] = '\0';
+		}
+		NET_SwarmSystemInfo( cl, info );
+	}
+}
+
+
+/*
+=================
+NET_SwarmGamestate
+
+Mirrors CL_ParseGamestate()
+=================
+*/
+static qboolean NET_SwarmGamestate( swarmClient_t *cl, msg_t *msg ) {
+	entityState_t	nullstate, es;
+	const char		*s;
+	int				cmd, i;
+
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+
+	cl->serverCommandSequence = MSG_ReadLong( msg );
+
+	while ( 1 ) {
+		cmd = MSG_ReadByte( msg );
+
+		if ( cmd == svc_EOF ) {
+			break;
+		}
+
+		if ( cmd == svc_configstring ) {
+			i = MSG_ReadShort( msg );
+			s = MSG_ReadBigString( msg );
+			if ( i == CS_SYSTEMINFO ) {
+				NET_SwarmSystemInfo( cl, s );
+			}
+		} else if ( cmd == svc_baseline ) {
+			i = MSG_ReadEntitynum( msg );
+			if ( i < 0 || i >= MAX_GENTITIES ) {
+				return qfalse;
+			}
+			MSG_ReadDeltaEntity( msg, &nullstate, &es, i );
+		} else {
+			return qfalse;
+		}
+	}
+
+	/* clientNum = */ MSG_ReadLong( msg );
+	cl->checksumFeed = MSG_ReadLong( msg );
+
+	cl->state = SWARM_PRIMED;
+	cl->serverTime = 0;
+	cl->snapTime = Sys_Milliseconds();
+
+	return qtrue;
+}
+
+
+/*
+=================
+NET_SwarmSnapshot
+
+Snapshot contents are not decoded, only arrival statistics are updated
+=================
+*/
+static void NET_SwarmSnapshot( swarmClient_t *cl, msg_t *msg, int now ) {
+	int transit, d;
+
+	cl->serverTime = MSG_ReadLong( msg );
+	cl->snapTime = now;
+	cl->snapMessageNum = cl->serverMessageSequence;
+
+	// interarrival jitter as in RFC 3550
+	transit = now - cl->serverTime;
+	if ( cl->state == SWARM_ACTIVE ) {
+		d = abs( transit - cl->transit );
+		cl->jitter += ( (float)d - cl->jitter ) / 16.0f;
+	} else {
+		cl->state = SWARM_ACTIVE;
+		cl->activeTime = now;
+	}
+	cl->transit = transit;
+
+	cl->snapshots++;
+}
+
+
+/*
+=================
+NET_SwarmServerMessage
+
+Mirrors CL_ParseServerMessage()
+=================
+*/
+static void NET_SwarmServerMessage( swarmClient_t *cl, msg_t *msg, int now ) {
+	int cmd;
+
+	MSG_Bitstream( msg );
+
+	cl->reliableAcknowledge = MSG_ReadLong( msg );
+	if ( cl->reliableSequence - cl->reliableAcknowledge < 0 || cl->reliableSequence - cl->reliableAcknowledge > MAX_RELIABLE_COMMANDS ) {
+		cl->reliableAcknowledge = cl->reliableSequence;
+	}
+
+	while ( cl->state != SWARM_DROPPED ) {
+		if ( msg->readcount > msg->cursize ) {
+			NET_SwarmDrop( cl, "read past end of server message" );
+			return;
+		}
+
+		cmd = MSG_ReadByte( msg );
+
+		switch ( cmd ) {
+		case svc_EOF:
+			return;
+		case svc_nop:
+			break;
+		case svc_serverCommand:
+			NET_SwarmServerCommand( cl, msg );
+			break;
+		case svc_gamestate:
+			if ( !NET_SwarmGamestate( cl, msg ) ) {
+				NET_SwarmDrop( cl, "bad gamestate" );
+			}
+			break;
+		case svc_snapshot:
+			// entities and playerstate are not decoded so stop here,
+			// only download data may follow
+			NET_SwarmSnapshot( cl, msg, now );
+			return;
+		default:
+			// downloads are never requested
+			return;
+		}
+	}
+}
+
+
+/*
+=================
+NET_SwarmPacket
+=================
+*/
+static void NET_SwarmPacket( swarmClient_t *cl, const netadr_t *from, msg_t *msg, int now ) {
+	const char *s, *c;
+
+	if ( msg->cursize < 5 || !NET_CompareAdr( from, &swarmServer ) ) {
+		return;
+	}
+
+	if ( *(int32_t *)msg->data == -1 ) {
+		MSG_BeginReadingOOB( msg );
+		MSG_ReadLong( msg );
+		s = MSG_ReadStringLine( msg );
+		Cmd_TokenizeString( s );
+		c = Cmd_Argv( 0 );
+
+		if ( !Q_stricmp( c, "challengeResponse" ) && cl->state == SWARM_CHALLENGING ) {
+			if ( atoi( Cmd_Argv( 2 ) ) != cl->clientChallenge ) {
+				return;
+			}
+			if ( atoi( Cmd_Argv( 3 ) ) != NEW_PROTOCOL_VERSION ) {
+				NET_SwarmDrop( cl, va( "server protocol %s is not supported", Cmd_Argv( 3 ) ) );
+				return;
+			}
+			cl->challenge = atoi( Cmd_Argv( 1 ) );
+			cl->state = SWARM_CONNECTING;
+			cl->lastRequestTime = now - SWARM_RESEND_TIME;
+		} else if ( !Q_stricmp( c, "connectResponse" ) && cl->state == SWARM_CONNECTING ) {
+			if ( atoi( Cmd_Argv( 1 ) ) != cl->challenge ) {
+				return;
+			}
+			Netchan_Setup( NS_CLIENT, &cl->netchan, from, cl->qport, cl->challenge, qfalse );
+			cl->state = SWARM_CONNECTED;
+			cl->lastPacketTime = now;
+			cl->nextPacketTime = now;
+		} else if ( !Q_stricmp( c, "print" ) && cl->state < SWARM_CONNECTED ) {
+			// usually a reject reason
+			Q_strncpyz( cl->error, MSG_ReadStringLine( msg ), sizeof( cl->error ) );
+		} else if ( !Q_stricmp( c, "disconnect" ) || !Q_stricmp( c, "droperror" ) ) {
+			NET_SwarmDrop( cl, c );
+		}
+		return;
+	}
+
+	if ( cl->state < SWARM_CONNECTED || cl->state == SWARM_DROPPED ) {
+		return;
+	}
+
+	if ( !Netchan_Process( &cl->netchan, msg ) ) {
+		return; // out of order, duplicated, incomplete fragment
+	}
+
+	cl->lost += cl->netchan.dropped;
+	cl->received++;
+	cl->bytes += msg->cursize;
+	cl->lastPacketTime = now;
+
+	cl->serverMessageSequence = LittleLong( *(int32_t *)msg->data );
+
+	NET_SwarmServerMessage( cl, msg, now );
+}
+
+
+/*
+=================
+NET_SwarmClientFrame
+=================
+*/
+static void NET_SwarmClientFrame( swarmClient_t *cl, int index, int now, int packetMsec ) {
+	switch ( cl->state ) {
+	case SWARM_CHALLENGING:
+		if ( now - cl->lastRequestTime >= SWARM_RESEND_TIME ) {
+			cl->lastRequestTime = now;
+			NET_SwarmSendOOB( cl, va( "getchallenge %i %s", cl->clientChallenge, GAMENAME_FOR_MASTER ) );
+		}
+		break;
+
+	case SWARM_CONNECTING:
+		if ( now - cl->lastRequestTime >= SWARM_RESEND_TIME ) {
+			cl->lastRequestTime = now;
+			NET_SwarmSendConnect( cl, index );
+		}
+		break;
+
+	case SWARM_CONNECTED:
+	case SWARM_PRIMED:
+	case SWARM_ACTIVE:
+		if ( now - cl->lastPacketTime > SWARM_TIMEOUT ) {
+			NET_SwarmDrop( cl, "server connection timed out" );
+			break;
+		}
+		if ( now - cl->nextPacketTime >= 0 ) {
+			if ( cl->state >= SWARM_PRIMED ) {
+				NET_SwarmNextMove( cl, now, packetMsec );
+			}
+			NET_SwarmWritePacket( cl, NULL );
+			cl->nextPacketTime += packetMsec;
+			// don't try to catch up after stalls
+			if ( now - cl->nextPacketTime > packetMsec ) {
+				cl->nextPacketTime = now + packetMsec;
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+/*
+=================
+NET_SwarmLoadScript
+
+Each non-empty line is: msec forwardmove rightmove upmove yawspeed pitchspeed buttons
+=================
+*/
+static qboolean NET_SwarmLoadScript( const char *filename ) {
+	swarmMove_t *move;
+	const char *token;
+	const char *text;
+	char *buf;
+	int i;
+
+	swarmScriptLength = 0;
+
+	if ( FS_ReadFile( filename, (void **)&buf ) < 0 || !buf ) {
+		Com_Printf( "Couldn't load %s\n", filename );
+		return qfalse;
+	}
+
+	text = buf;
+	while ( swarmScriptLength < SWARM_MAX_SCRIPT ) {
+		token = COM_ParseExt( &text, qtrue );
+		if ( !token[0] ) {
+			break;
+		}
+		move = &swarmScript[ swarmScriptLength++ ];
+		move->msec = atoi( token );
+		if ( move->msec < 1 ) {
+			move->msec = 1;
+		}
+		for ( i = 0; i < 6; i++ ) {
+			token = COM_ParseExt( &text, qfalse );
+			switch ( i ) {
+			case 0: move->forwardmove = Com_Clamp( -127, 127, atoi( token ) ); break;
+			case 1: move->rightmove = Com_Clamp( -127, 127, atoi( token ) ); break;
+			case 2: move->upmove = Com_Clamp( -127, 127, atoi( token ) ); break;
+			case 3: move->yaw = Q_atof( token ); break;
+			case 4: move->pitch = Q_atof( token ); break;
+			case 5: move->buttons = atoi( token ); break;
+			}
+		}
+		SkipRestOfLine( &text );
+	}
+
+	FS_FreeFile( buf );
+
+	if ( !swarmScriptLength ) {
+		Com_Printf( "%s contains no moves\n", filename );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+
+/*
+=================
+NET_SwarmCollect
+
+Moves statistics of the last report period to totals
+=================
+*/
+static void NET_SwarmCollect( swarmClient_t *clients, int numClients ) {
+	swarmClient_t *cl;
+	int i;
+
+	for ( i = 0, cl = clients; i < numClients; i++, cl++ ) {
+		cl->totalSnapshots += cl->snapshots;
+		cl->totalBytes += cl->bytes;
+		cl->totalReceived += cl->received;
+		cl->totalLost += cl->lost;
+		cl->snapshots = cl->bytes = cl->received = cl->lost = 0;
+	}
+}
+
+
+/*
+=================
+NET_SwarmReport
+
+Prints per-client averages of the last report period
+=================
+*/
+static void NET_SwarmReport( const swarmClient_t *clients, int numClients, int msec ) {
+	const swarmClient_t *cl;
+	int i, active, snapshots, bytes, received, lost;
+	float jitter;
+
+	active = snapshots = bytes = received = lost = 0;
+	jitter = 0.0f;
+
+	for ( i = 0, cl = clients; i < numClients; i++, cl++ ) {
+		if ( cl->state == SWARM_ACTIVE ) {
+			active++;
+			jitter += cl->jitter;
+			snapshots += cl->snapshots;
+			bytes += cl->bytes;
+		}
+		received += cl->received;
+		lost += cl->lost;
+	}
+
+	if ( msec < 1 ) {
+		msec = 1;
+	}
+
+	Com_Printf( "%i/%i active, per client: %.1f snaps/s, %.1f KB/s, jitter %.1f ms, loss %.2f%%\n",
+		active, numClients,
+		active ? snapshots * 1000.0f / msec / active : 0.0f,
+		active ? bytes * 1000.0f / 1024.0f / msec / active : 0.0f,
+		active ? jitter / active : 0.0f,
+		received + lost ? lost * 100.0f / ( received + lost ) : 0.0f );
+}
+
+
+/*
+=================
+NET_SwarmSummary
+
+Prints totals for each client since it became active
+=================
+*/
+static void NET_SwarmSummary( const swarmClient_t *clients, int numClients, int now ) {
+	const swarmClient_t *cl;
+	int i, msec;
+
+	Com_Printf( "  # state       snaps/s     KB/s jitter   loss\n" );
+	Com_Printf( "--- ----------- ------- -------- ------ ------\n" );
+
+	for ( i = 0, cl = clients; i < numClients; i++, cl++ ) {
+		msec = cl->activeTime ? MAX( now - cl->activeTime, 1 ) : 1;
+		Com_Printf( "%3i %-11s %7.1f %8.1f %6.1f %5.1f%% %s\n", i, swarmStateNames[ cl->state ],
+			cl->totalSnapshots * 1000.0f / msec, cl->totalBytes * 1000.0f / 1024.0f / msec, cl->jitter,
+			cl->totalReceived + cl->totalLost ? cl->totalLost * 100.0f / ( cl->totalReceived + cl->totalLost ) : 0.0f,
+			cl->error );
+	}
+}
+
+
+/*
+=================
+NET_SwarmFree
+
+Closes client sockets and releases state left by the last run
+=================
+*/
+void NET_SwarmFree( void ) {
+	int i;
+
+	if ( !swarmClients ) {
+		return;
+	}
+
+	for ( i = 0; i < swarmNumClients; i++ ) {
+		NET_CloseClientSocket( swarmClients[ i ].sock );
+	}
+
+	Z_Free( swarmClients );
+	swarmClients = NULL;
+	swarmNumClients = 0;
+}
+
+
+/*
+=================
+NET_Swarm_f
+
+Connects a number of headless clients to a server and reports
+per-client snapshot rate, bandwidth, jitter and packet loss
+=================
+*/
+void NET_Swarm_f( void ) {
+	char			server[ MAX_OSPATH ];
+	char			script[ MAX_OSPATH ];
+	swarmClient_t	*clients, *cl;
+	intptr_t		socks[ SWARM_MAX_CLIENTS ];
+	byte			data[ MAX_MSGLEN_BUF ];
+	netadr_t		from;
+	msg_t			msg;
+	int				numClients, maxClients, started, seconds, packets, packetMsec;
+	int				i, now, start, end, nextConnect, nextReport, lastReport;
+
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "Usage: %s <server> [clients] [seconds] [packets/sec] [script]\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	if ( com_sv_running->integer ) {
+		Com_Printf( "Can't run swarm while hosting a server.\n" );
+		return;
+	}
+
+	Q_strncpyz( server, Cmd_Argv( 1 ), sizeof( server ) );
+	numClients = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 16;
+	seconds = Cmd_Argc() > 3 ? atoi( Cmd_Argv( 3 ) ) : 60;
+	packets = Cmd_Argc() > 4 ? atoi( Cmd_Argv( 4 ) ) : 30;
+	Q_strncpyz( script, Cmd_Argv( 5 ), sizeof( script ) );
+
+	// all client sockets must fit into single select() set
+	maxClients = MIN( SWARM_MAX_CLIENTS, NET_MaxClientSockets() );
+
+	if ( numClients < 1 || numClients > maxClients || seconds < 1 || packets < 1 || packets > 125 ) {
+		Com_Printf( "Clients must be in range 1..%i, packets in range 1..125\n", maxClients );
+		return;
+	}
+
+	if ( !NET_StringToAdr( server, &swarmServer, NA_UNSPEC ) ) {
+		Com_Printf( "Bad server address %s\n", server );
+		return;
+	}
+
+	if ( script[0] ) {
+		if ( !NET_SwarmLoadScript( script ) ) {
+			return;
+		}
+	} else {
+		swarmScriptLength = 0;
+	}
+
+	// release sockets of interrupted run, if any
+	NET_SwarmFree();
+
+	clients = Z_Malloc( numClients * sizeof( *clients ) );
+	swarmClients = clients;
+	swarmNumClients = numClients;
+
+	for ( i = 0, cl = clients; i < numClients; i++, cl++ ) {
+		cl->sock = -1;
+	}
+
+	for ( i = 0, cl = clients; i < numClients; i++, cl++ ) {
+		cl->sock = NET_OpenClientSocket( swarmServer.type );
+		socks[ i ] = cl->sock;
+		if ( cl->sock == -1 ) {
+			NET_SwarmDrop( cl, "couldn't open socket" );
+		}
+		cl->qport = ( rand() & 0xffff );
+		cl->clientChallenge = ( ( rand() << 16 ) ^ rand() ) ^ i;
+		cl->moveIndex = swarmScriptLength ? i % swarmScriptLength : 0;
+	}
+
+	packetMsec = 1000 / packets;
+
+	Com_Printf( "Connecting %i clients to %s for %i seconds, %i packets/s, %s moves\n",
+		numClients, NET_AdrToStringwPort( &swarmServer ), seconds, packets, swarmScriptLength ? script : "random" );
+
+	start = now = Sys_Milliseconds();
+	end = start + seconds * 1000;
+	nextConnect = start;
+	nextReport = start + SWARM_REPORT_INTERVAL;
+	lastReport = start;
+	started = 0;
+
+	while ( now - end < 0 ) {
+		// staggered connects
+		if ( started < numClients && now - nextConnect >= 0 ) {
+			cl = &clients[ started++ ];
+			if ( cl->state == SWARM_IDLE ) {
+				cl->state = SWARM_CHALLENGING;
+				cl->lastRequestTime = now - SWARM_RESEND_TIME;
+			}
+			nextConnect = now + SWARM_CONNECT_INTERVAL;
+		}
+
+		for ( i = 0, cl = clients; i < numClients; i++, cl++ ) {
+			NET_SwarmClientFrame( cl, i, now, packetMsec );
+		}
+
+		NET_WaitClientSockets( socks, numClients, 1000 );
+
+		now = Sys_Milliseconds();
+
+		for ( i = 0, cl = clients; i < numClients; i++, cl++ ) {
+			if ( cl->sock == -1 ) {
+				continue;
+			}
+			MSG_Init( &msg, data, sizeof( data ) );
+			while ( NET_ClientRecvFrom( cl->sock, &from, &msg ) ) {
+				NET_SwarmPacket( cl, &from, &msg, now );
+				MSG_Init( &msg, data, sizeof( data ) );
+			}
+		}
+
+		if ( now - nextReport >= 0 ) {
+			Com_Printf( "%3is: ", ( now - start ) / 1000 );
+			NET_SwarmReport( clients, numClients, now - lastReport );
+			NET_SwarmCollect( clients, numClients );
+			lastReport = now;
+			nextReport = now + SWARM_REPORT_INTERVAL;
+		}
+	}
+
+	NET_SwarmCollect( clients, numClients );
+	NET_SwarmSummary( clients, numClients, now );
+
+	for ( i = 0, cl = clients; i < numClients; i++, cl++ ) {
+		if ( cl->state >= SWARM_CONNECTED && cl->state != SWARM_DROPPED ) {
+			// send disconnect few times as the real client does
+			cl->reliableSequence++;
+			NET_SwarmWritePacket( cl, "disconnect" );
+			NET_SwarmWritePacket( cl, "disconnect" );
+			NET_SwarmWritePacket( cl, "disconnect" );
+		}
+	}
+
+	NET_SwarmFree();
+}
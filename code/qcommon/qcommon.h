@@ -75,6 +75,7 @@ void MSG_InitOOB( msg_t *buf, byte *data, int length );
 void MSG_Clear( msg_t *buf );
 void MSG_WriteData( msg_t *buf, const void *data, int length );
 void MSG_Bitstream( msg_t *buf );
+void MSG_LegacyBits( qboolean enable );
 
 // TTimo
 // copy a msg_t in case we need to store it as is for a bit
@@ -87,6 +88,8 @@ struct entityState_s;
 struct playerState_s;
 
 void MSG_WriteBits( msg_t *msg, int value, int bits );
+void MSG_WriteBitStream( msg_t *msg, const byte *data, int bits );
+void MSG_WriteRawData( msg_t *msg, const void *data, int length );
 
 void MSG_WriteChar (msg_t *sb, int c);
 void MSG_WriteByte (msg_t *sb, int c);
@@ -111,6 +114,7 @@ const char *MSG_ReadBigString (msg_t *sb);
 const char *MSG_ReadStringLine (msg_t *sb);
 float MSG_ReadAngle16 (msg_t *sb);
 void  MSG_ReadData(msg_t *sb, void *buffer, int size);
+void  MSG_ReadRawData( msg_t *msg, void *buffer, int size );
 int   MSG_ReadEntitynum(msg_t *sb);
 
 void MSG_WriteDeltaUsercmdKey( msg_t *msg, int key, const usercmd_t *from, const usercmd_t *to );
@@ -200,7 +204,10 @@ typedef struct {
 void		NET_Init( void );
 void		NET_Shutdown( void );
 void		NET_FlushPacketQueue( int time_diff );
+int			NET_RunPacketQueues( void );
 void		NET_QueuePacket( netsrc_t sock, int length, const void *data, const netadr_t *to, int offset );
+qboolean	NET_ImpairIncoming( const netadr_t *from, const msg_t *msg );
+void		NET_DispatchPacket( const netadr_t *from, msg_t *msg );
 void		NET_SendPacket( netsrc_t sock, int length, const void *data, const netadr_t *to );
 void		QDECL NET_OutOfBandPrint( netsrc_t net_socket, const netadr_t *adr, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
 void		NET_OutOfBandCompress( netsrc_t sock, const netadr_t *adr, const byte *data, int len );
@@ -215,12 +222,36 @@ int         NET_StringToAdr( const char *s, netadr_t *a, netadrtype_t family );
 #ifndef DEDICATED
 qboolean	NET_GetLoopPacket( netsrc_t sock, netadr_t *net_from, msg_t *net_message );
 #endif
+
+intptr_t	NET_OpenClientSocket( netadrtype_t type );
+void		NET_CloseClientSocket( intptr_t sock );
+qboolean	NET_ClientSendTo( intptr_t sock, const netadr_t *to, const void *data, int length );
+qboolean	NET_ClientRecvFrom( intptr_t sock, netadr_t *from, msg_t *msg );
+void		NET_WaitClientSockets( const intptr_t *socks, int count, int usec );
+int			NET_MaxClientSockets( void );
+
+intptr_t	NET_TCPListen( int port );
+intptr_t	NET_TCPAccept( intptr_t listener, netadr_t *from );
+int			NET_TCPRecv( intptr_t sock, void *data, int length );
+int			NET_TCPSend( intptr_t sock, const void *data, int length );
+int			NET_TCPSendFile( intptr_t sock, FILE *f, int offset, int length );
+qboolean	NET_GetPrimaryAddress( netadr_t *adr );
+
+// net_swarm.c
+void		NET_Swarm_f( void );
+void		NET_SwarmFree( void );
 #ifdef USE_IPV6
 void		NET_JoinMulticast6( void );
 void		NET_LeaveMulticast6( void );
 #endif
 qboolean	NET_Sleep( int timeout );
 
+// connectionless packet handler called from query threads, returns reply
+// length, 0 to drop the packet or -1 to pass it to the main thread
+typedef int (*netQueryHandler_t)( const netadr_t *from, const byte *data, int length, byte *reply, int replySize );
+void		NET_SetQueryHandler( netQueryHandler_t handler );
+int			NET_QueryThreads( void );
+
 #define	MAX_PACKETLEN	1400	// max size of a network packet
 
 #define	MAX_MSGLEN		16384	// max length of a message, which may
@@ -231,8 +262,15 @@ qboolean	NET_Sleep( int timeout );
 
 #define MAX_DOWNLOAD_WINDOW		48	// ACK window of 48 download chunks. Cannot set this higher, or clients
 						// will overflow the reliable commands buffer
+#define MAX_DOWNLOAD_WINDOW_EXT	256	// window for clients with DL_CAP_WINDOW which acknowledge cumulatively
 #define MAX_DOWNLOAD_BLKSIZE		1024	// 896 byte block chunks
 
+// download capabilities, advertised by server in "sv_dlCaps" serverinfo key
+// and requested by client as a second argument of "download" command
+#define DL_CAP_RAW		1	// block data is byte-aligned and not huffman-encoded
+#define DL_CAP_WINDOW	2	// client keeps out-of-order blocks and acknowledges cumulatively
+#define DL_CAP_ALL		( DL_CAP_RAW | DL_CAP_WINDOW )
+
 #define NETCHAN_GENCHECKSUM(challenge, sequence) ((challenge) ^ ((sequence) * (challenge)))
 
 /*
@@ -762,7 +800,12 @@ qboolean FS_SV_FileExists( const char *file );
 
 fileHandle_t FS_SV_FOpenFileWrite( const char *filename );
 int		FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp );
+const void *FS_SV_MapFile( const char *filename, int *size );
+FILE *FS_SV_OpenSysFile( const char *filename, int *length );
+void FS_ClosePakHandles( void );
+void FS_ReopenHandles( void );
 void	FS_SV_Rename( const char *from, const char *to );
+qboolean FS_SV_Replace( const char *from, const char *to );
 int		FS_FOpenFileRead( const char *qpath, fileHandle_t *file, qboolean uniqueFILE );
 // if uniqueFILE is true, then a new FILE will be fopened even if the file
 // is found in an already open pak file.  If uniqueFILE is false, you must call
@@ -1325,6 +1368,8 @@ void	Sys_ShowConsole( int level, qboolean quitOnClose );
 void	Sys_SetErrorText( const char *text );
 
 void	Sys_SendPacket( int length, const void *data, const netadr_t *to );
+void	Sys_BeginPacketBatch( void );
+void	Sys_FlushPacketBatch( void );
 
 qboolean	Sys_StringToAdr( const char *s, netadr_t *a, netadrtype_t family );
 //Does NOT parse port numbers, only base addresses.
@@ -1334,6 +1379,7 @@ void		Sys_ShowIP(void);
 
 qboolean	Sys_Mkdir( const char *path );
 FILE	*Sys_FOpen( const char *ospath, const char *mode );
+qboolean	Sys_ReplaceFile( const char *from, const char *to );
 qboolean Sys_ResetReadOnlyAttribute( const char *ospath );
 
 const char *Sys_Pwd( void );
@@ -1350,6 +1396,13 @@ void Sys_FreeFileList( char **list );
 
 qboolean Sys_GetFileStats( const char *filename, fileOffset_t *size, fileTime_t *mtime, fileTime_t *ctime );
 
+const void *Sys_MapFile( const char *ospath, int *size );
+void	Sys_UnmapFile( const void *data, int size );
+
+int		Sys_ForkInstance( void );
+void	Sys_ReapInstances( void );
+qboolean Sys_ReopenFile( FILE *f );
+
 void Sys_BeginProfiling( void );
 void Sys_EndProfiling( void );
 
@@ -1362,6 +1415,25 @@ void *Sys_LoadFunction( void *handle, const char *name );
 int   Sys_LoadFunctionErrors( void );
 void  Sys_UnloadLibrary( void *handle );
 
+// worker thread pool, jobs must not call Com_Error(), Com_Printf() or zone functions
+#define MAX_WORKER_THREADS 16
+typedef void (*sysJob_t)( void *data, int index );
+void Sys_RunJobs( sysJob_t job, void *data, int count, int numThreads );
+
+// long-running threads with the same restrictions
+typedef void (*sysThread_t)( void *arg );
+void *Sys_CreateThread( sysThread_t func, void *arg );
+void Sys_JoinThread( void *thread );
+
+// atomic operations on ints shared between worker threads
+#ifdef _MSC_VER
+#define Sys_AtomicAdd( ptr, value ) _InterlockedExchangeAdd( (volatile long *)(ptr), (value) )
+#define Sys_AtomicCAS( ptr, oldValue, newValue ) ( _InterlockedCompareExchange( (volatile long *)(ptr), (newValue), (oldValue) ) == (oldValue) )
+#else
+#define Sys_AtomicAdd( ptr, value ) __sync_fetch_and_add( (ptr), (value) )
+#define Sys_AtomicCAS( ptr, oldValue, newValue ) __sync_bool_compare_and_swap( (ptr), (oldValue), (newValue) )
+#endif
+
 // adaptive huffman functions
 void Huff_Compress( msg_t *buf, int offset );
 void Huff_Decompress( msg_t *buf, int offset );
@@ -1371,6 +1443,9 @@ void HuffmanPutBit( byte* fout, int32_t bitIndex, int bit );
 int HuffmanPutSymbol( byte* fout, uint32_t offset, int symbol );
 int HuffmanGetBit( const byte* buffer, int bitIndex );
 int HuffmanGetSymbol( unsigned int* symbol, const byte* buffer, int bitIndex );
+void HuffmanInitLookup( void );
+int HuffmanWriteBits( byte *fout, int bitIndex, int bufSize, uint32_t value, int bits );
+int HuffmanReadBits( uint32_t *value, const byte *buffer, int bitIndex, int bufSize, int bits );
 
 #define	SV_ENCODE_START		4
 #define	SV_DECODE_START		12
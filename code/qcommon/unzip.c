@@ -1319,6 +1319,16 @@ extern unzFile unzReOpen (const char* path, unzFile file)
 	return (unzFile)s;	
 }
 
+/*
+  Return stdio stream used to read given Zip file.
+*/
+extern FILE *unzGetStream (unzFile file)
+{
+	if (file==NULL)
+		return NULL;
+	return ((unz_s*)file)->file;
+}
+
 /*
   Open a Zip file. path contain the full pathname (by example,
      on a Windows NT computer "c:\\test\\zlib109.zip" or on an Unix computer
@@ -29,6 +29,11 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 //=============================================================================
 
+// address bans and exceptions matched with prefix tries, see sv_banFile
+#ifndef DISABLE_BANS
+#define USE_BANS
+#endif
+
 #define	PERS_SCORE				0		// !!! MUST NOT CHANGE, SERVER AND
 										// GAME BOTH REFERENCE !!!
 
@@ -43,7 +48,6 @@ typedef struct svEntity_s {
 	int			clusternums[MAX_ENT_CLUSTERS];
 	int			lastCluster;		// if all the clusters don't fit in clusternums
 	int			areanum, areanum2;
-	int			snapshotCounter;	// used to prevent double adding from portal views
 } svEntity_t;
 
 typedef enum {
@@ -71,9 +75,13 @@ typedef struct {
 	int				serverId;			// changes each server start
 	int				restartedServerId;	// changes each map restart
 	int				checksumFeed;		// the feed key that we use to compute the pure checksum strings
-	int				snapshotCounter;	// incremented for each snapshot built
 	int				timeResidual;		// <= 1000 / sv_frame->value
 	char			*configstrings[MAX_CONFIGSTRINGS];
+	// configstring changes coalesced until SV_FlushConfigstrings()
+	char			*csPrevious[MAX_CONFIGSTRINGS];		// value before the first pending change, NULL if not pending
+	int				csWrites[MAX_CONFIGSTRINGS];		// number of pending changes
+	int				csPending[MAX_CONFIGSTRINGS];		// changed indexes in order of the first change
+	int				numCsPending;
 	svEntity_t		svEntities[MAX_GENTITIES];
 
 	const char		*entityParsePoint;	// used during game VM init
@@ -107,7 +115,9 @@ typedef struct {
 	int				messageSize;		// used to rate drop packets
 
 	int				frameNum;			// from snapshot storage to compare with last valid
+	int				baseFrameNum;		// oldest storage frame referenced by ents[]
 	entityState_t	*ents[ MAX_SNAPSHOT_ENTITIES ];
+	int				entFrames[ MAX_SNAPSHOT_ENTITIES ];	// storage frame each state was taken from
 
 } clientSnapshot_t;
 
@@ -190,6 +200,13 @@ typedef struct client_s {
 	int				downloadBlockSize[MAX_DOWNLOAD_WINDOW];
 	qboolean		downloadEOF;		// We have sent the EOF block
 	int				downloadSendTime;	// time we last got an ack from the client
+	int				downloadCaps;		// DL_CAP_* flags requested by client
+	int				downloadMap;		// 1-based index of shared file mapping, 0 if reading via downloadBlocks
+	int				downloadXmitTime[MAX_DOWNLOAD_WINDOW_EXT];	// time each block was last sent
+	qboolean		downloadRetried[MAX_DOWNLOAD_WINDOW_EXT];	// block was sent more than once, don't sample rtt
+	int				downloadRTT;		// smoothed round-trip time of block acknowledges
+	int				downloadRTTVar;
+	int				downloadRTO;		// current retransmission timeout
 
 	qboolean		deltaActive;		// delta snapshots enabled
 	int				deltaStart;			// don't delta from messages earlier than this when CS_ACTIVE
@@ -200,6 +217,11 @@ typedef struct client_s {
 	qboolean		rateDelayed;		// true if nextSnapshotTime was set based on rate instead of snapshotMsec
 	int				timeoutCount;		// must timeout a few frames in a row so debugging doesn't break
 	clientSnapshot_t	frames[PACKET_BACKUP];	// updates can be delta'd from here
+	int				snapBudget;			// entity bytes budget of the last snapshot, 0 - not scheduled
+	int				snapDeferred;		// entity updates deferred in the last snapshot
+	int				snapUpdates;		// total entity updates scheduled
+	int				snapDeferredTotal;	// total entity updates deferred
+	int				snapOverBudget;		// snapshots which didn't fit even without deferrable updates
 	int				ping;
 	int				rate;				// bytes / second, 0 - unlimited
 	int				snapshotMsec;		// requests a snapshot every snapshotMsec unless rate choked
@@ -261,10 +283,15 @@ typedef struct {
 	snapshotFrame_t	snapFrames[ NUM_SNAPSHOT_FRAMES ];
 	snapshotFrame_t	*currFrame; // current frame that clients can refer
 
+	// configstring coalescing counters
+	uint64_t	csChanges;				// configstring changes broadcasted
+	uint64_t	csCommands;				// configstring commands added to clients
+	uint64_t	csCommandsSaved;		// commands not sent because of coalescing
+
 } serverStatic_t;
 
 #ifdef USE_BANS
-#define SERVER_MAXBANS	1024
+#define SERVER_MAXBANS	65536
 // Structure for managing bans
 typedef struct
 {
@@ -312,6 +339,17 @@ extern	cvar_t	*sv_lanForceRate;
 
 extern	cvar_t *sv_levelTimeReset;
 extern	cvar_t *sv_filter;
+extern	cvar_t *sv_snapshotThreads;
+extern	cvar_t *sv_traceThreads;
+extern	cvar_t *sv_deltaCache;
+extern	cvar_t *sv_visCache;
+extern	cvar_t *sv_snapshotBudget;
+extern	cvar_t *sv_snapshotMaxDefer;
+extern	cvar_t *sv_profileLog;
+extern	cvar_t *sv_httpPort;
+extern	cvar_t *sv_httpHost;
+extern	cvar_t *sv_httpMaxConnsPerIP;
+extern	cvar_t *sv_httpRate;
 
 #ifdef USE_BANS
 extern	cvar_t	*sv_banFile;
@@ -338,6 +376,11 @@ void SV_RemoveOperatorCommands( void );
 void SV_MasterShutdown( void );
 int SV_RateMsec( const client_t *client );
 
+void SV_UpdateQueryInfo( void );
+void SV_InvalidateQueryInfo( void );
+void SV_QueryBench_f( void );
+int SV_QueryHandler( const netadr_t *from, const byte *data, int length, byte *reply, int replySize );
+
 
 //
 // sv_init.c
@@ -345,6 +388,8 @@ int SV_RateMsec( const client_t *client );
 void SV_SetConfigstring( int index, const char *val );
 void SV_GetConfigstring( int index, char *buffer, int bufferSize );
 void SV_UpdateConfigstrings( client_t *client );
+void SV_FlushConfigstrings( void );
+void SV_PrintConfigstringStats( void );
 
 void SV_SetUserinfo( int index, const char *val );
 void SV_GetUserinfo( int index, char *buffer, int bufferSize );
@@ -373,11 +418,18 @@ qboolean SV_ExecuteClientCommand( client_t *cl, const char *s );
 void SV_ClientThink( client_t *cl, usercmd_t *cmd );
 
 int SV_SendDownloadMessages( void );
+void SV_PrintDownloadStats( void );
+void SV_DownloadCheck_f( void );
 int SV_SendQueuedMessages( void );
 
-void SV_FreeIP4DB( void );
+void SV_FreeIPDB( void );
+void SV_RehashIPDB_f( void );
 void SV_PrintLocations_f( client_t *client );
 
+#ifdef USE_BANS
+void SV_RebuildBans( void );
+#endif
+
 //
 // sv_ccmds.c
 //
@@ -388,7 +440,7 @@ client_t *SV_GetPlayerByHandle( void );
 // sv_snapshot.c
 //
 void SV_AddServerCommand( client_t *client, const char *cmd );
-void SV_UpdateServerCommandsToClient( client_t *client, msg_t *msg );
+void SV_UpdateServerCommandsToClient( const client_t *client, msg_t *msg );
 void SV_WriteFrameToClient( client_t *client, msg_t *msg );
 void SV_SendMessageToClient( msg_t *msg, client_t *client );
 void SV_SendClientMessages( void );
@@ -396,9 +448,52 @@ void SV_SendClientSnapshot( client_t *client );
 
 void SV_InitSnapshotStorage( void );
 void SV_IssueNewSnapshot( void );
+void SV_PrintDeltaCacheStats( void );
+void SV_SnapshotStats_f( void );
+void SV_MsgBench_f( void );
 
 int SV_RemainingGameState( void );
 
+//
+// sv_http.c
+int SV_HTTPFrame( void );
+void SV_HTTPShutdown( void );
+
+// sv_profile.c
+//
+typedef enum {
+	PROF_PACKETS,
+	PROF_GAME,
+	PROF_COMMON_SNAPSHOT,
+	PROF_SNAPSHOTS,
+	PROF_CLIENT_SNAPSHOT,	// per-client samples
+	PROF_QUEUED_MESSAGES,
+	PROF_DOWNLOADS,
+	PROF_FRAME,
+	PROF_NUM_PHASES
+} profilePhase_t;
+
+#define SV_ProfileStart() Sys_Microseconds()
+void SV_ProfileEnd( profilePhase_t phase, int64_t start );
+void SV_ProfileSample( profilePhase_t phase, int usec );
+void SV_ProfileFrame( void );
+void SV_ProfileCloseLog( void );
+void SV_ProfileReset( void );
+void SV_ProfilePrint( void );
+void SV_Profile_f( void );
+
+//
+// sv_replay.c
+//
+void SV_RecordConnect( const client_t *cl );
+void SV_RecordDisconnect( const client_t *cl );
+void SV_RecordCommand( const client_t *cl, const char *cmd );
+void SV_RecordMove( const client_t *cl, const usercmd_t *cmds, int count, qboolean delta );
+void SV_StopRecord( void );
+void SV_Record_f( void );
+void SV_StopRecord_f( void );
+void SV_Replay_f( void );
+
 //
 // sv_game.c
 //
@@ -480,6 +575,12 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 
 // passEntityNum is explicitly excluded from clipping checks (normally ENTITYNUM_NONE)
 
+void SV_TraceBatch( const traceRequest_t *requests, trace_t *results, int count );
+// same as SV_Trace for each request, results are identical
+
+void SV_FreeTraceContexts( void );
+// releases worker trace contexts, they must be recreated after map change
+
 
 void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int entityNum, int contentmask, qboolean capsule );
 // clip to a specific entity
@@ -499,3 +600,4 @@ void SV_LoadFilters( const char *filename );
 const char *SV_RunFilters( const char *userinfo, const netadr_t *addr );
 void SV_AddFilter_f( void );
 void SV_AddFilterCmd_f( void );
+void SV_FilterBench_f( void );
@@ -568,7 +568,7 @@ static void SV_Ban_f( void ) {
 	}
 
 	// look up the authorize server's IP
-	if ( !svs.authorizeAddress.ip[0] && svs.authorizeAddress.type != NA_BAD ) {
+	if ( !svs.authorizeAddress.ipv._4[0] && svs.authorizeAddress.type != NA_BAD ) {
 		Com_Printf( "Resolving %s\n", AUTHORIZE_SERVER_NAME );
 		if ( !NET_StringToAdr( AUTHORIZE_SERVER_NAME, &svs.authorizeAddress, NA_IP ) ) {
 			Com_Printf( "Couldn't resolve address\n" );
@@ -576,16 +576,16 @@ static void SV_Ban_f( void ) {
 		}
 		svs.authorizeAddress.port = BigShort( PORT_AUTHORIZE );
 		Com_Printf( "%s resolved to %i.%i.%i.%i:%i\n", AUTHORIZE_SERVER_NAME,
-			svs.authorizeAddress.ip[0], svs.authorizeAddress.ip[1],
-			svs.authorizeAddress.ip[2], svs.authorizeAddress.ip[3],
+			svs.authorizeAddress.ipv._4[0], svs.authorizeAddress.ipv._4[1],
+			svs.authorizeAddress.ipv._4[2], svs.authorizeAddress.ipv._4[3],
 			BigShort( svs.authorizeAddress.port ) );
 	}
 
 	// otherwise send their ip to the authorize server
 	if ( svs.authorizeAddress.type != NA_BAD ) {
 		NET_OutOfBandPrint( NS_SERVER, &svs.authorizeAddress,
-			"banUser %i.%i.%i.%i", cl->netchan.remoteAddress.ip[0], cl->netchan.remoteAddress.ip[1], 
-								   cl->netchan.remoteAddress.ip[2], cl->netchan.remoteAddress.ip[3] );
+			"banUser %i.%i.%i.%i", cl->netchan.remoteAddress.ipv._4[0], cl->netchan.remoteAddress.ipv._4[1], 
+								   cl->netchan.remoteAddress.ipv._4[2], cl->netchan.remoteAddress.ipv._4[3] );
 		Com_Printf("%s was banned from coming back\n", cl->name);
 	}
 }
@@ -622,7 +622,7 @@ static void SV_BanNum_f( void ) {
 	}
 
 	// look up the authorize server's IP
-	if ( !svs.authorizeAddress.ip[0] && svs.authorizeAddress.type != NA_BAD ) {
+	if ( !svs.authorizeAddress.ipv._4[0] && svs.authorizeAddress.type != NA_BAD ) {
 		Com_Printf( "Resolving %s\n", AUTHORIZE_SERVER_NAME );
 		if ( !NET_StringToAdr( AUTHORIZE_SERVER_NAME, &svs.authorizeAddress, NA_IP ) ) {
 			Com_Printf( "Couldn't resolve address\n" );
@@ -630,16 +630,16 @@ static void SV_BanNum_f( void ) {
 		}
 		svs.authorizeAddress.port = BigShort( PORT_AUTHORIZE );
 		Com_Printf( "%s resolved to %i.%i.%i.%i:%i\n", AUTHORIZE_SERVER_NAME,
-			svs.authorizeAddress.ip[0], svs.authorizeAddress.ip[1],
-			svs.authorizeAddress.ip[2], svs.authorizeAddress.ip[3],
+			svs.authorizeAddress.ipv._4[0], svs.authorizeAddress.ipv._4[1],
+			svs.authorizeAddress.ipv._4[2], svs.authorizeAddress.ipv._4[3],
 			BigShort( svs.authorizeAddress.port ) );
 	}
 
 	// otherwise send their ip to the authorize server
 	if ( svs.authorizeAddress.type != NA_BAD ) {
 		NET_OutOfBandPrint( NS_SERVER, &svs.authorizeAddress,
-			"banUser %i.%i.%i.%i", cl->netchan.remoteAddress.ip[0], cl->netchan.remoteAddress.ip[1], 
-								   cl->netchan.remoteAddress.ip[2], cl->netchan.remoteAddress.ip[3] );
+			"banUser %i.%i.%i.%i", cl->netchan.remoteAddress.ipv._4[0], cl->netchan.remoteAddress.ipv._4[1], 
+								   cl->netchan.remoteAddress.ipv._4[2], cl->netchan.remoteAddress.ipv._4[3] );
 		Com_Printf("%s was banned from coming back\n", cl->name);
 	}
 }
@@ -650,12 +650,12 @@ static void SV_BanNum_f( void ) {
 #ifdef USE_BANS
 /*
 ==================
-SV_RehashBans_f
+SV_LoadBans
 
 Load saved bans from file.
 ==================
 */
-static void SV_RehashBans_f(void)
+static void SV_LoadBans(void)
 {
 	int index, filelen, res;
 	fileHandle_t readfrom;
@@ -741,6 +741,17 @@ static void SV_RehashBans_f(void)
 	}
 }
 
+/*
+==================
+SV_RehashBans_f
+==================
+*/
+static void SV_RehashBans_f(void)
+{
+	SV_LoadBans();
+	SV_RebuildBans();
+}
+
 /*
 ==================
 SV_WriteBans
@@ -941,7 +952,7 @@ static void SV_AddBanToList(qboolean isexception)
 		
 		if(curban->subnet <= mask)
 		{
-			if((curban->isexception || !isexception) && NET_CompareBaseAdrMask(&curban->ip, ip, &curban->subnet))
+			if((curban->isexception || !isexception) && NET_CompareBaseAdrMask(&curban->ip, &ip, curban->subnet))
 			{
 				Q_strncpyz(addy2, NET_AdrToString(&ip), sizeof(addy2));
 				
@@ -984,6 +995,7 @@ static void SV_AddBanToList(qboolean isexception)
 	serverBansCount++;
 	
 	SV_WriteBans();
+	SV_RebuildBans();
 
 	Com_Printf("Added %s: %s/%d\n", isexception ? "ban exception" : "ban",
 		   NET_AdrToString(&ip), mask);
@@ -1078,6 +1090,7 @@ static void SV_DelBanFromList(qboolean isexception)
 	}
 	
 	SV_WriteBans();
+	SV_RebuildBans();
 }
 
 
@@ -1146,10 +1159,106 @@ static void SV_FlushBans_f(void)
 	
 	// empty the ban file.
 	SV_WriteBans();
+	SV_RebuildBans();
 	
 	Com_Printf("All bans and exceptions have been deleted.\n");
 }
 
+/*
+==================
+SV_ImportBans_f
+
+Append bans or exceptions from a plain list of addresses in CIDR notation,
+one per line, lines starting with '#' or ';' are ignored.
+==================
+*/
+static void SV_ImportBans_f(void)
+{
+	fileHandle_t readfrom;
+	char filepath[MAX_QPATH];
+	char *textbuf, *line, *next, *s;
+	int filelen, added, skipped, mask;
+	qboolean isexception;
+	netadr_t ip;
+
+	// make sure server is running
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() < 2 || Cmd_Argc() > 3 ) {
+		Com_Printf( "Usage: %s <filename> [except]\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	isexception = !Q_stricmp( Cmd_Argv( 2 ), "except" ) ? qtrue : qfalse;
+
+	Com_sprintf( filepath, sizeof( filepath ), "%s/%s", FS_GetCurrentGameDir(), Cmd_Argv( 1 ) );
+
+	filelen = FS_SV_FOpenFileRead( filepath, &readfrom );
+	if ( filelen < 0 || readfrom == FS_INVALID_HANDLE ) {
+		Com_Printf( "Couldn't open %s\n", filepath );
+		return;
+	}
+
+	textbuf = Z_Malloc( filelen + 1 );
+	if ( FS_Read( textbuf, filelen, readfrom ) != filelen ) {
+		FS_FCloseFile( readfrom );
+		Z_Free( textbuf );
+		return;
+	}
+	FS_FCloseFile( readfrom );
+	textbuf[ filelen ] = '\0';
+
+	added = skipped = 0;
+	for ( line = textbuf; line; line = next ) {
+		next = strchr( line, '\n' );
+		if ( next ) {
+			*next++ = '\0';
+		}
+
+		while ( *line == ' ' || *line == '\t' )
+			line++;
+
+		if ( *line == '\0' || *line == '\r' || *line == '#' || *line == ';' )
+			continue;
+
+		// numeric addresses only, never resolve host names
+		for ( s = line; *s && ( isxdigit( (unsigned char)*s ) || *s == '.' || *s == ':' || *s == '/' ); s++ )
+			;
+		if ( *s != '\0' && *s != ' ' && *s != '\t' && *s != '\r' && *s != '#' ) {
+			skipped++;
+			continue;
+		}
+		*s = '\0';
+
+		if ( SV_ParseCIDRNotation( &ip, &mask, line ) || ( ip.type != NA_IP && ip.type != NA_IP6 ) ) {
+			skipped++;
+			continue;
+		}
+
+		if ( serverBansCount >= ARRAY_LEN( serverBans ) ) {
+			Com_Printf( "Error: Maximum number of bans/exceptions exceeded.\n" );
+			break;
+		}
+
+		serverBans[ serverBansCount ].ip = ip;
+		serverBans[ serverBansCount ].subnet = mask;
+		serverBans[ serverBansCount ].isexception = isexception;
+		serverBansCount++;
+		added++;
+	}
+
+	Z_Free( textbuf );
+
+	SV_WriteBans();
+	SV_RebuildBans();
+
+	Com_Printf( "Imported %i %s from %s, %i lines skipped.\n", added,
+		isexception ? "exceptions" : "bans", Cmd_Argv( 1 ), skipped );
+}
+
 static void SV_BanAddr_f(void)
 {
 	SV_AddBanToList(qfalse);
@@ -1308,6 +1417,12 @@ static void SV_Status_f( void ) {
 	}
 
 	Com_Printf( "\n" );
+
+	if ( sv_deltaCache->integer ) {
+		SV_PrintDeltaCacheStats();
+	}
+	SV_PrintDownloadStats();
+	SV_PrintConfigstringStats();
 }
 
 
@@ -1568,6 +1683,13 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("dumpuser", SV_DumpUser_f);
 	Cmd_AddCommand ("map_restart", SV_MapRestart_f);
 	Cmd_AddCommand ("sectorlist", SV_SectorList_f);
+	Cmd_AddCommand ("sv_snapshotStats", SV_SnapshotStats_f);
+	Cmd_AddCommand ("sv_msgBench", SV_MsgBench_f);
+	Cmd_AddCommand ("sv_queryBench", SV_QueryBench_f);
+	Cmd_AddCommand ("sv_profile", SV_Profile_f);
+	Cmd_AddCommand ("sv_record", SV_Record_f);
+	Cmd_AddCommand ("sv_stoprecord", SV_StopRecord_f);
+	Cmd_AddCommand ("sv_replay", SV_Replay_f);
 	Cmd_AddCommand ("map", SV_Map_f);
 	Cmd_SetCommandCompletionFunc( "map", SV_CompleteMapName );
 #ifndef PRE_RELEASE_DEMO
@@ -1581,6 +1703,7 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("killserver", SV_KillServer_f);
 #ifdef USE_BANS	
 	Cmd_AddCommand("rehashbans", SV_RehashBans_f);
+	Cmd_AddCommand("importbans", SV_ImportBans_f);
 	Cmd_AddCommand("listbans", SV_ListBans_f);
 	Cmd_AddCommand("banaddr", SV_BanAddr_f);
 	Cmd_AddCommand("exceptaddr", SV_ExceptAddr_f);
@@ -1590,6 +1713,9 @@ void SV_AddOperatorCommands( void ) {
 #endif
 	Cmd_AddCommand( "filter", SV_AddFilter_f );
 	Cmd_AddCommand( "filtercmd", SV_AddFilterCmd_f );
+	Cmd_AddCommand( "filter_bench", SV_FilterBench_f );
+	Cmd_AddCommand( "rehashipdb", SV_RehashIPDB_f );
+	Cmd_AddCommand( "dl_check", SV_DownloadCheck_f );
 }
 
 
@@ -157,39 +157,254 @@ void SV_GetChallenge( const netadr_t *from ) {
 }
 
 
+#ifdef USE_BANS
 /*
 ==================
-SV_IsBanned
+BAN TRIE
 
-Check whether a certain address is banned
+Bans and exceptions are kept in path-compressed binary tries, one per
+address family, so lookup cost depends on the prefix length only.
+All prefixes matching an address are on the lookup path, the longest
+one is reported and any matching exception overrides bans.
 ==================
 */
-#ifdef USE_BANS
 
-static qboolean SV_IsBanned( const netadr_t *from, qboolean isexception )
-{
-	int index;
-	serverBan_t *curban;
+#define BAN_FLAG_BAN		1
+#define BAN_FLAG_EXCEPTION	2
 
-	if(!isexception)
-	{
-		// If this is a query for a ban, first check whether the client is excepted
-		if(SV_IsBanned(from, qtrue))
-			return qfalse;
+typedef struct {
+	byte	key[16];		// prefix, unused bits are zero
+	int		bits;			// prefix length
+	int		child[2];		// node indexes, zero if empty
+	int		flags;			// BAN_FLAG_*
+	int		ban;			// serverBans[] index of the longest entry with this prefix
+} banNode_t;
+
+static banNode_t	*banNodes;		// [0] is not used
+static int			banNodesCount;
+static int			banNodesSize;
+static int			banRoot[2];		// NA_IP and NA_IP6 tries
+
+
+/*
+==================
+SV_BanKeyBit
+==================
+*/
+static int SV_BanKeyBit( const byte *key, int bit ) {
+	return ( key[ bit >> 3 ] >> ( 7 - ( bit & 7 ) ) ) & 1;
+}
+
+
+/*
+==================
+SV_BanKeyMatch
+
+Returns length of the common prefix of two keys, up to maxBits
+==================
+*/
+static int SV_BanKeyMatch( const byte *a, const byte *b, int maxBits ) {
+	int i, n;
+	byte x;
+
+	for ( i = 0, n = 0; n < maxBits; i++, n += 8 ) {
+		x = a[i] ^ b[i];
+		if ( x ) {
+			while ( !( x & 0x80 ) ) {
+				x <<= 1;
+				n++;
+			}
+			break;
+		}
 	}
 
-	for(index = 0; index < serverBansCount; index++)
-	{
-		curban = &serverBans[index];
+	return n < maxBits ? n : maxBits;
+}
 
-		if(curban->isexception == isexception)
-		{
-			if(NET_CompareBaseAdrMask(&curban->ip, from, curban->subnet))
-				return qtrue;
+
+/*
+==================
+SV_BanNewNode
+==================
+*/
+static int SV_BanNewNode( const byte *key, int bits ) {
+	banNode_t *node = &banNodes[ banNodesCount ];
+	int i;
+
+	Com_Memset( node, 0, sizeof( *node ) );
+	for ( i = 0; i < bits >> 3; i++ ) {
+		node->key[i] = key[i];
+	}
+	if ( bits & 7 ) {
+		node->key[i] = key[i] & ( 0xFF00 >> ( bits & 7 ) );
+	}
+	node->bits = bits;
+	node->ban = -1;
+
+	return banNodesCount++;
+}
+
+
+/*
+==================
+SV_BanKey
+==================
+*/
+static int SV_BanKey( const netadr_t *adr, byte *key ) {
+	Com_Memset( key, 0, 16 );
+	if ( adr->type == NA_IP ) {
+		Com_Memcpy( key, adr->ipv._4, 4 );
+		return 0;
+	}
+#ifdef USE_IPV6
+	if ( adr->type == NA_IP6 ) {
+		Com_Memcpy( key, adr->ipv._6, 16 );
+		return 1;
+	}
+#endif
+	return -1;
+}
+
+
+/*
+==================
+SV_InsertBan
+==================
+*/
+static void SV_InsertBan( int index ) {
+	const serverBan_t *ban = &serverBans[ index ];
+	byte key[16];
+	int *link, n, m, common, bits, family;
+
+	family = SV_BanKey( &ban->ip, key );
+	if ( family < 0 ) {
+		return;
+	}
+
+	bits = ban->subnet;
+	link = &banRoot[ family ];
+
+	for ( ;; ) {
+		n = *link;
+		if ( n == 0 ) {
+			n = *link = SV_BanNewNode( key, bits );
+			break;
+		}
+
+		common = SV_BanKeyMatch( key, banNodes[n].key, MIN( bits, banNodes[n].bits ) );
+
+		if ( common < banNodes[n].bits ) {
+			// split the edge
+			m = SV_BanNewNode( key, common );
+			banNodes[m].child[ SV_BanKeyBit( banNodes[n].key, common ) ] = n;
+			*link = m;
+			if ( common == bits ) {
+				n = m;
+			} else {
+				n = banNodes[m].child[ SV_BanKeyBit( key, common ) ] = SV_BanNewNode( key, bits );
+			}
+			break;
+		}
+
+		if ( bits == banNodes[n].bits ) {
+			break;
 		}
+
+		link = &banNodes[n].child[ SV_BanKeyBit( key, banNodes[n].bits ) ];
 	}
 
-	return qfalse;
+	banNodes[n].flags |= ban->isexception ? BAN_FLAG_EXCEPTION : BAN_FLAG_BAN;
+	if ( banNodes[n].ban < 0 || !ban->isexception ) {
+		banNodes[n].ban = index;
+	}
+}
+
+
+/*
+==================
+SV_RebuildBans
+
+Must be called after any change in serverBans[]
+==================
+*/
+void SV_RebuildBans( void ) {
+	int i;
+
+	if ( banNodesSize < serverBansCount * 2 + 1 ) {
+		if ( banNodes ) {
+			Z_Free( banNodes );
+		}
+		banNodesSize = serverBansCount * 2 + 1;
+		banNodes = Z_Malloc( banNodesSize * sizeof( banNodes[0] ) );
+	}
+
+	banNodesCount = 1;
+	banRoot[0] = banRoot[1] = 0;
+
+	for ( i = 0; i < serverBansCount; i++ ) {
+		SV_InsertBan( i );
+	}
+
+	Com_DPrintf( "%i ban entries, %i trie nodes\n", serverBansCount, banNodesCount - 1 );
+}
+
+
+/*
+==================
+SV_FindBan
+
+Returns serverBans[] index of the longest ban or exception prefix
+matching the address or -1, flags receive all matched types
+==================
+*/
+static int SV_FindBan( const netadr_t *from, int *flags ) {
+	const banNode_t *node;
+	byte key[16];
+	int n, family, bits, found;
+
+	*flags = 0;
+
+	family = SV_BanKey( from, key );
+	if ( family < 0 || !banNodes ) {
+		return -1;
+	}
+
+	bits = family ? 128 : 32;
+	found = -1;
+
+	for ( n = banRoot[ family ]; n; n = node->child[ SV_BanKeyBit( key, node->bits ) ] ) {
+		node = &banNodes[n];
+		if ( node->bits > bits || SV_BanKeyMatch( key, node->key, node->bits ) < node->bits ) {
+			break;
+		}
+		if ( node->flags ) {
+			*flags |= node->flags;
+			found = node->ban;
+		}
+		if ( node->bits == bits ) {
+			break;
+		}
+	}
+
+	return found;
+}
+
+
+/*
+==================
+SV_IsBanned
+
+Check whether a certain address is banned
+==================
+*/
+static qboolean SV_IsBanned( const netadr_t *from )
+{
+	int flags;
+
+	SV_FindBan( from, &flags );
+
+	// exceptions override bans
+	return ( flags & ( BAN_FLAG_BAN | BAN_FLAG_EXCEPTION ) ) == BAN_FLAG_BAN ? qtrue : qfalse;
 }
 #endif
 
@@ -197,25 +412,70 @@ static qboolean SV_IsBanned( const netadr_t *from, qboolean isexception )
 /*
 ==================
 SV_SetClientTLD
+
+Source databases are binary files with big-endian ranges sorted by address:
+
+ip4db.dat: [from4][to4]...[tld2]... (10 bytes per range)
+ip6db.dat: [from16][to16][tld2]     (34 bytes per range)
+
+They are compiled into a single host-endian ipdb.bin in the home directory
+where ranges are stored in eytzinger (breadth-first) order for cache
+friendly searches, the compiled file is mapped read-only so every server
+instance on the same host shares one copy of it in the page cache.
 ==================
 */
-#pragma pack(push,1)
 
-typedef struct iprange_s {
-	uint32_t from;
-	uint32_t to;
-} iprange_t;
+#define IPDB_SOURCE4	"ip4db.dat"
+#define IPDB_SOURCE6	"ip6db.dat"
+#define IPDB_FILE		"ipdb.bin"
+#define IPDB_VERSION	1
+#define IPDB_ALIGN		64
+
+typedef struct {
+	uint64_t hi;
+	uint64_t lo;
+} ip6key_t;
+
+typedef struct {
+	char		magic[4];	// "IPDB"
+	uint32_t	version;
+	uint32_t	byteOrder;	// 0x01020304 in host order
+	uint32_t	size;		// total file size
+
+	int64_t		source4Size;
+	int64_t		source4Time;
+	int64_t		source6Size;
+	int64_t		source6Time;
+
+	// all arrays are 1-based
+	uint32_t	num4;
+	uint32_t	ofsTo4;		// uint32_t[ num4 + 1 ], search keys
+	uint32_t	ofsFrom4;	// uint32_t[ num4 + 1 ]
+	uint32_t	ofsTld4;	// char[ num4 + 1 ][ 2 ]
+
+	uint32_t	num6;
+	uint32_t	ofsTo6;		// ip6key_t[ num6 + 1 ], search keys
+	uint32_t	ofsFrom6;	// ip6key_t[ num6 + 1 ]
+	uint32_t	ofsTld6;	// char[ num6 + 1 ][ 2 ]
+} ipdbHeader_t;
+
+typedef struct {
+	const ipdbHeader_t	*header;
+	int					size;
 
-typedef struct iprange_tld_s {
-	char tld[2];
-} iprange_tld_t;
+	int					num4;
+	const uint32_t		*to4;
+	const uint32_t		*from4;
+	const char			*tld4;
 
-#pragma pack(pop)
+	int					num6;
+	const ip6key_t		*to6;
+	const ip6key_t		*from6;
+	const char			*tld6;
+} ipdb_t;
 
 static qboolean ipdb_loaded;
-static iprange_t *ipdb_range;
-static iprange_tld_t *ipdb_tld;
-static int num_tlds;
+static ipdb_t ipdb;
 
 typedef struct tld_info_s {
 	const char *tld;
@@ -228,106 +488,474 @@ static const tld_info_t tld_info[] = {
 
 /*
 ==================
-SV_FreeIP4DB
+SV_FreeIPDB
 ==================
 */
-void SV_FreeIP4DB( void )
+void SV_FreeIPDB( void )
 {
-	if ( ipdb_range )
-		Z_Free( ipdb_range );
+	if ( ipdb.header )
+		Sys_UnmapFile( ipdb.header, ipdb.size );
 
+	Com_Memset( &ipdb, 0, sizeof( ipdb ) );
 	ipdb_loaded = qfalse;
-	ipdb_range = NULL;
-	ipdb_tld = NULL;
 }
 
 
 /*
 ==================
-SV_LoadIP4DB
+SV_IPDBSourcePath
 
-Loads geoip database into memory
+Finds existing source database, home directory has priority
 ==================
 */
-static qboolean SV_LoadIP4DB( const char *filename )
+static qboolean SV_IPDBSourcePath( const char *filename, char *ospath, int ospathSize, fileOffset_t *size, fileTime_t *mtime )
 {
-	fileHandle_t fh = FS_INVALID_HANDLE;
-	uint32_t last_ip;
-	void *buf;
-	int len, res, i;
+	const char *paths[2];
+	const char *path;
+	fileTime_t ctime;
+	int i;
 
-	len = FS_SV_FOpenFileRead( filename, &fh );
+	paths[0] = FS_GetHomePath();
+	paths[1] = Cvar_VariableString( "fs_basepath" );
 
-	if ( len <= 0 )
+	for ( i = 0; i < ARRAY_LEN( paths ); i++ )
 	{
-		if ( fh != FS_INVALID_HANDLE )
-			FS_FCloseFile( fh );
-		return qfalse;
+		if ( !paths[i][0] )
+			continue;
+		path = FS_BuildOSPath( paths[i], filename, NULL );
+		if ( Sys_GetFileStats( path, size, mtime, &ctime ) )
+		{
+			if ( ospath )
+				Q_strncpyz( ospath, path, ospathSize );
+			return qtrue;
+		}
 	}
 
-	if ( len % 10 ) // should be a power of IP4:IP4:TLD2
+	*size = 0;
+	*mtime = 0;
+	return qfalse;
+}
+
+
+static int ip6_compare( const ip6key_t *a, const ip6key_t *b )
+{
+	if ( a->hi != b->hi )
+		return a->hi < b->hi ? -1 : 1;
+	if ( a->lo != b->lo )
+		return a->lo < b->lo ? -1 : 1;
+	return 0;
+}
+
+
+static void ip6_key( ip6key_t *key, const byte *ip )
+{
+	int i;
+
+	key->hi = key->lo = 0;
+	for ( i = 0; i < 8; i++ )
 	{
-		Com_DPrintf( "%s(%s): invalid file size %i\n", __func__, filename, len );
-		if ( fh != FS_INVALID_HANDLE )
-			FS_FCloseFile( fh );
+		key->hi = ( key->hi << 8 ) | ip[i];
+		key->lo = ( key->lo << 8 ) | ip[i+8];
+	}
+}
+
+
+static qboolean SV_IPDBCheckTLD( const byte *tld )
+{
+	return tld[0] >= 'A' && tld[0] <= 'Z' && tld[1] >= 'A' && tld[1] <= 'Z';
+}
+
+
+/*
+==================
+SV_IPDBReadSource
+
+Reads and validates source database, returns number of ranges or -1 on error
+==================
+*/
+static int SV_IPDBReadSource( const char *ospath, int recordSize, byte **data )
+{
+	FILE *f;
+	long len;
+
+	*data = NULL;
+
+	if ( !ospath )
+		return 0;
+
+	f = Sys_FOpen( ospath, "rb" );
+	if ( f == NULL )
+		return 0;
+
+	fseek( f, 0, SEEK_END );
+	len = ftell( f );
+	fseek( f, 0, SEEK_SET );
+
+	if ( len <= 0 || len >= INT_MAX / 2 || len % recordSize )
+	{
+		Com_Printf( S_COLOR_YELLOW "%s: invalid file size %li\n", ospath, len );
+		fclose( f );
+		return -1;
+	}
+
+	*data = Z_Malloc( len );
+	if ( fread( *data, len, 1, f ) != 1 )
+	{
+		Z_Free( *data );
+		*data = NULL;
+		fclose( f );
+		return -1;
+	}
+
+	fclose( f );
+	return len / recordSize;
+}
+
+
+// sets array offsets and file size from number of ranges
+static void SV_IPDBLayout( ipdbHeader_t *h )
+{
+	uint32_t n;
+
+	n = PAD( sizeof( *h ), IPDB_ALIGN );
+	h->ofsTo4 = n;		n += PAD( ( h->num4 + 1 ) * sizeof( uint32_t ), IPDB_ALIGN );
+	h->ofsFrom4 = n;	n += PAD( ( h->num4 + 1 ) * sizeof( uint32_t ), IPDB_ALIGN );
+	h->ofsTld4 = n;		n += PAD( ( h->num4 + 1 ) * 2, IPDB_ALIGN );
+	h->ofsTo6 = n;		n += PAD( ( h->num6 + 1 ) * sizeof( ip6key_t ), IPDB_ALIGN );
+	h->ofsFrom6 = n;	n += PAD( ( h->num6 + 1 ) * sizeof( ip6key_t ), IPDB_ALIGN );
+	h->ofsTld6 = n;		n += PAD( ( h->num6 + 1 ) * 2, IPDB_ALIGN );
+	h->size = n;
+}
+
+
+// maps sorted indexes into eytzinger order
+static int SV_IPDBEytzinger( int *order, int i, int k, int n )
+{
+	if ( k <= n )
+	{
+		i = SV_IPDBEytzinger( order, i, 2 * k, n );
+		order[ k ] = i++;
+		i = SV_IPDBEytzinger( order, i, 2 * k + 1, n );
+	}
+	return i;
+}
+
+
+/*
+==================
+SV_BuildIPDB
+
+Compiles source databases into IPDB_FILE
+==================
+*/
+static qboolean SV_BuildIPDB( void )
+{
+	ipdbHeader_t header;
+	fileOffset_t size4, size6;
+	fileTime_t time4, time6;
+	char path4[ MAX_OSPATH ], path6[ MAX_OSPATH ];
+	qboolean found4, found6;
+	byte *src4, *src6, *buf;
+	int num4, num6, i, n, *order;
+	char tmpname[ MAX_QPATH ];
+	char tmppath[ MAX_OSPATH ];
+	byte rnd[4];
+	FILE *f;
+
+	found4 = SV_IPDBSourcePath( IPDB_SOURCE4, path4, sizeof( path4 ), &size4, &time4 );
+	found6 = SV_IPDBSourcePath( IPDB_SOURCE6, path6, sizeof( path6 ), &size6, &time6 );
+
+	if ( !found4 && !found6 )
 		return qfalse;
+
+	num4 = SV_IPDBReadSource( found4 ? path4 : NULL, 10, &src4 );
+	num6 = SV_IPDBReadSource( found6 ? path6 : NULL, 34, &src6 );
+
+	if ( num4 < 0 || num6 < 0 )
+		goto fail;
+
+	Com_Memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, "IPDB", 4 );
+	header.version = IPDB_VERSION;
+	header.byteOrder = 0x01020304;
+	header.source4Size = size4;
+	header.source4Time = time4;
+	header.source6Size = size6;
+	header.source6Time = time6;
+	header.num4 = num4;
+	header.num6 = num6;
+
+	SV_IPDBLayout( &header );
+	n = header.size;
+
+	buf = Z_Malloc( n + ( MAX( num4, num6 ) + 1 ) * sizeof( int ) );
+	Com_Memset( buf, 0, n );
+	order = (int *)( buf + n );
+	memcpy( buf, &header, sizeof( header ) );
+
+	if ( num4 )
+	{
+		uint32_t *to = (uint32_t *)( buf + header.ofsTo4 );
+		uint32_t *from = (uint32_t *)( buf + header.ofsFrom4 );
+		char *tld = (char *)( buf + header.ofsTld4 );
+		const byte *range = src4, *name = src4 + num4 * 8;
+		uint32_t last = 0;
+
+		// validate sorted source
+		for ( i = 0; i < num4; i++ )
+		{
+			uint32_t f4 = (uint32_t)range[i*8+0] << 24 | range[i*8+1] << 16 | range[i*8+2] << 8 | range[i*8+3];
+			uint32_t t4 = (uint32_t)range[i*8+4] << 24 | range[i*8+5] << 16 | range[i*8+6] << 8 | range[i*8+7];
+			if ( ( i && last >= f4 ) || f4 > t4 || !SV_IPDBCheckTLD( name + i*2 ) )
+			{
+				Com_Printf( S_COLOR_YELLOW "invalid %s entry #%i: range=[%08x..%08x], tld=%c%c\n",
+					IPDB_SOURCE4, i, f4, t4, name[i*2], name[i*2+1] );
+				Z_Free( buf );
+				goto fail;
+			}
+			last = t4;
+		}
+
+		SV_IPDBEytzinger( order, 0, 1, num4 );
+		for ( i = 1; i <= num4; i++ )
+		{
+			const byte *r = range + order[i] * 8;
+			from[i] = (uint32_t)r[0] << 24 | r[1] << 16 | r[2] << 8 | r[3];
+			to[i] = (uint32_t)r[4] << 24 | r[5] << 16 | r[6] << 8 | r[7];
+			tld[i*2+0] = name[ order[i] * 2 + 0 ];
+			tld[i*2+1] = name[ order[i] * 2 + 1 ];
+		}
 	}
 
-	SV_FreeIP4DB();
+	if ( num6 )
+	{
+		ip6key_t *to = (ip6key_t *)( buf + header.ofsTo6 );
+		ip6key_t *from = (ip6key_t *)( buf + header.ofsFrom6 );
+		char *tld = (char *)( buf + header.ofsTld6 );
+		ip6key_t f6, t6, last;
+
+		last.hi = last.lo = 0;
+		for ( i = 0; i < num6; i++ )
+		{
+			const byte *r = src6 + i * 34;
+			ip6_key( &f6, r );
+			ip6_key( &t6, r + 16 );
+			if ( ( i && ip6_compare( &last, &f6 ) >= 0 ) || ip6_compare( &f6, &t6 ) > 0 || !SV_IPDBCheckTLD( r + 32 ) )
+			{
+				Com_Printf( S_COLOR_YELLOW "invalid %s entry #%i: tld=%c%c\n", IPDB_SOURCE6, i, r[32], r[33] );
+				Z_Free( buf );
+				goto fail;
+			}
+			last = t6;
+		}
+
+		SV_IPDBEytzinger( order, 0, 1, num6 );
+		for ( i = 1; i <= num6; i++ )
+		{
+			const byte *r = src6 + order[i] * 34;
+			ip6_key( &from[i], r );
+			ip6_key( &to[i], r + 16 );
+			tld[i*2+0] = r[32];
+			tld[i*2+1] = r[33];
+		}
+	}
 
-	buf = Z_Malloc( len );
+	if ( src4 )
+		Z_Free( src4 );
+	if ( src6 )
+		Z_Free( src6 );
 
-	res = FS_Read( buf, len, fh );
-	FS_FCloseFile( fh );
+	// write under temporary name and rename so other instances
+	// will never map partially written file
+	Com_RandomBytes( rnd, sizeof( rnd ) );
+	Com_sprintf( tmpname, sizeof( tmpname ), "%s.%02x%02x%02x%02x.tmp", IPDB_FILE, rnd[0], rnd[1], rnd[2], rnd[3] );
 
-	if ( res != len ) {
+	Q_strncpyz( tmppath, FS_BuildOSPath( FS_GetHomePath(), tmpname, NULL ), sizeof( tmppath ) );
+	f = Sys_FOpen( tmppath, "wb" );
+	if ( f == NULL )
+	{
+		Com_Printf( S_COLOR_YELLOW "couldn't write %s\n", tmpname );
 		Z_Free( buf );
 		return qfalse;
 	}
 
-	// check integrity of loaded database
-	last_ip = 0;
-	num_tlds = len / 10;
+	i = ( fwrite( buf, header.size, 1, f ) == 1 );
+	if ( fclose( f ) != 0 )
+		i = 0;
+	Z_Free( buf );
 
-	// database format:
-	// [range1][range2]...[rangeN]
-	// [tld1][tld2]...[tldN]
+	if ( !i )
+	{
+		Com_Printf( S_COLOR_YELLOW "couldn't write %s\n", tmpname );
+		FS_Remove( tmppath );
+		return qfalse;
+	}
+
+	// release our own mapping before replacing the file
+	SV_FreeIPDB();
+	if ( !FS_SV_Replace( tmpname, IPDB_FILE ) )
+		return qfalse;
+
+	Com_Printf( "%s: compiled %i ipv4 and %i ipv6 ranges\n", IPDB_FILE, num4, num6 );
+	return qtrue;
+
+fail:
+	if ( src4 )
+		Z_Free( src4 );
+	if ( src6 )
+		Z_Free( src6 );
+	return qfalse;
+}
+
+
+/*
+==================
+SV_MapIPDB
 
-	ipdb_range = (iprange_t*)buf;
-	ipdb_tld = (iprange_tld_t*)(ipdb_range + num_tlds);
+Maps compiled database, checks that it is up to date with sources
+==================
+*/
+static qboolean SV_MapIPDB( qboolean checkSources )
+{
+	const ipdbHeader_t *h;
+	ipdbHeader_t layout;
+	fileOffset_t size4, size6;
+	fileTime_t time4, time6;
+	int size;
 
-	for ( i = 0; i < num_tlds; i++ )
+	SV_FreeIPDB();
+
+	h = Sys_MapFile( FS_BuildOSPath( FS_GetHomePath(), IPDB_FILE, NULL ), &size );
+	if ( h == NULL )
+		return qfalse;
+
+	Com_Memset( &layout, 0, sizeof( layout ) );
+	if ( size >= sizeof( layout ) )
 	{
-#ifdef Q3_LITTLE_ENDIAN
-		ipdb_range[i].from = LongSwap( ipdb_range[i].from );
-		ipdb_range[i].to = LongSwap( ipdb_range[i].to );
-#endif
-		if ( last_ip && last_ip >= ipdb_range[i].from )
-			break;
-		if ( ipdb_range[i].from > ipdb_range[i].to )
-			break;
-		if ( ipdb_tld[i].tld[0] < 'A' || ipdb_tld[i].tld[0] > 'Z' || ipdb_tld[i].tld[1] < 'A' || ipdb_tld[i].tld[1] > 'Z' )
-			break;
-		last_ip = ipdb_range[i].to;
+		layout = *h;
+		if ( layout.num4 < size && layout.num6 < size )
+			SV_IPDBLayout( &layout );
 	}
 
-	if ( i != num_tlds ) {
-			Com_Printf( S_COLOR_YELLOW "invalid ip4db entry #%i: range=[%08x..%08x], tld=%c%c\n",
-				i, ipdb_range[i].from, ipdb_range[i].to, ipdb_tld[i].tld[0], ipdb_tld[i].tld[1] );
-			SV_FreeIP4DB();
-			return qtrue; // to not try to load it again
+	if ( size < sizeof( *h ) || memcmp( h->magic, "IPDB", 4 ) || h->version != IPDB_VERSION
+		|| h->byteOrder != 0x01020304 || h->size != size || memcmp( h, &layout, sizeof( layout ) ) )
+	{
+		Com_DPrintf( "%s: invalid header\n", IPDB_FILE );
+		Sys_UnmapFile( h, size );
+		return qfalse;
+	}
+
+	if ( checkSources )
+	{
+		SV_IPDBSourcePath( IPDB_SOURCE4, NULL, 0, &size4, &time4 );
+		SV_IPDBSourcePath( IPDB_SOURCE6, NULL, 0, &size6, &time6 );
+		if ( h->source4Size != size4 || h->source4Time != time4 || h->source6Size != size6 || h->source6Time != time6 )
+		{
+			Com_DPrintf( "%s: outdated\n", IPDB_FILE );
+			Sys_UnmapFile( h, size );
+			return qfalse;
+		}
 	}
 
-	Com_Printf( "ip4db: %i entries loaded\n", num_tlds );
+	ipdb.header = h;
+	ipdb.size = size;
+	ipdb.num4 = h->num4;
+	ipdb.to4 = (const uint32_t *)( (const byte *)h + h->ofsTo4 );
+	ipdb.from4 = (const uint32_t *)( (const byte *)h + h->ofsFrom4 );
+	ipdb.tld4 = (const char *)h + h->ofsTld4;
+	ipdb.num6 = h->num6;
+	ipdb.to6 = (const ip6key_t *)( (const byte *)h + h->ofsTo6 );
+	ipdb.from6 = (const ip6key_t *)( (const byte *)h + h->ofsFrom6 );
+	ipdb.tld6 = (const char *)h + h->ofsTld6;
+
+	return qtrue;
+}
+
+
+/*
+==================
+SV_LoadIPDB
+
+Maps compiled database, recompiles it from sources when needed
+==================
+*/
+static qboolean SV_LoadIPDB( qboolean rebuild )
+{
+	if ( rebuild || !SV_MapIPDB( qtrue ) )
+	{
+		if ( !SV_BuildIPDB() )
+		{
+			// sources may be missing while compiled database is present
+			if ( !SV_MapIPDB( qfalse ) )
+				return qfalse;
+		}
+		else if ( !SV_MapIPDB( qfalse ) )
+		{
+			return qfalse;
+		}
+	}
+
+	Com_Printf( "%s: %i ipv4 and %i ipv6 ranges mapped\n", IPDB_FILE, ipdb.num4, ipdb.num6 );
 	return qtrue;
 }
 
 
+/*
+==================
+SV_RehashIPDB_f
+
+Reloads geoip database without server restart
+==================
+*/
+void SV_RehashIPDB_f( void )
+{
+	SV_FreeIPDB();
+
+	if ( !SV_LoadIPDB( qtrue ) )
+		Com_Printf( "No geoip database loaded.\n" );
+
+	ipdb_loaded = qtrue;
+}
+
+
+// returns eytzinger index of the first key which is not less than ip or 0
+static int SV_IPDBSearch4( uint32_t ip )
+{
+	const uint32_t *to = ipdb.to4;
+	int n = ipdb.num4;
+	int k = 1;
+
+	while ( k <= n )
+		k = 2 * k + ( to[k] < ip );
+
+	// cancel right turns after last left turn
+	while ( k & 1 )
+		k >>= 1;
+
+	return k >> 1;
+}
+
+
+static int SV_IPDBSearch6( const ip6key_t *ip )
+{
+	const ip6key_t *to = ipdb.to6;
+	int n = ipdb.num6;
+	int k = 1;
+
+	while ( k <= n )
+		k = 2 * k + ( ip6_compare( &to[k], ip ) < 0 );
+
+	while ( k & 1 )
+		k >>= 1;
+
+	return k >> 1;
+}
+
+
 static void SV_SetTLD( char *str, const netadr_t *from, qboolean isLAN )
 {
-	const iprange_t *e;
-	int lo, hi, m;
-	uint32_t ip;
+	const char *tld;
+	int k;
 
 	str[0] = '\0';
 
@@ -340,44 +968,39 @@ static void SV_SetTLD( char *str, const netadr_t *from, qboolean isLAN )
 		return;
 	}
 
-	if ( from->type != NA_IP ) // ipv4-only
-		return;
-
 	if ( !ipdb_loaded )
-		ipdb_loaded = SV_LoadIP4DB( "ip4db.dat" );
-
-	if ( !ipdb_range )
-		return;
-
-	lo = 0;
-	hi = num_tlds;
-
-	// big-endian to host-endian
-#ifdef Q3_LITTLE_ENDIAN
-	ip =  from->ipv._4[3] | from->ipv._4[2] << 8 | from->ipv._4[1] << 16 | from->ipv._4[0] << 24;
-#else
-	ip =  from->ipv._4[0] | from->ipv._4[1] << 8 | from->ipv._4[2] << 16 | from->ipv._4[3] << 24;
-#endif
+	{
+		SV_LoadIPDB( qfalse );
+		ipdb_loaded = qtrue; // to not try to load it again
+	}
 
-	// binary search
-	while ( lo <= hi )
+	if ( from->type == NA_IP && ipdb.num4 )
 	{
-		m = ( lo + hi ) / 2;
-		e = ipdb_range + m;
-		if ( ip >= e->from && ip <= e->to )
-		{
-			const iprange_tld_t *tld = ipdb_tld + m;
-			str[0] = tld->tld[0];
-			str[1] = tld->tld[1];
-			str[2] = '\0';
+		const uint32_t ip = (uint32_t)from->ipv._4[0] << 24 | from->ipv._4[1] << 16 | from->ipv._4[2] << 8 | from->ipv._4[3];
+		k = SV_IPDBSearch4( ip );
+		if ( k == 0 || ipdb.from4[k] > ip )
 			return;
-		}
-
-		if ( e->from > ip )
-			hi = m - 1;
-		else
-			lo = m + 1;
+		tld = ipdb.tld4 + k * 2;
+	}
+#ifdef USE_IPV6
+	else if ( from->type == NA_IP6 && ipdb.num6 )
+	{
+		ip6key_t ip;
+		ip6_key( &ip, from->ipv._6 );
+		k = SV_IPDBSearch6( &ip );
+		if ( k == 0 || ip6_compare( &ipdb.from6[k], &ip ) > 0 )
+			return;
+		tld = ipdb.tld6 + k * 2;
+	}
+#endif
+	else
+	{
+		return;
 	}
+
+	str[0] = tld[0];
+	str[1] = tld[1];
+	str[2] = '\0';
 }
 
 
@@ -491,9 +1114,9 @@ void SV_DirectConnect( const netadr_t *from ) {
 
 #ifdef USE_BANS
 	// Check whether this client is banned.
-	if(SV_IsBanned(from, qfalse))
+	if(SV_IsBanned(from))
 	{
-		NET_OutOfBandPrint(NS_SERVER, &from, "print\nYou are banned from this server.\n");
+		NET_OutOfBandPrint(NS_SERVER, from, "print\nYou are banned from this server.\n");
 		return;
 	}
 #endif
@@ -818,6 +1441,8 @@ gotnewcl:
 	newcl->lastConnectTime = svs.time;
 	newcl->lastDisconnectTime = svs.time;
 
+	SV_RecordConnect( newcl );
+
 	SVC_RateRestoreToxicAddress( &newcl->netchan.remoteAddress, 10, 1000 );
 	newcl->justConnected = qtrue;
 
@@ -876,6 +1501,8 @@ void SV_DropClient( client_t *drop, const char *reason ) {
 
 	Q_strncpyz( name, drop->name, sizeof( name ) );	// for further DPrintf() because drop->name will be nuked in SV_SetUserinfo()
 
+	SV_RecordDisconnect( drop );
+
 	// Free all allocated data on the client structure
 	SV_FreeClient( drop );
 
@@ -1030,6 +1657,9 @@ static void SV_SendClientGameState( client_t *client ) {
 
 	Com_DPrintf( "SV_SendClientGameState() for %s\n", client->name );
 
+	// gamestate must not be followed by older pending changes
+	SV_FlushConfigstrings();
+
 	SV_PrintClientStateChange( client, CS_PRIMED );
 
 	client->state = CS_PRIMED;
@@ -1203,6 +1833,296 @@ CLIENT COMMAND EXECUTION
 ============================================================
 */
 
+/*
+=============================================================================
+
+Files being downloaded by one or more clients are mapped into memory once,
+blocks are written to messages directly from the shared mapping. If mapping
+is not possible file is read via regular file handle into per-client window
+buffers.
+
+=============================================================================
+*/
+
+#define MAX_DOWNLOAD_MAPS	8
+
+#define DL_INITIAL_RTO		1000
+#define DL_MIN_RTO			100
+#define DL_MAX_RTO			3000
+
+typedef struct {
+	char		name[MAX_QPATH];
+	const byte	*data;
+	int			size;
+	int			refs;
+} downloadMap_t;
+
+static downloadMap_t downloadMaps[ MAX_DOWNLOAD_MAPS ];
+
+static uint64_t	dlBytesTotal;		// payload bytes sent since startup
+static uint64_t	dlBlocksTotal;
+static uint64_t	dlRetransmits;
+static int		dlRateBytes;		// payload bytes sent since dlRateTime
+static int		dlRateTime;
+static int		dlRate;				// bytes per second over last measured interval
+
+
+/*
+==================
+SV_AcquireDownloadMap
+
+Returns 1-based index of shared mapping or 0 if file can't be mapped
+==================
+*/
+static int SV_AcquireDownloadMap( const char *name, int *size ) {
+	downloadMap_t *map;
+	int i, freeSlot = -1;
+
+	for ( i = 0; i < MAX_DOWNLOAD_MAPS; i++ ) {
+		map = &downloadMaps[ i ];
+		if ( map->refs == 0 ) {
+			if ( freeSlot == -1 )
+				freeSlot = i;
+			continue;
+		}
+		if ( strcmp( map->name, name ) == 0 ) {
+			map->refs++;
+			*size = map->size;
+			return i + 1;
+		}
+	}
+
+	if ( freeSlot == -1 )
+		return 0;
+
+	map = &downloadMaps[ freeSlot ];
+	map->data = FS_SV_MapFile( name, &map->size );
+	if ( map->data == NULL )
+		return 0;
+
+	// keep offset of the EOF block in range
+	if ( map->size > INT_MAX - MAX_DOWNLOAD_BLKSIZE ) {
+		Sys_UnmapFile( map->data, map->size );
+		map->data = NULL;
+		return 0;
+	}
+
+	Q_strncpyz( map->name, name, sizeof( map->name ) );
+	map->refs = 1;
+	*size = map->size;
+
+	return freeSlot + 1;
+}
+
+
+/*
+==================
+SV_ReleaseDownloadMap
+==================
+*/
+static void SV_ReleaseDownloadMap( int index ) {
+	downloadMap_t *map = &downloadMaps[ index - 1 ];
+
+	if ( --map->refs == 0 ) {
+		Sys_UnmapFile( map->data, map->size );
+		map->data = NULL;
+		map->size = 0;
+	}
+}
+
+
+/*
+==================
+SV_MappedDownloadBlock
+==================
+*/
+static const byte *SV_MappedDownloadBlock( const downloadMap_t *map, int block, int *size ) {
+	const int offset = block * MAX_DOWNLOAD_BLKSIZE;
+
+	// EOF block starts at or past the end of file when its size is not a multiple of block size
+	if ( offset >= map->size ) {
+		*size = 0;
+		return NULL;
+	}
+
+	*size = MIN( map->size - offset, MAX_DOWNLOAD_BLKSIZE );
+	return map->data + offset;
+}
+
+
+/*
+==================
+SV_DownloadBlock
+
+Returns data and size of specified block, zero size means EOF block
+==================
+*/
+static const byte *SV_DownloadBlock( const client_t *cl, int block, int *size ) {
+
+	if ( cl->downloadMap ) {
+		return SV_MappedDownloadBlock( &downloadMaps[ cl->downloadMap - 1 ], block, size );
+	}
+
+	*size = cl->downloadBlockSize[ block % MAX_DOWNLOAD_WINDOW ];
+	return cl->downloadBlocks[ block % MAX_DOWNLOAD_WINDOW ];
+}
+
+
+/*
+==================
+SV_DownloadWindow
+
+Returns number of blocks which may be sent ahead of last acknowledged one
+==================
+*/
+static int SV_DownloadWindow( const client_t *cl ) {
+	if ( cl->downloadMap && ( cl->downloadCaps & DL_CAP_WINDOW ) )
+		return MAX_DOWNLOAD_WINDOW_EXT;
+	else
+		return MAX_DOWNLOAD_WINDOW;
+}
+
+
+/*
+==================
+SV_UpdateDownloadRate
+==================
+*/
+static void SV_UpdateDownloadRate( void ) {
+	const int now = Sys_Milliseconds();
+	const int dt = now - dlRateTime;
+
+	if ( dt >= 1000 || dt < 0 ) {
+		dlRate = ( dt > 0 && dt < 2000 ) ? (int)( (int64_t)dlRateBytes * 1000 / dt ) : 0;
+		dlRateBytes = 0;
+		dlRateTime = now;
+	}
+}
+
+
+/*
+==================
+SV_DownloadCheck_f
+
+Walks all blocks of a mapped download up to the EOF block
+and compares them with the file contents
+==================
+*/
+void SV_DownloadCheck_f( void ) {
+	const downloadMap_t *map;
+	const byte *data;
+	fileHandle_t f;
+	byte buf[ MAX_DOWNLOAD_BLKSIZE ];
+	int index, fileSize, size, block, total;
+	qboolean ok;
+
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "Usage: %s <filename>\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	if ( FS_SV_FOpenFileRead( Cmd_Argv( 1 ), &f ) < 0 || f == FS_INVALID_HANDLE ) {
+		Com_Printf( "Couldn't read %s\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	index = SV_AcquireDownloadMap( Cmd_Argv( 1 ), &fileSize );
+	if ( !index ) {
+		Com_Printf( "Couldn't map %s\n", Cmd_Argv( 1 ) );
+		FS_FCloseFile( f );
+		return;
+	}
+	map = &downloadMaps[ index - 1 ];
+
+	ok = qtrue;
+	total = 0;
+	for ( block = 0; ; block++ ) {
+		data = SV_MappedDownloadBlock( map, block, &size );
+		if ( size < 0 || size > MAX_DOWNLOAD_BLKSIZE || ( size > 0 && total + size > fileSize ) ) {
+			Com_Printf( S_COLOR_YELLOW "block %i: bad size %i at offset %i\n", block, size, total );
+			ok = qfalse;
+			break;
+		}
+		if ( size == 0 ) {
+			break; // EOF block
+		}
+		if ( FS_Read( buf, size, f ) != size || memcmp( buf, data, size ) ) {
+			Com_Printf( S_COLOR_YELLOW "block %i: data mismatch at offset %i\n", block, total );
+			ok = qfalse;
+			break;
+		}
+		total += size;
+	}
+
+	if ( ok && total != fileSize ) {
+		Com_Printf( S_COLOR_YELLOW "EOF block %i at offset %i, file size %i\n", block, total, fileSize );
+		ok = qfalse;
+	}
+
+	SV_ReleaseDownloadMap( index );
+	FS_FCloseFile( f );
+
+	Com_Printf( "%s: %i bytes in %i blocks + EOF block, %s\n", Cmd_Argv( 1 ), total, block, ok ? "ok" : "FAILED" );
+}
+
+
+/*
+==================
+SV_PrintDownloadStats
+==================
+*/
+void SV_PrintDownloadStats( void ) {
+	const client_t *cl;
+	int i, active, mapped;
+
+	active = mapped = 0;
+	for ( i = 0, cl = svs.clients; i < sv.maxclients; i++, cl++ ) {
+		if ( cl->state >= CS_CONNECTED && *cl->downloadName ) {
+			active++;
+			if ( cl->downloadMap )
+				mapped++;
+		}
+	}
+
+	if ( active == 0 && dlBlocksTotal == 0 )
+		return;
+
+	SV_UpdateDownloadRate();
+
+	Com_Printf( "downloads: %i active (%i mapped), %i KB/s, %llu KB in %llu blocks, %llu retransmitted\n",
+		active, mapped, dlRate / 1024, (unsigned long long)( dlBytesTotal / 1024 ),
+		(unsigned long long)dlBlocksTotal, (unsigned long long)dlRetransmits );
+}
+
+
+/*
+==================
+SV_DownloadSampleRTT
+
+Updates retransmission timeout from a round-trip sample of never resent block
+==================
+*/
+static void SV_DownloadSampleRTT( client_t *cl, int rtt ) {
+
+	if ( rtt < 0 )
+		return;
+
+	if ( cl->downloadRTT < 0 ) {
+		cl->downloadRTT = rtt;
+		cl->downloadRTTVar = rtt / 2;
+	} else {
+		cl->downloadRTTVar = ( 3 * cl->downloadRTTVar + abs( cl->downloadRTT - rtt ) ) / 4;
+		cl->downloadRTT = ( 7 * cl->downloadRTT + rtt ) / 8;
+	}
+
+	cl->downloadRTO = cl->downloadRTT + 4 * cl->downloadRTTVar;
+	if ( cl->downloadRTO < DL_MIN_RTO )
+		cl->downloadRTO = DL_MIN_RTO;
+	else if ( cl->downloadRTO > DL_MAX_RTO )
+		cl->downloadRTO = DL_MAX_RTO;
+}
+
+
 /*
 ==================
 SV_CloseDownload
@@ -1219,6 +2139,11 @@ static void SV_CloseDownload( client_t *cl ) {
 		cl->download = FS_INVALID_HANDLE;
 	}
 
+	if ( cl->downloadMap ) {
+		SV_ReleaseDownloadMap( cl->downloadMap );
+		cl->downloadMap = 0;
+	}
+
 	*cl->downloadName = '\0';
 
 	// Free the temporary buffer space
@@ -1273,31 +2198,54 @@ static void SV_DoneDownload_f( client_t *cl ) {
 SV_NextDownload_f
 
 The argument will be the last acknowledged block from the client, it should be
-the same as cl->downloadClientBlock
+the same as cl->downloadClientBlock, clients with DL_CAP_WINDOW acknowledge all
+blocks up to and including the argument
 ==================
 */
 static void SV_NextDownload_f( client_t *cl )
 {
 	int block = atoi( Cmd_Argv(1) );
+	int index;
 
-	if (block == cl->downloadClientBlock) {
-		Com_DPrintf( "clientDownload: %d : client acknowledge of block %d\n", (int) (cl - svs.clients), block );
+	if ( !*cl->downloadName )
+		return;
 
-		// Find out if we are done.  A zero-length block indicates EOF
-		if (cl->downloadBlockSize[cl->downloadClientBlock % MAX_DOWNLOAD_WINDOW] == 0) {
-			Com_Printf( "clientDownload: %d : file \"%s\" completed\n", (int) (cl - svs.clients), cl->downloadName );
-			SV_CloseDownload( cl );
+	if ( cl->downloadCaps & DL_CAP_WINDOW ) {
+		// ignore duplicate and reordered acknowledges
+		if ( block < cl->downloadClientBlock || block >= cl->downloadXmitBlock )
 			return;
-		}
+	} else if ( block != cl->downloadClientBlock ) {
+		// We aren't getting an acknowledge for the correct block, drop the client
+		// FIXME: this is bad... the client will never parse the disconnect message
+		//			because the cgame isn't loaded yet
+		SV_DropClient( cl, "broken download" );
+		return;
+	}
+
+	Com_DPrintf( "clientDownload: %d : client acknowledge of block %d\n", (int) (cl - svs.clients), block );
 
-		cl->downloadSendTime = svs.time;
-		cl->downloadClientBlock++;
+	index = block % MAX_DOWNLOAD_WINDOW_EXT;
+	if ( !cl->downloadRetried[ index ] ) {
+		SV_DownloadSampleRTT( cl, Sys_Milliseconds() - cl->downloadXmitTime[ index ] );
+	}
+
+	// Find out if we are done.  A zero-length block indicates EOF
+	if ( cl->downloadEOF && block == cl->downloadCurrentBlock - 1 ) {
+		Com_Printf( "clientDownload: %d : file \"%s\" completed\n", (int) (cl - svs.clients), cl->downloadName );
+		SV_CloseDownload( cl );
 		return;
 	}
-	// We aren't getting an acknowledge for the correct block, drop the client
-	// FIXME: this is bad... the client will never parse the disconnect message
-	//			because the cgame isn't loaded yet
-	SV_DropClient( cl, "broken download" );
+
+	cl->downloadSendTime = svs.time;
+	for ( ; cl->downloadClientBlock <= block; cl->downloadClientBlock++ ) {
+		cl->downloadRetried[ cl->downloadClientBlock % MAX_DOWNLOAD_WINDOW_EXT ] = qfalse;
+	}
+
+	// after go-back legacy clients may still acknowledge blocks sent before it,
+	// don't resend them and don't let stale send times trigger retransmit timeout
+	if ( cl->downloadXmitBlock < cl->downloadClientBlock ) {
+		cl->downloadXmitBlock = cl->downloadClientBlock;
+	}
 }
 
 
@@ -1316,6 +2264,7 @@ static void SV_BeginDownload_f( client_t *cl ) {
 	// cl->downloadName is non-zero now, SV_WriteDownloadToClient will see this and open
 	// the file itself
 	Q_strncpyz( cl->downloadName, Cmd_Argv(1), sizeof(cl->downloadName) );
+	cl->downloadCaps = atoi( Cmd_Argv(2) ) & DL_CAP_ALL;
 
 	SV_PrintClientStateChange( cl, CS_CONNECTED );
 	cl->state = CS_CONNECTED;
@@ -1329,6 +2278,24 @@ static void SV_BeginDownload_f( client_t *cl ) {
 }
 
 
+/*
+==================
+SV_OpenDownload
+
+Maps requested file or opens it for reading, returns file size or -1
+==================
+*/
+static int SV_OpenDownload( client_t *cl ) {
+	int size;
+
+	cl->downloadMap = SV_AcquireDownloadMap( cl->downloadName, &size );
+	if ( cl->downloadMap )
+		return size;
+
+	return FS_SV_FOpenFileRead( cl->downloadName, &cl->download );
+}
+
+
 /*
 ==================
 SV_WriteDownloadToClient
@@ -1346,8 +2313,10 @@ static int SV_WriteDownloadToClient( client_t *cl )
 	int numRefPaks;
 	msg_t msg;
 	byte msgBuffer[MAX_DOWNLOAD_BLKSIZE*2+8];
+	const byte *data;
+	int block, size, window;
 
-	if ( cl->download == FS_INVALID_HANDLE ) {
+	if ( cl->download == FS_INVALID_HANDLE && !cl->downloadMap ) {
 		qboolean idPack = qfalse;
 		qboolean missionPack = qfalse;
  		// Chop off filename extension.
@@ -1389,7 +2358,7 @@ static int SV_WriteDownloadToClient( client_t *cl )
 		if ( !(sv_allowDownload->integer & DLF_ENABLE) ||
 			(sv_allowDownload->integer & DLF_NO_UDP) ||
 			idPack || unreferenced ||
-			( cl->downloadSize = FS_SV_FOpenFileRead( cl->downloadName, &cl->download ) ) < 0 ) {
+			( cl->downloadSize = SV_OpenDownload( cl ) ) < 0 ) {
 
 			// cannot auto-download file
 			if(unreferenced)
@@ -1449,17 +2418,31 @@ static int SV_WriteDownloadToClient( client_t *cl )
 			return 1;
 		}
 
-		Com_Printf( "clientDownload: %d : beginning \"%s\"\n", (int) (cl - svs.clients), cl->downloadName );
+		Com_Printf( "clientDownload: %d : beginning \"%s\"%s\n", (int) (cl - svs.clients), cl->downloadName,
+			cl->downloadMap ? " (mapped)" : "" );
 
 		cl->downloadCurrentBlock = cl->downloadClientBlock = cl->downloadXmitBlock = 0;
 		cl->downloadCount = 0;
 		cl->downloadEOF = qfalse;
+		cl->downloadRTT = -1;
+		cl->downloadRTTVar = 0;
+		cl->downloadRTO = DL_INITIAL_RTO;
+		Com_Memset( cl->downloadRetried, 0, sizeof( cl->downloadRetried ) );
 	}
 
+	window = SV_DownloadWindow( cl );
+
 	// Perform any reads that we need to
-	while (cl->downloadCurrentBlock - cl->downloadClientBlock < MAX_DOWNLOAD_WINDOW &&
+	while (cl->downloadCurrentBlock - cl->downloadClientBlock < window &&
 		cl->downloadSize != cl->downloadCount) {
 
+		if ( cl->downloadMap ) {
+			// mapped blocks are sent directly, nothing to read
+			cl->downloadCount += MIN( cl->downloadSize - cl->downloadCount, MAX_DOWNLOAD_BLKSIZE );
+			cl->downloadCurrentBlock++;
+			continue;
+		}
+
 		curindex = (cl->downloadCurrentBlock % MAX_DOWNLOAD_WINDOW);
 
 		if (!cl->downloadBlocks[curindex])
@@ -1482,7 +2465,7 @@ static int SV_WriteDownloadToClient( client_t *cl )
 	// Check to see if we have eof condition and add the EOF block
 	if (cl->downloadCount == cl->downloadSize &&
 		!cl->downloadEOF &&
-		cl->downloadCurrentBlock - cl->downloadClientBlock < MAX_DOWNLOAD_WINDOW) {
+		cl->downloadCurrentBlock - cl->downloadClientBlock < window) {
 
 		cl->downloadBlockSize[cl->downloadCurrentBlock % MAX_DOWNLOAD_WINDOW] = 0;
 		cl->downloadCurrentBlock++;
@@ -1493,44 +2476,73 @@ static int SV_WriteDownloadToClient( client_t *cl )
 	if (cl->downloadClientBlock == cl->downloadCurrentBlock)
 		return 0; // Nothing to transmit
 
-	// Write out the next section of the file, if we have already reached our window,
-	// automatically start retransmitting
-	if (cl->downloadXmitBlock == cl->downloadCurrentBlock)
-	{
-		// We have transmitted the complete window, should we start resending?
-		if (svs.time - cl->downloadSendTime > 1000)
+	block = -1;
+
+	// Check if the oldest unacknowledged block has timed out
+	if ( cl->downloadClientBlock != cl->downloadXmitBlock &&
+		Sys_Milliseconds() - cl->downloadXmitTime[ cl->downloadClientBlock % MAX_DOWNLOAD_WINDOW_EXT ] > cl->downloadRTO ) {
+
+		cl->downloadRTO = MIN( cl->downloadRTO * 2, DL_MAX_RTO );
+
+		if ( cl->downloadCaps & DL_CAP_WINDOW ) {
+			// client keeps out-of-order blocks, resend only the missing one
+			block = cl->downloadClientBlock;
+			cl->downloadRetried[ block % MAX_DOWNLOAD_WINDOW_EXT ] = qtrue;
+		} else {
+			// go back and resend the whole window
+			for ( block = cl->downloadClientBlock; block < cl->downloadXmitBlock; block++ ) {
+				cl->downloadRetried[ block % MAX_DOWNLOAD_WINDOW_EXT ] = qtrue;
+			}
 			cl->downloadXmitBlock = cl->downloadClientBlock;
-		else
+			block = -1;
+		}
+	}
+
+	if ( block == -1 ) {
+		// Write out the next section of the file unless we have already reached our window
+		if ( cl->downloadXmitBlock == cl->downloadCurrentBlock )
 			return 0;
+		// Move on to the next block
+		// It will get sent with next snap shot.  The rate will keep us in line.
+		block = cl->downloadXmitBlock++;
 	}
 
 	// Send current block
-	curindex = (cl->downloadXmitBlock % MAX_DOWNLOAD_WINDOW);
+	curindex = block % MAX_DOWNLOAD_WINDOW_EXT;
+	data = SV_DownloadBlock( cl, block, &size );
 
 	MSG_Init( &msg, msgBuffer, sizeof( msgBuffer ) - 8 );
 	MSG_WriteLong( &msg, cl->lastClientCommand );
 
 	MSG_WriteByte( &msg, svc_download );
-	MSG_WriteShort( &msg, cl->downloadXmitBlock );
+	MSG_WriteShort( &msg, block );
 
 	// block zero is special, contains file size
-	if ( cl->downloadXmitBlock == 0 )
+	if ( block == 0 )
 		MSG_WriteLong( &msg, cl->downloadSize );
 
-	MSG_WriteShort( &msg, cl->downloadBlockSize[curindex] );
+	MSG_WriteShort( &msg, size );
 
 	// Write the block
-	if ( cl->downloadBlockSize[curindex] > 0 )
-		MSG_WriteData( &msg, cl->downloadBlocks[curindex], cl->downloadBlockSize[curindex] );
+	if ( size > 0 ) {
+		if ( cl->downloadCaps & DL_CAP_RAW )
+			MSG_WriteRawData( &msg, data, size );
+		else
+			MSG_WriteData( &msg, data, size );
+	}
 
 	MSG_WriteByte( &msg, svc_EOF );
 	SV_Netchan_Transmit( cl, &msg );
 
-	Com_DPrintf( "clientDownload: %d : writing block %d\n", (int) (cl - svs.clients), cl->downloadXmitBlock );
+	Com_DPrintf( "clientDownload: %d : writing block %d\n", (int) (cl - svs.clients), block );
 
-	// Move on to the next block
-	// It will get sent with next snap shot.  The rate will keep us in line.
-	cl->downloadXmitBlock++;
+	if ( cl->downloadRetried[ curindex ] )
+		dlRetransmits++;
+	dlBlocksTotal++;
+	dlBytesTotal += size;
+	dlRateBytes += size;
+
+	cl->downloadXmitTime[ curindex ] = Sys_Milliseconds();
 	cl->downloadSendTime = svs.time;
 
 	return 1;
@@ -1582,6 +2594,8 @@ int SV_SendDownloadMessages( void )
 	int i, numDLs = 0;
 	client_t *cl;
 
+	SV_UpdateDownloadRate();
+
 	for( i = 0; i < sv.maxclients; i++ )
 	{
 		cl = &svs.clients[ i ];
@@ -2114,6 +3128,10 @@ static qboolean SV_ClientCommand( client_t *cl, msg_t *msg ) {
 		return qfalse;
 	}
 
+	if ( cl->state != CS_ZOMBIE ) {
+		SV_RecordCommand( cl, s );
+	}
+
 	cl->lastClientCommand = seq;
 	Q_strncpyz( cl->lastClientCommandString, s, sizeof( cl->lastClientCommandString ) );
 
@@ -2189,6 +3207,8 @@ static void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta ) {
 		oldcmd = cmd;
 	}
 
+	SV_RecordMove( cl, cmds, cmdCount, delta );
+
 	// save time for ping calculation
 	if ( cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked == 0 ) {
 		cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked = Sys_Milliseconds();
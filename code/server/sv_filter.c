@@ -113,6 +113,74 @@ static void free_nodes( filter_node_t *node )
 }
 
 
+// compares node's right value with specified userinfo value
+static int compare_node( const filter_node_t *node, const char *value )
+{
+	const char *value2;
+	int res = 0, v1, v2;
+
+	if ( node->is_string )
+	{
+		value2 = node->p2.string;
+		if ( node->is_cvar ) // dereference value2 
+		{
+			value2 = Cvar_VariableString( value2 + 1 );
+		}
+
+		if ( node->fop == FOP_MATCH )
+		{
+			res = Com_FilterExt( value2, value );
+			return res; // early exit, just to silent compiler warnings about uninitialized v1 & v2
+		}
+		else
+		{
+			if ( node->is_quoted ) // forced string comparison
+			{
+				v1 = Q_stricmp( value, value2 );
+				v2 = 0;
+			}
+			else // integer comparison
+			{
+				v1 = atoi( value );
+				v2 = atoi( value2 );
+			}
+		}
+	}
+	else
+	{
+		v1 = atoi( value );
+		v2 = node->p2.integer;
+	}
+
+	switch ( node->fop )
+	{
+		//case FOP_MATCH:res = Com_FilterExt( value2, value ); break;
+		case FOP_EQ:   res = (v1 == v2); break;
+		case FOP_NEQ:  res = (v1 != v2); break;
+		case FOP_LT:   res = (v1 <  v2); break;
+		case FOP_LTE:  res = (v1 <= v2); break;
+		case FOP_GT:   res = (v1 >  v2); break;
+		case FOP_GTE:  res = (v1 >= v2); break;
+	}
+	return res;
+}
+
+
+static const char *date_value( void )
+{
+	if ( filterCurrMsec != filterDateMsec ) // update date string
+	{
+		qtime_t t;
+		Com_RealTime( &t );
+		sprintf( filterDate, "%04i-%02i-%02i %02i:%02i",
+			t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+			t.tm_hour, t.tm_min );
+		filterDateMsec = filterCurrMsec;
+	}
+	return filterDate;
+}
+
+
 static int eval_node( const filter_node_t *node )
 {
 	if ( node->fop == FOP_DROP )
@@ -122,21 +190,11 @@ static int eval_node( const filter_node_t *node )
 	}
 	else
 	{
-		const char *value, *value2;
-		int res = 0, v1, v2;
+		const char *value;
 
 		if ( node->is_date )
 		{
-			if ( filterCurrMsec != filterDateMsec ) // update date string
-			{
-				qtime_t t;
-				Com_RealTime( &t );
-				sprintf( node->p1, "%04i-%02i-%02i %02i:%02i",
-					t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-					t.tm_hour, t.tm_min );
-				filterDateMsec = filterCurrMsec;
-			}
-			value = node->p1;
+			value = date_value(); // p1 points on filterDate
 		}
 		else
 		if ( node->is_fname )
@@ -153,50 +211,7 @@ static int eval_node( const filter_node_t *node )
 			value = Info_ValueForKeyToken( node->p1 ); 
 		}
 
-		if ( node->is_string )
-		{
-			value2 = node->p2.string;
-			if ( node->is_cvar ) // dereference value2 
-			{
-				value2 = Cvar_VariableString( value2 + 1 );
-			}
-
-			if ( node->fop == FOP_MATCH )
-			{
-				res = Com_FilterExt( value2, value );
-				return res; // early exit, just to silent compiler warnings about uninitialized v1 & v2
-			}
-			else
-			{
-				if ( node->is_quoted ) // forced string comparison
-				{
-					v1 = Q_stricmp( value, value2 );
-					v2 = 0;
-				}
-				else // integer comparison
-				{
-					v1 = atoi( value );
-					v2 = atoi( value2 );
-				}
-			}
-		}
-		else
-		{
-			v1 = atoi( value );
-			v2 = node->p2.integer;
-		}
-
-		switch ( node->fop )
-		{
-			//case FOP_MATCH:res = Com_FilterExt( value2, value ); break;
-			case FOP_EQ:   res = (v1 == v2); break;
-			case FOP_NEQ:  res = (v1 != v2); break;
-			case FOP_LT:   res = (v1 <  v2); break;
-			case FOP_LTE:  res = (v1 <= v2); break;
-			case FOP_GT:   res = (v1 >  v2); break;
-			case FOP_GTE:  res = (v1 >= v2); break;
-		}
-		return res;
+		return compare_node( node, value );
 	}
 }
 
@@ -238,19 +253,22 @@ static void dump_nodes( const filter_node_t *node, int level, int skip_tagged, F
 			}
 			else
 			{
+				// p1 points on filtered name buffer for 'fname' key
+				const char *key = node->is_fname ? "fname" : node->p1;
+
 				if ( node->fop == FOP_EQ ) // do not print default action for strings
 					s = "";
 
 				if ( node->is_string )
 				{
 					if ( node->is_quoted )
-						n = Com_sprintf( buf, sizeof(buf), "%s %s\"%s\"", node->p1, s, node->p2.string );
+						n = Com_sprintf( buf, sizeof(buf), "%s %s\"%s\"", key, s, node->p2.string );
 					else
-						n = Com_sprintf( buf, sizeof(buf), "%s %s%s", node->p1, s, node->p2.string );
+						n = Com_sprintf( buf, sizeof(buf), "%s %s%s", key, s, node->p2.string );
 				}
 				else
 				{
-					n = Com_sprintf( buf, sizeof(buf), "%s %s%i", node->p1, s, node->p2.integer );
+					n = Com_sprintf( buf, sizeof(buf), "%s %s%i", key, s, node->p2.integer );
 				}
 			}
 
@@ -300,6 +318,570 @@ static int walk_nodes( const filter_node_t *node )
 }
 
 
+/*
+=============================================================================
+
+COMPILED FILTERS
+
+The node tree is kept for parsing, dumping and expiration while evaluation
+runs on a flat copy of it: every sibling list becomes a contiguous range of
+entries, userinfo keys are interned into slots which are resolved once per
+evaluation and nodes that can only match one exact value or one literal
+prefix are indexed so only the candidates need to be compared.
+
+=============================================================================
+*/
+
+#define FILTER_SLOT_NONE -1
+
+typedef struct
+{
+	const filter_node_t *node;
+	int			list;		// owner list
+	int			slot;		// userinfo key slot or FILTER_SLOT_NONE
+	int			child;		// compiled child list or -1
+	int			next;		// next entry in the same hash bucket or trie node
+	unsigned	hash;		// lowercased value hash for exact matches
+} filter_entry_t;
+
+typedef struct
+{
+	int			firstEntry;
+	int			firstGeneric;	// entries which are evaluated for each walk
+	int			numGeneric;
+	int			firstIndex;		// per-slot hash/trie lookups
+	int			numIndexes;
+} filter_list_t;
+
+typedef struct
+{
+	int			slot;
+	int			hashed;			// there are exact matches for this slot
+	int			trie;			// root trie node for prefix matches or -1
+} filter_index_t;
+
+typedef struct
+{
+	int			child;
+	int			sibling;
+	int			entries;		// patterns whose literal prefix ends here
+	byte		c;
+} filter_trie_t;
+
+typedef struct
+{
+	void			*block;
+	filter_entry_t	*entries;
+	filter_list_t	*lists;
+	filter_index_t	*indexes;
+	filter_trie_t	*trie;
+	int				*generic;
+	int				*buckets;
+	int				bucketMask;
+	int				*candidates;
+	int				numCandidates;
+
+	char			**keys;			// interned lowercased key names
+	unsigned		*keyHashes;
+	int				*keyBuckets;
+	int				keyMask;
+	int				numKeys;
+	int				nameSlot;
+	int				fnameSlot;
+
+	const char		**values;		// per-slot userinfo values
+	int				*valueSeq;
+	int				seq;
+
+	int				numEntries;
+	int				numLists;
+	int				numIndexes;
+	int				numTrie;
+	int				numGeneric;
+	qboolean		valid;
+} filter_compiled_t;
+
+static filter_compiled_t compiled;
+
+
+static unsigned hash_lowercase( const char *s )
+{
+	unsigned hash = 2166136261u;
+
+	while ( *s != '\0' )
+	{
+		hash ^= locase[ (byte)*s++ ];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+
+static int bucket_for( unsigned hash, int list, int slot )
+{
+	return ( hash ^ ( list * 0x9E3779B1u ) ^ ( slot * 0x85EBCA6Bu ) ) & compiled.bucketMask;
+}
+
+
+static int literal_prefix( const char *pattern )
+{
+	int n = 0;
+
+	while ( pattern[n] != '\0' && pattern[n] != '*' && pattern[n] != '?' )
+		n++;
+
+	return n;
+}
+
+
+static void free_compiled( void )
+{
+	int i;
+
+	for ( i = 0; i < compiled.numKeys; i++ )
+		Z_Free( compiled.keys[ i ] );
+
+	if ( compiled.block )
+		Z_Free( compiled.block );
+
+	Com_Memset( &compiled, 0, sizeof( compiled ) );
+}
+
+
+static int find_slot( const char *key, unsigned hash )
+{
+	int i;
+
+	for ( i = hash & compiled.keyMask; compiled.keyBuckets[ i ] >= 0; i = ( i + 1 ) & compiled.keyMask )
+	{
+		int slot = compiled.keyBuckets[ i ];
+		if ( compiled.keyHashes[ slot ] == hash && Q_stricmp( compiled.keys[ slot ], key ) == 0 )
+			return slot;
+	}
+
+	return -1 - i; // free bucket
+}
+
+
+static int intern_slot( const char *key )
+{
+	unsigned hash = hash_lowercase( key );
+	int slot = find_slot( key, hash );
+
+	if ( slot >= 0 )
+		return slot;
+
+	compiled.keyBuckets[ -1 - slot ] = compiled.numKeys;
+	compiled.keyHashes[ compiled.numKeys ] = hash;
+	compiled.keys[ compiled.numKeys ] = CopyString( key );
+
+	return compiled.numKeys++;
+}
+
+
+static void count_nodes( const filter_node_t *node, int *numNodes, int *numLists, int *numTrie )
+{
+	(*numLists)++;
+
+	while ( node != NULL )
+	{
+		(*numNodes)++;
+		if ( node->is_string )
+			*numTrie += literal_prefix( node->p2.string ) + 1;
+		if ( node->child )
+			count_nodes( node->child, numNodes, numLists, numTrie );
+		node = node->next;
+	}
+}
+
+
+static filter_index_t *list_index( filter_list_t *list, int slot )
+{
+	filter_index_t *index;
+	int i;
+
+	for ( i = 0; i < list->numIndexes; i++ )
+	{
+		index = &compiled.indexes[ list->firstIndex + i ];
+		if ( index->slot == slot )
+			return index;
+	}
+
+	index = &compiled.indexes[ compiled.numIndexes++ ];
+	index->slot = slot;
+	index->hashed = 0;
+	index->trie = -1;
+	list->numIndexes++;
+
+	return index;
+}
+
+
+static int new_trie_node( byte c )
+{
+	filter_trie_t *t = &compiled.trie[ compiled.numTrie ];
+
+	t->child = -1;
+	t->sibling = -1;
+	t->entries = -1;
+	t->c = c;
+
+	return compiled.numTrie++;
+}
+
+
+static void trie_insert( filter_index_t *index, int entry, const char *pattern, int len )
+{
+	int n, t, i;
+
+	if ( index->trie < 0 )
+		index->trie = new_trie_node( 0 );
+
+	n = index->trie;
+	for ( i = 0; i < len; i++ )
+	{
+		byte c = locase[ (byte)pattern[i] ];
+		for ( t = compiled.trie[ n ].child; t >= 0; t = compiled.trie[ t ].sibling )
+		{
+			if ( compiled.trie[ t ].c == c )
+				break;
+		}
+		if ( t < 0 )
+		{
+			t = new_trie_node( c );
+			compiled.trie[ t ].sibling = compiled.trie[ n ].child;
+			compiled.trie[ n ].child = t;
+		}
+		n = t;
+	}
+
+	compiled.entries[ entry ].next = compiled.trie[ n ].entries;
+	compiled.trie[ n ].entries = entry;
+}
+
+
+static int compile_list( const filter_node_t *node )
+{
+	const filter_node_t *n;
+	filter_entry_t *e;
+	filter_list_t *list;
+	filter_index_t *index;
+	int listNum, count, i, len;
+
+	listNum = compiled.numLists++;
+	list = &compiled.lists[ listNum ];
+
+	for ( count = 0, n = node; n != NULL; n = n->next )
+		count++;
+
+	list->firstEntry = compiled.numEntries;
+	list->firstGeneric = compiled.numGeneric;
+	list->numGeneric = 0;
+	list->firstIndex = compiled.numIndexes;
+	list->numIndexes = 0;
+	compiled.numEntries += count;
+
+	// siblings first, so list ranges stay contiguous
+	for ( i = 0, n = node; n != NULL; n = n->next, i++ )
+	{
+		e = &compiled.entries[ list->firstEntry + i ];
+		e->node = n;
+		e->list = listNum;
+		e->child = -1;
+		e->next = -1;
+		e->hash = 0;
+
+		if ( n->fop == FOP_DROP || n->is_date )
+			e->slot = FILTER_SLOT_NONE;
+		else if ( n->is_fname )
+			e->slot = compiled.fnameSlot;
+		else
+			e->slot = intern_slot( n->p1 );
+
+		if ( e->slot != FILTER_SLOT_NONE && n->is_string && !n->is_cvar )
+		{
+			if ( ( n->fop == FOP_EQ && n->is_quoted ) || ( n->fop == FOP_MATCH && !Com_HasPatterns( n->p2.string ) ) )
+			{
+				// exact case-insensitive match
+				int b;
+				index = list_index( list, e->slot );
+				index->hashed = 1;
+				e->hash = hash_lowercase( n->p2.string );
+				b = bucket_for( e->hash, listNum, e->slot );
+				e->next = compiled.buckets[ b ];
+				compiled.buckets[ b ] = list->firstEntry + i;
+				continue;
+			}
+			if ( n->fop == FOP_MATCH && ( len = literal_prefix( n->p2.string ) ) > 0 )
+			{
+				// pattern with literal prefix, i.e. ip ranges
+				index = list_index( list, e->slot );
+				trie_insert( index, list->firstEntry + i, n->p2.string, len );
+				continue;
+			}
+		}
+
+		compiled.generic[ compiled.numGeneric++ ] = list->firstEntry + i;
+		list->numGeneric++;
+	}
+
+	for ( i = 0, n = node; n != NULL; n = n->next, i++ )
+	{
+		if ( n->child )
+		{
+			compiled.entries[ list->firstEntry + i ].child = compile_list( n->child );
+		}
+	}
+
+	return listNum;
+}
+
+
+static void compile_filters( void )
+{
+	int numNodes, numLists, numTrie, numBuckets, numKeyBuckets;
+	byte *buf;
+	int size;
+
+	free_compiled();
+
+	numNodes = numLists = numTrie = 0;
+	count_nodes( nodes, &numNodes, &numLists, &numTrie );
+
+	for ( numBuckets = 16; numBuckets < numNodes * 2; numBuckets <<= 1 )
+		;
+	for ( numKeyBuckets = 16; numKeyBuckets < ( numNodes + 2 ) * 2; numKeyBuckets <<= 1 )
+		;
+
+	numTrie += numNodes; // trie roots
+
+	size = numNodes * sizeof( filter_entry_t )
+		+ numLists * sizeof( filter_list_t )
+		+ numNodes * sizeof( filter_index_t )
+		+ numTrie * sizeof( filter_trie_t )
+		+ numNodes * sizeof( int ) // generic
+		+ numNodes * sizeof( int ) // candidates
+		+ numBuckets * sizeof( int )
+		+ numKeyBuckets * sizeof( int )
+		+ ( numNodes + 2 ) * ( sizeof( char * ) + sizeof( unsigned ) + sizeof( const char * ) + sizeof( int ) );
+
+	buf = compiled.block = Z_Malloc( size );
+	Com_Memset( buf, 0, size );
+
+	// pointer-sized arrays first to keep them aligned
+	compiled.keys = (char **) buf; buf += ( numNodes + 2 ) * sizeof( char * );
+	compiled.values = (const char **) buf; buf += ( numNodes + 2 ) * sizeof( const char * );
+	compiled.entries = (filter_entry_t *) buf; buf += numNodes * sizeof( filter_entry_t );
+	compiled.lists = (filter_list_t *) buf; buf += numLists * sizeof( filter_list_t );
+	compiled.indexes = (filter_index_t *) buf; buf += numNodes * sizeof( filter_index_t );
+	compiled.trie = (filter_trie_t *) buf; buf += numTrie * sizeof( filter_trie_t );
+	compiled.generic = (int *) buf; buf += numNodes * sizeof( int );
+	compiled.candidates = (int *) buf; buf += numNodes * sizeof( int );
+	compiled.buckets = (int *) buf; buf += numBuckets * sizeof( int );
+	compiled.keyBuckets = (int *) buf; buf += numKeyBuckets * sizeof( int );
+	compiled.keyHashes = (unsigned *) buf; buf += ( numNodes + 2 ) * sizeof( unsigned );
+	compiled.valueSeq = (int *) buf;
+
+	Com_Memset( compiled.buckets, -1, numBuckets * sizeof( int ) );
+	Com_Memset( compiled.keyBuckets, -1, numKeyBuckets * sizeof( int ) );
+	compiled.bucketMask = numBuckets - 1;
+	compiled.keyMask = numKeyBuckets - 1;
+
+	// "name" is always needed to produce "fname"
+	compiled.nameSlot = intern_slot( "name" );
+	compiled.fnameSlot = numNodes + 1;
+
+	compile_list( nodes );
+
+	compiled.valid = qtrue;
+}
+
+
+/*
+=================
+tokenize_slots
+
+Resolves userinfo values for all interned keys, first key occurrence wins
+as with Info_ValueForKeyToken()
+=================
+*/
+static void tokenize_slots( const char *s )
+{
+	static char tokenBuffer[ MAX_INFO_STRING ];
+	char *o = tokenBuffer, *key;
+	const char *name;
+	int slot;
+
+	if ( ++compiled.seq == 0 ) // wrap
+	{
+		Com_Memset( compiled.valueSeq, 0, ( compiled.fnameSlot + 1 ) * sizeof( int ) );
+		compiled.seq = 1;
+	}
+
+	while ( *s != '\0' && o < tokenBuffer + sizeof( tokenBuffer ) - 2 )
+	{
+		while ( *s == '\\' )
+			s++;
+		if ( *s == '\0' )
+			break;
+
+		key = o;
+		while ( *s != '\\' && *s != '\0' && o < tokenBuffer + sizeof( tokenBuffer ) - 2 )
+			*o++ = *s++;
+		*o++ = '\0';
+
+		slot = find_slot( key, hash_lowercase( key ) );
+		if ( *s == '\\' )
+			s++;
+
+		if ( slot >= 0 && compiled.valueSeq[ slot ] != compiled.seq )
+		{
+			compiled.valueSeq[ slot ] = compiled.seq;
+			compiled.values[ slot ] = o;
+			while ( *s != '\\' && *s != '\0' && o < tokenBuffer + sizeof( tokenBuffer ) - 1 )
+				*o++ = *s++;
+			*o++ = '\0';
+		}
+		else
+		{
+			while ( *s != '\\' && *s != '\0' )
+				s++;
+		}
+	}
+
+	// filtered name
+	if ( compiled.valueSeq[ compiled.nameSlot ] == compiled.seq )
+		name = compiled.values[ compiled.nameSlot ];
+	else
+		name = "";
+	CleanStr( filterName, sizeof( filterName ), name );
+	compiled.values[ compiled.fnameSlot ] = filterName;
+	compiled.valueSeq[ compiled.fnameSlot ] = compiled.seq;
+}
+
+
+static const char *slot_value( int slot )
+{
+	if ( compiled.valueSeq[ slot ] == compiled.seq )
+		return compiled.values[ slot ];
+	else
+		return "";
+}
+
+
+static int eval_entry( const filter_entry_t *e )
+{
+	if ( e->slot == FILTER_SLOT_NONE )
+		return eval_node( e->node ); // action or date
+	else
+		return compare_node( e->node, slot_value( e->slot ) );
+}
+
+
+static void add_candidate( int base, int entry )
+{
+	int *c = compiled.candidates;
+	int i = compiled.numCandidates++;
+
+	// keep sorted by entry number, which is the original node order
+	while ( i > base && c[ i - 1 ] > entry )
+	{
+		c[ i ] = c[ i - 1 ];
+		i--;
+	}
+	c[ i ] = entry;
+}
+
+
+static void collect_candidates( int listNum, const filter_list_t *list, int base )
+{
+	const filter_index_t *index;
+	const filter_entry_t *e;
+	const char *value;
+	unsigned hash;
+	int i, n, t;
+
+	for ( i = 0; i < list->numIndexes; i++ )
+	{
+		index = &compiled.indexes[ list->firstIndex + i ];
+		value = slot_value( index->slot );
+
+		if ( index->hashed )
+		{
+			hash = hash_lowercase( value );
+			for ( n = compiled.buckets[ bucket_for( hash, listNum, index->slot ) ]; n >= 0; n = e->next )
+			{
+				e = &compiled.entries[ n ];
+				if ( e->hash == hash && e->list == listNum && e->slot == index->slot )
+					add_candidate( base, n );
+			}
+		}
+
+		if ( index->trie >= 0 )
+		{
+			for ( t = index->trie; *value != '\0'; value++ )
+			{
+				byte c = locase[ (byte)*value ];
+				for ( t = compiled.trie[ t ].child; t >= 0; t = compiled.trie[ t ].sibling )
+				{
+					if ( compiled.trie[ t ].c == c )
+						break;
+				}
+				if ( t < 0 )
+					break;
+				for ( n = compiled.trie[ t ].entries; n >= 0; n = compiled.entries[ n ].next )
+					add_candidate( base, n );
+			}
+		}
+	}
+}
+
+
+/*
+=================
+walk_compiled
+
+Same as walk_nodes() but only visits nodes which are not indexed and
+indexed candidates for current userinfo values, in original order
+=================
+*/
+static int walk_compiled( int listNum )
+{
+	const filter_list_t *list = &compiled.lists[ listNum ];
+	const filter_entry_t *e;
+	const int *generic = compiled.generic + list->firstGeneric;
+	const int *cand;
+	int base, numGeneric, g, c, n, res;
+
+	base = compiled.numCandidates;
+	collect_candidates( listNum, list, base );
+	cand = compiled.candidates + base;
+	n = compiled.numCandidates - base;
+	numGeneric = list->numGeneric;
+
+	for ( g = 0, c = 0; g < numGeneric || c < n; )
+	{
+		if ( c >= n || ( g < numGeneric && generic[ g ] < cand[ c ] ) )
+			e = &compiled.entries[ generic[ g++ ] ];
+		else
+			e = &compiled.entries[ cand[ c++ ] ];
+
+		if ( ( res = eval_entry( e ) ) != 0 )
+		{
+			if ( res < 0 || ( e->child >= 0 && ( res = walk_compiled( e->child ) ) < 0 ) )
+			{
+				compiled.numCandidates = base;
+				return res;
+			}
+		}
+	}
+
+	compiled.numCandidates = base;
+	return 0;
+}
+
+
 // marks specified node and its kids as expired
 static void tag_from( filter_node_t *node )
 {
@@ -671,6 +1253,7 @@ static qboolean parse_file( const char *filename )
 	int size;
 	
 	// unconditionally release old filters
+	free_compiled();
 	free_nodes( nodes );
 	nodes = NULL;
 
@@ -774,6 +1357,7 @@ static void SV_ReloadFilters( const char *filename, filter_node_t *new_node )
 		if ( new_node )
 		{
 			clear_tags( nodes );
+			free_compiled();
 			// link new new node
 			new_node->next = nodes;
 			nodes = new_node;
@@ -837,18 +1421,35 @@ void SV_LoadFilters( const char *filename )
 }
 
 
-const char *SV_RunFilters( const char *userinfo, const netadr_t *addr )
+static int run_filters( const char *userinfo, qboolean tree )
 {
-	if ( addr->type <= NA_LOOPBACK ) // cannot kick host player/bot
-		return "";
-
-	Info_Tokenize( userinfo );
-
 	filterName[0] = '\0';
 	filterMessage[0] = '\0';
 	filterCurrMsec = Sys_Milliseconds();
 
-	if ( walk_nodes( nodes ) != 0 )
+	if ( nodes == NULL )
+		return 0;
+
+	if ( tree )
+	{
+		Info_Tokenize( userinfo );
+		return walk_nodes( nodes );
+	}
+
+	if ( !compiled.valid )
+		compile_filters();
+
+	tokenize_slots( userinfo );
+	return walk_compiled( 0 );
+}
+
+
+const char *SV_RunFilters( const char *userinfo, const netadr_t *addr )
+{
+	if ( addr->type <= NA_LOOPBACK ) // cannot kick host player/bot
+		return "";
+
+	if ( run_filters( userinfo, qfalse ) != 0 )
 	{
 		if ( filterMessage[0] )
 			return filterMessage;
@@ -860,6 +1461,135 @@ const char *SV_RunFilters( const char *userinfo, const netadr_t *addr )
 }
 
 
+/*
+===============
+SV_FilterBench_f
+
+Evaluates userinfo strings listed in a file, one per line,
+with both node tree and compiled filters
+===============
+*/
+void SV_FilterBench_f( void )
+{
+	char *data, *s, **lines;
+	unsigned *results;
+	int64_t start, usec[2];
+	int numLines, iterations, dropped, mismatches;
+	int i, n, pass;
+
+	if ( !sv_filter->string[0] )
+	{
+		Com_Printf( "Filter system is not enabled.\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() < 2 )
+	{
+		Com_Printf( "Usage: %s <userinfo list file> [iterations]\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	if ( FS_ReadFile( Cmd_Argv( 1 ), (void **)&data ) < 0 || data == NULL )
+	{
+		Com_Printf( "Couldn't load %s\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	iterations = 100;
+	if ( Cmd_Argc() > 2 )
+		iterations = atoi( Cmd_Argv( 2 ) );
+	if ( iterations < 1 )
+		iterations = 1;
+
+	numLines = 0;
+	for ( s = data; *s != '\0'; s++ )
+	{
+		if ( *s == '\n' )
+			numLines++;
+	}
+	numLines++;
+
+	lines = Z_Malloc( numLines * ( sizeof( *lines ) + sizeof( *results ) ) );
+	results = (unsigned *)( lines + numLines );
+
+	// split into lines, skip empty ones
+	n = 0;
+	for ( s = data; *s != '\0'; )
+	{
+		char *line = s;
+		while ( *s != '\0' && *s != '\n' && *s != '\r' )
+			s++;
+		if ( *s != '\0' )
+			*s++ = '\0';
+		if ( *line != '\0' )
+			lines[ n++ ] = line;
+	}
+	numLines = n;
+
+	if ( numLines == 0 )
+	{
+		Com_Printf( "No userinfo strings in %s\n", Cmd_Argv( 1 ) );
+		Z_Free( lines );
+		FS_FreeFile( data );
+		return;
+	}
+
+	SV_LoadFilters( sv_filter->string );
+
+	start = Sys_Microseconds();
+	compile_filters();
+	Com_Printf( "%i filter nodes compiled in %i usec: %i lists, %i keys, %i generic nodes, %i trie nodes\n",
+		compiled.numEntries, (int)( Sys_Microseconds() - start ), compiled.numLists, compiled.numKeys,
+		compiled.numGeneric, compiled.numTrie );
+
+	dropped = 0;
+	mismatches = 0;
+
+	for ( pass = 0; pass < 2; pass++ )
+	{
+		// pass 0: node tree, pass 1: compiled
+		start = Sys_Microseconds();
+		for ( n = 0; n < iterations; n++ )
+		{
+			for ( i = 0; i < numLines; i++ )
+			{
+				unsigned res;
+				if ( run_filters( lines[ i ], pass == 0 ) != 0 )
+					res = 1 | hash_lowercase( filterMessage );
+				else
+					res = 0;
+				if ( n == 0 )
+				{
+					if ( pass == 0 )
+					{
+						results[ i ] = res;
+						if ( res )
+							dropped++;
+					}
+					else if ( results[ i ] != res )
+					{
+						if ( mismatches++ < 8 )
+							Com_Printf( S_COLOR_YELLOW "mismatch on line %i: %s\n", i + 1, lines[ i ] );
+					}
+				}
+			}
+		}
+		usec[ pass ] = Sys_Microseconds() - start;
+		if ( usec[ pass ] < 1 )
+			usec[ pass ] = 1;
+	}
+
+	Com_Printf( "%i userinfo strings x %i iterations, %i dropped\n", numLines, iterations, dropped );
+	Com_Printf( "tree:     %.0f evaluations/sec\n", (double)numLines * iterations * 1000000.0 / usec[0] );
+	Com_Printf( "compiled: %.0f evaluations/sec\n", (double)numLines * iterations * 1000000.0 / usec[1] );
+	if ( mismatches )
+		Com_Printf( S_COLOR_YELLOW "%i mismatches\n", mismatches );
+
+	Z_Free( lines );
+	FS_FreeFile( data );
+}
+
+
 #define IS_LEAP(year) ( ( ( (year) % 4 == 0 ) && ( (year) % 100 != 0 ) ) || ( (year) % 400 == 0 ) )
 
 /* Add hours to specified date */
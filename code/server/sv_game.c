@@ -365,6 +365,12 @@ static qboolean SV_GetValue( char* value, int valueSize, const char* key )
 		return qtrue;
 	}
 
+	if ( !Q_stricmp( key, "trap_TraceBatch_Q3E" ) )
+	{
+		Com_sprintf( value, valueSize, "%i", G_TRACE_BATCH );
+		return qtrue;
+	}
+
 	return qfalse;
 }
 
@@ -982,6 +988,15 @@ static intptr_t SV_GameSystemCalls( intptr_t *args ) {
 		Cvar_SetDescription2( (const char*)VMA(1), (const char*)VMA(2) );
 		return 0;
 
+	case G_TRACE_BATCH:
+		if ( (unsigned)args[3] > MAX_TRACE_BATCH ) {
+			Com_Error( ERR_DROP, "%s: bad trace batch size %i", __func__, (int)args[3] );
+		}
+		VM_CHECKBOUNDS3( gvm, args[1], args[3], sizeof( traceRequest_t ) );
+		VM_CHECKBOUNDS3( gvm, args[2], args[3], sizeof( trace_t ) );
+		SV_TraceBatch( VMA(1), VMA(2), args[3] );
+		return 0;
+
 	case G_TRAP_GETVALUE:
 		VM_CHECKBOUNDS( gvm, args[1], args[2] );
 		return SV_GetValue( VMA(1), args[2], VMA(3) );
@@ -0,0 +1,537 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// sv_http.c -- built-in HTTP/1.1 file server for sv_dlURL downloads
+
+#include "server.h"
+
+/*
+=============================================================================
+
+Minimal HTTP server which answers GET and HEAD requests for referenced pk3
+files so clients with cURL support don't need a separate web server.
+Sockets are non-blocking and serviced from SV_SendQueuedPackets(), file
+data is pushed with NET_TCPSendFile() in chunks limited by per-IP rate.
+Each connection serves a single request and is closed afterwards.
+
+=============================================================================
+*/
+
+#define HTTP_MAX_CONNECTIONS	64
+#define HTTP_MAX_REQUEST		2048
+#define HTTP_MAX_CHUNK			(256*1024)	// max bytes pushed per connection per call
+#define HTTP_TIMEOUT			15000		// drop connections without any progress
+#define HTTP_POLL_MSEC			5			// service interval while transfers are active
+
+typedef enum {
+	HTTP_FREE,
+	HTTP_REQUEST,	// reading request headers
+	HTTP_RESPONSE,	// sending response headers
+	HTTP_BODY		// sending file data
+} httpState_t;
+
+typedef struct {
+	httpState_t	state;
+	intptr_t	sock;
+	netadr_t	addr;
+	int			lastActive;		// time of last sent or received data
+
+	char		request[ HTTP_MAX_REQUEST ];
+	int			requestLength;
+
+	char		response[ 512 ];
+	int			responseLength;
+	int			responseSent;
+
+	FILE		*file;
+	int			fileOffset;
+	int			fileLength;
+
+	int			budget;			// bytes allowed to send by sv_httpRate
+	int			budgetTime;
+} httpConn_t;
+
+static httpConn_t	httpConns[ HTTP_MAX_CONNECTIONS ];
+static intptr_t		httpListener = (intptr_t)-1;
+static qboolean		httpListening;
+static int			httpPort;				// port we have tried to listen on
+static char			httpURL[ MAX_CVAR_VALUE_STRING ];	// sv_dlURL value set by us
+static int			httpURLFlags;			// sv_dlURL flags cleared by us
+
+
+/*
+==================
+SV_HTTPClose
+==================
+*/
+static void SV_HTTPClose( httpConn_t *conn ) {
+	if ( conn->file ) {
+		fclose( conn->file );
+		conn->file = NULL;
+	}
+	NET_CloseClientSocket( conn->sock );
+	conn->state = HTTP_FREE;
+}
+
+
+/*
+==================
+SV_HTTPShutdown
+
+Closes all connections and listening socket, restores sv_dlURL
+==================
+*/
+void SV_HTTPShutdown( void ) {
+	int i;
+
+	for ( i = 0; i < HTTP_MAX_CONNECTIONS; i++ ) {
+		if ( httpConns[ i ].state != HTTP_FREE ) {
+			SV_HTTPClose( &httpConns[ i ] );
+		}
+	}
+
+	if ( httpListening ) {
+		NET_CloseClientSocket( httpListener );
+		httpListening = qfalse;
+	}
+
+	if ( httpURL[0] ) {
+		cvar_t *dlURL = Cvar_Get( "sv_dlURL", "", 0 );
+		if ( strcmp( dlURL->string, httpURL ) == 0 ) {
+			Cvar_Set( "sv_dlURL", "" );
+		}
+		dlURL->flags |= httpURLFlags;
+		httpURLFlags = 0;
+		httpURL[0] = '\0';
+	}
+
+	httpPort = 0;
+}
+
+
+/*
+==================
+SV_HTTPOpen
+==================
+*/
+static void SV_HTTPOpen( void ) {
+	const char *host;
+	netadr_t adr;
+	cvar_t *dlURL;
+
+	SV_HTTPShutdown();
+
+	httpPort = sv_httpPort->integer;
+	if ( httpPort <= 0 ) {
+		return;
+	}
+
+	httpListener = NET_TCPListen( httpPort );
+	if ( httpListener == (intptr_t)-1 ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't open HTTP server on port %i\n", httpPort );
+		return;
+	}
+	httpListening = qtrue;
+
+	// advertise ourselves unless operator has configured external server
+	if ( sv_httpHost->string[0] ) {
+		host = sv_httpHost->string;
+	} else if ( Q_stricmp( Cvar_VariableString( "net_ip" ), "0.0.0.0" ) != 0 ) {
+		host = Cvar_VariableString( "net_ip" );
+	} else if ( NET_GetPrimaryAddress( &adr ) ) {
+		host = NET_AdrToString( &adr );
+	} else {
+		host = "localhost";
+	}
+
+	dlURL = Cvar_Get( "sv_dlURL", "", 0 );
+	if ( dlURL->string[0] == '\0' ) {
+		Com_sprintf( httpURL, sizeof( httpURL ), "http://%s:%i", host, httpPort );
+		// automatic value must not be saved to config, archiving is restored on shutdown
+		httpURLFlags = dlURL->flags & CVAR_ARCHIVE;
+		dlURL->flags &= ~CVAR_ARCHIVE;
+		Cvar_Set( "sv_dlURL", httpURL );
+	}
+
+	Com_Printf( "HTTP server listening on port %i, sv_dlURL is \"%s\"\n", httpPort, Cvar_VariableString( "sv_dlURL" ) );
+}
+
+
+/*
+==================
+SV_HTTPConnectionsFrom
+==================
+*/
+static int SV_HTTPConnectionsFrom( const netadr_t *addr ) {
+	int i, count;
+
+	for ( i = 0, count = 0; i < HTTP_MAX_CONNECTIONS; i++ ) {
+		if ( httpConns[ i ].state != HTTP_FREE && NET_CompareBaseAdr( &httpConns[ i ].addr, addr ) ) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
+/*
+==================
+SV_HTTPRespond
+
+Queues response headers, file is sent afterwards if opened
+==================
+*/
+static void SV_HTTPRespond( httpConn_t *conn, int status, const char *reason, int length ) {
+	conn->responseLength = Com_sprintf( conn->response, sizeof( conn->response ),
+		"HTTP/1.1 %i %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %i\r\n"
+		"Connection: close\r\n"
+		"\r\n",
+		status, reason, status == 200 ? "application/octet-stream" : "text/plain", length );
+	conn->responseSent = 0;
+	conn->state = HTTP_RESPONSE;
+}
+
+
+/*
+==================
+SV_HTTPAllowedPath
+
+Only referenced non-id pk3 files can be downloaded, same as via UDP
+==================
+*/
+static qboolean SV_HTTPAllowedPath( const char *path ) {
+	char pakbuf[ MAX_QPATH ], name[ MAX_QPATH ];
+	const char *s;
+	char *ext;
+	int len;
+
+	if ( strstr( path, ".." ) || strchr( path, '\\' ) || strchr( path, ':' ) || *path == '/' ) {
+		return qfalse;
+	}
+
+	Q_strncpyz( pakbuf, path, sizeof( pakbuf ) );
+	ext = strrchr( pakbuf, '.' );
+	if ( !ext || Q_stricmp( ext, ".pk3" ) != 0 ) {
+		return qfalse;
+	}
+	*ext = '\0';
+
+	if ( FS_idPak( pakbuf, BASEGAME, NUM_ID_PAKS ) || FS_idPak( pakbuf, BASETA, NUM_TA_PAKS ) ) {
+		return qfalse;
+	}
+
+	for ( s = sv_referencedPakNames->string; *s; s += len ) {
+		while ( *s == ' ' )
+			s++;
+		for ( len = 0; s[len] && s[len] != ' '; len++ )
+			;
+		if ( len == 0 || len >= sizeof( name ) )
+			continue;
+		Com_Memcpy( name, s, len );
+		name[ len ] = '\0';
+		if ( !FS_FilenameCompare( name, pakbuf ) ) {
+			return qtrue;
+		}
+	}
+
+	return qfalse;
+}
+
+
+/*
+==================
+SV_HTTPHexValue
+==================
+*/
+static int SV_HTTPHexValue( int ch ) {
+	if ( ch >= '0' && ch <= '9' )
+		return ch - '0';
+	if ( ch >= 'a' && ch <= 'f' )
+		return ch - 'a' + 10;
+	if ( ch >= 'A' && ch <= 'F' )
+		return ch - 'A' + 10;
+	return -1;
+}
+
+
+/*
+==================
+SV_HTTPParseRequest
+
+Called once complete request headers are received
+==================
+*/
+static void SV_HTTPParseRequest( httpConn_t *conn ) {
+	char path[ MAX_QPATH ];
+	char *s, *target, *version;
+	qboolean head;
+	int i, hi, lo;
+
+	s = conn->request;
+	if ( !Q_strncmp( s, "GET ", 4 ) ) {
+		head = qfalse;
+		target = s + 4;
+	} else if ( !Q_strncmp( s, "HEAD ", 5 ) ) {
+		head = qtrue;
+		target = s + 5;
+	} else {
+		SV_HTTPRespond( conn, 405, "Method Not Allowed", 0 );
+		return;
+	}
+
+	version = strchr( target, ' ' );
+	if ( !version || *target != '/' ) {
+		SV_HTTPRespond( conn, 400, "Bad Request", 0 );
+		return;
+	}
+	*version = '\0';
+
+	// decode path, ignore query string
+	for ( i = 0, s = target + 1; *s && *s != '?' && *s != '#'; s++ ) {
+		if ( i >= sizeof( path ) - 1 ) {
+			SV_HTTPRespond( conn, 404, "Not Found", 0 );
+			return;
+		}
+		if ( *s == '%' ) {
+			hi = SV_HTTPHexValue( s[1] );
+			lo = hi >= 0 ? SV_HTTPHexValue( s[2] ) : -1;
+			if ( lo < 0 || ( hi | lo ) == 0 ) {
+				SV_HTTPRespond( conn, 400, "Bad Request", 0 );
+				return;
+			}
+			path[ i++ ] = hi * 16 + lo;
+			s += 2;
+		} else {
+			path[ i++ ] = *s;
+		}
+	}
+	path[ i ] = '\0';
+
+	if ( !SV_HTTPAllowedPath( path ) ) {
+		Com_DPrintf( "HTTP: %s : \"%s\" is not allowed\n", NET_AdrToString( &conn->addr ), path );
+		SV_HTTPRespond( conn, 404, "Not Found", 0 );
+		return;
+	}
+
+	conn->file = FS_SV_OpenSysFile( path, &conn->fileLength );
+	if ( !conn->file ) {
+		SV_HTTPRespond( conn, 404, "Not Found", 0 );
+		return;
+	}
+
+	Com_Printf( "HTTP: %s : %s \"%s\"\n", NET_AdrToString( &conn->addr ), head ? "HEAD" : "GET", path );
+
+	SV_HTTPRespond( conn, 200, "OK", conn->fileLength );
+	conn->fileOffset = 0;
+
+	if ( head ) {
+		fclose( conn->file );
+		conn->file = NULL;
+	}
+}
+
+
+/*
+==================
+SV_HTTPAccept
+==================
+*/
+static void SV_HTTPAccept( void ) {
+	httpConn_t *conn;
+	netadr_t addr;
+	intptr_t sock;
+	int i;
+
+	while ( ( sock = NET_TCPAccept( httpListener, &addr ) ) != (intptr_t)-1 ) {
+
+		for ( i = 0, conn = NULL; i < HTTP_MAX_CONNECTIONS; i++ ) {
+			if ( httpConns[ i ].state == HTTP_FREE ) {
+				conn = &httpConns[ i ];
+				break;
+			}
+		}
+
+		if ( !conn || SV_HTTPConnectionsFrom( &addr ) >= sv_httpMaxConnsPerIP->integer ) {
+			static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+			NET_TCPSend( sock, busy, sizeof( busy ) - 1 );
+			NET_CloseClientSocket( sock );
+			continue;
+		}
+
+		Com_Memset( conn, 0, sizeof( *conn ) );
+		conn->state = HTTP_REQUEST;
+		conn->sock = sock;
+		conn->addr = addr;
+		conn->lastActive = Sys_Milliseconds();
+		conn->budgetTime = conn->lastActive;
+	}
+}
+
+
+/*
+==================
+SV_HTTPRefillBudget
+
+Splits sv_httpRate of the remote address between its connections
+==================
+*/
+static void SV_HTTPRefillBudget( httpConn_t *conn, int now ) {
+	int64_t refill;
+	int rate;
+
+	if ( sv_httpRate->integer <= 0 ) {
+		conn->budget = HTTP_MAX_CHUNK;
+		return;
+	}
+
+	rate = sv_httpRate->integer * 1024 / SV_HTTPConnectionsFrom( &conn->addr );
+	refill = (int64_t)rate * ( now - conn->budgetTime ) / 1000;
+	if ( refill <= 0 )
+		return;
+
+	conn->budgetTime = now;
+	// allow bursts up to 1/4 second
+	conn->budget = (int)MIN( conn->budget + refill, rate / 4 + MAX_DOWNLOAD_BLKSIZE );
+}
+
+
+/*
+==================
+SV_HTTPService
+
+Advances state of a single connection, returns qfalse if it was closed
+==================
+*/
+static qboolean SV_HTTPService( httpConn_t *conn, int now ) {
+	char *end;
+	int n;
+
+	switch ( conn->state ) {
+	case HTTP_REQUEST:
+		n = NET_TCPRecv( conn->sock, conn->request + conn->requestLength, sizeof( conn->request ) - 1 - conn->requestLength );
+		if ( n < 0 ) {
+			SV_HTTPClose( conn );
+			return qfalse;
+		}
+		if ( n == 0 )
+			break;
+		conn->lastActive = now;
+		conn->requestLength += n;
+		conn->request[ conn->requestLength ] = '\0';
+		end = strstr( conn->request, "\r\n\r\n" );
+		if ( end ) {
+			SV_HTTPParseRequest( conn );
+		} else if ( conn->requestLength >= sizeof( conn->request ) - 1 ) {
+			SV_HTTPRespond( conn, 431, "Request Header Fields Too Large", 0 );
+		}
+		break;
+
+	case HTTP_RESPONSE:
+		n = NET_TCPSend( conn->sock, conn->response + conn->responseSent, conn->responseLength - conn->responseSent );
+		if ( n < 0 ) {
+			SV_HTTPClose( conn );
+			return qfalse;
+		}
+		if ( n == 0 )
+			break;
+		conn->lastActive = now;
+		conn->responseSent += n;
+		if ( conn->responseSent < conn->responseLength )
+			break;
+		if ( !conn->file || conn->fileLength == 0 ) {
+			SV_HTTPClose( conn );
+			return qfalse;
+		}
+		conn->state = HTTP_BODY;
+		// fall through
+
+	case HTTP_BODY:
+		SV_HTTPRefillBudget( conn, now );
+		n = MIN( conn->fileLength - conn->fileOffset, MIN( conn->budget, HTTP_MAX_CHUNK ) );
+		if ( n <= 0 )
+			break;
+		n = NET_TCPSendFile( conn->sock, conn->file, conn->fileOffset, n );
+		if ( n < 0 ) {
+			SV_HTTPClose( conn );
+			return qfalse;
+		}
+		if ( n == 0 )
+			break;
+		conn->lastActive = now;
+		conn->fileOffset += n;
+		if ( sv_httpRate->integer > 0 )
+			conn->budget -= n;
+		if ( conn->fileOffset >= conn->fileLength ) {
+			SV_HTTPClose( conn );
+			return qfalse;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	if ( now - conn->lastActive > HTTP_TIMEOUT ) {
+		SV_HTTPClose( conn );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+
+/*
+==================
+SV_HTTPFrame
+
+Accepts new connections and pushes pending data without blocking,
+returns time in msec until next call is needed or -1 if idle
+==================
+*/
+int SV_HTTPFrame( void ) {
+	int i, now, active;
+
+	if ( sv_httpPort->integer != httpPort || sv_httpHost->modified ) {
+		sv_httpHost->modified = qfalse;
+		SV_HTTPOpen();
+	}
+
+	if ( !httpListening ) {
+		return -1;
+	}
+
+	SV_HTTPAccept();
+
+	now = Sys_Milliseconds();
+	active = 0;
+
+	for ( i = 0; i < HTTP_MAX_CONNECTIONS; i++ ) {
+		if ( httpConns[ i ].state != HTTP_FREE && SV_HTTPService( &httpConns[ i ], now ) ) {
+			active++;
+		}
+	}
+
+	return active ? HTTP_POLL_MSEC : -1;
+}
+
@@ -82,6 +82,9 @@ void SV_UpdateConfigstrings(client_t *client)
 {
 	int index;
 
+	// pending changes must not be sent after newer values
+	SV_FlushConfigstrings();
+
 	for( index = 0; index < MAX_CONFIGSTRINGS; index++ ) {
 		// if the CS hasn't changed since we went to CS_PRIMED, ignore
 		if(!client->csUpdated[index])
@@ -97,15 +100,108 @@ void SV_UpdateConfigstrings(client_t *client)
 	}
 }
 
+
+/*
+===============
+SV_BroadcastConfigstring
+
+Sends configstring to all active clients and marks it for the others,
+returns number of active clients which got or would get the update
+===============
+*/
+static int SV_BroadcastConfigstring( int index, qboolean send ) {
+	client_t	*client;
+	int			i, count;
+
+	count = 0;
+	for ( i = 0, client = svs.clients; i < sv.maxclients; i++, client++ ) {
+		if ( client->state < CS_ACTIVE ) {
+			if ( send && ( client->state == CS_PRIMED || client->state == CS_CONNECTED ) ) {
+				// track CS_CONNECTED clients as well to optimize gamestate acknowledge after downloading/retransmission
+				client->csUpdated[index] = qtrue;
+			}
+			continue;
+		}
+		// do not always send server info to all clients
+		if ( index == CS_SERVERINFO && ( SV_GentityNum( i )->r.svFlags & SVF_NOSERVERINFO ) ) {
+			continue;
+		}
+
+		if ( send ) {
+			SV_SendConfigstring( client, index );
+		}
+		count++;
+	}
+
+	return count;
+}
+
+
+/*
+===============
+SV_FlushConfigstrings
+
+Sends configstrings changed since the last flush, each index once with
+its final value, in order of their first change. Called before any other
+server command is queued, so ordering between them is preserved
+===============
+*/
+void SV_FlushConfigstrings( void ) {
+	int		i, n, index, writes, count;
+	char	*prev;
+
+	n = sv.numCsPending;
+	if ( n == 0 ) {
+		return;
+	}
+
+	// sending commands will try to flush again
+	sv.numCsPending = 0;
+
+	for ( i = 0; i < n; i++ ) {
+		index = sv.csPending[ i ];
+		prev = sv.csPrevious[ index ];
+		writes = sv.csWrites[ index ];
+		sv.csPrevious[ index ] = NULL;
+		sv.csWrites[ index ] = 0;
+
+		if ( !strcmp( prev, sv.configstrings[ index ] ) ) {
+			// changed back to what clients already have
+			count = SV_BroadcastConfigstring( index, qfalse );
+			svs.csCommandsSaved += (uint64_t)writes * count;
+		} else {
+			count = SV_BroadcastConfigstring( index, qtrue );
+			svs.csCommands += count;
+			svs.csCommandsSaved += (uint64_t)( writes - 1 ) * count;
+		}
+
+		Z_Free( prev );
+	}
+}
+
+
+/*
+===============
+SV_PrintConfigstringStats
+===============
+*/
+void SV_PrintConfigstringStats( void ) {
+	const uint64_t total = svs.csCommands + svs.csCommandsSaved;
+
+	Com_Printf( "configstrings: %llu changes, %llu commands sent, %llu saved (%.1f%%)\n",
+		(unsigned long long)svs.csChanges, (unsigned long long)svs.csCommands, (unsigned long long)svs.csCommandsSaved,
+		total ? svs.csCommandsSaved * 100.0 / total : 0.0 );
+}
+
+
 /*
 ===============
 SV_SetConfigstring
 
+Changes made in game are sent to clients on the next SV_FlushConfigstrings()
 ===============
 */
 void SV_SetConfigstring (int index, const char *val) {
-	int		i;
-	client_t	*client;
 
 	if ( index < 0 || index >= MAX_CONFIGSTRINGS ) {
 		Com_Error (ERR_DROP, "SV_SetConfigstring: bad index %i", index);
@@ -120,31 +216,25 @@ void SV_SetConfigstring (int index, const char *val) {
 		return;
 	}
 
-	// change the string in sv
-	Z_Free( sv.configstrings[index] );
-	sv.configstrings[index] = CopyString( val );
-
 	// send it to all the clients if we aren't
 	// spawning a new server
 	if ( sv.state == SS_GAME || sv.restarting ) {
-
-		// send the data to all relevant clients
-		for (i = 0, client = svs.clients; i < sv.maxclients; i++, client++) {
-			if ( client->state < CS_ACTIVE ) {
-				if ( client->state == CS_PRIMED || client->state == CS_CONNECTED ) {
-					// track CS_CONNECTED clients as well to optimize gamestate acknowledge after downloading/retransmission
-					client->csUpdated[index] = qtrue;
-				}
-				continue;
-			}
-			// do not always send server info to all clients
-			if ( index == CS_SERVERINFO && ( SV_GentityNum( i )->r.svFlags & SVF_NOSERVERINFO ) ) {
-				continue;
-			}
-
-			SV_SendConfigstring(client, index);
+		if ( sv.csPrevious[ index ] ) {
+			// already pending, only the last value matters
+			Z_Free( sv.configstrings[ index ] );
+		} else {
+			// keep what clients have to detect changing back
+			sv.csPrevious[ index ] = sv.configstrings[ index ];
+			sv.csPending[ sv.numCsPending++ ] = index;
 		}
+		sv.csWrites[ index ]++;
+		svs.csChanges++;
+	} else {
+		Z_Free( sv.configstrings[ index ] );
 	}
+
+	// change the string in sv
+	sv.configstrings[index] = CopyString( val );
 }
 
 
@@ -388,6 +478,9 @@ static void SV_ClearServer( void ) {
 		if ( sv.configstrings[i] ) {
 			Z_Free( sv.configstrings[i] );
 		}
+		if ( sv.csPrevious[i] ) {
+			Z_Free( sv.csPrevious[i] );
+		}
 	}
 
 	if ( !sv_levelTimeReset->integer ) {
@@ -415,6 +508,9 @@ void SV_SpawnServer( const char *mapname, qboolean killBots ) {
 	qboolean	isBot;
 	const char	*p;
 
+	// recorded input belongs to the previous map
+	SV_StopRecord();
+
 	// shut down the existing game if it is running
 	SV_ShutdownGameProgs();
 
@@ -670,6 +766,7 @@ void SV_SpawnServer( const char *mapname, qboolean killBots ) {
 
 	SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO, NULL ) );
 	cvar_modifiedFlags &= ~CVAR_SERVERINFO;
+	SV_InvalidateQueryInfo();
 
 	// any media configstring setting now should issue a warning
 	// and any configstring changes should be reliably transmitted
@@ -773,6 +870,19 @@ void SV_Init( void )
 	sv_allowDownload = Cvar_Get ("sv_allowDownload", "1", CVAR_SERVERINFO);
 	Cvar_SetDescription( sv_allowDownload, "Toggle the ability for clients to download files maps etc. from server." );
 	Cvar_Get ("sv_dlURL", "", CVAR_SERVERINFO | CVAR_ARCHIVE);
+	Cvar_Get ("sv_dlCaps", va( "%i", DL_CAP_ALL ), CVAR_SERVERINFO | CVAR_ROM);
+
+	sv_httpPort = Cvar_Get( "sv_httpPort", "0", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( sv_httpPort, "0", "65535", CV_INTEGER );
+	Cvar_SetDescription( sv_httpPort, "TCP port of built-in HTTP server for referenced pk3 downloads, 0 - disabled.\nEmpty sv_dlURL is set to point to it automatically." );
+	sv_httpHost = Cvar_Get( "sv_httpHost", "", CVAR_ARCHIVE_ND );
+	Cvar_SetDescription( sv_httpHost, "Host name or address advertised in sv_dlURL for built-in HTTP server, detected automatically if empty." );
+	sv_httpMaxConnsPerIP = Cvar_Get( "sv_httpMaxConnsPerIP", "4", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( sv_httpMaxConnsPerIP, "1", "64", CV_INTEGER );
+	Cvar_SetDescription( sv_httpMaxConnsPerIP, "Maximum number of simultaneous HTTP connections from single IP address." );
+	sv_httpRate = Cvar_Get( "sv_httpRate", "0", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( sv_httpRate, "0", NULL, CV_INTEGER );
+	Cvar_SetDescription( sv_httpRate, "Bandwidth allotted to HTTP downloads per IP address, in kbyte/s, 0 - unlimited." );
 
 	// moved to Com_Init()
 	//sv_master[0] = Cvar_Get( "sv_master1", MASTER_SERVER_NAME, CVAR_INIT | CVAR_ARCHIVE_ND );
@@ -806,6 +916,32 @@ void SV_Init( void )
 	sv_filter = Cvar_Get( "sv_filter", "filter.txt", CVAR_ARCHIVE );
 	Cvar_SetDescription( sv_filter, "Cvar that point on filter file, if it is "" then filtering will be disabled." );
 
+	sv_snapshotThreads = Cvar_Get( "sv_snapshotThreads", "0", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( sv_snapshotThreads, "0", XSTRING( MAX_WORKER_THREADS ), CV_INTEGER );
+	Cvar_SetDescription( sv_snapshotThreads, "Number of threads used to build and encode client snapshots in parallel, 0 or 1 - serial processing." );
+
+	sv_traceThreads = Cvar_Get( "sv_traceThreads", "0", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( sv_traceThreads, "0", XSTRING( MAX_WORKER_THREADS ), CV_INTEGER );
+	Cvar_SetDescription( sv_traceThreads, "Number of threads used for world collision of batched game traces, 0 or 1 - serial processing." );
+
+	sv_deltaCache = Cvar_Get( "sv_deltaCache", "1", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( sv_deltaCache, "0", "1", CV_INTEGER );
+	Cvar_SetDescription( sv_deltaCache, "Encode each entity delta once per snapshot frame and share it between clients." );
+
+	sv_visCache = Cvar_Get( "sv_visCache", "1", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( sv_visCache, "0", "1", CV_INTEGER );
+	Cvar_SetDescription( sv_visCache, "Share list of entities visible from the same PVS cluster and area between clients." );
+
+	sv_snapshotBudget = Cvar_Get( "sv_snapshotBudget", "0", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( sv_snapshotBudget, "0", "1", CV_INTEGER );
+	Cvar_SetDescription( sv_snapshotBudget, "Fit entity updates of rate-limited clients into per-snapshot byte budget derived from rate and snaps, least relevant updates are deferred to later snapshots." );
+
+	sv_snapshotMaxDefer = Cvar_Get( "sv_snapshotMaxDefer", "8", CVAR_ARCHIVE_ND );
+	Cvar_CheckRange( sv_snapshotMaxDefer, "1", "16", CV_INTEGER );
+	Cvar_SetDescription( sv_snapshotMaxDefer, "Maximum number of snapshot frames entity update can be deferred for with sv_snapshotBudget enabled." );
+	sv_profileLog = Cvar_Get( "sv_profileLog", "", 0 );
+	Cvar_SetDescription( sv_profileLog, "Append per-frame server phase timings in CSV format to specified file, see also sv_profile command." );
+
 	// initialize bot cvars so they are listed and can be set before loading the botlib
 	SV_BotInitCvars();
 
@@ -827,6 +963,8 @@ void SV_Init( void )
 	SV_TrackCvarChanges();
 
 	SV_InitChallenger();
+
+	NET_SetQueryHandler( SV_QueryHandler );
 }
 
 
@@ -880,6 +1018,8 @@ void SV_Shutdown( const char *finalmsg ) {
 
 	Com_Printf( "----- Server Shutdown (%s) -----\n", finalmsg );
 
+	SV_StopRecord();
+
 #ifdef USE_IPV6
 	NET_LeaveMulticast6();
 #endif
@@ -895,8 +1035,11 @@ void SV_Shutdown( const char *finalmsg ) {
 
 	// free current level
 	SV_ClearServer();
+	SV_FreeTraceContexts();
+
+	SV_FreeIPDB();
 
-	SV_FreeIP4DB();
+	SV_HTTPShutdown();
 
 	// free server static data
 	if ( svs.clients ) {
@@ -912,6 +1055,13 @@ void SV_Shutdown( const char *finalmsg ) {
 
 	Cvar_Set( "sv_running", "0" );
 
+	// stop answering queries from query threads
+	SV_UpdateQueryInfo();
+
+	// filesystem may be restarted, reopen on next frame
+	SV_ProfileCloseLog();
+	sv_profileLog->modified = qtrue;
+
 	// allow setting timescale 0 for demo playback
 	Cvar_CheckRange( com_timescale, "0", NULL, CV_FLOAT );
 
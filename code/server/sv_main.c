@@ -56,6 +56,17 @@ cvar_t	*sv_lanForceRate; // dedicated 1 (LAN) server forces local client rates t
 
 cvar_t *sv_levelTimeReset;
 cvar_t *sv_filter;
+cvar_t *sv_snapshotThreads;
+cvar_t *sv_traceThreads;
+cvar_t *sv_deltaCache;
+cvar_t *sv_visCache;
+cvar_t *sv_snapshotBudget;
+cvar_t *sv_snapshotMaxDefer;
+cvar_t *sv_profileLog;
+cvar_t *sv_httpPort;
+cvar_t *sv_httpHost;
+cvar_t *sv_httpMaxConnsPerIP;
+cvar_t *sv_httpRate;
 
 #ifdef USE_BANS
 cvar_t	*sv_banFile;
@@ -148,6 +159,9 @@ void SV_AddServerCommand( client_t *client, const char *cmd ) {
 //		return;
 //	}
 
+	// configstring changes made before this command must arrive first
+	SV_FlushConfigstrings();
+
 	// do not send commands until the gamestate has been sent
 	if ( client->state < CS_PRIMED )
 		return;
@@ -641,16 +655,275 @@ void SVC_RateDropAddress( const netadr_t *from, int burst, int period ) {
 
 /*
 ================
-SVC_Status
+SV_AddInfoKeys
 
-Responds with all the info that qplug or qspy can see about the server
-and all connected players.  Used for getting detailed information after
-the simple info query.
+Appends getinfo response keys to infostring
 ================
 */
-static void SVC_Status( const netadr_t *from ) {
+static void SV_AddInfoKeys( char *infostring ) {
+	int		i, count, humans;
+	const char	*gamedir;
+
+	// don't count privateclients
+	count = humans = 0;
+	for ( i = sv_privateClients->integer; i < sv.maxclients; i++ ) {
+		if ( svs.clients[i].state >= CS_CONNECTED ) {
+			count++;
+			if (svs.clients[i].netchan.remoteAddress.type != NA_BOT) {
+				humans++;
+			}
+		}
+	}
+
+	Info_SetValueForKey( infostring, "protocol", va( "%i", com_protocol->integer ) );
+	Info_SetValueForKey( infostring, "hostname", sv_hostname->string );
+	Info_SetValueForKey( infostring, "mapname", sv_mapname->string );
+	Info_SetValueForKey( infostring, "clients", va("%i", count) );
+	Info_SetValueForKey( infostring, "g_humanplayers", va( "%i", humans ) );
+	Info_SetValueForKey( infostring, "sv_maxclients", va( "%i", sv.maxclients - sv_privateClients->integer ) );
+	Info_SetValueForKey( infostring, "gametype", va( "%i", sv_gametype->integer ) );
+	Info_SetValueForKey( infostring, "pure", va( "%i", sv.pure ) );
+	Info_SetValueForKey( infostring, "g_needpass", va( "%d", Cvar_VariableIntegerValue( "g_needpass" ) ) );
+	gamedir = Cvar_VariableString( "fs_game" );
+	if ( *gamedir != '\0' ) {
+		Info_SetValueForKey( infostring, "game", gamedir );
+	}
+}
+
+
+/*
+==============================================================================
+
+QUERY CACHE
+
+getstatus and getinfo responses are built from pre-serialized serverinfo,
+getinfo keys and player list, which are rebuilt only when serverinfo, client
+list or player names, scores and pings are changed, so a query costs only
+challenge splicing. The same copy is used by network query threads
+(net_queryShards) and is guarded by a sequence counter so readers never
+block the server.
+
+==============================================================================
+*/
+
+typedef struct {
+	volatile int	sequence;				// odd while being updated
+	qboolean		valid;
+	char			serverinfo[ MAX_INFO_STRING ];
+	char			info[ MAX_INFO_STRING ];	// getinfo keys without challenge
+	char			players[ MAX_PACKETLEN ];
+	int				playerEnd[ MAX_CLIENTS ];	// end of each line in players
+	int				numPlayers;
+
+	// change detection, main thread only
+	qboolean		modified;
+	qboolean		listed[ MAX_CLIENTS ];
+	int				score[ MAX_CLIENTS ];
+	int				ping[ MAX_CLIENTS ];
+	char			name[ MAX_CLIENTS ][ MAX_NAME_LENGTH ];
+	int				rebuilds;
+} queryInfo_t;
+
+static queryInfo_t queryInfo;
+
+
+/*
+================
+SV_InvalidateQueryInfo
+
+Called when serverinfo has been propagated and the modification flag is cleared
+================
+*/
+void SV_InvalidateQueryInfo( void ) {
+	queryInfo.modified = qtrue;
+}
+
+
+/*
+================
+SV_QueryInfoChanged
+================
+*/
+static qboolean SV_QueryInfoChanged( qboolean valid ) {
+	const queryInfo_t *q = &queryInfo;
+	const client_t *cl;
+	int i;
+
+	if ( q->modified || q->valid != valid || ( cvar_modifiedFlags & CVAR_SERVERINFO ) ) {
+		return qtrue;
+	}
+
+	if ( !valid ) {
+		return qfalse;
+	}
+
+	for ( i = 0, cl = svs.clients; i < sv.maxclients; i++, cl++ ) {
+		if ( cl->state >= CS_CONNECTED ) {
+			if ( !q->listed[i] || q->ping[i] != cl->ping || q->score[i] != SV_GameClientNum( i )->persistant[ PERS_SCORE ]
+				|| strcmp( q->name[i], cl->name ) != 0 ) {
+				return qtrue;
+			}
+		} else if ( q->listed[i] ) {
+			return qtrue;
+		}
+	}
+
+	return qfalse;
+}
+
+
+/*
+================
+SV_UpdateQueryInfo
+================
+*/
+void SV_UpdateQueryInfo( void ) {
+	queryInfo_t	*q = &queryInfo;
+	char		player[MAX_NAME_LENGTH + 32];
+	client_t	*cl;
+	int			i, len, total;
+	qboolean	valid;
+
+	valid = com_sv_running->integer ? qtrue : qfalse;
+#ifndef DEDICATED
+	if ( Cvar_VariableIntegerValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableIntegerValue("ui_singlePlayerActive")) {
+		valid = qfalse;
+	}
+#endif
+
+	if ( !SV_QueryInfoChanged( valid ) ) {
+		return;
+	}
+
+	Sys_AtomicAdd( &q->sequence, 1 );
+
+	q->valid = valid;
+	q->modified = qfalse;
+	q->rebuilds++;
+
+	Com_Memset( q->listed, 0, sizeof( q->listed ) );
+
+	if ( q->valid ) {
+		Q_strncpyz( q->serverinfo, Cvar_InfoString( CVAR_SERVERINFO, NULL ), sizeof( q->serverinfo ) );
+
+		q->info[0] = '\0';
+		SV_AddInfoKeys( q->info );
+
+		total = 0;
+		q->numPlayers = 0;
+		for ( i = 0; i < sv.maxclients; i++ ) {
+			cl = &svs.clients[i];
+			if ( cl->state >= CS_CONNECTED ) {
+				q->listed[i] = qtrue;
+				q->score[i] = SV_GameClientNum( i )->persistant[ PERS_SCORE ];
+				q->ping[i] = cl->ping;
+				Q_strncpyz( q->name[i], cl->name, sizeof( q->name[i] ) );
+				len = Com_sprintf( player, sizeof( player ), "%i %i \"%s\"\n",
+					q->score[i], q->ping[i], cl->name );
+				if ( total + len >= sizeof( q->players ) )
+					continue;
+				strcpy( q->players + total, player );
+				total += len;
+				q->playerEnd[ q->numPlayers++ ] = total;
+			}
+		}
+	}
+
+	Sys_AtomicAdd( &q->sequence, 1 );
+}
+
+
+/*
+================
+SV_QueryResponse
+
+Builds getstatus/getinfo reply with 0xFFFFFFFF header, may be called from
+query threads. Returns reply length or -1 if the challenge can't be spliced
+in the same way as Info_SetValueForKey() does.
+================
+*/
+static int SV_QueryResponse( byte *reply, int replySize, qboolean status, const char *challenge,
+	const char *infostring, const char *players, const int *playerEnd, int numPlayers ) {
+	int		infoLength, challengeLength, statusLength, playerStart, playerLength, i;
+	char	*s;
+
+	infoLength = (int)strlen( infostring );
+	challengeLength = (int)strlen( challenge );
+
+	if ( challengeLength > 128 || !Info_ValidateKeyValue( challenge ) ) {
+		return -1;
+	}
+
+	if ( *challenge && infoLength + challengeLength + 11 >= MAX_INFO_STRING ) {
+		return -1;
+	}
+
+	memset( reply, 0xFF, 4 );
+	s = (char *)reply + 4;
+
+	if ( status ) {
+		// Info_ValueForKey() is not reentrant
+		if ( *challenge && strstr( infostring, "\\challenge\\" ) ) {
+			return -1;
+		}
+
+		statusLength = infoLength + 16; // strlen( "statusResponse\n\n" )
+		if ( *challenge ) {
+			statusLength += challengeLength + 11;
+		}
+
+		playerStart = 0;
+		for ( i = 0; i < numPlayers; i++ ) {
+			playerLength = playerEnd[i] - playerStart;
+			if ( statusLength + playerLength >= MAX_PACKETLEN-4 )
+				break; // can't hold any more
+			statusLength += playerLength;
+			playerStart = playerEnd[i];
+		}
+
+		if ( statusLength + 4 >= replySize ) {
+			return -1;
+		}
+
+		s = Q_stradd( s, "statusResponse\n" );
+		memcpy( s, infostring, infoLength );
+		s += infoLength;
+		// echo back the parameter to status
+		if ( *challenge ) {
+			s = Q_stradd( s, "\\challenge\\" );
+			s = Q_stradd( s, challenge );
+		}
+		*s++ = '\n';
+		memcpy( s, players, playerStart );
+		s += playerStart;
+		*s = '\0';
+	} else {
+		if ( infoLength + challengeLength + 11 + 4 + 13 >= replySize ) {
+			return -1;
+		}
+
+		s = Q_stradd( s, "infoResponse\n" );
+		if ( *challenge ) {
+			s = Q_stradd( s, "\\challenge\\" );
+			s = Q_stradd( s, challenge );
+		}
+		memcpy( s, infostring, infoLength + 1 );
+		s += infoLength;
+	}
+
+	return s - (char *)reply;
+}
+
+
+/*
+================
+SV_BuildStatusResponse
+
+Builds full statusResponse from scratch
+================
+*/
+static void SV_BuildStatusResponse( char *status, const char *challenge ) {
 	char	player[MAX_NAME_LENGTH + 32]; // score + ping + name
-	char	status[MAX_PACKETLEN];
 	char	*s;
 	int		i;
 	client_t	*cl;
@@ -659,6 +932,69 @@ static void SVC_Status( const netadr_t *from ) {
 	int		playerLength;
 	char	infostring[MAX_INFO_STRING+160]; // add some space for challenge string
 
+	Q_strncpyz( infostring, Cvar_InfoString( CVAR_SERVERINFO, NULL ), sizeof( infostring ) );
+
+	// echo back the parameter to status. so master servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	Info_SetValueForKey( infostring, "challenge", challenge );
+
+	s = Q_stradd( Q_stradd( Q_stradd( status, "statusResponse\n" ), infostring ), "\n" );
+	statusLength = strlen( infostring ) + 16; // strlen( "statusResponse\n\n" )
+
+	for ( i = 0; i < sv.maxclients; i++ ) {
+		cl = &svs.clients[i];
+		if ( cl->state >= CS_CONNECTED ) {
+
+			ps = SV_GameClientNum( i );
+			playerLength = Com_sprintf( player, sizeof( player ), "%i %i \"%s\"\n", 
+				ps->persistant[ PERS_SCORE ], cl->ping, cl->name );
+			
+			if ( statusLength + playerLength >= MAX_PACKETLEN-4 )
+				break; // can't hold any more
+			
+			s = Q_stradd( s, player );
+			statusLength += playerLength;
+		}
+	}
+}
+
+
+/*
+================
+SV_BuildInfoResponse
+
+Builds full infoResponse from scratch
+================
+*/
+static void SV_BuildInfoResponse( char *info, const char *challenge ) {
+	char	infostring[MAX_INFO_STRING];
+
+	infostring[0] = '\0';
+
+	// echo back the parameter to status. so servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	Info_SetValueForKey( infostring, "challenge", challenge );
+
+	SV_AddInfoKeys( infostring );
+
+	Q_stradd( Q_stradd( info, "infoResponse\n" ), infostring );
+}
+
+
+/*
+================
+SVC_Status
+
+Responds with all the info that qplug or qspy can see about the server
+and all connected players.  Used for getting detailed information after
+the simple info query.
+================
+*/
+static void SVC_Status( const netadr_t *from ) {
+	const queryInfo_t *q = &queryInfo;
+	byte	reply[MAX_PACKETLEN];
+	int		len;
+
 	// ignore if we are in single player
 #ifndef DEDICATED
 	if ( Cvar_VariableIntegerValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableIntegerValue("ui_singlePlayerActive")) {
@@ -686,33 +1022,18 @@ static void SVC_Status( const netadr_t *from ) {
 	if ( strlen( Cmd_Argv( 1 ) ) > 128 )
 		return;
 
-	Q_strncpyz( infostring, Cvar_InfoString( CVAR_SERVERINFO, NULL ), sizeof( infostring ) );
+	SV_UpdateQueryInfo();
 
-	// echo back the parameter to status. so master servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv( 1 ) );
-
-	s = status;
-	status[0] = '\0';
-	statusLength = strlen( infostring ) + 16; // strlen( "statusResponse\n\n" )
-
-	for ( i = 0; i < sv.maxclients; i++ ) {
-		cl = &svs.clients[i];
-		if ( cl->state >= CS_CONNECTED ) {
+	len = SV_QueryResponse( reply, sizeof( reply ), qtrue, Cmd_Argv( 1 ),
+		q->serverinfo, q->players, q->playerEnd, q->numPlayers );
 
-			ps = SV_GameClientNum( i );
-			playerLength = Com_sprintf( player, sizeof( player ), "%i %i \"%s\"\n", 
-				ps->persistant[ PERS_SCORE ], cl->ping, cl->name );
-			
-			if ( statusLength + playerLength >= MAX_PACKETLEN-4 )
-				break; // can't hold any more
-			
-			s = Q_stradd( s, player );
-			statusLength += playerLength;
-		}
+	if ( len < 0 ) {
+		// unusual challenge, let Info_SetValueForKey() deal with it
+		SV_BuildStatusResponse( (char *)reply + 4, Cmd_Argv( 1 ) );
+		len = (int)strlen( (char *)reply + 4 ) + 4;
 	}
 
-	NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s\n%s", infostring, status );
+	NET_SendPacket( NS_SERVER, len, reply, from );
 }
 
 
@@ -725,9 +1046,9 @@ if a user is interested in a server to do a full status
 ================
 */
 static void SVC_Info( const netadr_t *from ) {
-	int		i, count, humans;
-	const char	*gamedir;
-	char	infostring[MAX_INFO_STRING];
+	const queryInfo_t *q = &queryInfo;
+	byte	reply[MAX_PACKETLEN];
+	int		len;
 
 	// ignore if we are in single player
 #ifndef DEDICATED
@@ -761,38 +1082,244 @@ static void SVC_Info( const netadr_t *from ) {
 	if ( strlen( Cmd_Argv( 1 ) ) > 128 )
 		return;
 
-	// don't count privateclients
-	count = humans = 0;
-	for ( i = sv_privateClients->integer; i < sv.maxclients; i++ ) {
-		if ( svs.clients[i].state >= CS_CONNECTED ) {
-			count++;
-			if (svs.clients[i].netchan.remoteAddress.type != NA_BOT) {
-				humans++;
+	SV_UpdateQueryInfo();
+
+	len = SV_QueryResponse( reply, sizeof( reply ), qfalse, Cmd_Argv( 1 ), q->info, NULL, NULL, 0 );
+
+	if ( len < 0 ) {
+		SV_BuildInfoResponse( (char *)reply + 4, Cmd_Argv( 1 ) );
+		len = (int)strlen( (char *)reply + 4 ) + 4;
+	}
+
+	NET_SendPacket( NS_SERVER, len, reply, from );
+}
+
+
+/*
+================
+SV_QueryBench_f
+
+Compares cost of building query responses from scratch and from cache
+================
+*/
+void SV_QueryBench_f( void ) {
+	const queryInfo_t *q = &queryInfo;
+	byte	reply[MAX_PACKETLEN];
+	char	challenge[16];
+	int64_t	start, usec[2], checkTime;
+	int		i, count, bytes[2];
+
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	count = atoi( Cmd_Argv( 1 ) );
+	if ( count <= 0 ) {
+		count = 100000;
+	}
+
+	SV_UpdateQueryInfo();
+
+	bytes[0] = 0;
+	start = Sys_Microseconds();
+	for ( i = 0; i < count; i++ ) {
+		Com_sprintf( challenge, sizeof( challenge ), "%i", i );
+		if ( i & 1 ) {
+			SV_BuildInfoResponse( (char *)reply + 4, challenge );
+		} else {
+			SV_BuildStatusResponse( (char *)reply + 4, challenge );
+		}
+		bytes[0] += (int)strlen( (char *)reply + 4 ) + 4;
+	}
+	usec[0] = Sys_Microseconds() - start;
+
+	bytes[1] = 0;
+	start = Sys_Microseconds();
+	for ( i = 0; i < count; i++ ) {
+		Com_sprintf( challenge, sizeof( challenge ), "%i", i );
+		SV_UpdateQueryInfo();
+		if ( i & 1 ) {
+			bytes[1] += SV_QueryResponse( reply, sizeof( reply ), qfalse, challenge, q->info, NULL, NULL, 0 );
+		} else {
+			bytes[1] += SV_QueryResponse( reply, sizeof( reply ), qtrue, challenge,
+				q->serverinfo, q->players, q->playerEnd, q->numPlayers );
+		}
+	}
+	usec[1] = Sys_Microseconds() - start;
+
+	// what is added to every server frame
+	start = Sys_Microseconds();
+	for ( i = 0; i < count; i++ ) {
+		SV_UpdateQueryInfo();
+	}
+	checkTime = Sys_Microseconds() - start;
+
+	Com_Printf( "%i getstatus/getinfo queries, %i players\n", count, q->numPlayers );
+	Com_Printf( "rebuild: %8.0f queries/sec, %i bytes\n", usec[0] ? count * 1e6 / usec[0] : 0.0, bytes[0] );
+	Com_Printf( "cached:  %8.0f queries/sec, %i bytes\n", usec[1] ? count * 1e6 / usec[1] : 0.0, bytes[1] );
+	Com_Printf( "change check: %.3f usec per frame, %i rebuilds so far\n", (double)checkTime / count, q->rebuilds );
+}
+
+
+/*
+==============================================================================
+
+QUERY THREADS
+
+getstatus and getinfo requests may be answered by network query threads
+from the query cache above, rate limiters are lock-free
+
+==============================================================================
+*/
+
+// fixed-window counters packed as ( window << 8 ) | count
+static volatile int queryAddressLimit[ MAX_HASHES ];
+static volatile int queryOutboundLimit;
+
+
+/*
+================
+SV_QueryRateLimit
+
+Lock-free fixed-window rate limiter
+================
+*/
+static qboolean SV_QueryRateLimit( volatile int *counter, int window, int burst ) {
+	int oldValue, newValue;
+
+	window &= 0x7FFFFF;
+
+	do {
+		oldValue = *counter;
+		if ( ( oldValue >> 8 ) != window ) {
+			newValue = ( window << 8 ) | 1;
+		} else if ( ( oldValue & 255 ) >= burst ) {
+			return qtrue;
+		} else {
+			newValue = oldValue + 1;
+		}
+	} while ( !Sys_AtomicCAS( counter, oldValue, newValue ) );
+
+	return qfalse;
+}
+
+
+/*
+================
+SV_QueryHandler
+
+Called from query threads, must not use Cmd_*, Com_Printf() and other
+non-reentrant functions. Returns reply length, 0 to drop the request or
+-1 to process it on the main thread as usual.
+================
+*/
+int SV_QueryHandler( const netadr_t *from, const byte *data, int length, byte *reply, int replySize ) {
+	char	line[ MAX_STRING_CHARS ];
+	char	infostring[ MAX_INFO_STRING ];
+	char	players[ MAX_PACKETLEN ];
+	int		playerEnd[ MAX_CLIENTS ];
+	int		numPlayers;
+	const char *cmd, *challenge;
+	char	*s;
+	int		i, c, sequence, now;
+	qboolean status, valid;
+
+	// keep developer output and everything unusual on the main thread
+	if ( com_developer->integer || length < 4 || *(const int32_t *)data != -1 ) {
+		return -1;
+	}
+
+	// same as MSG_ReadStringLine()
+	for ( i = 4, s = line; i < length && s < line + sizeof( line ) - 1; i++ ) {
+		c = data[i];
+		if ( c == '\0' || c == '\n' ) {
+			break;
+		}
+		if ( c == '%' || c > 127 ) {
+			c = '.';
+		}
+		// quotes and comments require full tokenizer
+		if ( c == '"' || c == '/' ) {
+			return -1;
+		}
+		*s++ = c;
+	}
+	*s = '\0';
+
+	// split "command [challenge]"
+	s = line;
+	while ( *s != '\0' && *s <= ' ' )
+		s++;
+	cmd = s;
+	while ( *s > ' ' )
+		s++;
+	if ( *s != '\0' )
+		*s++ = '\0';
+	while ( *s != '\0' && *s <= ' ' )
+		s++;
+	challenge = s;
+	while ( *s > ' ' )
+		s++;
+	*s = '\0';
+
+	if ( !Q_stricmp( cmd, "getstatus" ) ) {
+		status = qtrue;
+	} else if ( !Q_stricmp( cmd, "getinfo" ) ) {
+		status = qfalse;
+	} else {
+		return -1;
+	}
+
+	if ( strlen( challenge ) > 128 || !Info_ValidateKeyValue( challenge ) ) {
+		return -1;
+	}
+
+	// take consistent copy of the current state
+	numPlayers = 0;
+	for ( ;; ) {
+		sequence = Sys_AtomicAdd( &queryInfo.sequence, 0 );
+		if ( sequence & 1 ) {
+			continue;
+		}
+		valid = queryInfo.valid;
+		if ( valid ) {
+			if ( status ) {
+				Q_strncpyz( infostring, queryInfo.serverinfo, sizeof( infostring ) );
+				numPlayers = queryInfo.numPlayers;
+				memcpy( playerEnd, queryInfo.playerEnd, numPlayers * sizeof( playerEnd[0] ) );
+				memcpy( players, queryInfo.players, sizeof( players ) );
+			} else {
+				Q_strncpyz( infostring, queryInfo.info, sizeof( infostring ) );
 			}
 		}
+		if ( sequence == Sys_AtomicAdd( &queryInfo.sequence, 0 ) ) {
+			break;
+		}
 	}
 
-	infostring[0] = '\0';
+	if ( !valid ) {
+		return -1;
+	}
 
-	// echo back the parameter to status. so servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+	now = Sys_Milliseconds();
 
-	Info_SetValueForKey( infostring, "protocol", va( "%i", com_protocol->integer ) );
-	Info_SetValueForKey( infostring, "hostname", sv_hostname->string );
-	Info_SetValueForKey( infostring, "mapname", sv_mapname->string );
-	Info_SetValueForKey( infostring, "clients", va("%i", count) );
-	Info_SetValueForKey( infostring, "g_humanplayers", va( "%i", humans ) );
-	Info_SetValueForKey( infostring, "sv_maxclients", va( "%i", sv.maxclients - sv_privateClients->integer ) );
-	Info_SetValueForKey( infostring, "gametype", va( "%i", sv_gametype->integer ) );
-	Info_SetValueForKey( infostring, "pure", va( "%i", sv.pure ) );
-	Info_SetValueForKey( infostring, "g_needpass", va( "%d", Cvar_VariableIntegerValue( "g_needpass" ) ) );
-	gamedir = Cvar_VariableString( "fs_game" );
-	if ( *gamedir != '\0' ) {
-		Info_SetValueForKey( infostring, "game", gamedir );
+	// Prevent using getstatus/getinfo as an amplifier
+	if ( SV_QueryRateLimit( &queryAddressLimit[ SVC_HashForAddress( from ) ], now / 1000, 10 ) ) {
+		return 0;
 	}
 
-	NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s", infostring );
+	// Allow query to be DoSed relatively easily, but prevent
+	// excess outbound bandwidth usage when being flooded inbound
+	if ( SV_QueryRateLimit( &queryOutboundLimit, now / 100, 10 ) ) {
+		return 0;
+	}
+
+	if ( status ) {
+		return SV_QueryResponse( reply, replySize, qtrue, challenge, infostring, players, playerEnd, numPlayers );
+	} else {
+		return SV_QueryResponse( reply, replySize, qfalse, challenge, infostring, NULL, NULL, 0 );
+	}
 }
 
 
@@ -966,10 +1493,10 @@ static void SV_ConnectionlessPacket( const netadr_t *from, msg_t *msg ) {
 
 /*
 =================
-SV_PacketEvent
+SV_ProcessPacket
 =================
 */
-void SV_PacketEvent( const netadr_t *from, msg_t *msg ) {
+static void SV_ProcessPacket( const netadr_t *from, msg_t *msg ) {
 	int			i;
 	client_t	*cl;
 	int			qport;
@@ -1029,6 +1556,20 @@ void SV_PacketEvent( const netadr_t *from, msg_t *msg ) {
 }
 
 
+/*
+=================
+SV_PacketEvent
+=================
+*/
+void SV_PacketEvent( const netadr_t *from, msg_t *msg ) {
+	int64_t start = SV_ProfileStart();
+
+	SV_ProcessPacket( from, msg );
+
+	SV_ProfileEnd( PROF_PACKETS, start );
+}
+
+
 /*
 ===================
 SV_CalcPings
@@ -1280,8 +1821,11 @@ happen before SV_Frame is called
 ==================
 */
 void SV_Frame( int msec ) {
+	int64_t	frameStart;
+	int64_t	gameStart;
 	int		frameMsec;
 	int		startTime;
+	int		numFrames;
 	int		i;
 
 	if ( Cvar_CheckGroup( CVG_SERVER ) )
@@ -1310,6 +1854,8 @@ void SV_Frame( int msec ) {
 		return;
 	}
 
+	frameStart = SV_ProfileStart();
+
 	// if it isn't time for the next frame, do nothing
 
 	frameMsec = (1000 / sv_fps->integer) * com_timescale->value;
@@ -1361,6 +1907,7 @@ void SV_Frame( int msec ) {
 	if ( cvar_modifiedFlags & CVAR_SERVERINFO ) {
 		SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO, NULL ) );
 		cvar_modifiedFlags &= ~CVAR_SERVERINFO;
+		SV_InvalidateQueryInfo();
 	}
 	if ( cvar_modifiedFlags & CVAR_SYSTEMINFO ) {
 		SV_SetConfigstring( CS_SYSTEMINFO, Cvar_InfoString_Big( CVAR_SYSTEMINFO, NULL ) );
@@ -1379,13 +1926,17 @@ void SV_Frame( int msec ) {
 	if (com_dedicated->integer) SV_BotFrame (sv.time);
 
 	// run the game simulation in chunks
+	numFrames = 0;
 	while ( sv.timeResidual >= frameMsec ) {
 		sv.timeResidual -= frameMsec;
 		svs.time += frameMsec;
 		sv.time += frameMsec;
 
 		// let everything in the world think and move
+		gameStart = SV_ProfileStart();
 		VM_Call( gvm, 1, GAME_RUN_FRAME, sv.time );
+		SV_ProfileEnd( PROF_GAME, gameStart );
+		numFrames++;
 	}
 
 	if ( com_speeds->integer ) {
@@ -1403,6 +1954,16 @@ void SV_Frame( int msec ) {
 
 	// send a heartbeat to the master if needed
 	SV_MasterHeartbeat(HEARTBEAT_FOR_MASTER);
+
+	// refresh state for query threads
+	SV_UpdateQueryInfo();
+
+	SV_ProfileEnd( PROF_FRAME, frameStart );
+
+	// idle frames are accounted to the next simulated one
+	if ( numFrames ) {
+		SV_ProfileFrame();
+	}
 }
 
 
@@ -1460,9 +2021,12 @@ int SV_SendQueuedPackets( void )
 	int dlStart, deltaT, delayT;
 	static int dlNextRound = 0;
 	int timeVal = INT_MAX;
+	int64_t start;
 
 	// Send out fragmented packets now that we're idle
+	start = SV_ProfileStart();
 	delayT = SV_SendQueuedMessages();
+	SV_ProfileEnd( PROF_QUEUED_MESSAGES, start );
 	if(delayT >= 0)
 		timeVal = delayT;
 
@@ -1480,7 +2044,9 @@ int SV_SendQueuedPackets( void )
 		}
 		else
 		{
+			start = SV_ProfileStart();
 			numBlocks = SV_SendDownloadMessages();
+			SV_ProfileEnd( PROF_DOWNLOADS, start );
 
 			if(numBlocks)
 			{
@@ -1517,9 +2083,19 @@ int SV_SendQueuedPackets( void )
 	}
 	else
 	{
-		if(SV_SendDownloadMessages())
+		start = SV_ProfileStart();
+		numBlocks = SV_SendDownloadMessages();
+		SV_ProfileEnd( PROF_DOWNLOADS, start );
+		if(numBlocks)
 			timeVal = 0;
 	}
 
+	// Push built-in HTTP server transfers
+	start = SV_ProfileStart();
+	delayT = SV_HTTPFrame();
+	SV_ProfileEnd( PROF_DOWNLOADS, start );
+	if(delayT >= 0 && delayT < timeVal)
+		timeVal = delayT;
+
 	return timeVal;
 }
@@ -0,0 +1,257 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// sv_profile.c -- server frame phase timings
+
+#include "server.h"
+
+/*
+=============================================================================
+
+Each phase accumulates microseconds spent in it since the last game frame,
+the sums are pushed into per-phase ring buffers once per server frame which
+did run the game simulation, so time spent on packets and downloads between
+frames is attributed to the next frame. Per-client snapshot timings are
+recorded as individual samples.
+
+=============================================================================
+*/
+
+#define PROFILE_WINDOW 4096 // must be a power of two
+
+typedef struct {
+	int		samples[ PROFILE_WINDOW ];
+	int		count;	// total number of samples pushed since reset
+	int64_t	sum;	// total time since reset
+} profileRing_t;
+
+static const char *profilePhaseNames[ PROF_NUM_PHASES ] = {
+	"packets",
+	"game",
+	"commonSnapshot",
+	"snapshots",
+	"clientSnapshot",
+	"queuedMessages",
+	"downloads",
+	"frame"
+};
+
+static profileRing_t	profileRings[ PROF_NUM_PHASES ];
+static int64_t			profileCurrent[ PROF_NUM_PHASES ];
+static int				profileClients;		// per-client samples since last frame
+static fileHandle_t		profileLog = FS_INVALID_HANDLE;
+
+
+/*
+=================
+SV_ProfilePush
+=================
+*/
+static void SV_ProfilePush( profilePhase_t phase, int64_t usec ) {
+	profileRing_t *ring = &profileRings[ phase ];
+
+	if ( usec > INT_MAX )
+		usec = INT_MAX;
+
+	ring->samples[ ring->count & ( PROFILE_WINDOW - 1 ) ] = (int)usec;
+	ring->count++;
+	ring->sum += usec;
+}
+
+
+/*
+=================
+SV_ProfileEnd
+
+Accumulates time elapsed since start into current frame
+=================
+*/
+void SV_ProfileEnd( profilePhase_t phase, int64_t start ) {
+	profileCurrent[ phase ] += Sys_Microseconds() - start;
+}
+
+
+/*
+=================
+SV_ProfileSample
+
+Records a single per-client sample, must be called from the main thread
+=================
+*/
+void SV_ProfileSample( profilePhase_t phase, int usec ) {
+	SV_ProfilePush( phase, usec );
+	// keep the worst one for the log
+	if ( profileCurrent[ phase ] < usec )
+		profileCurrent[ phase ] = usec;
+	profileClients++;
+}
+
+
+/*
+=================
+SV_ProfileCloseLog
+=================
+*/
+void SV_ProfileCloseLog( void ) {
+	if ( profileLog != FS_INVALID_HANDLE ) {
+		FS_FCloseFile( profileLog );
+		profileLog = FS_INVALID_HANDLE;
+	}
+}
+
+
+/*
+=================
+SV_ProfileOpenLog
+=================
+*/
+static void SV_ProfileOpenLog( void ) {
+	int i;
+
+	SV_ProfileCloseLog();
+
+	if ( !sv_profileLog->string[0] )
+		return;
+
+	profileLog = FS_FOpenFileAppend( sv_profileLog->string );
+	if ( profileLog == FS_INVALID_HANDLE ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't open profile log %s\n", sv_profileLog->string );
+		return;
+	}
+
+	FS_Printf( profileLog, "time,clients" );
+	for ( i = 0; i < PROF_NUM_PHASES; i++ ) {
+		FS_Printf( profileLog, ",%s", profilePhaseNames[ i ] );
+	}
+	FS_Printf( profileLog, "\n" );
+}
+
+
+/*
+=================
+SV_ProfileFrame
+
+Flushes phase timings accumulated since previous game frame
+=================
+*/
+void SV_ProfileFrame( void ) {
+	int i;
+
+	for ( i = 0; i < PROF_NUM_PHASES; i++ ) {
+		if ( i != PROF_CLIENT_SNAPSHOT ) {
+			SV_ProfilePush( i, profileCurrent[ i ] );
+		}
+	}
+
+	if ( sv_profileLog->modified ) {
+		sv_profileLog->modified = qfalse;
+		SV_ProfileOpenLog();
+	}
+
+	if ( profileLog != FS_INVALID_HANDLE ) {
+		FS_Printf( profileLog, "%i,%i", svs.time, profileClients );
+		for ( i = 0; i < PROF_NUM_PHASES; i++ ) {
+			FS_Printf( profileLog, ",%i", (int)profileCurrent[ i ] );
+		}
+		FS_Printf( profileLog, "\n" );
+	}
+
+	Com_Memset( profileCurrent, 0, sizeof( profileCurrent ) );
+	profileClients = 0;
+}
+
+
+/*
+=================
+SV_ProfileCompare
+=================
+*/
+static int QDECL SV_ProfileCompare( const void *a, const void *b ) {
+	return *(const int *)a - *(const int *)b;
+}
+
+
+/*
+=================
+SV_ProfileReset
+=================
+*/
+void SV_ProfileReset( void ) {
+	Com_Memset( profileRings, 0, sizeof( profileRings ) );
+}
+
+
+/*
+=================
+SV_ProfilePrint
+
+Prints p50/p99/max timings of each server frame phase over the rolling window
+=================
+*/
+void SV_ProfilePrint( void ) {
+	static int sorted[ PROFILE_WINDOW ];
+	const profileRing_t *ring;
+	int64_t total;
+	int i, n, k;
+
+	Com_Printf( "phase            samples      avg      p50      p99      max (usec)  total (msec)\n" );
+	Com_Printf( "--------------- -------- -------- -------- -------- -------- -------------\n" );
+
+	for ( i = 0; i < PROF_NUM_PHASES; i++ ) {
+		ring = &profileRings[ i ];
+		n = MIN( ring->count, PROFILE_WINDOW );
+		if ( n == 0 ) {
+			Com_Printf( "%-15s %8i\n", profilePhaseNames[ i ], 0 );
+			continue;
+		}
+
+		Com_Memcpy( sorted, ring->samples, n * sizeof( sorted[0] ) );
+		qsort( sorted, n, sizeof( sorted[0] ), SV_ProfileCompare );
+
+		for ( k = 0, total = 0; k < n; k++ ) {
+			total += sorted[ k ];
+		}
+
+		Com_Printf( "%-15s %8i %8i %8i %8i %8i %13i\n", profilePhaseNames[ i ], n,
+			(int)( total / n ), sorted[ n / 2 ], sorted[ ( n * 99 ) / 100 ], sorted[ n - 1 ], (int)( ring->sum / 1000 ) );
+	}
+}
+
+
+/*
+=================
+SV_Profile_f
+=================
+*/
+void SV_Profile_f( void ) {
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		SV_ProfileReset();
+		Com_Printf( "Server profile reset.\n" );
+		return;
+	}
+
+	SV_ProfilePrint();
+
+	if ( profileLog != FS_INVALID_HANDLE ) {
+		Com_Printf( "Logging to %s\n", sv_profileLog->string );
+	}
+}
@@ -0,0 +1,704 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// sv_replay.c -- client input recorder and offline replay benchmark
+
+#include "server.h"
+
+/*
+=============================================================================
+
+Recorder stores decoded client input: connects, disconnects, executed
+client commands and usercmds, grouped in chunks by sv.time. Each chunk is
+a bitstream message prefixed with its length and time:
+
+[int length] [int sv.time] [ops...] [REC_EOF]
+
+Replay loads recorded map, creates client slots without network address
+and rebuilds regular client messages with valid acknowledges and keys,
+so input goes through SV_ExecuteClientMessage() as usual. Server frames
+are run as fast as possible between recorded chunks.
+
+=============================================================================
+*/
+
+#define REPLAY_MAGIC		"SVR1"
+#define REPLAY_EXT			"svr"
+#define REPLAY_DIR			"replays"
+#define REPLAY_MAX_PENDING	8
+
+typedef enum {
+	REC_EOF,
+	REC_CONNECT,		// [byte] clientNum [bigstring] userinfo
+	REC_DISCONNECT,		// [byte] clientNum
+	REC_COMMAND,		// [byte] clientNum [string] command
+	REC_MOVE			// [byte] clientNum [byte] delta [byte] count [usercmd_t...]
+} recordOp_t;
+
+typedef struct {
+	char	magic[4];
+	int		startTime;
+	int		fps;
+	char	mapname[ MAX_QPATH ];
+} recordHeader_t;
+
+static fileHandle_t	recordFile = FS_INVALID_HANDLE;
+static msg_t		recordMsg;
+static byte			recordBuf[ MAX_MSGLEN ];
+static int			recordTime;
+static int			recordChunks;
+
+static qboolean		replaying;
+
+
+/*
+=================
+SV_RecordFlush
+=================
+*/
+static void SV_RecordFlush( void ) {
+	int header[2];
+
+	if ( recordMsg.cursize == 0 ) {
+		return;
+	}
+
+	MSG_WriteByte( &recordMsg, REC_EOF );
+
+	header[0] = LittleLong( recordMsg.cursize );
+	header[1] = LittleLong( recordTime );
+
+	FS_Write( header, sizeof( header ), recordFile );
+	FS_Write( recordMsg.data, recordMsg.cursize, recordFile );
+
+	recordChunks++;
+
+	MSG_Init( &recordMsg, recordBuf, sizeof( recordBuf ) );
+	MSG_Bitstream( &recordMsg );
+}
+
+
+/*
+=================
+SV_RecordBegin
+
+Starts new chunk if time has been changed or there is not enough space
+=================
+*/
+static qboolean SV_RecordBegin( const client_t *cl, recordOp_t op ) {
+
+	if ( recordFile == FS_INVALID_HANDLE || cl->netchan.remoteAddress.type == NA_BOT ) {
+		return qfalse;
+	}
+
+	if ( recordTime != sv.time || recordMsg.cursize > recordMsg.maxsize - MAX_INFO_STRING * 2 ) {
+		SV_RecordFlush();
+		recordTime = sv.time;
+	}
+
+	MSG_WriteByte( &recordMsg, op );
+	MSG_WriteByte( &recordMsg, cl - svs.clients );
+
+	return qtrue;
+}
+
+
+/*
+=================
+SV_RecordConnect
+=================
+*/
+void SV_RecordConnect( const client_t *cl ) {
+	if ( SV_RecordBegin( cl, REC_CONNECT ) ) {
+		MSG_WriteBigString( &recordMsg, cl->userinfo );
+	}
+}
+
+
+/*
+=================
+SV_RecordDisconnect
+=================
+*/
+void SV_RecordDisconnect( const client_t *cl ) {
+	SV_RecordBegin( cl, REC_DISCONNECT );
+}
+
+
+/*
+=================
+SV_RecordCommand
+=================
+*/
+void SV_RecordCommand( const client_t *cl, const char *cmd ) {
+
+	if ( recordFile == FS_INVALID_HANDLE ) {
+		return;
+	}
+
+	// pure checksums and downloads depend on the original session
+	if ( !Q_strncmp( cmd, "cp ", 3 ) || !Q_strncmp( cmd, "download ", 9 ) || !Q_stricmp( cmd, "nextdl" )
+		|| !Q_stricmp( cmd, "stopdl" ) || !Q_stricmp( cmd, "donedl" ) ) {
+		return;
+	}
+
+	if ( SV_RecordBegin( cl, REC_COMMAND ) ) {
+		MSG_WriteString( &recordMsg, cmd );
+	}
+}
+
+
+/*
+=================
+SV_RecordMove
+=================
+*/
+void SV_RecordMove( const client_t *cl, const usercmd_t *cmds, int count, qboolean delta ) {
+	static const usercmd_t nullcmd = { 0 };
+	const usercmd_t *oldcmd;
+	int i;
+
+	if ( SV_RecordBegin( cl, REC_MOVE ) ) {
+		MSG_WriteByte( &recordMsg, delta );
+		MSG_WriteByte( &recordMsg, count );
+		oldcmd = &nullcmd;
+		for ( i = 0; i < count; i++ ) {
+			MSG_WriteDeltaUsercmdKey( &recordMsg, 0, oldcmd, &cmds[ i ] );
+			oldcmd = &cmds[ i ];
+		}
+	}
+}
+
+
+/*
+=================
+SV_StopRecord
+=================
+*/
+void SV_StopRecord( void ) {
+
+	if ( recordFile == FS_INVALID_HANDLE ) {
+		return;
+	}
+
+	SV_RecordFlush();
+
+	FS_FCloseFile( recordFile );
+	recordFile = FS_INVALID_HANDLE;
+
+	Com_Printf( "Stopped recording client input, %i chunks written.\n", recordChunks );
+}
+
+
+/*
+=================
+SV_Record_f
+=================
+*/
+void SV_Record_f( void ) {
+	recordHeader_t header;
+	char filename[ MAX_OSPATH ];
+	const client_t *cl;
+	int i;
+
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "Usage: %s <name>\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	if ( !com_sv_running->integer || sv.state != SS_GAME ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( replaying ) {
+		Com_Printf( "Can't record during replay.\n" );
+		return;
+	}
+
+	SV_StopRecord();
+
+	Com_sprintf( filename, sizeof( filename ), REPLAY_DIR "/%s", Cmd_Argv( 1 ) );
+	COM_DefaultExtension( filename, sizeof( filename ), "." REPLAY_EXT );
+
+	recordFile = FS_FOpenFileWrite( filename );
+	if ( recordFile == FS_INVALID_HANDLE ) {
+		Com_Printf( "Couldn't open %s for writing.\n", filename );
+		return;
+	}
+
+	Com_Memset( &header, 0, sizeof( header ) );
+	Com_Memcpy( header.magic, REPLAY_MAGIC, sizeof( header.magic ) );
+	header.startTime = LittleLong( sv.time );
+	header.fps = LittleLong( sv_fps->integer );
+	Q_strncpyz( header.mapname, sv_mapname->string, sizeof( header.mapname ) );
+	FS_Write( &header, sizeof( header ), recordFile );
+
+	recordChunks = 0;
+	recordTime = sv.time;
+	MSG_Init( &recordMsg, recordBuf, sizeof( recordBuf ) );
+	MSG_Bitstream( &recordMsg );
+
+	// clients which are already connected
+	for ( i = 0, cl = svs.clients; i < sv.maxclients; i++, cl++ ) {
+		if ( cl->state >= CS_CONNECTED ) {
+			SV_RecordConnect( cl );
+		}
+	}
+
+	Com_Printf( "Recording client input to %s.\n", filename );
+}
+
+
+/*
+=================
+SV_StopRecord_f
+=================
+*/
+void SV_StopRecord_f( void ) {
+
+	if ( recordFile == FS_INVALID_HANDLE ) {
+		Com_Printf( "Not recording client input.\n" );
+		return;
+	}
+
+	SV_StopRecord();
+}
+
+
+/*
+=============================================================================
+
+REPLAY
+
+=============================================================================
+*/
+
+typedef struct {
+	qboolean	active;
+	int			numPending;
+	char		pending[ REPLAY_MAX_PENDING ][ MAX_STRING_CHARS ];
+} replayClient_t;
+
+typedef struct {
+	replayClient_t	clients[ MAX_CLIENTS ];
+	int				timeShift;
+	int				messages;
+	int				frames;
+} replayState_t;
+
+
+/*
+=================
+SV_ReplayMessage
+
+Builds regular client message from pending commands and optional usercmds
+and executes it as if it was received from network
+=================
+*/
+static void SV_ReplayMessage( replayState_t *rs, client_t *cl, const usercmd_t *cmds, int count, qboolean delta ) {
+	static const usercmd_t nullcmd = { 0 };
+	replayClient_t *rc = &rs->clients[ cl - svs.clients ];
+	byte data[ MAX_MSGLEN_BUF ];
+	usercmd_t shifted[ MAX_PACKET_USERCMDS ];
+	const usercmd_t *oldcmd;
+	int64_t start;
+	int messageAcknowledge;
+	int reliableAcknowledge;
+	int i, key;
+	msg_t msg;
+
+	MSG_Init( &msg, data, MAX_MSGLEN );
+	MSG_Bitstream( &msg );
+
+	// acknowledge everything we have "received"
+	if ( cl->gamestateAck != GSA_ACKED ) {
+		messageAcknowledge = cl->gamestateMessageNum;
+	} else {
+		messageAcknowledge = cl->netchan.outgoingSequence - 1;
+	}
+
+	// commands executed below may queue new reliable commands
+	reliableAcknowledge = cl->reliableSequence;
+
+	MSG_WriteLong( &msg, sv.serverId );
+	MSG_WriteLong( &msg, messageAcknowledge );
+	MSG_WriteLong( &msg, reliableAcknowledge );
+
+	for ( i = 0; i < rc->numPending; i++ ) {
+		MSG_WriteByte( &msg, clc_clientCommand );
+		MSG_WriteLong( &msg, cl->lastClientCommand + 1 + i );
+		MSG_WriteString( &msg, rc->pending[ i ] );
+	}
+	rc->numPending = 0;
+
+	if ( count > 0 ) {
+		MSG_WriteByte( &msg, delta ? clc_move : clc_moveNoDelta );
+		MSG_WriteByte( &msg, count );
+
+		key = sv.checksumFeed;
+		key ^= messageAcknowledge;
+		key ^= MSG_HashKey( cl->reliableCommands[ reliableAcknowledge & ( MAX_RELIABLE_COMMANDS - 1 ) ], 32 );
+
+		oldcmd = &nullcmd;
+		for ( i = 0; i < count; i++ ) {
+			shifted[ i ] = cmds[ i ];
+			shifted[ i ].serverTime += rs->timeShift;
+			MSG_WriteDeltaUsercmdKey( &msg, key, oldcmd, &shifted[ i ] );
+			oldcmd = &shifted[ i ];
+		}
+	}
+
+	MSG_WriteByte( &msg, clc_EOF );
+
+	if ( msg.overflowed ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: replay message overflowed for %s\n", cl->name );
+		return;
+	}
+
+	msg.readcount = 0;
+	msg.bit = 0;
+
+	start = SV_ProfileStart();
+
+	cl->lastPacketTime = svs.time;
+	SV_ExecuteClientMessage( cl, &msg );
+
+	SV_ProfileEnd( PROF_PACKETS, start );
+
+	rs->messages++;
+}
+
+
+/*
+=================
+SV_ReplayConnect
+
+Creates client slot without network address, messages to it
+are fully built and encoded but never sent
+=================
+*/
+static void SV_ReplayConnect( replayState_t *rs, int clientNum, const char *userinfo ) {
+	client_t *cl = &svs.clients[ clientNum ];
+	netadr_t adr;
+	intptr_t denied;
+
+	if ( cl->state >= CS_CONNECTED ) {
+		SV_DropClient( cl, NULL );
+	}
+
+	Com_Memset( cl, 0, sizeof( *cl ) );
+	Com_Memset( &adr, 0, sizeof( adr ) );
+	adr.type = NA_BAD;
+
+	Netchan_Setup( NS_SERVER, &cl->netchan, &adr, clientNum, 0, qfalse );
+	cl->netchan.isLANAddress = qtrue; // no rate limits
+	cl->netchan_end_queue = &cl->netchan_start_queue;
+
+	Q_strncpyz( cl->userinfo, userinfo, sizeof( cl->userinfo ) );
+	cl->longstr = qtrue;
+	cl->country = "REPLAY";
+
+	// recorded pure checksums are not valid for this session
+	cl->gotCP = qtrue;
+	cl->pureAuthentic = qtrue;
+
+	SV_UserinfoChanged( cl, qtrue, qfalse );
+
+	denied = VM_Call( gvm, 3, GAME_CLIENT_CONNECT, clientNum, qtrue, qfalse );
+	if ( denied ) {
+		Com_Printf( "Game rejected replay client %i: %s\n", clientNum, (const char *)GVM_ArgPtr( denied ) );
+		return;
+	}
+
+	cl->state = CS_CONNECTED;
+	cl->lastSnapshotTime = svs.time - 9999;
+	cl->lastPacketTime = svs.time;
+	cl->lastConnectTime = svs.time;
+	cl->lastDisconnectTime = svs.time;
+	cl->gamestateMessageNum = cl->messageAcknowledge - 1;
+
+	rs->clients[ clientNum ].active = qtrue;
+	rs->clients[ clientNum ].numPending = 0;
+
+	// request gamestate
+	SV_ReplayMessage( rs, cl, NULL, 0, qfalse );
+}
+
+
+/*
+=================
+SV_ReplayChunk
+=================
+*/
+static qboolean SV_ReplayChunk( replayState_t *rs, msg_t *msg ) {
+	static const usercmd_t nullcmd = { 0 };
+	usercmd_t cmds[ MAX_PACKET_USERCMDS ];
+	replayClient_t *rc;
+	client_t *cl;
+	const char *s;
+	int op, clientNum, delta, count, i;
+
+	while ( 1 ) {
+		if ( msg->readcount > msg->cursize ) {
+			return qfalse;
+		}
+
+		op = MSG_ReadByte( msg );
+		if ( op == REC_EOF ) {
+			break;
+		}
+
+		clientNum = MSG_ReadByte( msg );
+		if ( clientNum < 0 || clientNum >= sv.maxclients ) {
+			return qfalse;
+		}
+
+		cl = &svs.clients[ clientNum ];
+		rc = &rs->clients[ clientNum ];
+
+		switch ( op ) {
+		case REC_CONNECT:
+			s = MSG_ReadBigString( msg );
+			SV_ReplayConnect( rs, clientNum, s );
+			break;
+
+		case REC_DISCONNECT:
+			if ( rc->active ) {
+				rc->active = qfalse;
+				rc->numPending = 0;
+				if ( cl->state >= CS_CONNECTED ) {
+					SV_DropClient( cl, "disconnected" );
+				}
+			}
+			break;
+
+		case REC_COMMAND:
+			s = MSG_ReadString( msg );
+			if ( !rc->active || cl->state < CS_CONNECTED ) {
+				break;
+			}
+			if ( rc->numPending == REPLAY_MAX_PENDING ) {
+				SV_ReplayMessage( rs, cl, NULL, 0, qfalse );
+			}
+			Q_strncpyz( rc->pending[ rc->numPending++ ], s, sizeof( rc->pending[0] ) );
+			break;
+
+		case REC_MOVE:
+			delta = MSG_ReadByte( msg );
+			count = MSG_ReadByte( msg );
+			if ( count < 1 || count > MAX_PACKET_USERCMDS ) {
+				return qfalse;
+			}
+			for ( i = 0; i < count; i++ ) {
+				MSG_ReadDeltaUsercmdKey( msg, 0, i ? &cmds[ i - 1 ] : &nullcmd, &cmds[ i ] );
+			}
+			if ( rc->active && cl->state >= CS_CONNECTED ) {
+				SV_ReplayMessage( rs, cl, cmds, count, delta ? qtrue : qfalse );
+			}
+			break;
+
+		default:
+			return qfalse;
+		}
+	}
+
+	// deliver commands which were not followed by usercmds
+	for ( i = 0, rc = rs->clients; i < sv.maxclients; i++, rc++ ) {
+		if ( rc->numPending && svs.clients[ i ].state >= CS_CONNECTED ) {
+			SV_ReplayMessage( rs, &svs.clients[ i ], NULL, 0, qfalse );
+		}
+		rc->numPending = 0;
+	}
+
+	return qtrue;
+}
+
+
+/*
+=================
+SV_ReplayRunFrames
+
+Runs server frames until specified time
+=================
+*/
+static qboolean SV_ReplayRunFrames( replayState_t *rs, int time ) {
+	int frameMsec;
+	int oldTime;
+
+	frameMsec = 1000 / sv_fps->integer;
+
+	while ( time - sv.time >= frameMsec ) {
+		oldTime = sv.time;
+		SV_Frame( frameMsec );
+		SV_SendQueuedPackets();
+		if ( !com_sv_running->integer || sv.time == oldTime ) {
+			return qfalse;
+		}
+		rs->frames++;
+	}
+
+	return qtrue;
+}
+
+
+/*
+=================
+SV_Replay_f
+
+Replays recorded client input on local server as fast as possible
+and reports consumed time
+=================
+*/
+void SV_Replay_f( void ) {
+	char filename[ MAX_OSPATH ];
+	recordHeader_t header;
+	replayState_t *rs;
+	char fps[ MAX_CVAR_VALUE_STRING ];
+	int floodProtect;
+	int64_t start, usec;
+	int length, offset, chunkLength, chunkTime, startTime;
+	byte *buf;
+	msg_t msg;
+	int i;
+
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "Usage: %s <name>\n", Cmd_Argv( 0 ) );
+		return;
+	}
+
+	if ( recordFile != FS_INVALID_HANDLE ) {
+		Com_Printf( "Can't replay while recording.\n" );
+		return;
+	}
+
+	Com_sprintf( filename, sizeof( filename ), REPLAY_DIR "/%s", Cmd_Argv( 1 ) );
+	COM_DefaultExtension( filename, sizeof( filename ), "." REPLAY_EXT );
+
+	length = FS_ReadFile( filename, (void **)&buf );
+	if ( length < (int)sizeof( header ) || !buf ) {
+		if ( buf ) {
+			FS_FreeFile( buf );
+		}
+		Com_Printf( "Couldn't load %s\n", filename );
+		return;
+	}
+
+	Com_Memcpy( &header, buf, sizeof( header ) );
+	header.mapname[ sizeof( header.mapname ) - 1 ] = '\0';
+	if ( memcmp( header.magic, REPLAY_MAGIC, sizeof( header.magic ) ) != 0 ) {
+		Com_Printf( "%s is not a replay file\n", filename );
+		FS_FreeFile( buf );
+		return;
+	}
+
+	// file is loaded into temporary hunk memory which doesn't survive map change
+	FS_FreeFile( buf );
+
+	// replay runs at recorded tick rate, current one is restored afterwards
+	Q_strncpyz( fps, sv_fps->string, sizeof( fps ) );
+
+	// always start from clean map state
+	Cvar_SetIntegerValue( "sv_fps", LittleLong( header.fps ) );
+	Cmd_ExecuteString( va( "map %s", header.mapname ) );
+
+	if ( !com_sv_running->integer || sv.state != SS_GAME ) {
+		Com_Printf( "Couldn't load map %s for replay\n", header.mapname );
+		Cvar_Set( "sv_fps", fps );
+		return;
+	}
+
+	length = FS_ReadFile( filename, (void **)&buf );
+	if ( length < (int)sizeof( header ) || !buf ) {
+		if ( buf ) {
+			FS_FreeFile( buf );
+		}
+		Com_Printf( "Couldn't load %s\n", filename );
+		Cvar_Set( "sv_fps", fps );
+		return;
+	}
+
+	rs = Z_Malloc( sizeof( *rs ) );
+
+	startTime = sv.time;
+	rs->timeShift = startTime - LittleLong( header.startTime );
+
+	// replayed commands are coming much faster than in real time
+	floodProtect = sv_floodProtect->integer;
+	Cvar_Set( "sv_floodProtect", "0" );
+
+	replaying = qtrue;
+
+	SV_ProfileReset();
+
+	Com_Printf( "Replaying %s on %s...\n", filename, header.mapname );
+
+	start = Sys_Microseconds();
+
+	for ( offset = sizeof( header ); offset + 8 <= length; offset += chunkLength ) {
+		chunkLength = LittleLong( *(int *)( buf + offset ) );
+		chunkTime = LittleLong( *(int *)( buf + offset + 4 ) );
+		offset += 8;
+
+		if ( chunkLength <= 0 || chunkLength > MAX_MSGLEN || offset + chunkLength > length ) {
+			Com_Printf( S_COLOR_YELLOW "Truncated replay chunk at offset %i\n", offset );
+			break;
+		}
+
+		if ( !SV_ReplayRunFrames( rs, chunkTime + rs->timeShift ) ) {
+			Com_Printf( S_COLOR_YELLOW "Server stopped during replay\n" );
+			break;
+		}
+
+		MSG_Init( &msg, buf + offset, chunkLength );
+		msg.cursize = chunkLength;
+		MSG_BeginReading( &msg );
+
+		if ( !SV_ReplayChunk( rs, &msg ) ) {
+			Com_Printf( S_COLOR_YELLOW "Bad replay chunk at offset %i\n", offset );
+			break;
+		}
+	}
+
+	usec = Sys_Microseconds() - start;
+
+	replaying = qfalse;
+
+	Cvar_SetIntegerValue( "sv_floodProtect", floodProtect );
+	Cvar_Set( "sv_fps", fps );
+
+	if ( com_sv_running->integer ) {
+		for ( i = 0; i < sv.maxclients; i++ ) {
+			if ( rs->clients[ i ].active && svs.clients[ i ].state >= CS_CONNECTED ) {
+				SV_DropClient( &svs.clients[ i ], NULL );
+			}
+		}
+	}
+
+	Com_Printf( "Replayed %i messages in %i frames, %.1f seconds of game time in %.3f seconds (%.1fx real time)\n",
+		rs->messages, rs->frames, ( sv.time - startTime ) / 1000.0, usec / 1000000.0,
+		usec ? ( sv.time - startTime ) * 1000.0 / usec : 0.0 );
+
+	SV_ProfilePrint();
+
+	Z_Free( rs );
+	FS_FreeFile( buf );
+}
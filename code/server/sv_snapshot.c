@@ -45,6 +45,146 @@ A normal server packet will look like:
 =============================================================================
 */
 
+/*
+=============================================================================
+
+Delta entity encoding cache
+
+Most clients see the same entities and acknowledge the same frames, so
+each (entity, source frame) delta is huffman-encoded once per common
+snapshot and bit-copied into every other message that needs it.
+Cache may be accessed from multiple snapshot threads at once, entries
+are published with a single compare-and-swap and never modified after.
+
+=============================================================================
+*/
+
+#define DELTA_CACHE_BITS	13
+#define DELTA_CACHE_SLOTS	(1<<DELTA_CACHE_BITS)
+#define DELTA_CACHE_PROBES	32
+#define DELTA_CACHE_SIZE	(256*1024)
+#define DELTA_MAX_BYTES		1024				// enough for any entityState_t delta
+
+typedef struct {
+	unsigned int key;
+	int		bits;
+	byte	data[4];							// variable sized
+} deltaCacheEntry_t;
+
+static struct {
+	int				frameNum;					// common snapshot frame the cache is valid for
+	volatile int	slots[ DELTA_CACHE_SLOTS ];	// offset+1 in data[], 0 - empty slot
+	volatile int	used;						// bytes allocated in data[]
+	int				data[ DELTA_CACHE_SIZE / sizeof( int ) ];
+	volatile int	frameHits;					// updated by snapshot threads
+	volatile int	frameLookups;
+	uint64_t		hits;						// since map start
+	uint64_t		misses;
+} deltaCache;
+
+
+/*
+=============
+SV_ResetDeltaCache
+=============
+*/
+static void SV_ResetDeltaCache( int frameNum ) {
+	Com_Memset( (void *)deltaCache.slots, 0, sizeof( deltaCache.slots ) );
+	deltaCache.used = 0;
+	deltaCache.frameNum = frameNum;
+}
+
+
+/*
+=============
+SV_PrintCacheStats
+=============
+*/
+static void SV_PrintCacheStats( const char *name, uint64_t hits, uint64_t misses ) {
+	const uint64_t total = hits + misses;
+
+	Com_Printf( "%s: %llu hits, %llu misses (%.1f%%)\n", name,
+		(unsigned long long)hits, (unsigned long long)misses,
+		total ? hits * 100.0 / total : 0.0 );
+}
+
+
+/*
+=============
+SV_WriteCachedDeltaEntity
+
+Same as MSG_WriteDeltaEntity() but looks up already encoded data first,
+dist is number of snapshot frames between source and target or 0 for baseline
+=============
+*/
+static void SV_WriteCachedDeltaEntity( msg_t *msg, const entityState_t *from, const entityState_t *to, qboolean force, int dist, int *hits ) {
+	const deltaCacheEntry_t *entry;
+	deltaCacheEntry_t *newEntry;
+	byte	buffer[ DELTA_MAX_BYTES ];
+	msg_t	tmp;
+	unsigned int key, hash;
+	int		ref, size, offset, probe;
+
+	if ( dist < 0 || dist > NUM_SNAPSHOT_FRAMES ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	// source frame, delta type and entity number give unique key within current frame
+	if ( to ) {
+		key = 1 + to->number + MAX_GENTITIES * ( dist * 2 + 0 );
+	} else {
+		key = 1 + from->number + MAX_GENTITIES * ( dist * 2 + 1 );
+	}
+
+	hash = ( key * 2654435761U ) >> ( 32 - DELTA_CACHE_BITS );
+
+	for ( probe = 0; probe < DELTA_CACHE_PROBES; probe++, hash = ( hash + 1 ) & ( DELTA_CACHE_SLOTS - 1 ) ) {
+		ref = deltaCache.slots[ hash ];
+		if ( ref == 0 ) {
+			break;
+		}
+		entry = (const deltaCacheEntry_t *)( (const byte *)deltaCache.data + ref - 1 );
+		if ( entry->key == key ) {
+			MSG_WriteBitStream( msg, entry->data, entry->bits );
+			(*hits)++;
+			return;
+		}
+	}
+
+	// encode into temporary buffer
+	MSG_Init( &tmp, buffer, sizeof( buffer ) );
+	MSG_WriteDeltaEntity( &tmp, from, to, force );
+
+	size = PAD( offsetof( deltaCacheEntry_t, data ) + ( ( tmp.bit + 7 ) >> 3 ), sizeof( int ) );
+	offset = Sys_AtomicAdd( &deltaCache.used, size );
+	if ( tmp.overflowed || offset + size > sizeof( deltaCache.data ) ) {
+		// too large or out of storage, write directly
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	newEntry = (deltaCacheEntry_t *)( (byte *)deltaCache.data + offset );
+	newEntry->key = key;
+	newEntry->bits = tmp.bit;
+	Com_Memcpy( newEntry->data, buffer, ( tmp.bit + 7 ) >> 3 );
+
+	// publish, other thread may take the same slot first
+	for ( ; probe < DELTA_CACHE_PROBES; probe++, hash = ( hash + 1 ) & ( DELTA_CACHE_SLOTS - 1 ) ) {
+		if ( Sys_AtomicCAS( &deltaCache.slots[ hash ], 0, offset + 1 ) ) {
+			break;
+		}
+		ref = deltaCache.slots[ hash ];
+		entry = (const deltaCacheEntry_t *)( (const byte *)deltaCache.data + ref - 1 );
+		if ( entry->key == key ) {
+			break;
+		}
+	}
+
+	MSG_WriteBitStream( msg, buffer, tmp.bit );
+}
+
+
 /*
 =============
 SV_EmitPacketEntities
@@ -57,6 +197,8 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, const clientSna
 	int		oldindex, newindex;
 	int		oldnum, newnum;
 	int		from_num_entities;
+	int		hits, lookups;
+	qboolean	cached;
 
 	// generate the delta update
 	if ( !from ) {
@@ -65,6 +207,12 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, const clientSna
 		from_num_entities = from->num_entities;
 	}
 
+	// cached deltas are keyed by storage frames of both states, so
+	// only states taken from the current common snapshot can use it
+	cached = ( sv_deltaCache->integer && to->frameNum == deltaCache.frameNum );
+
+	hits = lookups = 0;
+
 	newent = NULL;
 	oldent = NULL;
 	newindex = 0;
@@ -88,7 +236,12 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, const clientSna
 			// delta update from old position
 			// because the force parm is qfalse, this will not result
 			// in any bytes being emitted if the entity has not changed at all
-			MSG_WriteDeltaEntity (msg, oldent, newent, qfalse );
+			if ( !cached || to->entFrames[ newindex ] != to->frameNum ) {
+				MSG_WriteDeltaEntity( msg, oldent, newent, qfalse );
+			} else {
+				SV_WriteCachedDeltaEntity( msg, oldent, newent, qfalse, to->frameNum - from->entFrames[ oldindex ] + 1, &hits );
+				lookups++;
+			}
 			oldindex++;
 			newindex++;
 			continue;
@@ -96,64 +249,92 @@ static void SV_EmitPacketEntities( const clientSnapshot_t *from, const clientSna
 
 		if ( newnum < oldnum ) {
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity (msg, &sv.svEntities[newnum].baseline, newent, qtrue );
+			if ( !cached || to->entFrames[ newindex ] != to->frameNum ) {
+				MSG_WriteDeltaEntity( msg, &sv.svEntities[newnum].baseline, newent, qtrue );
+			} else {
+				SV_WriteCachedDeltaEntity( msg, &sv.svEntities[newnum].baseline, newent, qtrue, 0, &hits );
+				lookups++;
+			}
 			newindex++;
 			continue;
 		}
 
 		if ( newnum > oldnum ) {
 			// the old entity isn't present in the new message
-			MSG_WriteDeltaEntity (msg, oldent, NULL, qtrue );
+			if ( !cached ) {
+				MSG_WriteDeltaEntity( msg, oldent, NULL, qtrue );
+			} else {
+				SV_WriteCachedDeltaEntity( msg, oldent, NULL, qtrue, to->frameNum - from->entFrames[ oldindex ] + 1, &hits );
+				lookups++;
+			}
 			oldindex++;
 			continue;
 		}
 	}
 
 	MSG_WriteBits( msg, (MAX_GENTITIES-1), GENTITYNUM_BITS );	// end of packetentities
+
+	if ( cached ) {
+		Sys_AtomicAdd( &deltaCache.frameHits, hits );
+		Sys_AtomicAdd( &deltaCache.frameLookups, lookups );
+	}
 }
 
 
 /*
 ==================
-SV_WriteSnapshotToClient
+SV_GetDeltaFrame
+
+Selects previous frame as the source for delta compressing the snapshot,
+returns NULL if full snapshot should be sent
 ==================
 */
-static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
+static const clientSnapshot_t *SV_GetDeltaFrame( client_t *client, int *lastframe ) {
 	const clientSnapshot_t	*oldframe;
-	const clientSnapshot_t	*frame;
-	int					lastframe;
-	int					i;
-	int					snapFlags;
-
-	// this is the snapshot we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	// try to use a previous frame as the source for delta compressing the snapshot
 	if ( client->state != CS_ACTIVE || !client->deltaActive || client->deltaStart - client->messageAcknowledge > 0 ) {
 		// client is asking for a retransmit
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 	} else if ( client->netchan.outgoingSequence - client->messageAcknowledge >= (PACKET_BACKUP - 3) ) {
 		// client hasn't gotten a good message through in a long time
 		if ( com_developer->integer ) {
 			Com_Printf( S_COLOR_DEVEL "%s: Delta request from out of date packet.\n", client->name );
 		}
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 	} else {
 		// we have a valid snapshot to delta from
 		oldframe = &client->frames[ client->messageAcknowledge & PACKET_MASK ];
-		lastframe = client->netchan.outgoingSequence - client->messageAcknowledge;
+		*lastframe = client->netchan.outgoingSequence - client->messageAcknowledge;
 		// we may refer on outdated frame
-		if ( oldframe->frameNum - svs.lastValidFrame < 0 ) {
+		if ( oldframe->baseFrameNum - svs.lastValidFrame < 0 ) {
 			Com_DPrintf( "%s: Delta request from out of date frame.\n", client->name );
 			oldframe = NULL;
-			lastframe = 0;
+			*lastframe = 0;
 		} else {
 			client->deltaStart = client->messageAcknowledge; // adjust delta range
 		}
 	}
 
+	return oldframe;
+}
+
+
+/*
+==================
+SV_WriteSnapshotToClient
+==================
+*/
+static void SV_WriteSnapshotToClient( const client_t *client, msg_t *msg, const clientSnapshot_t *oldframe, int lastframe ) {
+	const clientSnapshot_t	*frame;
+	int					i;
+	int					snapFlags;
+
+	// this is the snapshot we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
 	MSG_WriteByte( msg, svc_snapshot );
 
 	// NOTE, MRE: now sent at the start of every message from server to client
@@ -227,7 +408,7 @@ SV_UpdateServerCommandsToClient
 (re)send all server commands the client hasn't acknowledged yet
 ==================
 */
-void SV_UpdateServerCommandsToClient( client_t *client, msg_t *msg ) {
+void SV_UpdateServerCommandsToClient( const client_t *client, msg_t *msg ) {
 	int i, n;
 
 	// write any unacknowledged serverCommands
@@ -255,6 +436,8 @@ typedef struct {
 	int		numSnapshotEntities;
 	entityNum_t	snapshotEntities[ MAX_SNAPSHOT_ENTITIES ];
 	qboolean unordered;
+	byte	added[ MAX_GENTITIES / 8 ];	// used to prevent double adding from portal views
+	const char *error;
 } snapshotEntityNumbers_t;
 
 
@@ -293,17 +476,420 @@ static void SV_SortEntityNumbers( entityNum_t *num, const int size ) {
 SV_AddIndexToSnapshot
 ===============
 */
-static void SV_AddIndexToSnapshot( svEntity_t *svEnt, int index, snapshotEntityNumbers_t *eNums ) {
+static void SV_AddIndexToSnapshot( int entityNum, int index, snapshotEntityNumbers_t *eNums ) {
+
+	eNums->added[ entityNum >> 3 ] |= 1 << ( entityNum & 7 );
+
+	// if we are full, silently discard entities
+	if ( eNums->numSnapshotEntities >= MAX_SNAPSHOT_ENTITIES ) {
+		return;
+	}
+
+	eNums->snapshotEntities[ eNums->numSnapshotEntities ] = index;
+	eNums->numSnapshotEntities++;
+}
+
+
+/*
+=============================================================================
+
+Visible entity cache
+
+Area and PVS cluster tests don't depend on the client, so list of
+common snapshot entities passing them is built once per (cluster, area)
+pair and shared by all viewpoints located there.
+
+=============================================================================
+*/
+
+#define VIS_CACHE_SLOTS		256				// must be power of two
+#define VIS_CACHE_SIZE		(512*1024)
+
+typedef struct {
+	int		cluster;
+	int		area;
+	int		count;
+	short	ents[2];						// variable sized, indexes in svs.currFrame->ents[]
+} visCacheEntry_t;
+
+static struct {
+	int				frameNum;				// common snapshot frame the cache is valid for
+	volatile int	slots[ VIS_CACHE_SLOTS ];
+	volatile int	used;
+	int				data[ VIS_CACHE_SIZE / sizeof( int ) ];
+	volatile int	frameHits;				// updated by snapshot threads
+	volatile int	frameLookups;
+	uint64_t		hits;					// since map start
+	uint64_t		misses;
+} visCache;
+
+
+/*
+===============
+SV_UpdateSnapshotStats
+
+Accumulates cache counters collected by snapshot threads
+===============
+*/
+static void SV_UpdateSnapshotStats( void ) {
+	deltaCache.hits += deltaCache.frameHits;
+	deltaCache.misses += deltaCache.frameLookups - deltaCache.frameHits;
+	deltaCache.frameHits = 0;
+	deltaCache.frameLookups = 0;
+
+	visCache.hits += visCache.frameHits;
+	visCache.misses += visCache.frameLookups - visCache.frameHits;
+	visCache.frameHits = 0;
+	visCache.frameLookups = 0;
+}
+
+
+/*
+===============
+SV_PrintDeltaCacheStats
+===============
+*/
+void SV_PrintDeltaCacheStats( void ) {
+	SV_UpdateSnapshotStats();
+	SV_PrintCacheStats( "delta cache", deltaCache.hits, deltaCache.misses );
+}
+
+
+/*
+===============
+SV_SnapshotStats_f
+===============
+*/
+void SV_SnapshotStats_f( void ) {
+	const client_t *cl;
+	int i;
+
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	SV_UpdateSnapshotStats();
+	SV_PrintCacheStats( "visibility cache", visCache.hits, visCache.misses );
+	SV_PrintCacheStats( "delta cache", deltaCache.hits, deltaCache.misses );
+
+	if ( !sv_snapshotBudget->integer ) {
+		return;
+	}
+
+	Com_Printf( "\ncl budget deferred   updates  deferred%% overbudget name\n" );
+	Com_Printf( "-- ------ -------- --------- --------- ---------- ---------------\n" );
+	for ( i = 0, cl = svs.clients; i < sv.maxclients; i++, cl++ ) {
+		if ( cl->state != CS_ACTIVE || cl->netchan.remoteAddress.type == NA_BOT ) {
+			continue;
+		}
+		Com_Printf( "%2i %6i %8i %9i %8.1f%% %10i %s\n", i, cl->snapBudget, cl->snapDeferred, cl->snapUpdates,
+			cl->snapUpdates ? cl->snapDeferredTotal * 100.0 / cl->snapUpdates : 0.0, cl->snapOverBudget, cl->name );
+	}
+}
+
+
+/*
+===============
+SV_CollectBenchPairs
+
+Copies entity deltas of the last snapshots sent to active clients
+===============
+*/
+static int SV_CollectBenchPairs( entityState_t *from, entityState_t *to, int maxPairs ) {
+	const clientSnapshot_t *newframe, *oldframe;
+	const entityState_t *oldent;
+	const client_t *cl;
+	int i, n, oldindex, count;
+
+	count = 0;
+	for ( i = 0, cl = svs.clients; i < sv.maxclients; i++, cl++ ) {
+		if ( cl->state != CS_ACTIVE ) {
+			continue;
+		}
+
+		newframe = &cl->frames[ ( cl->netchan.outgoingSequence - 1 ) & PACKET_MASK ];
+		oldframe = &cl->frames[ ( cl->netchan.outgoingSequence - 2 ) & PACKET_MASK ];
+		if ( newframe->baseFrameNum - svs.lastValidFrame < 0 ) {
+			continue;
+		}
+		if ( oldframe->baseFrameNum - svs.lastValidFrame < 0 ) {
+			oldframe = NULL;
+		}
+
+		oldindex = 0;
+		for ( n = 0; n < newframe->num_entities && count < maxPairs; n++ ) {
+			to[ count ] = *newframe->ents[ n ];
+			oldent = &sv.svEntities[ to[ count ].number ].baseline;
+			if ( oldframe ) {
+				// both lists are sorted by entity number
+				while ( oldindex < oldframe->num_entities && oldframe->ents[ oldindex ]->number < to[ count ].number ) {
+					oldindex++;
+				}
+				if ( oldindex < oldframe->num_entities && oldframe->ents[ oldindex ]->number == to[ count ].number ) {
+					oldent = oldframe->ents[ oldindex ];
+				}
+			}
+			from[ count ] = *oldent;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
+/*
+===============
+SV_BenchDeltaEntities
+
+Encodes and decodes all pairs, stores time spent on each pass
+===============
+*/
+static void SV_BenchDeltaEntities( const entityState_t *from, const entityState_t *to, int count, int iterations,
+	msg_t *msg, int64_t *writeTime, int64_t *readTime ) {
+	entityState_t decoded;
+	int64_t start;
+	int i, n, num;
+
+	start = Sys_Microseconds();
+	for ( i = 0; i < iterations; i++ ) {
+		MSG_Clear( msg );
+		MSG_Bitstream( msg );
+		for ( n = 0; n < count; n++ ) {
+			MSG_WriteDeltaEntity( msg, &from[ n ], &to[ n ], qtrue );
+		}
+	}
+	*writeTime = Sys_Microseconds() - start;
+
+	start = Sys_Microseconds();
+	for ( i = 0; i < iterations; i++ ) {
+		MSG_BeginReading( msg );
+		for ( n = 0; n < count; n++ ) {
+			num = MSG_ReadEntitynum( msg );
+			if ( num != to[ n ].number ) {
+				Com_Printf( S_COLOR_YELLOW "entity %i decoded as %i\n", to[ n ].number, num );
+				return;
+			}
+			MSG_ReadDeltaEntity( msg, &from[ n ], &decoded, num );
+		}
+	}
+	*readTime = Sys_Microseconds() - start;
+}
+
+
+/*
+===============
+SV_MsgBench_f
+
+Measures entity delta compression throughput with per-bit and
+word-level huffman coders over the last sent snapshots
+===============
+*/
+void SV_MsgBench_f( void ) {
+	const int maxPairs = MAX_SNAPSHOT_ENTITIES * 4;
+	entityState_t *from, *to;
+	int64_t writeTime[2], readTime[2];
+	byte *data[2];
+	msg_t msg[2];
+	int iterations, count, size, i;
+
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	iterations = atoi( Cmd_Argv( 1 ) );
+	if ( iterations <= 0 ) {
+		iterations = 1000;
+	}
+
+	from = Z_Malloc( maxPairs * sizeof( *from ) * 2 );
+	to = from + maxPairs;
+
+	count = SV_CollectBenchPairs( from, to, maxPairs );
+	if ( count == 0 ) {
+		Com_Printf( "No snapshot entities to benchmark.\n" );
+		Z_Free( from );
+		return;
+	}
+
+	// entity state can't take more than sizeof( entityState_t ) with all fields changed
+	size = count * ( sizeof( entityState_t ) + 8 ) + 8;
+	for ( i = 0; i < 2; i++ ) {
+		data[ i ] = Z_Malloc( size );
+		MSG_Init( &msg[ i ], data[ i ], size );
+		MSG_LegacyBits( i == 0 ? qtrue : qfalse );
+		SV_BenchDeltaEntities( from, to, count, iterations, &msg[ i ], &writeTime[ i ], &readTime[ i ] );
+	}
+	MSG_LegacyBits( qfalse );
+
+	Com_Printf( "%i entity deltas, %i bytes, %i iterations\n", count, msg[1].cursize, iterations );
+	Com_Printf( "coder       write MB/s   read MB/s\n" );
+	for ( i = 0; i < 2; i++ ) {
+		Com_Printf( "%-10s %11.1f %11.1f\n", i == 0 ? "per-bit" : "word",
+			writeTime[ i ] ? (double)msg[ i ].cursize * iterations / writeTime[ i ] : 0.0,
+			readTime[ i ] ? (double)msg[ i ].cursize * iterations / readTime[ i ] : 0.0 );
+	}
+
+	if ( msg[0].cursize != msg[1].cursize || memcmp( data[0], data[1], msg[0].bit >> 3 ) != 0 ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: encoded streams differ\n" );
+	} else {
+		Com_Printf( "encoded streams are identical\n" );
+	}
+
+	Z_Free( data[1] );
+	Z_Free( data[0] );
+	Z_Free( from );
+}
+
+
+/*
+===============
+SV_ResetVisCache
+===============
+*/
+static void SV_ResetVisCache( int frameNum ) {
+	Com_Memset( (void *)visCache.slots, 0, sizeof( visCache.slots ) );
+	visCache.used = 0;
+	visCache.frameNum = frameNum;
+}
+
+
+/*
+===============
+SV_FindVisibleEntities
+
+Collects broadcast entities and entities touching PV leafs in connected areas
+===============
+*/
+static int SV_FindVisibleEntities( int clientcluster, int clientarea, short *list ) {
+	const entityState_t *es;
+	const sharedEntity_t *ent;
+	const svEntity_t *svEnt;
+	const byte	*bitvector;
+	int		e, i, l;
+	int		count;
+
+	bitvector = CM_ClusterPVS( clientcluster );
+	count = 0;
+
+	for ( e = 0 ; e < svs.currFrame->count; e++ ) {
+		es = svs.currFrame->ents[ e ];
+		ent = SV_GentityNum( es->number );
+
+		// broadcast entities are always sent
+		if ( ent->r.svFlags & SVF_BROADCAST ) {
+			list[ count++ ] = e;
+			continue;
+		}
+
+		svEnt = &sv.svEntities[ es->number ];
+
+		// ignore if not touching a PV leaf
+		// check area
+		if ( !CM_AreasConnected( clientarea, svEnt->areanum ) ) {
+			// doors can legally straddle two areas, so
+			// we may need to check another one
+			if ( !CM_AreasConnected( clientarea, svEnt->areanum2 ) ) {
+				continue;		// blocked by a door
+			}
+		}
+
+		// check individual leafs
+		if ( !svEnt->numClusters ) {
+			continue;
+		}
+		l = 0;
+		for ( i=0 ; i < svEnt->numClusters ; i++ ) {
+			l = svEnt->clusternums[i];
+			if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
+				break;
+			}
+		}
+
+		// if we haven't found it to be visible,
+		// check overflow clusters that couldn't be stored
+		if ( i == svEnt->numClusters ) {
+			if ( svEnt->lastCluster ) {
+				for ( ; l <= svEnt->lastCluster ; l++ ) {
+					if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
+						break;
+					}
+				}
+				if ( l == svEnt->lastCluster ) {
+					continue;	// not visible
+				}
+			} else {
+				continue;
+			}
+		}
+
+		list[ count++ ] = e;
+	}
+
+	return count;
+}
+
+
+/*
+===============
+SV_GetVisibleEntities
+
+Returns cached entity list for given viewpoint location,
+storage is used when the cache is disabled or full
+===============
+*/
+static const short *SV_GetVisibleEntities( int clientcluster, int clientarea, short *storage, int *count ) {
+	const visCacheEntry_t *entry;
+	visCacheEntry_t *newEntry;
+	unsigned int hash;
+	int ref, size, offset, probe;
+
+	if ( !sv_visCache->integer || visCache.frameNum != svs.currFrame->frameNum ) {
+		*count = SV_FindVisibleEntities( clientcluster, clientarea, storage );
+		return storage;
+	}
+
+	Sys_AtomicAdd( &visCache.frameLookups, 1 );
+
+	hash = ( (unsigned int)clientcluster * 2654435761U + (unsigned int)clientarea * 40503U ) >> 8;
+
+	for ( probe = 0; probe < VIS_CACHE_SLOTS; probe++ ) {
+		ref = visCache.slots[ ( hash + probe ) & ( VIS_CACHE_SLOTS - 1 ) ];
+		if ( ref == 0 ) {
+			break;
+		}
+		entry = (const visCacheEntry_t *)( (const byte *)visCache.data + ref - 1 );
+		if ( entry->cluster == clientcluster && entry->area == clientarea ) {
+			Sys_AtomicAdd( &visCache.frameHits, 1 );
+			*count = entry->count;
+			return entry->ents;
+		}
+	}
+
+	*count = SV_FindVisibleEntities( clientcluster, clientarea, storage );
+
+	size = PAD( offsetof( visCacheEntry_t, ents ) + *count * sizeof( short ), sizeof( int ) );
+	offset = Sys_AtomicAdd( &visCache.used, size );
+	if ( offset + size > sizeof( visCache.data ) ) {
+		return storage;
+	}
 
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	newEntry = (visCacheEntry_t *)( (byte *)visCache.data + offset );
+	newEntry->cluster = clientcluster;
+	newEntry->area = clientarea;
+	newEntry->count = *count;
+	Com_Memcpy( newEntry->ents, storage, *count * sizeof( short ) );
 
-	// if we are full, silently discard entities
-	if ( eNums->numSnapshotEntities >= MAX_SNAPSHOT_ENTITIES ) {
-		return;
+	// publish, other thread may take the same slot first
+	for ( ; probe < VIS_CACHE_SLOTS; probe++ ) {
+		if ( Sys_AtomicCAS( &visCache.slots[ ( hash + probe ) & ( VIS_CACHE_SLOTS - 1 ) ], 0, offset + 1 ) ) {
+			break;
+		}
 	}
 
-	eNums->snapshotEntities[ eNums->numSnapshotEntities ] = index;
-	eNums->numSnapshotEntities++;
+	return storage;
 }
 
 
@@ -314,15 +900,14 @@ SV_AddEntitiesVisibleFromPoint
 */
 static void SV_AddEntitiesVisibleFromPoint( const vec3_t origin, clientSnapshot_t *frame,
 									snapshotEntityNumbers_t *eNums, qboolean portal ) {
-	int		e, i;
+	int		e, n;
 	sharedEntity_t *ent;
-	svEntity_t	*svEnt;
 	entityState_t  *es;
-	int		l;
 	int		clientarea, clientcluster;
 	int		leafnum;
-	byte	*clientpvs;
-	byte	*bitvector;
+	short	storage[ MAX_GENTITIES ];
+	const short *list;
+	int		count;
 
 	// during an error shutdown message we may need to transmit
 	// the shutdown message after the server has shutdown, so
@@ -338,9 +923,10 @@ static void SV_AddEntitiesVisibleFromPoint( const vec3_t origin, clientSnapshot_
 	// calculate the visible areas
 	frame->areabytes = CM_WriteAreaBits( frame->areabits, clientarea );
 
-	clientpvs = CM_ClusterPVS (clientcluster);
+	list = SV_GetVisibleEntities( clientcluster, clientarea, storage, &count );
 
-	for ( e = 0 ; e < svs.currFrame->count; e++ ) {
+	for ( n = 0 ; n < count; n++ ) {
+		e = list[ n ];
 		es = svs.currFrame->ents[ e ];
 		ent = SV_GentityNum( es->number );
 
@@ -358,68 +944,26 @@ static void SV_AddEntitiesVisibleFromPoint( const vec3_t origin, clientSnapshot_
 		}
 		// entities can be flagged to be sent to a given mask of clients
 		if ( ent->r.svFlags & SVF_CLIENTMASK ) {
-			if (frame->ps.clientNum >= 32)
-				Com_Error( ERR_DROP, "SVF_CLIENTMASK: clientNum >= 32" );
+			if (frame->ps.clientNum >= 32) {
+				eNums->error = "SVF_CLIENTMASK: clientNum >= 32";
+				return;
+			}
 			if (~ent->r.singleClient & (1 << frame->ps.clientNum))
 				continue;
 		}
 
-		svEnt = &sv.svEntities[ es->number ];
-
 		// don't double add an entity through portals
-		if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+		if ( eNums->added[ es->number >> 3 ] & ( 1 << ( es->number & 7 ) ) ) {
 			continue;
 		}
 
+		// add it
+		SV_AddIndexToSnapshot( es->number, e, eNums );
+
 		// broadcast entities are always sent
 		if ( ent->r.svFlags & SVF_BROADCAST ) {
-			SV_AddIndexToSnapshot( svEnt, e, eNums );
-			continue;
-		}
-
-		// ignore if not touching a PV leaf
-		// check area
-		if ( !CM_AreasConnected( clientarea, svEnt->areanum ) ) {
-			// doors can legally straddle two areas, so
-			// we may need to check another one
-			if ( !CM_AreasConnected( clientarea, svEnt->areanum2 ) ) {
-				continue;		// blocked by a door
-			}
-		}
-
-		bitvector = clientpvs;
-
-		// check individual leafs
-		if ( !svEnt->numClusters ) {
 			continue;
 		}
-		l = 0;
-		for ( i=0 ; i < svEnt->numClusters ; i++ ) {
-			l = svEnt->clusternums[i];
-			if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
-				break;
-			}
-		}
-
-		// if we haven't found it to be visible,
-		// check overflow clusters that couldn't be stored
-		if ( i == svEnt->numClusters ) {
-			if ( svEnt->lastCluster ) {
-				for ( ; l <= svEnt->lastCluster ; l++ ) {
-					if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
-						break;
-					}
-				}
-				if ( l == svEnt->lastCluster ) {
-					continue;	// not visible
-				}
-			} else {
-				continue;
-			}
-		}
-
-		// add it
-		SV_AddIndexToSnapshot( svEnt, e, eNums );
 
 		// if it's a portal entity, add everything visible from its camera position
 		if ( ent->r.svFlags & SVF_PORTAL && !portal ) {
@@ -461,6 +1005,14 @@ void SV_InitSnapshotStorage( void )
 	svs.lastValidFrame = 0;
 
 	svs.currFrame = NULL;
+
+	SV_ResetDeltaCache( -1 );
+	deltaCache.hits = 0;
+	deltaCache.misses = 0;
+
+	SV_ResetVisCache( -1 );
+	visCache.hits = 0;
+	visCache.misses = 0;
 }
 
 
@@ -500,6 +1052,9 @@ static void SV_BuildCommonSnapshot( void )
 	int index;
 	int	num;
 	int i;
+	int64_t start;
+
+	start = SV_ProfileStart();
 
 	count = 0;
 
@@ -524,12 +1079,9 @@ static void SV_BuildCommonSnapshot( void )
 			}
 
 			list[ count++ ] = ent;
-			sv.svEntities[ num ].snapshotCounter = -1;
 		}
 	}
 
-	sv.snapshotCounter = -1;
-
 	sf = &svs.snapFrames[ svs.snapshotFrame % NUM_SNAPSHOT_FRAMES ];
 	
 	// track last valid frame
@@ -566,6 +1118,9 @@ static void SV_BuildCommonSnapshot( void )
 
 	svs.currFrame = sf; // clients can refer to this
 
+	SV_ResetDeltaCache( sf->frameNum );
+	SV_ResetVisCache( sf->frameNum );
+
 	// setup start index
 	index = sf->start;
 	for ( i = 0 ; i < count ; i++, index = (index+1) % svs.numSnapshotEntities ) {
@@ -573,6 +1128,8 @@ static void SV_BuildCommonSnapshot( void )
 		svs.snapshotEntities[ index ] = list[ i ]->s;
 		sf->ents[ i ] = &svs.snapshotEntities[ index ];
 	}
+
+	SV_ProfileEnd( PROF_COMMON_SNAPSHOT, start );
 }
 
 
@@ -587,14 +1144,15 @@ This properly handles multiple recursive portals, but the render
 currently doesn't.
 
 For viewing through other player's eyes, clent can be something other than client->gentity
+
+Returns error message instead of calling Com_Error() so it can be used from worker threads
 =============
 */
-static void SV_BuildClientSnapshot( client_t *client ) {
+static const char *SV_BuildClientSnapshot( client_t *client ) {
 	vec3_t						org;
 	clientSnapshot_t			*frame;
 	snapshotEntityNumbers_t		entityNumbers;
 	int							i, cl;
-	svEntity_t					*svEnt;
 	int							clientNum;
 	playerState_t				*ps;
 
@@ -609,9 +1167,10 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	// https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=62
 	frame->num_entities = 0;
 	frame->frameNum = svs.currentSnapshotFrame;
+	frame->baseFrameNum = frame->frameNum;
 	
 	if ( client->state == CS_ZOMBIE )
-		return;
+		return NULL;
 
 	// grab the current playerState_t
 	ps = SV_GameClientNum( cl );
@@ -619,14 +1178,14 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 
 	clientNum = frame->ps.clientNum;
 	if ( clientNum < 0 || clientNum >= MAX_GENTITIES ) {
-		Com_Error( ERR_DROP, "SV_SvEntityForGentity: bad gEnt" );
+		return "SV_SvEntityForGentity: bad gEnt";
 	}
 
 	// we set client->gentity only after sending gamestate
 	// so don't send any packetentities changes until CS_PRIMED
 	// because new gamestate will invalidate them anyway
 	if ( !client->gentity ) {
-		return;
+		return NULL;
 	}
 
 	if ( svs.currFrame == NULL ) {
@@ -634,18 +1193,17 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 		SV_BuildCommonSnapshot();
 	}
 
-	// bump the counter used to prevent double adding
-	sv.snapshotCounter++;
-
 	// empty entities before visibility check
 	entityNumbers.numSnapshotEntities = 0;
+	entityNumbers.error = NULL;
+	Com_Memset( entityNumbers.added, 0, sizeof( entityNumbers.added ) );
 
 	frame->frameNum = svs.currFrame->frameNum;
+	frame->baseFrameNum = frame->frameNum;
 
 	// never send client's own entity, because it can
 	// be regenerated from the playerstate
-	svEnt = &sv.svEntities[ clientNum ];
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	entityNumbers.added[ clientNum >> 3 ] |= 1 << ( clientNum & 7 );
 
 	// find the client's viewpoint
 	VectorCopy( ps->origin, org );
@@ -655,6 +1213,9 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	// may include portal entities that merge other viewpoints
 	entityNumbers.unordered = qfalse;
 	SV_AddEntitiesVisibleFromPoint( org, frame, &entityNumbers, qfalse );
+	if ( entityNumbers.error ) {
+		return entityNumbers.error;
+	}
 
 	// if there were portals visible, there may be out of order entities
 	// in the list which will need to be resorted for the delta compression
@@ -675,7 +1236,238 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	// get pointers from common snapshot
 	for ( i = 0 ; i < entityNumbers.numSnapshotEntities ; i++ )	{
 		frame->ents[ i ] = svs.currFrame->ents[ entityNumbers.snapshotEntities[ i ] ];
+		frame->entFrames[ i ] = frame->frameNum;
+	}
+
+	return NULL;
+}
+
+
+/*
+=============================================================================
+
+Relevance-priority entity scheduling
+
+A snapshot that doesn't fit into what the client rate allows per snapshot
+interval delays the whole next snapshot. With sv_snapshotBudget enabled
+entity updates are scored by distance, view direction, kind of entity and
+number of frames the client copy is behind, least relevant ones which
+don't fit keep the state client already has until a later snapshot.
+Deferred states are referenced from older storage frames, so each client
+frame tracks the oldest storage frame it depends on.
+
+=============================================================================
+*/
+
+#define SNAPSHOT_OVERHEAD_BYTES	48		// udp/ip, netchan and snapshot headers
+#define MIN_ENTITY_BUDGET		64		// never starve entities completely
+
+typedef struct {
+	int		index;						// in new frame
+	int		oldindex;					// in delta source frame
+	int		bits;
+	float	score;
+} snapshotUpdate_t;
+
+
+/*
+=============
+SV_CompareSnapshotUpdates
+=============
+*/
+static int QDECL SV_CompareSnapshotUpdates( const void *a, const void *b ) {
+	const float sa = ((const snapshotUpdate_t *)a)->score;
+	const float sb = ((const snapshotUpdate_t *)b)->score;
+
+	if ( sa > sb )
+		return -1;
+	if ( sa < sb )
+		return 1;
+	return 0;
+}
+
+
+/*
+=============
+SV_EntityDeltaBits
+
+Returns size of encoded entity delta, 0 if entity didn't change,
+encoded data stays in the delta cache for the actual message
+=============
+*/
+static int SV_EntityDeltaBits( const entityState_t *from, const entityState_t *to, qboolean force, int dist ) {
+	byte	buffer[ DELTA_MAX_BYTES ];
+	msg_t	tmp;
+	int		hits;
+
+	MSG_Init( &tmp, buffer, sizeof( buffer ) );
+
+	if ( dist < 0 ) {
+		MSG_WriteDeltaEntity( &tmp, from, to, force );
+	} else {
+		SV_WriteCachedDeltaEntity( &tmp, from, to, force, dist, &hits );
+	}
+
+	return tmp.bit;
+}
+
+
+/*
+=============
+SV_EntityPriority
+
+Engine doesn't know game entity types so players are told
+by entity number and missiles by their trajectory
+=============
+*/
+static float SV_EntityPriority( const entityState_t *es, const vec3_t viewOrg, const vec3_t forward, int age ) {
+	vec3_t	dir;
+	float	dist, weight;
+
+	if ( es->number < sv.maxclients ) {
+		weight = 4.0f;
+	} else if ( es->pos.trType != TR_STATIONARY ) {
+		weight = 2.0f;
+	} else {
+		weight = 1.0f;
+	}
+
+	VectorSubtract( es->pos.trBase, viewOrg, dir );
+	dist = VectorNormalize( dir );
+
+	// entities in front of the viewer weigh up to 5 times more than behind
+	return weight * age * ( 1.5f + DotProduct( dir, forward ) ) / ( 1.0f + dist * ( 1.0f / 256.0f ) );
+}
+
+
+/*
+=============
+SV_ScheduleSnapshotEntities
+
+Defers least relevant entity updates of the just built frame which
+don't fit into client's byte budget, may run on worker thread
+=============
+*/
+static void SV_ScheduleSnapshotEntities( client_t *client, const clientSnapshot_t *oldframe ) {
+	snapshotUpdate_t	updates[ MAX_SNAPSHOT_ENTITIES ];
+	byte		buffer[ 2048 ];
+	msg_t		tmp;
+	clientSnapshot_t	*frame;
+	const entityState_t	*oldent, *newent;
+	const snapshotUpdate_t	*up;
+	vec3_t		viewOrg, forward;
+	int			budget, mandatory, optional;
+	int			i, oldindex, numUpdates;
+	int			bits, age, dist;
+	qboolean	cached;
+
+	client->snapBudget = 0;
+	client->snapDeferred = 0;
+
+	if ( !sv_snapshotBudget->integer || !oldframe || !client->rate ) {
+		return;
+	}
+
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
+	// bytes client can receive within one snapshot interval without rate delay
+	budget = client->rate * client->snapshotMsec / 1000 - SNAPSHOT_OVERHEAD_BYTES - frame->areabytes;
+
+	// unacknowledged reliable commands are always resent
+	for ( i = client->reliableAcknowledge + 1; i - client->reliableSequence <= 0; i++ ) {
+		budget -= 5 + (int)strlen( client->reliableCommands[ i & (MAX_RELIABLE_COMMANDS-1) ] );
+	}
+
+	MSG_Init( &tmp, buffer, sizeof( buffer ) );
+	tmp.allowoverflow = qtrue;
+	MSG_WriteDeltaPlayerstate( &tmp, &oldframe->ps, &frame->ps );
+	budget -= tmp.overflowed ? sizeof( buffer ) : tmp.cursize;
+
+	if ( budget < MIN_ENTITY_BUDGET ) {
+		budget = MIN_ENTITY_BUDGET;
 	}
+	client->snapBudget = budget;
+
+	cached = ( sv_deltaCache->integer && frame->frameNum == deltaCache.frameNum );
+
+	VectorCopy( frame->ps.origin, viewOrg );
+	viewOrg[2] += frame->ps.viewheight;
+	AngleVectors( frame->ps.viewangles, forward, NULL, NULL );
+
+	mandatory = GENTITYNUM_BITS; // end of packetentities
+	optional = 0;
+	numUpdates = 0;
+	oldindex = 0;
+
+	// both lists are sorted by entity number
+	for ( i = 0; i < frame->num_entities; i++ ) {
+		newent = frame->ents[ i ];
+
+		while ( oldindex < oldframe->num_entities && oldframe->ents[ oldindex ]->number < newent->number ) {
+			// removed entity
+			mandatory += GENTITYNUM_BITS + 1;
+			oldindex++;
+		}
+
+		if ( oldindex >= oldframe->num_entities || oldframe->ents[ oldindex ]->number != newent->number ) {
+			// new entity, will be sent from the baseline
+			mandatory += SV_EntityDeltaBits( &sv.svEntities[ newent->number ].baseline, newent, qtrue, cached ? 0 : -1 );
+			continue;
+		}
+
+		oldent = oldframe->ents[ oldindex ];
+		age = frame->frameNum - oldframe->entFrames[ oldindex ];
+		dist = cached ? age + 1 : -1;
+		bits = SV_EntityDeltaBits( oldent, newent, qfalse, dist );
+
+		if ( bits == 0 ) {
+			// not changed
+		} else if ( age >= sv_snapshotMaxDefer->integer || oldent->event != newent->event || newent->solid == SOLID_BMODEL ) {
+			// too old, carries an event or affects client-side prediction
+			mandatory += bits;
+			client->snapUpdates++;
+		} else {
+			updates[ numUpdates ].index = i;
+			updates[ numUpdates ].oldindex = oldindex;
+			updates[ numUpdates ].bits = bits;
+			updates[ numUpdates ].score = SV_EntityPriority( newent, viewOrg, forward, age );
+			optional += bits;
+			numUpdates++;
+			client->snapUpdates++;
+		}
+
+		oldindex++;
+	}
+
+	mandatory += ( oldframe->num_entities - oldindex ) * ( GENTITYNUM_BITS + 1 );
+
+	budget = budget * 8 - mandatory;
+	if ( budget < 0 ) {
+		client->snapOverBudget++;
+		budget = 0;
+	}
+
+	if ( optional <= budget ) {
+		return;
+	}
+
+	qsort( updates, numUpdates, sizeof( updates[0] ), SV_CompareSnapshotUpdates );
+
+	for ( i = 0, up = updates; i < numUpdates; i++, up++ ) {
+		if ( up->bits <= budget ) {
+			budget -= up->bits;
+			continue;
+		}
+		// client keeps the state it already has
+		frame->ents[ up->index ] = oldframe->ents[ up->oldindex ];
+		frame->entFrames[ up->index ] = oldframe->entFrames[ up->oldindex ];
+		if ( frame->entFrames[ up->index ] - frame->baseFrameNum < 0 ) {
+			frame->baseFrameNum = frame->entFrames[ up->index ];
+		}
+		client->snapDeferred++;
+	}
+
+	client->snapDeferredTotal += client->snapDeferred;
 }
 
 
@@ -698,6 +1490,28 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client )
 }
 
 
+/*
+=======================
+SV_WriteClientSnapshot
+
+Writes complete snapshot message, frame must be already built
+=======================
+*/
+static void SV_WriteClientSnapshot( const client_t *client, msg_t *msg, const clientSnapshot_t *oldframe, int lastframe ) {
+
+	// NOTE, MRE: all server->client messages now acknowledge
+	// let the client know which reliable clientCommands we have received
+	MSG_WriteLong( msg, client->lastClientCommand );
+
+	// (re)send any reliable server commands
+	SV_UpdateServerCommandsToClient( client, msg );
+
+	// send over all the relevant entityState_t
+	// and the playerState_t
+	SV_WriteSnapshotToClient( client, msg, oldframe, lastframe );
+}
+
+
 /*
 =======================
 SV_SendClientSnapshot
@@ -709,9 +1523,17 @@ Also called by SV_FinalMessage
 void SV_SendClientSnapshot( client_t *client ) {
 	byte		msg_buf[ MAX_MSGLEN_BUF ];
 	msg_t		msg;
+	const clientSnapshot_t *oldframe;
+	const char	*error;
+	int			lastframe;
+
+	SV_FlushConfigstrings();
 
 	// build the snapshot
-	SV_BuildClientSnapshot( client );
+	error = SV_BuildClientSnapshot( client );
+	if ( error ) {
+		Com_Error( ERR_DROP, "%s", error );
+	}
 
 	// bots need to have their snapshots build, but
 	// the query them directly without needing to be sent
@@ -719,19 +1541,14 @@ void SV_SendClientSnapshot( client_t *client ) {
 		return;
 	}
 
-	MSG_Init( &msg, msg_buf, MAX_MSGLEN );
-	msg.allowoverflow = qtrue;
+	oldframe = SV_GetDeltaFrame( client, &lastframe );
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
+	SV_ScheduleSnapshotEntities( client, oldframe );
 
-	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+	MSG_Init( &msg, msg_buf, MAX_MSGLEN );
+	msg.allowoverflow = qtrue;
 
-	// send over all the relevant entityState_t
-	// and the playerState_t
-	SV_WriteSnapshotToClient( client, &msg );
+	SV_WriteClientSnapshot( client, &msg, oldframe, lastframe );
 
 	// check for overflow
 	if ( msg.overflowed ) {
@@ -743,6 +1560,123 @@ void SV_SendClientSnapshot( client_t *client ) {
 }
 
 
+typedef struct {
+	client_t	*client;
+	const clientSnapshot_t *oldframe;
+	int			lastframe;
+	const char	*error;
+	int			usec;
+	msg_t		msg;
+	byte		msgBuffer[ MAX_MSGLEN_BUF ];
+} snapshotJob_t;
+
+static snapshotJob_t snapshotJobs[ MAX_CLIENTS ];
+
+
+/*
+=======================
+SV_CheckSnapshotEntities
+
+MSG_WriteDeltaEntity() and SV_EmitPacketEntities() would fail with
+Com_Error() on bad entity numbers, check them in advance so that error
+can be reported by job and raised on the main thread after Sys_RunJobs()
+=======================
+*/
+static const char *SV_CheckSnapshotEntities( const clientSnapshot_t *frame ) {
+	int i;
+
+	for ( i = 0; i < frame->num_entities; i++ ) {
+		const int num = frame->ents[ i ]->number;
+		if ( num < 0 || num >= MAX_GENTITIES - 1 ) {
+			return "SV_SnapshotJob: bad entity number";
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+=======================
+SV_SnapshotJob
+
+Builds and encodes single client snapshot, may run on worker thread
+=======================
+*/
+static void SV_SnapshotJob( void *data, int index ) {
+	snapshotJob_t *job = (snapshotJob_t *)data + index;
+	int64_t start = SV_ProfileStart();
+
+	job->error = SV_BuildClientSnapshot( job->client );
+	if ( job->error || job->client->netchan.remoteAddress.type == NA_BOT ) {
+		job->usec = (int)( Sys_Microseconds() - start );
+		return;
+	}
+
+	// nothing below may call Com_Error() on worker thread
+	job->error = SV_CheckSnapshotEntities( &job->client->frames[ job->client->netchan.outgoingSequence & PACKET_MASK ] );
+	if ( job->error ) {
+		job->usec = (int)( Sys_Microseconds() - start );
+		return;
+	}
+
+	SV_ScheduleSnapshotEntities( job->client, job->oldframe );
+
+	MSG_Init( &job->msg, job->msgBuffer, MAX_MSGLEN );
+	job->msg.allowoverflow = qtrue;
+
+	SV_WriteClientSnapshot( job->client, &job->msg, job->oldframe, job->lastframe );
+
+	job->usec = (int)( Sys_Microseconds() - start );
+}
+
+
+/*
+=======================
+SV_SendClientSnapshots
+
+Builds and encodes snapshots for a set of clients in parallel, only
+the final transmission is performed serially, in the same order
+=======================
+*/
+static void SV_SendClientSnapshots( int numJobs ) {
+	snapshotJob_t *job;
+	int i;
+
+	// common snapshot and delta sources must be ready before going wide
+	for ( i = 0, job = snapshotJobs; i < numJobs; i++, job++ ) {
+		if ( job->client->state != CS_ZOMBIE && job->client->gentity && svs.currFrame == NULL ) {
+			SV_BuildCommonSnapshot();
+		}
+		if ( job->client->netchan.remoteAddress.type != NA_BOT ) {
+			job->oldframe = SV_GetDeltaFrame( job->client, &job->lastframe );
+		}
+	}
+
+	Sys_RunJobs( SV_SnapshotJob, snapshotJobs, numJobs, sv_snapshotThreads->integer );
+
+	for ( i = 0, job = snapshotJobs; i < numJobs; i++, job++ ) {
+		if ( job->error ) {
+			Com_Error( ERR_DROP, "%s", job->error );
+		}
+
+		SV_ProfileSample( PROF_CLIENT_SNAPSHOT, job->usec );
+
+		if ( job->client->netchan.remoteAddress.type == NA_BOT ) {
+			continue;
+		}
+
+		// check for overflow
+		if ( job->msg.overflowed ) {
+			Com_Printf( "WARNING: msg overflowed for %s\n", job->client->name );
+			MSG_Clear( &job->msg );
+		}
+
+		SV_SendMessageToClient( &job->msg, job->client );
+	}
+}
+
+
 /*
 =======================
 SV_SendClientMessages
@@ -750,11 +1684,24 @@ SV_SendClientMessages
 */
 void SV_SendClientMessages( void )
 {
+	int64_t	start;
+	int64_t	clientStart;
 	int		i;
+	int		numJobs;
 	client_t	*c;
 
+	start = SV_ProfileStart();
+
 	svs.msgTime = Sys_Milliseconds();
 
+	// send configstring changes of this frame
+	SV_FlushConfigstrings();
+
+	numJobs = 0;
+
+	// collect outgoing datagrams to send them with fewer system calls
+	Sys_BeginPacketBatch();
+
 	// send a message to each connected client
 	for ( i = 0; i < sv.maxclients; i++ )
 	{
@@ -792,8 +1739,28 @@ void SV_SendClientMessages( void )
 		}
 
 		// generate and send a new message
-		SV_SendClientSnapshot( c );
+		if ( sv_snapshotThreads->integer > 1 ) {
+			// SNAPFLAG_RATE_DELAYED must reflect previous state
+			snapshotJobs[ numJobs++ ].client = c;
+		} else {
+			clientStart = SV_ProfileStart();
+			SV_SendClientSnapshot( c );
+			SV_ProfileSample( PROF_CLIENT_SNAPSHOT, (int)( Sys_Microseconds() - clientStart ) );
+			c->rateDelayed = qfalse;
+		}
 		c->lastSnapshotTime = svs.time;
-		c->rateDelayed = qfalse;
 	}
+
+	if ( numJobs ) {
+		SV_SendClientSnapshots( numJobs );
+		for ( i = 0; i < numJobs; i++ ) {
+			snapshotJobs[ i ].client->rateDelayed = qfalse;
+		}
+	}
+
+	Sys_FlushPacketBatch();
+
+	SV_UpdateSnapshotStats();
+
+	SV_ProfileEnd( PROF_SNAPSHOTS, start );
 }
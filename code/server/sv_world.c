@@ -151,6 +151,9 @@ void SV_ClearWorld( void ) {
 	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
 	sv_numworldSectors = 0;
 
+	// collision map might be changed
+	SV_FreeTraceContexts();
+
 	// get world map bounds
 	h = CM_InlineModel( 0 );
 	CM_ModelBounds( h, mins, maxs );
@@ -500,13 +503,12 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 
 /*
 ====================
-SV_ClipMoveToEntities
+SV_ClipMoveToEntityList
 
 ====================
 */
-static void SV_ClipMoveToEntities( moveclip_t *clip ) {
-	int			i, num;
-	int			touchlist[MAX_GENTITIES];
+static void SV_ClipMoveToEntityList( moveclip_t *clip, const int *touchlist, int num ) {
+	int			i;
 	sharedEntity_t *touch;
 	int			passOwnerNum;
 	trace_t		trace;
@@ -514,8 +516,6 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 	float		*origin;
 	const float *angles;
 
-	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
-
 	if ( clip->passEntityNum != ENTITYNUM_NONE ) {
 		passOwnerNum = ( SV_GentityNum( clip->passEntityNum ) )->r.ownerNum;
 		if ( passOwnerNum == ENTITYNUM_NONE ) {
@@ -587,6 +587,44 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 }
 
 
+/*
+====================
+SV_ClipMoveToEntities
+
+====================
+*/
+static void SV_ClipMoveToEntities( moveclip_t *clip ) {
+	int			num;
+	int			touchlist[MAX_GENTITIES];
+
+	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
+
+	SV_ClipMoveToEntityList( clip, touchlist, num );
+}
+
+
+/*
+====================
+SV_MoveBounds
+
+Creates the bounding box of the entire move
+====================
+*/
+static void SV_MoveBounds( const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, vec3_t boxmins, vec3_t boxmaxs ) {
+	int			i;
+
+	for ( i=0 ; i<3 ; i++ ) {
+		if ( end[i] > start[i] ) {
+			boxmins[i] = start[i] + mins[i] - 1;
+			boxmaxs[i] = end[i] + maxs[i] + 1;
+		} else {
+			boxmins[i] = end[i] + mins[i] - 1;
+			boxmaxs[i] = start[i] + maxs[i] + 1;
+		}
+	}
+}
+
+
 /*
 ==================
 SV_Trace
@@ -597,7 +635,6 @@ passEntityNum and entities owned by passEntityNum are explicitly not checked.
 */
 void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, qboolean capsule ) {
 	moveclip_t	clip;
-	int			i;
 
 	if ( !mins ) {
 		mins = vec3_origin;
@@ -633,15 +670,7 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 	// we can limit it to the part of the move not
 	// already clipped off by the world, which can be
 	// a significant savings for line of sight and shot traces
-	for ( i=0 ; i<3 ; i++ ) {
-		if ( end[i] > start[i] ) {
-			clip.boxmins[i] = clip.start[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.end[i] + clip.maxs[i] + 1;
-		} else {
-			clip.boxmins[i] = clip.end[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.start[i] + clip.maxs[i] + 1;
-		}
-	}
+	SV_MoveBounds( clip.start, clip.mins, clip.maxs, clip.end, clip.boxmins, clip.boxmaxs );
 
 	// clip to other solid entities
 	SV_ClipMoveToEntities ( &clip );
@@ -650,6 +679,247 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 }
 
 
+/*
+===============================================================================
+
+BATCHED TRACES
+
+World collision of a batch does not depend on entities, so it may be spread
+across worker threads, each with its own trace context. Clipping to entities
+stays on the main thread because it uses temporary box models. Consecutive
+requests with overlapping move bounds share a single area query, the result
+is filtered for each request with the same test as SV_AreaEntities_r, which
+gives the same entities in the same order as a separate query would.
+
+===============================================================================
+*/
+
+#define TRACE_BATCH_CHUNK		8	// requests claimed by a worker at once
+#define TRACE_BATCH_MIN_THREADED	32	// smaller batches are not worth waking up workers
+#define TRACE_BATCH_SHARE		2	// max.ratio of shared list filtering to separate area queries
+
+typedef struct {
+	const traceRequest_t *requests;
+	trace_t		*results;
+	int			count;
+	int			next;		// first unclaimed request, updated atomically
+} traceBatch_t;
+
+static traceContext_t *sv_traceContexts[ MAX_WORKER_THREADS ];
+static vec3_t sv_traceBounds[ MAX_TRACE_BATCH ][ 2 ];
+
+
+/*
+==================
+SV_FreeTraceContexts
+==================
+*/
+void SV_FreeTraceContexts( void ) {
+	int			i;
+
+	for ( i = 0; i < ARRAY_LEN( sv_traceContexts ); i++ ) {
+		CM_FreeTraceContext( sv_traceContexts[ i ] );
+		sv_traceContexts[ i ] = NULL;
+	}
+}
+
+
+/*
+==================
+SV_TraceWorld
+
+Clips single request to the world, uses main thread state if ctx is NULL
+==================
+*/
+static void SV_TraceWorld( traceContext_t *ctx, const traceRequest_t *req, trace_t *result ) {
+	if ( ctx ) {
+		CM_ContextBoxTrace( ctx, result, req->start, req->end, req->mins, req->maxs, 0, req->contentmask, req->capsule );
+	} else {
+		CM_BoxTrace( result, req->start, req->end, req->mins, req->maxs, 0, req->contentmask, req->capsule );
+	}
+	result->entityNum = result->fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+}
+
+
+/*
+==================
+SV_TraceWorldJob
+
+May run on worker thread
+==================
+*/
+static void SV_TraceWorldJob( void *data, int index ) {
+	traceBatch_t *batch = (traceBatch_t *)data;
+	traceContext_t *ctx = sv_traceContexts[ index ];
+	int			first, i;
+
+	while ( ( first = Sys_AtomicAdd( &batch->next, TRACE_BATCH_CHUNK ) ) < batch->count ) {
+		for ( i = first; i < first + TRACE_BATCH_CHUNK && i < batch->count; i++ ) {
+			SV_TraceWorld( ctx, &batch->requests[ i ], &batch->results[ i ] );
+		}
+	}
+}
+
+
+/*
+==================
+SV_TraceBatchWorld
+==================
+*/
+static void SV_TraceBatchWorld( const traceRequest_t *requests, trace_t *results, int count ) {
+	traceBatch_t batch;
+	int			i, numJobs;
+
+	numJobs = MIN( sv_traceThreads->integer, ( count + TRACE_BATCH_CHUNK - 1 ) / TRACE_BATCH_CHUNK );
+
+	if ( numJobs <= 1 || count < TRACE_BATCH_MIN_THREADED ) {
+		for ( i = 0; i < count; i++ ) {
+			SV_TraceWorld( NULL, &requests[ i ], &results[ i ] );
+		}
+		return;
+	}
+
+	// contexts are sized for the current map, allocate them while on the main thread
+	for ( i = 0; i < numJobs; i++ ) {
+		if ( !sv_traceContexts[ i ] ) {
+			sv_traceContexts[ i ] = CM_AllocTraceContext();
+		}
+	}
+
+	batch.requests = requests;
+	batch.results = results;
+	batch.count = count;
+	batch.next = 0;
+
+	Sys_RunJobs( SV_TraceWorldJob, &batch, numJobs, numJobs );
+}
+
+
+/*
+==================
+SV_BoundsVolume
+
+Area query cost estimate, roughly proportional to the number of entities returned
+==================
+*/
+static float SV_BoundsVolume( const vec3_t mins, const vec3_t maxs ) {
+	return ( maxs[0] - mins[0] ) * ( maxs[1] - mins[1] ) * ( maxs[2] - mins[2] );
+}
+
+
+/*
+==================
+SV_TraceBatch
+
+Same as calling SV_Trace for each request
+==================
+*/
+void SV_TraceBatch( const traceRequest_t *requests, trace_t *results, int count ) {
+	int			touchlist[MAX_GENTITIES];
+	int			arealist[MAX_GENTITIES];
+	const sharedEntity_t *check;
+	const traceRequest_t *req;
+	float		*bmins, *bmaxs;
+	moveclip_t	clip;
+	vec3_t		mins, maxs, umins, umaxs;
+	float		volume, sumVolume;
+	int			i, k, n, num, numArea, numShared, next;
+
+	if ( count <= 0 ) {
+		return;
+	}
+
+	// clip to world
+	SV_TraceBatchWorld( requests, results, count );
+
+	for ( i = 0; i < count; i++ ) {
+		req = &requests[ i ];
+		SV_MoveBounds( req->start, req->mins, req->maxs, req->end, sv_traceBounds[ i ][ 0 ], sv_traceBounds[ i ][ 1 ] );
+	}
+
+	// clip to other solid entities
+	for ( i = 0; i < count; i = next ) {
+		if ( results[ i ].fraction == 0 ) {
+			next = i + 1;
+			continue;	// blocked immediately by the world
+		}
+
+		// extend area with following requests as long as they overlap it and
+		// filtering of the shared list stays cheaper than separate queries
+		VectorCopy( sv_traceBounds[ i ][ 0 ], mins );
+		VectorCopy( sv_traceBounds[ i ][ 1 ], maxs );
+		sumVolume = SV_BoundsVolume( mins, maxs );
+		numShared = 1;
+		for ( next = i + 1; next < count; next++ ) {
+			if ( results[ next ].fraction == 0 ) {
+				continue;
+			}
+			bmins = sv_traceBounds[ next ][ 0 ];
+			bmaxs = sv_traceBounds[ next ][ 1 ];
+			if ( bmins[0] > maxs[0] || bmins[1] > maxs[1] || bmins[2] > maxs[2]
+				|| bmaxs[0] < mins[0] || bmaxs[1] < mins[1] || bmaxs[2] < mins[2] ) {
+				break;
+			}
+			VectorCopy( mins, umins );
+			VectorCopy( maxs, umaxs );
+			AddPointToBounds( bmins, umins, umaxs );
+			AddPointToBounds( bmaxs, umins, umaxs );
+			volume = SV_BoundsVolume( bmins, bmaxs );
+			if ( SV_BoundsVolume( umins, umaxs ) * ( numShared + 1 ) > TRACE_BATCH_SHARE * ( sumVolume + volume ) ) {
+				break;
+			}
+			VectorCopy( umins, mins );
+			VectorCopy( umaxs, maxs );
+			sumVolume += volume;
+			numShared++;
+		}
+
+		numArea = SV_AreaEntities( mins, maxs, arealist, MAX_GENTITIES );
+
+		for ( k = i; k < next; k++ ) {
+			if ( results[ k ].fraction == 0 ) {
+				continue;
+			}
+
+			req = &requests[ k ];
+			bmins = sv_traceBounds[ k ][ 0 ];
+			bmaxs = sv_traceBounds[ k ][ 1 ];
+
+			for ( n = 0, num = 0; n < numArea; n++ ) {
+				check = SV_GentityNum( arealist[ n ] );
+				if ( check->r.absmin[0] > bmaxs[0]
+				|| check->r.absmin[1] > bmaxs[1]
+				|| check->r.absmin[2] > bmaxs[2]
+				|| check->r.absmax[0] < bmins[0]
+				|| check->r.absmax[1] < bmins[1]
+				|| check->r.absmax[2] < bmins[2] ) {
+					continue;
+				}
+				touchlist[ num++ ] = arealist[ n ];
+			}
+
+			Com_Memset( &clip, 0, sizeof( clip ) );
+			clip.trace = results[ k ];
+			clip.contentmask = req->contentmask;
+			clip.start = req->start;
+			VectorCopy( req->end, clip.end );
+			clip.mins = req->mins;
+			clip.maxs = req->maxs;
+			if ( (unsigned)req->passEntityNum > MAX_GENTITIES - 1 ) {
+				clip.passEntityNum = ENTITYNUM_NONE;
+			} else {
+				clip.passEntityNum = req->passEntityNum;
+			}
+			clip.capsule = req->capsule;
+
+			SV_ClipMoveToEntityList( &clip, touchlist, num );
+
+			results[ k ] = clip.trace;
+		}
+	}
+}
+
+
 
 /*
 =============
@@ -49,4 +49,9 @@ char *strlwr (char *s);
 // signals.c
 void InitSig(void);
 
+#ifdef __linux__
+// net_ip.c
+qboolean NET_PollConsole( void );
+#endif
+
 #endif // __LINUX_LOCAL_H__
@@ -38,6 +38,9 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <sys/mman.h>
 #include <errno.h>
 #include <libgen.h> // dirname
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #include <dlfcn.h>
 
@@ -601,6 +604,105 @@ void Sys_SendKeyEvents( void )
 }
 
 
+/*
+==================
+Sys_ForkInstance
+
+Starts a copy of current process which shares already loaded memory pages
+with parent until either of them modifies them.
+Returns 0 in child process, child pid in parent or -1 on error
+==================
+*/
+int Sys_ForkInstance( void ) {
+	pid_t pid;
+
+	// don't let child flush parent's pending output again
+	fflush( NULL );
+
+	pid = fork();
+	if ( pid < 0 ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: fork failed: %s\n", strerror( errno ) );
+		return -1;
+	}
+
+	if ( pid == 0 ) {
+#ifdef __linux__
+		// terminate together with parent
+		prctl( PR_SET_PDEATHSIG, SIGTERM );
+#endif
+		signal( SIGCHLD, SIG_DFL );
+		// console input stays with parent, terminal settings must not be restored on exit
+		stdin_active = qfalse;
+		ttycon_on = qfalse;
+		return 0;
+	}
+
+	return (int)pid;
+}
+
+
+/*
+==================
+Sys_ReapInstances
+
+Called in parent process once all instances are started
+==================
+*/
+void Sys_ReapInstances( void ) {
+	// reap exited instances automatically
+	signal( SIGCHLD, SIG_IGN );
+}
+
+
+/*
+==================
+Sys_ReopenFile
+
+Replaces descriptor of inherited stream with a new open file description
+so current process no longer shares file offset with its parent
+==================
+*/
+qboolean Sys_ReopenFile( FILE *f ) {
+	char path[ PATH_MAX ];
+	off_t pos;
+	int fd, nfd, flags;
+
+	fd = fileno( f );
+	flags = fcntl( fd, F_GETFL );
+	if ( flags == -1 ) {
+		return qfalse;
+	}
+
+#if defined( F_GETPATH )
+	if ( fcntl( fd, F_GETPATH, path ) == -1 ) {
+		return qfalse;
+	}
+#elif defined( __linux__ )
+	Com_sprintf( path, sizeof( path ), "/proc/self/fd/%i", fd );
+#else
+	return qfalse;
+#endif
+
+	pos = lseek( fd, 0, SEEK_CUR );
+	nfd = open( path, flags & ( O_ACCMODE | O_APPEND ) );
+	if ( nfd == -1 ) {
+		return qfalse;
+	}
+
+	if ( pos > 0 ) {
+		lseek( nfd, pos, SEEK_SET );
+	}
+
+	if ( dup2( nfd, fd ) == -1 ) {
+		close( nfd );
+		return qfalse;
+	}
+
+	close( nfd );
+	return qtrue;
+}
+
+
 /*
 ==================
 Sys_Sleep
@@ -618,6 +720,14 @@ void Sys_Sleep( int msec ) {
 
 	if ( msec < 0 ) {
 		// special case: wait for console input or network packet
+#ifdef __linux__
+		if ( NET_PollConsole() ) {
+			// epoll backend wakes up on console input as well
+			while ( NET_Sleep( 3000 * 1000 ) )
+				;
+			return;
+		}
+#endif
 		if ( stdin_active ) {
 			msec = 300;
 			do {
@@ -24,6 +24,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <dirent.h>
 #include <unistd.h>
@@ -32,6 +33,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <pwd.h>
 #include <dlfcn.h>
 #include <libgen.h>
+#include <pthread.h>
 
 #include "../qcommon/q_shared.h"
 #include "../qcommon/qcommon.h"
@@ -302,6 +304,55 @@ qboolean Sys_GetFileStats( const char *filename, fileOffset_t *size, fileTime_t
 }
 
 
+/*
+=============
+Sys_MapFile
+
+Maps whole file into memory for reading, pages are shared with
+other processes which map the same file
+=============
+*/
+const void *Sys_MapFile( const char *ospath, int *size ) {
+	struct stat s;
+	void *data;
+	int fd;
+
+	*size = 0;
+
+	fd = open( ospath, O_RDONLY );
+	if ( fd == -1 ) {
+		return NULL;
+	}
+
+	if ( fstat( fd, &s ) != 0 || s.st_size <= 0 || s.st_size >= INT_MAX ) {
+		close( fd );
+		return NULL;
+	}
+
+	data = mmap( NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+
+	if ( data == MAP_FAILED ) {
+		return NULL;
+	}
+
+	*size = (int)s.st_size;
+	return data;
+}
+
+
+/*
+=============
+Sys_UnmapFile
+=============
+*/
+void Sys_UnmapFile( const void *data, int size ) {
+	if ( data ) {
+		munmap( (void *)data, size );
+	}
+}
+
+
 /*
 =================
 Sys_Mkdir
@@ -339,6 +390,19 @@ FILE *Sys_FOpen( const char *ospath, const char *mode )
 }
 
 
+/*
+=================
+Sys_ReplaceFile
+
+Atomically replaces existing destination file
+=================
+*/
+qboolean Sys_ReplaceFile( const char *from, const char *to )
+{
+	return ( rename( from, to ) == 0 ) ? qtrue : qfalse;
+}
+
+
 /*
 ==============
 Sys_ResetReadOnlyAttribute
@@ -596,3 +660,247 @@ qboolean Sys_SetAffinityMask( const uint64_t mask )
 	}
 }
 #endif // USE_AFFINITY_MASK
+
+
+/*
+========================================================================
+
+WORKER THREADS
+
+========================================================================
+*/
+
+static struct {
+	pthread_t		threads[ MAX_WORKER_THREADS ];
+	int				numThreads;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	wake;			// signalled when new batch is issued
+	pthread_cond_t	done;			// signalled when the last busy worker finishes
+	int				generation;		// incremented with each batch
+	int				numActive;		// number of workers that may take part in current batch
+	int				busy;			// workers currently processing jobs
+	sysJob_t		job;
+	void			*data;
+	int				count;
+	int				next;			// next job index to process, updated atomically
+	qboolean		forkHandlers;	// pthread_atfork() handlers are installed
+} pool = { .mutex = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+
+/*
+=================
+Sys_ProcessJobs
+=================
+*/
+static void Sys_ProcessJobs( void )
+{
+	int index;
+
+	while ( ( index = __sync_fetch_and_add( &pool.next, 1 ) ) < pool.count ) {
+		pool.job( pool.data, index );
+	}
+}
+
+
+/*
+=================
+Sys_WorkerThread
+=================
+*/
+static void *Sys_WorkerThread( void *arg )
+{
+	const int id = (int)(intptr_t)arg;
+	int generation;
+
+	pthread_mutex_lock( &pool.mutex );
+	generation = pool.generation;
+	for ( ;; ) {
+		while ( generation == pool.generation ) {
+			pthread_cond_wait( &pool.wake, &pool.mutex );
+		}
+		generation = pool.generation;
+		if ( id >= pool.numActive ) {
+			continue;
+		}
+		pool.busy++;
+		pthread_mutex_unlock( &pool.mutex );
+
+		Sys_ProcessJobs();
+
+		pthread_mutex_lock( &pool.mutex );
+		if ( --pool.busy == 0 ) {
+			pthread_cond_broadcast( &pool.done );
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+=================
+Sys_PoolPrepareFork
+
+Keeps pool state consistent while process is being forked
+=================
+*/
+static void Sys_PoolPrepareFork( void )
+{
+	pthread_mutex_lock( &pool.mutex );
+}
+
+
+/*
+=================
+Sys_PoolParentFork
+=================
+*/
+static void Sys_PoolParentFork( void )
+{
+	pthread_mutex_unlock( &pool.mutex );
+}
+
+
+/*
+=================
+Sys_PoolChildFork
+
+Worker threads don't exist in forked process, start with empty pool
+=================
+*/
+static void Sys_PoolChildFork( void )
+{
+	pthread_mutex_init( &pool.mutex, NULL );
+	pthread_cond_init( &pool.wake, NULL );
+	pthread_cond_init( &pool.done, NULL );
+	pool.numThreads = 0;
+	pool.numActive = 0;
+	pool.busy = 0;
+}
+
+
+/*
+=================
+Sys_RunJobs
+
+Runs job( data, 0 .. count-1 ) on up to numThreads threads, including the
+calling one, and returns when all of them are complete. Worker threads are
+created on demand and kept for later batches.
+=================
+*/
+void Sys_RunJobs( sysJob_t job, void *data, int count, int numThreads )
+{
+	if ( numThreads > MAX_WORKER_THREADS + 1 ) {
+		numThreads = MAX_WORKER_THREADS + 1;
+	}
+
+	pthread_mutex_lock( &pool.mutex );
+
+	if ( pool.numThreads == 0 && numThreads > 1 && !pool.forkHandlers ) {
+		pthread_atfork( Sys_PoolPrepareFork, Sys_PoolParentFork, Sys_PoolChildFork );
+		pool.forkHandlers = qtrue;
+	}
+
+	while ( pool.numThreads < numThreads - 1 ) {
+		if ( pthread_create( &pool.threads[ pool.numThreads ], NULL, Sys_WorkerThread, (void*)(intptr_t)pool.numThreads ) != 0 ) {
+			break;
+		}
+		pthread_detach( pool.threads[ pool.numThreads ] );
+		pool.numThreads++;
+	}
+
+	if ( pool.numThreads == 0 || numThreads <= 1 || count <= 1 ) {
+		int i;
+		pthread_mutex_unlock( &pool.mutex );
+		for ( i = 0; i < count; i++ ) {
+			job( data, i );
+		}
+		return;
+	}
+
+	// late workers from previous batch may still touch the job counter
+	while ( pool.busy ) {
+		pthread_cond_wait( &pool.done, &pool.mutex );
+	}
+
+	pool.job = job;
+	pool.data = data;
+	pool.count = count;
+	pool.next = 0;
+	pool.numActive = numThreads - 1;
+	pool.generation++;
+	pthread_cond_broadcast( &pool.wake );
+	pthread_mutex_unlock( &pool.mutex );
+
+	Sys_ProcessJobs();
+
+	pthread_mutex_lock( &pool.mutex );
+	while ( pool.busy ) {
+		pthread_cond_wait( &pool.done, &pool.mutex );
+	}
+	pthread_mutex_unlock( &pool.mutex );
+}
+
+
+typedef struct {
+	pthread_t		thread;
+	sysThread_t		func;
+	void			*arg;
+} sysThreadInfo_t;
+
+
+/*
+=================
+Sys_ThreadStart
+=================
+*/
+static void *Sys_ThreadStart( void *arg )
+{
+	sysThreadInfo_t *info = (sysThreadInfo_t *)arg;
+
+	info->func( info->arg );
+
+	return NULL;
+}
+
+
+/*
+=================
+Sys_CreateThread
+
+Returns NULL on failure, handle must be released with Sys_JoinThread()
+=================
+*/
+void *Sys_CreateThread( sysThread_t func, void *arg )
+{
+	sysThreadInfo_t *info;
+
+	info = malloc( sizeof( *info ) );
+	if ( !info ) {
+		return NULL;
+	}
+
+	info->func = func;
+	info->arg = arg;
+
+	if ( pthread_create( &info->thread, NULL, Sys_ThreadStart, info ) != 0 ) {
+		free( info );
+		return NULL;
+	}
+
+	return info;
+}
+
+
+/*
+=================
+Sys_JoinThread
+=================
+*/
+void Sys_JoinThread( void *thread )
+{
+	sysThreadInfo_t *info = (sysThreadInfo_t *)thread;
+
+	pthread_join( info->thread, NULL );
+	free( info );
+}
@@ -208,6 +208,20 @@ FILE *Sys_FOpen( const char *ospath, const char *mode )
 }
 
 
+/*
+==============
+Sys_ReplaceFile
+
+Atomically replaces existing destination file,
+unlike rename() which fails if it exists
+==============
+*/
+qboolean Sys_ReplaceFile( const char *from, const char *to )
+{
+	return MoveFileExA( from, to, MOVEFILE_REPLACE_EXISTING ) ? qtrue : qfalse;
+}
+
+
 /*
 ==============
 Sys_ResetReadOnlyAttribute
@@ -470,6 +484,90 @@ qboolean Sys_GetFileStats( const char *filename, fileOffset_t *size, fileTime_t
 }
 
 
+/*
+=============
+Sys_MapFile
+
+Maps whole file into memory for reading, pages are shared with
+other processes which map the same file
+=============
+*/
+const void *Sys_MapFile( const char *ospath, int *size ) {
+	HANDLE file, mapping;
+	LARGE_INTEGER fsize;
+	void *data;
+
+	*size = 0;
+
+	file = CreateFileA( ospath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( file == INVALID_HANDLE_VALUE ) {
+		return NULL;
+	}
+
+	if ( !GetFileSizeEx( file, &fsize ) || fsize.QuadPart <= 0 || fsize.QuadPart >= INT_MAX ) {
+		CloseHandle( file );
+		return NULL;
+	}
+
+	mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	CloseHandle( file );
+	if ( mapping == NULL ) {
+		return NULL;
+	}
+
+	data = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	CloseHandle( mapping );
+	if ( data == NULL ) {
+		return NULL;
+	}
+
+	*size = (int)fsize.QuadPart;
+	return data;
+}
+
+
+/*
+=============
+Sys_UnmapFile
+=============
+*/
+void Sys_UnmapFile( const void *data, int size ) {
+	if ( data ) {
+		UnmapViewOfFile( data );
+	}
+}
+
+
+/*
+=============
+Sys_ForkInstance
+=============
+*/
+int Sys_ForkInstance( void ) {
+	Com_Printf( S_COLOR_YELLOW "WARNING: multiple server instances are not supported on this platform\n" );
+	return -1;
+}
+
+
+/*
+=============
+Sys_ReapInstances
+=============
+*/
+void Sys_ReapInstances( void ) {
+}
+
+
+/*
+=============
+Sys_ReopenFile
+=============
+*/
+qboolean Sys_ReopenFile( FILE *f ) {
+	return qfalse;
+}
+
+
 //========================================================
 
 /*
@@ -247,3 +247,209 @@ qboolean Sys_SetAffinityMask( const uint64_t mask )
 	return qfalse;
 }
 #endif // USE_AFFINITY_MASK
+
+
+/*
+========================================================================
+
+WORKER THREADS
+
+========================================================================
+*/
+
+static struct {
+	HANDLE				threads[ MAX_WORKER_THREADS ];
+	int					numThreads;
+	qboolean			initialized;
+	CRITICAL_SECTION	mutex;
+	CONDITION_VARIABLE	wake;			// signalled when new batch is issued
+	CONDITION_VARIABLE	done;			// signalled when the last busy worker finishes
+	int					generation;		// incremented with each batch
+	int					numActive;		// number of workers that may take part in current batch
+	int					busy;			// workers currently processing jobs
+	sysJob_t			job;
+	void				*data;
+	int					count;
+	volatile LONG		next;			// next job index to process, updated atomically
+} pool;
+
+
+/*
+=================
+Sys_ProcessJobs
+=================
+*/
+static void Sys_ProcessJobs( void )
+{
+	int index;
+
+	while ( ( index = InterlockedExchangeAdd( &pool.next, 1 ) ) < pool.count ) {
+		pool.job( pool.data, index );
+	}
+}
+
+
+/*
+=================
+Sys_WorkerThread
+=================
+*/
+static DWORD WINAPI Sys_WorkerThread( LPVOID arg )
+{
+	const int id = (int)(intptr_t)arg;
+	int generation;
+
+	EnterCriticalSection( &pool.mutex );
+	generation = pool.generation;
+	for ( ;; ) {
+		while ( generation == pool.generation ) {
+			SleepConditionVariableCS( &pool.wake, &pool.mutex, INFINITE );
+		}
+		generation = pool.generation;
+		if ( id >= pool.numActive ) {
+			continue;
+		}
+		pool.busy++;
+		LeaveCriticalSection( &pool.mutex );
+
+		Sys_ProcessJobs();
+
+		EnterCriticalSection( &pool.mutex );
+		if ( --pool.busy == 0 ) {
+			WakeAllConditionVariable( &pool.done );
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+=================
+Sys_RunJobs
+
+Runs job( data, 0 .. count-1 ) on up to numThreads threads, including the
+calling one, and returns when all of them are complete. Worker threads are
+created on demand and kept for later batches.
+=================
+*/
+void Sys_RunJobs( sysJob_t job, void *data, int count, int numThreads )
+{
+	if ( !pool.initialized ) {
+		InitializeCriticalSection( &pool.mutex );
+		InitializeConditionVariable( &pool.wake );
+		InitializeConditionVariable( &pool.done );
+		pool.initialized = qtrue;
+	}
+
+	if ( numThreads > MAX_WORKER_THREADS + 1 ) {
+		numThreads = MAX_WORKER_THREADS + 1;
+	}
+
+	EnterCriticalSection( &pool.mutex );
+
+	while ( pool.numThreads < numThreads - 1 ) {
+		HANDLE h = CreateThread( NULL, 0, Sys_WorkerThread, (LPVOID)(intptr_t)pool.numThreads, 0, NULL );
+		if ( h == NULL ) {
+			break;
+		}
+		pool.threads[ pool.numThreads++ ] = h;
+	}
+
+	if ( pool.numThreads == 0 || numThreads <= 1 || count <= 1 ) {
+		int i;
+		LeaveCriticalSection( &pool.mutex );
+		for ( i = 0; i < count; i++ ) {
+			job( data, i );
+		}
+		return;
+	}
+
+	// late workers from previous batch may still touch the job counter
+	while ( pool.busy ) {
+		SleepConditionVariableCS( &pool.done, &pool.mutex, INFINITE );
+	}
+
+	pool.job = job;
+	pool.data = data;
+	pool.count = count;
+	pool.next = 0;
+	pool.numActive = numThreads - 1;
+	pool.generation++;
+	WakeAllConditionVariable( &pool.wake );
+	LeaveCriticalSection( &pool.mutex );
+
+	Sys_ProcessJobs();
+
+	EnterCriticalSection( &pool.mutex );
+	while ( pool.busy ) {
+		SleepConditionVariableCS( &pool.done, &pool.mutex, INFINITE );
+	}
+	LeaveCriticalSection( &pool.mutex );
+}
+
+
+typedef struct {
+	HANDLE			thread;
+	sysThread_t		func;
+	void			*arg;
+} sysThreadInfo_t;
+
+
+/*
+=================
+Sys_ThreadStart
+=================
+*/
+static DWORD WINAPI Sys_ThreadStart( LPVOID arg )
+{
+	sysThreadInfo_t *info = (sysThreadInfo_t *)arg;
+
+	info->func( info->arg );
+
+	return 0;
+}
+
+
+/*
+=================
+Sys_CreateThread
+
+Returns NULL on failure, handle must be released with Sys_JoinThread()
+=================
+*/
+void *Sys_CreateThread( sysThread_t func, void *arg )
+{
+	sysThreadInfo_t *info;
+
+	info = malloc( sizeof( *info ) );
+	if ( !info ) {
+		return NULL;
+	}
+
+	info->func = func;
+	info->arg = arg;
+	info->thread = CreateThread( NULL, 0, Sys_ThreadStart, info, 0, NULL );
+
+	if ( info->thread == NULL ) {
+		free( info );
+		return NULL;
+	}
+
+	return info;
+}
+
+
+/*
+=================
+Sys_JoinThread
+=================
+*/
+void Sys_JoinThread( void *thread )
+{
+	sysThreadInfo_t *info = (sysThreadInfo_t *)thread;
+
+	WaitForSingleObject( info->thread, INFINITE );
+	CloseHandle( info->thread );
+	free( info );
+}